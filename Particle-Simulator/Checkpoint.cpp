@@ -0,0 +1,324 @@
+#include "Checkpoint.hpp"
+#include "MappedFile.hpp"
+#include "Scene.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace {
+
+const char checkpointMagic[4] = { 'P', 'C', 'K', 'P' };
+const uint32_t checkpointVersion = 1;
+const uint64_t checkpointAlignment = 64;
+
+struct CheckpointHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t reserved;
+    uint64_t stepCount;
+    double time, deltaTime, simWidth, simHeight;
+    uint64_t particleCount, particleOffset;
+    uint64_t wallCount, wallOffset;
+    uint64_t rngStateSize, rngOffset;
+    uint64_t emitterCount, emitterOffset;
+    uint64_t absorberCount, absorberOffset;
+    uint64_t sinkCount, sinkOffset;
+    uint64_t expiryCount, expiryOffset;
+    uint64_t attractorCount, attractorOffset;
+    uint64_t constraintCount, constraintOffset;
+    uint64_t movingWallCount, movingWallOffset;
+};
+
+static_assert(std::is_trivially_copyable<Particle>::value && std::is_trivially_copyable<Wall>::value
+    && std::is_trivially_copyable<Emitter>::value && std::is_trivially_copyable<Sink>::value
+    && std::is_trivially_copyable<Attractor>::value && std::is_trivially_copyable<Constraint>::value
+    && std::is_trivially_copyable<MovingWall>::value,
+    "Checkpoints copy particles, walls, emitters, sinks, attractors, constraints and moving walls as raw bytes");
+
+uint64_t alignUp(uint64_t offset) {
+    return (offset + checkpointAlignment - 1) / checkpointAlignment * checkpointAlignment;
+}
+
+void writePadding(std::ofstream& file, uint64_t from, uint64_t to) {
+    static const char zeros[checkpointAlignment] = {};
+    file.write(zeros, static_cast<std::streamsize>(to - from));
+}
+
+// Whether count items of T starting at offset lie inside the file, written so corrupt
+// counts cannot overflow, and start aligned for reading in place
+template <typename T>
+bool arrayFits(uint64_t offset, uint64_t count, uint64_t fileSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / sizeof(T) && offset % alignof(T) == 0;
+}
+
+}
+
+void captureCheckpoint(const Simulation& simulation, CheckpointState& state) {
+    state.stepCount = simulation.stepCount;
+    state.time = simulation.time;
+    state.deltaTime = simulation.deltaTime;
+    state.simWidth = simulation.simWidth;
+    state.simHeight = simulation.simHeight;
+    state.particles.assign(simulation.particles.begin(), simulation.particles.end());
+    state.walls.assign(simulation.walls.begin(), simulation.walls.end());
+    state.emitters.assign(simulation.emitters.begin(), simulation.emitters.end());
+    state.absorbers.assign(simulation.absorbers.begin(), simulation.absorbers.end());
+    state.sinks.assign(simulation.sinks.begin(), simulation.sinks.end());
+    state.expiry.assign(simulation.expiry.begin(), simulation.expiry.end());
+    state.attractors.assign(simulation.attractors.begin(), simulation.attractors.end());
+    state.movingWalls.assign(simulation.movingWalls.begin(), simulation.movingWalls.end());
+    // Handles are not saved, so the constraints are stored by slot; restored particles get
+    // handles matching their slots
+    state.constraints.clear();
+    for (const auto& constraint : simulation.constraints) {
+        uint32_t a = simulation.slotOf(constraint.a), b = simulation.slotOf(constraint.b);
+        if (a != Simulation::noSlot && b != Simulation::noSlot) {
+            state.constraints.emplace_back(a, b, constraint.restLength, constraint.stiffness);
+        }
+    }
+
+    std::ostringstream rng;
+    rng << simulation.rng;
+    state.rngState = rng.str();
+}
+
+void writeCheckpoint(const std::string& path, const CheckpointState& state) {
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.stepCount = state.stepCount;
+    header.time = state.time;
+    header.deltaTime = state.deltaTime;
+    header.simWidth = state.simWidth;
+    header.simHeight = state.simHeight;
+    header.particleCount = state.particles.size();
+    header.particleOffset = alignUp(sizeof(CheckpointHeader));
+    header.wallCount = state.walls.size();
+    header.wallOffset = alignUp(header.particleOffset + header.particleCount * sizeof(Particle));
+    header.rngStateSize = state.rngState.size();
+    header.rngOffset = alignUp(header.wallOffset + header.wallCount * sizeof(Wall));
+    header.emitterCount = state.emitters.size();
+    header.emitterOffset = alignUp(header.rngOffset + header.rngStateSize);
+    header.absorberCount = state.absorbers.size();
+    header.absorberOffset = alignUp(header.emitterOffset + header.emitterCount * sizeof(Emitter));
+    header.sinkCount = state.sinks.size();
+    header.sinkOffset = alignUp(header.absorberOffset + header.absorberCount * sizeof(Wall));
+    header.expiryCount = state.expiry.size();
+    header.expiryOffset = alignUp(header.sinkOffset + header.sinkCount * sizeof(Sink));
+    header.attractorCount = state.attractors.size();
+    header.attractorOffset = alignUp(header.expiryOffset + header.expiryCount * sizeof(double));
+    header.constraintCount = state.constraints.size();
+    header.constraintOffset = alignUp(header.attractorOffset + header.attractorCount * sizeof(Attractor));
+    header.movingWallCount = state.movingWalls.size();
+    header.movingWallOffset = alignUp(header.constraintOffset + header.constraintCount * sizeof(Constraint));
+
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::invalid_argument("Could not write checkpoint '" + temporaryPath + "'.");
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writePadding(file, sizeof(header), header.particleOffset);
+        file.write(reinterpret_cast<const char*>(state.particles.data()), static_cast<std::streamsize>(header.particleCount * sizeof(Particle)));
+        writePadding(file, header.particleOffset + header.particleCount * sizeof(Particle), header.wallOffset);
+        file.write(reinterpret_cast<const char*>(state.walls.data()), static_cast<std::streamsize>(header.wallCount * sizeof(Wall)));
+        writePadding(file, header.wallOffset + header.wallCount * sizeof(Wall), header.rngOffset);
+        file.write(state.rngState.data(), static_cast<std::streamsize>(state.rngState.size()));
+        writePadding(file, header.rngOffset + header.rngStateSize, header.emitterOffset);
+        file.write(reinterpret_cast<const char*>(state.emitters.data()), static_cast<std::streamsize>(header.emitterCount * sizeof(Emitter)));
+        writePadding(file, header.emitterOffset + header.emitterCount * sizeof(Emitter), header.absorberOffset);
+        file.write(reinterpret_cast<const char*>(state.absorbers.data()), static_cast<std::streamsize>(header.absorberCount * sizeof(Wall)));
+        writePadding(file, header.absorberOffset + header.absorberCount * sizeof(Wall), header.sinkOffset);
+        file.write(reinterpret_cast<const char*>(state.sinks.data()), static_cast<std::streamsize>(header.sinkCount * sizeof(Sink)));
+        writePadding(file, header.sinkOffset + header.sinkCount * sizeof(Sink), header.expiryOffset);
+        file.write(reinterpret_cast<const char*>(state.expiry.data()), static_cast<std::streamsize>(header.expiryCount * sizeof(double)));
+        writePadding(file, header.expiryOffset + header.expiryCount * sizeof(double), header.attractorOffset);
+        file.write(reinterpret_cast<const char*>(state.attractors.data()), static_cast<std::streamsize>(header.attractorCount * sizeof(Attractor)));
+        writePadding(file, header.attractorOffset + header.attractorCount * sizeof(Attractor), header.constraintOffset);
+        file.write(reinterpret_cast<const char*>(state.constraints.data()), static_cast<std::streamsize>(header.constraintCount * sizeof(Constraint)));
+        writePadding(file, header.constraintOffset + header.constraintCount * sizeof(Constraint), header.movingWallOffset);
+        file.write(reinterpret_cast<const char*>(state.movingWalls.data()), static_cast<std::streamsize>(header.movingWallCount * sizeof(MovingWall)));
+
+        if (!file.flush()) {
+            throw std::invalid_argument("Could not write checkpoint '" + temporaryPath + "'.");
+        }
+    }
+
+    // rename() replaces the old checkpoint in one step on POSIX but refuses to on Windows
+#ifdef _WIN32
+    bool moved = MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool moved = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!moved) {
+        throw std::invalid_argument("Could not move checkpoint into place at '" + path + "'.");
+    }
+}
+
+void restoreCheckpoint(const std::string& path, Simulation& simulation) {
+    MappedFile file(path);
+    const unsigned char* data = file.data();
+
+    CheckpointHeader header;
+    if (file.size() < sizeof(header)) {
+        throw std::invalid_argument("'" + path + "' is not a checkpoint file.");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0) {
+        throw std::invalid_argument("'" + path + "' is not a checkpoint file.");
+    }
+    if (header.version != checkpointVersion || header.headerSize != sizeof(CheckpointHeader)) {
+        throw std::invalid_argument("Checkpoint '" + path + "' has unsupported version " + std::to_string(header.version) + ".");
+    }
+    uint64_t size = file.size();
+    if (!arrayFits<Particle>(header.particleOffset, header.particleCount, size)
+        || !arrayFits<Wall>(header.wallOffset, header.wallCount, size)
+        || !arrayFits<char>(header.rngOffset, header.rngStateSize, size)
+        || !arrayFits<Emitter>(header.emitterOffset, header.emitterCount, size)
+        || !arrayFits<Wall>(header.absorberOffset, header.absorberCount, size)
+        || !arrayFits<Sink>(header.sinkOffset, header.sinkCount, size)
+        || !arrayFits<double>(header.expiryOffset, header.expiryCount, size)
+        || !arrayFits<Attractor>(header.attractorOffset, header.attractorCount, size)
+        || !arrayFits<Constraint>(header.constraintOffset, header.constraintCount, size)
+        || !arrayFits<MovingWall>(header.movingWallOffset, header.movingWallCount, size)
+        || header.expiryCount > header.particleCount) {
+        throw std::invalid_argument("Checkpoint '" + path + "' is truncated.");
+    }
+
+    // The arrays are aligned in the file, so they can be checked and copied straight out
+    // of the mapping
+    const Particle* particles = reinterpret_cast<const Particle*>(data + header.particleOffset);
+    const Wall* walls = reinterpret_cast<const Wall*>(data + header.wallOffset);
+    const Emitter* emitters = reinterpret_cast<const Emitter*>(data + header.emitterOffset);
+    const Wall* absorbers = reinterpret_cast<const Wall*>(data + header.absorberOffset);
+    const Sink* sinks = reinterpret_cast<const Sink*>(data + header.sinkOffset);
+    const double* expiry = reinterpret_cast<const double*>(data + header.expiryOffset);
+    const Attractor* attractors = reinterpret_cast<const Attractor*>(data + header.attractorOffset);
+    const Constraint* constraints = reinterpret_cast<const Constraint*>(data + header.constraintOffset);
+    const MovingWall* movingWalls = reinterpret_cast<const MovingWall*>(data + header.movingWallOffset);
+
+    // Same checks as a scene file, so a damaged checkpoint is refused before it replaces anything
+    auto check = [&](const char* error) {
+        if (error != nullptr) {
+            throw std::invalid_argument("Checkpoint '" + path + "': " + error);
+        }
+    };
+    check(deltaTimeError(header.deltaTime));
+    check(domainSizeError(header.simWidth));
+    check(domainSizeError(header.simHeight));
+    for (const Particle* particle = particles; particle != particles + header.particleCount; ++particle) {
+        // Despawned particles wait for compaction with a zero radius
+        if (particle->alive()) check(particleError(*particle));
+    }
+    for (const Wall* wall = walls; wall != walls + header.wallCount; ++wall) check(wallError(*wall));
+    for (const Emitter* emitter = emitters; emitter != emitters + header.emitterCount; ++emitter) check(emitterError(*emitter));
+    for (const Wall* absorber = absorbers; absorber != absorbers + header.absorberCount; ++absorber) check(absorberError(*absorber));
+    for (const Sink* sink = sinks; sink != sinks + header.sinkCount; ++sink) check(sinkError(*sink));
+    for (const Attractor* attractor = attractors; attractor != attractors + header.attractorCount; ++attractor) check(attractorError(*attractor));
+    for (const MovingWall* moving = movingWalls; moving != movingWalls + header.movingWallCount; ++moving) check(movingWallError(*moving));
+    for (const Constraint* constraint = constraints; constraint != constraints + header.constraintCount; ++constraint) {
+        if (constraint->a >= header.particleCount || constraint->b >= header.particleCount) {
+            throw std::invalid_argument("Checkpoint '" + path + "' has a constraint on a missing particle.");
+        }
+    }
+
+    simulation.clearParticles();
+    simulation.particles.assign(particles, particles + header.particleCount);
+    simulation.walls.assign(walls, walls + header.wallCount);
+    ++simulation.wallVersion;
+    simulation.emitters.assign(emitters, emitters + header.emitterCount);
+    simulation.absorbers.assign(absorbers, absorbers + header.absorberCount);
+    simulation.sinks.assign(sinks, sinks + header.sinkCount);
+    simulation.expiry.assign(expiry, expiry + header.expiryCount);
+    simulation.attractors.assign(attractors, attractors + header.attractorCount);
+    simulation.constraints.assign(constraints, constraints + header.constraintCount);
+    simulation.movingWalls.assign(movingWalls, movingWalls + header.movingWallCount);
+    simulation.deadCount = static_cast<size_t>(std::count_if(simulation.particles.begin(), simulation.particles.end(),
+        [](const Particle& particle) { return !particle.alive(); }));
+
+    std::istringstream rng(std::string(reinterpret_cast<const char*>(data + header.rngOffset), static_cast<size_t>(header.rngStateSize)));
+    if (!(rng >> simulation.rng)) {
+        throw std::invalid_argument("Checkpoint '" + path + "' has a corrupt RNG state.");
+    }
+
+    simulation.stepCount = header.stepCount;
+    simulation.time = header.time;
+    simulation.deltaTime = header.deltaTime;
+    simulation.simWidth = header.simWidth;
+    simulation.simHeight = header.simHeight;
+}
+
+CheckpointWriter::CheckpointWriter(const std::string& path)
+    : path(path), thread(&CheckpointWriter::run, this) {}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+bool CheckpointWriter::request(const Simulation& simulation) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (hasPending) {
+            return false;
+        }
+    }
+
+    // The writer thread is idle, so the buffer can be filled without holding the lock
+    captureCheckpoint(simulation, pending);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        hasPending = true;
+    }
+    cv.notify_all();
+    return true;
+}
+
+void CheckpointWriter::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return !hasPending; });
+}
+
+void CheckpointWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return hasPending || stopping; });
+        if (!hasPending) {
+            return;
+        }
+
+        lock.unlock();
+        try {
+            writeCheckpoint(path, pending);
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Checkpoint failed: " << e.what() << '\n';
+        }
+        lock.lock();
+
+        hasPending = false;
+        cv.notify_all();
+    }
+}
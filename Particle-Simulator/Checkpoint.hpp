@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Constraints.hpp"
+#include "Generators.hpp"
+#include "Particle.hpp"
+#include "Wall.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Simulation;
+
+// Full simulation state as captured at a step boundary.
+//
+// On disk: a versioned header followed by the particle array, the wall array, the
+// RNG state, the emitters, absorbers, sinks, particle expiry times, attractors,
+// constraints and moving walls, each starting on a 64-byte boundary so a mapped file can be read in place.
+// Arrays are stored in native little-endian layout.
+struct CheckpointState {
+    uint64_t stepCount = 0;
+    double time = 0;
+    double deltaTime = 0;
+    double simWidth = 0, simHeight = 0;
+    std::vector<Particle> particles;
+    std::vector<Wall> walls;
+    std::string rngState; // Textual mt19937_64 state as produced by operator<<
+    std::vector<Emitter> emitters;
+    std::vector<Wall> absorbers;
+    std::vector<Sink> sinks;
+    std::vector<double> expiry;
+    std::vector<Attractor> attractors;
+    std::vector<Constraint> constraints; // Endpoints are particle indices rather than handles
+    std::vector<MovingWall> movingWalls;
+};
+
+void captureCheckpoint(const Simulation& simulation, CheckpointState& state);
+
+// Writes to "<path>.tmp" and renames over path, so a crash never leaves a torn checkpoint.
+// Throws std::invalid_argument on I/O errors.
+void writeCheckpoint(const std::string& path, const CheckpointState& state);
+
+// Maps the checkpoint and bulk-copies it into the simulation, replacing its state.
+// Throws std::invalid_argument if the file is missing, truncated or from another version.
+void restoreCheckpoint(const std::string& path, Simulation& simulation);
+
+// Writes checkpoints on a background thread. request() only copies the state
+// (one memcpy per array), so the simulation pauses for at most that copy.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(const std::string& path);
+    ~CheckpointWriter();
+
+    // Returns false without copying if the previous checkpoint is still being written
+    bool request(const Simulation& simulation);
+    // Blocks until any pending checkpoint is on disk
+    void wait();
+
+private:
+    void run();
+
+    std::string path;
+    CheckpointState pending;   // Filled by request(), written by the background thread
+    bool hasPending = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+};
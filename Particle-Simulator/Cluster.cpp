@@ -0,0 +1,509 @@
+#include "Cluster.hpp"
+#include "Metrics.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+const sf::Uint32 clusterVersion = 3;
+const double infinity = std::numeric_limits<double>::infinity();
+
+enum MessageType : sf::Uint8 {
+    Hello,      // Node to coordinator: version, port for its right-hand neighbour
+    Setup,      // Coordinator to node: strip, settings and left-hand neighbour
+    Walls,      // Replaces the walls, absorbers, sinks and attractors
+    Particles,  // Particles to add
+    Emitters,   // Emitters to add
+    Clear,      // Removes every particle and emitter
+    Step,       // Runs one step; asks for a frame of the node's particles
+    StepDone,   // Node to coordinator: step results and the frame if asked for
+    Exchange,   // Between neighbours: migrating particles
+    Stop
+};
+
+// Fixed-size fields go through the packet's own operators; arrays are appended raw after
+// them, so readRaw() walks the tail with its own offset.
+template <typename T>
+void appendRaw(sf::Packet& packet, const std::vector<T>& values) {
+    if (!values.empty()) {
+        packet.append(values.data(), values.size() * sizeof(T));
+    }
+}
+
+template <typename T>
+bool readRaw(const sf::Packet& packet, size_t& offset, size_t count, std::vector<T>& values) {
+    if (offset > packet.getDataSize() || (packet.getDataSize() - offset) / sizeof(T) < count) {
+        return false;
+    }
+    values.resize(count);
+    if (count > 0) {
+        std::memcpy(values.data(), static_cast<const char*>(packet.getData()) + offset, count * sizeof(T));
+    }
+    offset += count * sizeof(T);
+    return true;
+}
+
+void writeBatchHeader(sf::Packet& packet, const ParticleBatch& batch) {
+    packet << static_cast<sf::Uint32>(batch.particles.size()) << !batch.expiry.empty();
+}
+
+void writeBatchData(sf::Packet& packet, const ParticleBatch& batch) {
+    appendRaw(packet, batch.particles);
+    appendRaw(packet, batch.expiry);
+}
+
+bool readBatch(const sf::Packet& packet, size_t& offset, sf::Uint32 count, bool hasExpiry, ParticleBatch& batch) {
+    batch.expiry.clear();
+    return readRaw(packet, offset, count, batch.particles) && (!hasExpiry || readRaw(packet, offset, count, batch.expiry));
+}
+
+void sendPacket(sf::TcpSocket& socket, sf::Packet& packet, const std::string& peer) {
+    if (socket.send(packet) != sf::Socket::Done) {
+        throw std::invalid_argument("Lost the connection to " + peer + ".");
+    }
+}
+
+void receivePacket(sf::TcpSocket& socket, sf::Packet& packet, const std::string& peer) {
+    if (socket.receive(packet) != sf::Socket::Done) {
+        throw std::invalid_argument("Lost the connection to " + peer + ".");
+    }
+}
+
+template <typename T>
+bool sameItems(const std::vector<T>& a, const std::vector<T>& b) {
+    return a.size() == b.size() && (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+std::string nodeName(size_t rank) {
+    return "cluster node " + std::to_string(rank + 1);
+}
+
+}
+
+void ParticleBatch::add(const Simulation& simulation, size_t index) {
+    double expires = index < simulation.expiry.size() ? simulation.expiry[index] : infinity;
+    if (expires != infinity || !expiry.empty()) {
+        expiry.resize(particles.size(), infinity);
+        expiry.push_back(expires);
+    }
+    particles.push_back(simulation.particles[index]);
+}
+
+void ParticleBatch::appendTo(Simulation& simulation) const {
+    if (!expiry.empty()) {
+        simulation.expiry.resize(simulation.particles.size(), infinity);
+        simulation.expiry.insert(simulation.expiry.end(), expiry.begin(), expiry.end());
+    }
+    simulation.particles.insert(simulation.particles.end(), particles.begin(), particles.end());
+}
+
+void ParticleBatch::clear() {
+    particles.clear();
+    expiry.clear();
+}
+
+ClusterCoordinator::ClusterCoordinator(unsigned short port, size_t nodeCount, uint64_t gatherInterval, SimulationMetrics& metrics)
+    : port(port), gatherInterval(gatherInterval), metrics(metrics), outgoing(nodeCount) {
+    for (size_t i = 0; i < nodeCount; ++i) {
+        nodes.emplace_back(new Node());
+    }
+}
+
+ClusterCoordinator::~ClusterCoordinator() {
+    sf::Packet stop;
+    stop << static_cast<sf::Uint8>(Stop);
+    for (auto& node : nodes) {
+        node->socket.send(stop); // Nodes that already left need no telling
+    }
+}
+
+void ClusterCoordinator::start(Simulation& simulation, uint64_t seed) {
+    if (!simulation.constraints.empty()) {
+        // A constraint may join particles on different nodes
+        throw std::invalid_argument("Constraints cannot be simulated on a cluster.");
+    }
+    if (!simulation.movingWalls.empty()) {
+        // Nodes only receive the static walls
+        throw std::invalid_argument("Moving walls cannot be simulated on a cluster.");
+    }
+    if (listener.listen(port) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not listen for cluster nodes on port " + std::to_string(port) + ".");
+    }
+    std::cout << "Waiting for " << nodes.size() << " cluster nodes on port " << port << '\n';
+    for (size_t rank = 0; rank < nodes.size(); ++rank) {
+        Node& node = *nodes[rank];
+        if (listener.accept(node.socket) != sf::Socket::Done) {
+            throw std::invalid_argument("Could not accept a cluster node.");
+        }
+        sf::Packet hello;
+        receivePacket(node.socket, hello, nodeName(rank));
+        sf::Uint8 type = 0;
+        sf::Uint32 version = 0;
+        sf::Uint16 peerPort = 0;
+        if (!(hello >> type >> version >> peerPort) || type != Hello || version != clusterVersion || peerPort == 0) {
+            throw std::invalid_argument("Cluster node at " + node.socket.getRemoteAddress().toString() + " sent an invalid hello.");
+        }
+        node.address = node.socket.getRemoteAddress();
+        node.peerPort = peerPort;
+        std::cout << "Node " << rank + 1 << " of " << nodes.size() << " joined from " << node.address.toString() << '\n';
+    }
+    listener.close();
+
+    // Each node connects to the one on its left, which is already listening
+    stripWidth = simulation.simWidth / nodes.size();
+    for (size_t rank = 0; rank < nodes.size(); ++rank) {
+        double minX = rank == 0 ? -infinity : rank * stripWidth;
+        double maxX = rank + 1 == nodes.size() ? infinity : (rank + 1) * stripWidth;
+        sf::Uint32 leftAddress = rank > 0 ? nodes[rank - 1]->address.toInteger() : 0;
+        sf::Uint16 leftPort = rank > 0 ? nodes[rank - 1]->peerPort : 0;
+
+        sf::Packet setup;
+        setup << static_cast<sf::Uint8>(Setup) << clusterVersion << static_cast<sf::Uint32>(rank) << static_cast<sf::Uint32>(nodes.size())
+            << minX << maxX << simulation.deltaTime << simulation.simWidth << simulation.simHeight
+            << static_cast<sf::Uint64>(simulation.stepCount) << simulation.time << static_cast<sf::Uint64>(seed)
+            << simulation.deterministic << simulation.sortThreshold << simulation.softening << leftAddress << leftPort;
+        sendPacket(nodes[rank]->socket, setup, nodeName(rank));
+    }
+
+    sendWalls(simulation);
+    viewCount = 0;
+    viewLayout = simulation.layoutVersion;
+    forwardChanges(simulation); // Every particle and emitter is new to the nodes
+}
+
+size_t ClusterCoordinator::ownerOf(double x) const {
+    double strip = std::floor(x / stripWidth);
+    return strip <= 0 ? 0 : std::min(nodes.size() - 1, static_cast<size_t>(strip));
+}
+
+void ClusterCoordinator::sendWalls(const Simulation& simulation) {
+    sf::Packet packet;
+    packet << static_cast<sf::Uint8>(Walls) << static_cast<sf::Uint32>(simulation.walls.size())
+        << static_cast<sf::Uint32>(simulation.absorbers.size()) << static_cast<sf::Uint32>(simulation.sinks.size())
+        << static_cast<sf::Uint32>(simulation.attractors.size());
+    appendRaw(packet, simulation.walls);
+    appendRaw(packet, simulation.absorbers);
+    appendRaw(packet, simulation.sinks);
+    appendRaw(packet, simulation.attractors);
+    for (size_t rank = 0; rank < nodes.size(); ++rank) {
+        sendPacket(nodes[rank]->socket, packet, nodeName(rank));
+    }
+    sentWalls = simulation.walls;
+    sentAbsorbers = simulation.absorbers;
+    sentSinks = simulation.sinks;
+    sentAttractors = simulation.attractors;
+}
+
+void ClusterCoordinator::forwardChanges(Simulation& simulation) {
+    // The view is only ever reordered by gathering, so any other layout change means the
+    // particles were cleared, possibly with new ones added since
+    if (simulation.layoutVersion != viewLayout) {
+        sf::Packet clear;
+        clear << static_cast<sf::Uint8>(Clear);
+        for (size_t rank = 0; rank < nodes.size(); ++rank) {
+            sendPacket(nodes[rank]->socket, clear, nodeName(rank));
+        }
+        viewCount = 0;
+        viewLayout = simulation.layoutVersion;
+    }
+
+    if (!sameItems(simulation.walls, sentWalls) || !sameItems(simulation.absorbers, sentAbsorbers) || !sameItems(simulation.sinks, sentSinks)
+        || !sameItems(simulation.attractors, sentAttractors)) {
+        sendWalls(simulation);
+    }
+
+    if (viewCount < simulation.particles.size()) {
+        for (auto& batch : outgoing) {
+            batch.clear();
+        }
+        for (size_t i = viewCount; i < simulation.particles.size(); ++i) {
+            if (simulation.particles[i].alive()) {
+                outgoing[ownerOf(simulation.particles[i].x)].add(simulation, i);
+            }
+        }
+        for (size_t rank = 0; rank < nodes.size(); ++rank) {
+            if (outgoing[rank].particles.empty()) {
+                continue;
+            }
+            sf::Packet packet;
+            packet << static_cast<sf::Uint8>(Particles);
+            writeBatchHeader(packet, outgoing[rank]);
+            writeBatchData(packet, outgoing[rank]);
+            sendPacket(nodes[rank]->socket, packet, nodeName(rank));
+        }
+        viewCount = simulation.particles.size();
+    }
+
+    // Emitters move to the node owning their first point, which emits from then on
+    if (!simulation.emitters.empty()) {
+        std::vector<std::vector<Emitter>> owned(nodes.size());
+        for (const auto& emitter : simulation.emitters) {
+            owned[ownerOf(emitter.x1)].push_back(emitter);
+        }
+        for (size_t rank = 0; rank < nodes.size(); ++rank) {
+            if (owned[rank].empty()) {
+                continue;
+            }
+            sf::Packet packet;
+            packet << static_cast<sf::Uint8>(Emitters) << static_cast<sf::Uint32>(owned[rank].size());
+            appendRaw(packet, owned[rank]);
+            sendPacket(nodes[rank]->socket, packet, nodeName(rank));
+        }
+        simulation.emitters.clear();
+    }
+}
+
+void ClusterCoordinator::step(Simulation& simulation) {
+    auto stepStart = std::chrono::steady_clock::now();
+    forwardChanges(simulation);
+
+    bool gather = gatherInterval > 0 && (simulation.stepCount + 1) % gatherInterval == 0;
+    sf::Packet command;
+    command << static_cast<sf::Uint8>(Step) << simulation.deltaTime << gather;
+    for (size_t rank = 0; rank < nodes.size(); ++rank) {
+        sendPacket(nodes[rank]->socket, command, nodeName(rank));
+    }
+    if (gather) {
+        simulation.clearParticles();
+    }
+
+    // Node checksums are folded in strip order, so the result depends on the node count
+    uint64_t checksum = nodes.size();
+    uint64_t aliveCount = 0, despawned = 0;
+    ParticleBatch frame;
+    for (size_t rank = 0; rank < nodes.size(); ++rank) {
+        sf::Packet reply;
+        receivePacket(nodes[rank]->socket, reply, nodeName(rank));
+        sf::Uint8 type = 0;
+        sf::Uint64 stepCount = 0, alive = 0, nodeDespawned = 0, nodeChecksum = 0;
+        double time = 0, seconds = 0;
+        bool hasFrame = false, hasExpiry = false;
+        sf::Uint32 frameCount = 0;
+        if (!(reply >> type >> stepCount >> time >> alive >> nodeDespawned >> seconds >> nodeChecksum >> hasFrame) || type != StepDone
+            || (hasFrame && !(reply >> frameCount >> hasExpiry))) {
+            throw std::invalid_argument(nodeName(rank) + " sent an invalid step result.");
+        }
+        if (hasFrame) {
+            size_t offset = reply.getReadPosition();
+            if (!readBatch(reply, offset, frameCount, hasExpiry, frame)) {
+                throw std::invalid_argument(nodeName(rank) + " sent a truncated frame.");
+            }
+            frame.appendTo(simulation);
+        }
+        aliveCount += alive;
+        despawned += nodeDespawned;
+        checksum = (checksum ^ nodeChecksum) * 0x100000001b3ULL;
+        simulation.stepCount = stepCount;
+        simulation.time = time;
+    }
+
+    if (gather) {
+        simulation.assignIds();
+        viewCount = simulation.particles.size();
+        viewLayout = simulation.layoutVersion;
+    }
+    simulation.stepChecksum = simulation.deterministic ? checksum : 0;
+    simulation.lastStepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+
+    metrics.stepsTotal.fetch_add(1, std::memory_order_relaxed);
+    metrics.particlesDespawned.store(despawned, std::memory_order_relaxed);
+    metrics.particleCount.store(aliveCount, std::memory_order_relaxed);
+    metrics.wallCount.store(simulation.walls.size(), std::memory_order_relaxed);
+}
+
+ClusterNode::ClusterNode(const sf::IpAddress& host, unsigned short port, size_t threadCount)
+    : threadCount(threadCount) {
+    if (coordinator.connect(host, port, sf::seconds(5)) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not connect to cluster coordinator " + host.toString() + ":" + std::to_string(port) + ".");
+    }
+    if (peerListener.listen(sf::Socket::AnyPort) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not open a port for neighbouring cluster nodes.");
+    }
+    sf::Packet hello;
+    hello << static_cast<sf::Uint8>(Hello) << clusterVersion << static_cast<sf::Uint16>(peerListener.getLocalPort());
+    sendPacket(coordinator, hello, "the cluster coordinator");
+}
+
+ClusterNode::~ClusterNode() = default;
+
+int ClusterNode::run() {
+    sf::Packet packet;
+    while (true) {
+        if (coordinator.receive(packet) != sf::Socket::Done) {
+            std::cerr << "Lost the connection to the cluster coordinator\n";
+            return 1;
+        }
+        sf::Uint8 type = 0;
+        if (!(packet >> type)) {
+            throw std::invalid_argument("The cluster coordinator sent an empty message.");
+        }
+        if (type == Stop) {
+            return 0;
+        }
+        if (type == Setup) {
+            setup(packet);
+            continue;
+        }
+        if (!simulation) {
+            throw std::invalid_argument("The cluster coordinator sent a command before the setup.");
+        }
+
+        bool valid = true;
+        if (type == Walls) {
+            sf::Uint32 wallCount = 0, absorberCount = 0, sinkCount = 0, attractorCount = 0;
+            valid = static_cast<bool>(packet >> wallCount >> absorberCount >> sinkCount >> attractorCount);
+            size_t offset = packet.getReadPosition();
+            valid = valid && readRaw(packet, offset, wallCount, simulation->walls)
+                && readRaw(packet, offset, absorberCount, simulation->absorbers) && readRaw(packet, offset, sinkCount, simulation->sinks)
+                && readRaw(packet, offset, attractorCount, simulation->attractors);
+            ++simulation->wallVersion;
+        }
+        else if (type == Particles) {
+            sf::Uint32 count = 0;
+            bool hasExpiry = false;
+            valid = static_cast<bool>(packet >> count >> hasExpiry);
+            size_t offset = packet.getReadPosition();
+            valid = valid && readBatch(packet, offset, count, hasExpiry, received);
+            if (valid) {
+                received.appendTo(*simulation);
+            }
+        }
+        else if (type == Emitters) {
+            sf::Uint32 count = 0;
+            std::vector<Emitter> emitters;
+            valid = static_cast<bool>(packet >> count);
+            size_t offset = packet.getReadPosition();
+            valid = valid && readRaw(packet, offset, count, emitters);
+            simulation->emitters.insert(simulation->emitters.end(), emitters.begin(), emitters.end());
+        }
+        else if (type == Clear) {
+            simulation->clearParticles(); // Emitters keep running, as in a single process
+        }
+        else if (type == Step) {
+            bool withFrame = false;
+            valid = static_cast<bool>(packet >> simulation->deltaTime >> withFrame);
+            if (valid) {
+                simulation->step();
+                exchange();
+                sendStepDone(withFrame);
+            }
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            throw std::invalid_argument("The cluster coordinator sent an invalid message.");
+        }
+    }
+}
+
+void ClusterNode::setup(sf::Packet& packet) {
+    sf::Uint32 version = 0, rank = 0, nodeCount = 0, leftAddress = 0;
+    sf::Uint64 stepCount = 0, seed = 0;
+    sf::Uint16 leftPort = 0;
+    double deltaTime = 0, simWidth = 0, simHeight = 0, time = 0, sortThreshold = 0, softening = 0;
+    bool deterministic = false;
+    if (!(packet >> version >> rank >> nodeCount >> minX >> maxX >> deltaTime >> simWidth >> simHeight >> stepCount >> time >> seed
+        >> deterministic >> sortThreshold >> softening >> leftAddress >> leftPort) || version != clusterVersion || simulation) {
+        throw std::invalid_argument("The cluster coordinator sent an invalid setup.");
+    }
+
+    metrics.reset(new SimulationMetrics(threadCount));
+    simulation.reset(new Simulation(threadCount, deltaTime, simWidth, simHeight, *metrics));
+    simulation->rng.seed(seed + rank); // Each node's emitters get their own random sequence
+    simulation->stepCount = stepCount;
+    simulation->time = time;
+    simulation->deterministic = deterministic;
+    simulation->sortThreshold = sortThreshold;
+    simulation->softening = softening;
+
+    hasLeft = leftPort != 0;
+    hasRight = rank + 1 < nodeCount;
+    if (hasLeft && left.connect(sf::IpAddress(leftAddress), leftPort, sf::seconds(5)) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not connect to " + nodeName(rank - 1) + ".");
+    }
+    if (hasRight && peerListener.accept(right) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not accept " + nodeName(rank + 1) + ".");
+    }
+    peerListener.close();
+    std::cout << "Node " << rank + 1 << " of " << nodeCount << " simulating x from " << minX << " to " << maxX << '\n';
+}
+
+void ClusterNode::exchange() {
+    toLeft.clear();
+    toRight.clear();
+    std::vector<Particle>& particles = simulation->particles;
+    size_t migrated = 0;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        Particle& particle = particles[i];
+        if (!particle.alive()) {
+            continue;
+        }
+        if (particle.x < minX || particle.x >= maxX) {
+            // A particle that crossed several strips is passed on again after the next step
+            (particle.x < minX ? toLeft : toRight).add(*simulation, i);
+            particle.radius = 0; // Its slot is reclaimed by the next compaction
+            ++migrated;
+        }
+    }
+    simulation->deadCount += migrated;
+
+    // Everything flows right first, then left. Each node sends before it receives and the
+    // chain has two ends, so every send drains even when it overfills the socket buffers.
+    auto send = [this](sf::TcpSocket& socket, const ParticleBatch& migrants) {
+        sf::Packet packet;
+        packet << static_cast<sf::Uint8>(Exchange);
+        writeBatchHeader(packet, migrants);
+        writeBatchData(packet, migrants);
+        sendPacket(socket, packet, "a neighbouring cluster node");
+    };
+    auto receive = [this](sf::TcpSocket& socket) {
+        sf::Packet packet;
+        receivePacket(socket, packet, "a neighbouring cluster node");
+        sf::Uint8 type = 0;
+        sf::Uint32 count = 0;
+        bool hasExpiry = false;
+        bool valid = (packet >> type >> count >> hasExpiry) && type == Exchange;
+        size_t offset = packet.getReadPosition();
+        if (!valid || !readBatch(packet, offset, count, hasExpiry, received)) {
+            throw std::invalid_argument("A neighbouring cluster node sent an invalid exchange.");
+        }
+        received.appendTo(*simulation);
+    };
+    if (hasRight) {
+        send(right, toRight);
+    }
+    if (hasLeft) {
+        receive(left);
+        send(left, toLeft);
+    }
+    if (hasRight) {
+        receive(right);
+    }
+}
+
+void ClusterNode::sendStepDone(bool withFrame) {
+    sf::Packet packet;
+    packet << static_cast<sf::Uint8>(StepDone) << static_cast<sf::Uint64>(simulation->stepCount) << simulation->time
+        << static_cast<sf::Uint64>(simulation->aliveCount()) << static_cast<sf::Uint64>(metrics->particlesDespawned.load())
+        << simulation->lastStepSeconds << static_cast<sf::Uint64>(simulation->stepChecksum) << withFrame;
+    if (withFrame) {
+        ParticleBatch& frame = received; // Free again once the exchange is done
+        frame.clear();
+        for (size_t i = 0; i < simulation->particles.size(); ++i) {
+            if (simulation->particles[i].alive()) {
+                frame.add(*simulation, i);
+            }
+        }
+        writeBatchHeader(packet, frame);
+        writeBatchData(packet, frame);
+    }
+    sendPacket(coordinator, packet, "the cluster coordinator");
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <SFML/Network.hpp>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Simulation;
+class SimulationMetrics;
+
+// Splits one simulation across several processes, which may run on different machines.
+//
+// The coordinator loads the scene and divides the domain into vertical strips, one per
+// node. Each node simulates the particles in its own strip. After every step it hands
+// particles that crossed into a neighbouring strip to that neighbour over a direct TCP
+// connection. Walls, absorbers, sinks and attractors are copied to every node, so each
+// particle moves exactly as it would in a single process. Gravity between particles
+// reaches across the whole domain, so it is not supported on a cluster; nor are
+// constraints, which may join particles in different strips.
+//
+// The coordinator drives the steps and sums the nodes' statistics. It also gathers the
+// nodes' particles into its own Simulation, so the window, streams and outputs of a
+// single process work on top of the cluster unchanged.
+//
+// Particles travel as raw structs, so every process must run the same build.
+
+const unsigned short defaultClusterPort = 9490;
+
+// Particles with their expiry times, as sent between processes
+struct ParticleBatch {
+    std::vector<Particle> particles;
+    std::vector<double> expiry; // Empty when none of the particles expire
+
+    void add(const Simulation& simulation, size_t index);
+    void appendTo(Simulation& simulation) const;
+    void clear();
+};
+
+class ClusterCoordinator {
+public:
+    ClusterCoordinator(unsigned short port, size_t nodeCount, uint64_t gatherInterval, SimulationMetrics& metrics);
+    ~ClusterCoordinator(); // Tells the nodes to exit
+
+    // Waits for every node to join, then gives each one its strip of the simulation's
+    // particles and emitters, plus every wall. The simulation keeps only the gathered
+    // view from then on. Throws std::invalid_argument if the port cannot be opened or a
+    // node misbehaves.
+    void start(Simulation& simulation, uint64_t seed);
+
+    // Used instead of Simulation::step(). Forwards anything added to the simulation since
+    // the last step to the nodes, then steps every node and waits for all of them. Every
+    // gatherInterval steps, the simulation's particles are replaced with the ones gathered
+    // from the nodes.
+    void step(Simulation& simulation);
+
+private:
+    struct Node {
+        sf::TcpSocket socket;
+        sf::IpAddress address;
+        unsigned short peerPort = 0;   // Where the node accepts its right-hand neighbour
+    };
+
+    size_t ownerOf(double x) const;
+    void sendWalls(const Simulation& simulation);
+    void forwardChanges(Simulation& simulation);
+
+    unsigned short port;
+    uint64_t gatherInterval;
+    SimulationMetrics& metrics;
+    sf::TcpListener listener;
+    std::vector<std::unique_ptr<Node>> nodes;
+    double stripWidth = 0;
+
+    // What the nodes already know, so only changes are forwarded
+    std::vector<Wall> sentWalls, sentAbsorbers;
+    std::vector<Sink> sentSinks;
+    std::vector<Attractor> sentAttractors;
+    size_t viewCount = 0;       // Particles in the simulation that came from the nodes
+    uint64_t viewLayout = 0;    // Simulation::layoutVersion right after the last gather
+    std::vector<ParticleBatch> outgoing;
+};
+
+class ClusterNode {
+public:
+    // Connects to the coordinator. Throws std::invalid_argument if it cannot be reached.
+    ClusterNode(const sf::IpAddress& host, unsigned short port, size_t threadCount);
+    ~ClusterNode();
+
+    // Simulates this node's strip until the coordinator stops the cluster. Returns the
+    // process exit code.
+    int run();
+
+private:
+    void setup(sf::Packet& packet);
+    void exchange();
+    void sendStepDone(bool withFrame);
+
+    size_t threadCount;
+    sf::TcpSocket coordinator;
+    sf::TcpListener peerListener;
+    sf::TcpSocket left, right;          // Neighbouring strips; unconnected at the domain edges
+    bool hasLeft = false, hasRight = false;
+    std::unique_ptr<SimulationMetrics> metrics;
+    std::unique_ptr<Simulation> simulation;
+    double minX = 0, maxX = 0;          // This node's strip
+    ParticleBatch toLeft, toRight, received;
+};
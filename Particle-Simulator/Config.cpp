@@ -0,0 +1,409 @@
+#include "Config.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+std::string trim(const std::string& text) {
+    size_t first = text.find_first_not_of(" \t\r");
+    if (first == std::string::npos) {
+        return "";
+    }
+    size_t last = text.find_last_not_of(" \t\r");
+    return text.substr(first, last - first + 1);
+}
+
+double parseDouble(const std::string& key, const std::string& value) {
+    size_t used = 0;
+    double result = 0;
+    try {
+        result = std::stod(value, &used);
+    }
+    catch (const std::exception&) {
+        used = 0;
+    }
+    // stod also accepts nan and inf, which would slip past every range check below
+    if (used == 0 || used != value.size() || !std::isfinite(result)) {
+        throw std::invalid_argument("Option '" + key + "' expects a finite number, got '" + value + "'.");
+    }
+    return result;
+}
+
+uint64_t parseUnsigned(const std::string& key, const std::string& value) {
+    size_t used = 0;
+    unsigned long long result = 0;
+    try {
+        result = std::stoull(value, &used);
+    }
+    catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != value.size() || value[0] == '-') {
+        throw std::invalid_argument("Option '" + key + "' expects a non-negative integer, got '" + value + "'.");
+    }
+    return result;
+}
+
+bool parseBool(const std::string& key, const std::string& value) {
+    std::string lower = value;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    if (lower == "1" || lower == "true" || lower == "yes" || lower == "on") return true;
+    if (lower == "0" || lower == "false" || lower == "no" || lower == "off") return false;
+    throw std::invalid_argument("Option '" + key + "' expects true or false, got '" + value + "'.");
+}
+
+// Options that may be given on the command line without a value
+bool isFlag(const std::string& key) {
+    return key == "headless" || key == "deterministic" || key == "profile" || key == "no-metrics" || key == "help";
+}
+
+}
+
+void applyOption(SimulationConfig& config, const std::string& key, const std::string& value) {
+    if (key == "threads") {
+        config.threadCount = static_cast<size_t>(parseUnsigned(key, value));
+        if (config.threadCount == 0) throw std::invalid_argument("Thread count must be positive.");
+    }
+    else if (key == "dt") {
+        config.deltaTime = parseDouble(key, value);
+        if (config.deltaTime <= 0) throw std::invalid_argument("Time step must be greater than 0.");
+    }
+    else if (key == "width") {
+        config.simWidth = parseDouble(key, value);
+        if (config.simWidth <= 0) throw std::invalid_argument("Domain width must be greater than 0.");
+    }
+    else if (key == "height") {
+        config.simHeight = parseDouble(key, value);
+        if (config.simHeight <= 0) throw std::invalid_argument("Domain height must be greater than 0.");
+    }
+    else if (key == "headless") {
+        config.headless = parseBool(key, value);
+    }
+    else if (key == "steps") {
+        config.runSteps = parseUnsigned(key, value);
+    }
+    else if (key == "scene") {
+        config.sceneFile = value;
+    }
+    else if (key == "convert-scene") {
+        config.convertSceneOutput = value;
+    }
+    else if (key == "walls-svg") {
+        config.svgFile = value;
+    }
+    else if (key == "svg-tolerance") {
+        config.svgTolerance = parseDouble(key, value);
+        if (!(config.svgTolerance > 0)) throw std::invalid_argument("SVG tolerance must be greater than 0.");
+    }
+    else if (key == "walls-mask") {
+        config.maskFile = value;
+    }
+    else if (key == "mask-tolerance") {
+        config.maskTolerance = parseDouble(key, value);
+        if (!(config.maskTolerance > 0)) throw std::invalid_argument("Mask tolerance must be greater than 0.");
+    }
+    else if (key == "seed") {
+        config.seed = parseUnsigned(key, value);
+    }
+    else if (key == "deterministic") {
+        config.deterministic = parseBool(key, value);
+    }
+    else if (key == "checksum-output") {
+        config.checksumOutput = value;
+        config.deterministic = true;
+    }
+    else if (key == "sort-threshold") {
+        config.sortThreshold = parseDouble(key, value);
+        if (config.sortThreshold < 0 || config.sortThreshold > 1) throw std::invalid_argument("Sort threshold must be between 0 and 1.");
+    }
+    else if (key == "gravity") {
+        config.gravity = parseDouble(key, value);
+    }
+    else if (key == "opening-angle") {
+        config.openingAngle = parseDouble(key, value);
+        if (config.openingAngle < 0 || config.openingAngle > 2) throw std::invalid_argument("Opening angle must be between 0 and 2.");
+    }
+    else if (key == "softening") {
+        config.softening = parseDouble(key, value);
+        if (config.softening <= 0) throw std::invalid_argument("Softening must be greater than 0.");
+    }
+    else if (key == "mesh-cells") {
+        uint64_t cells = parseUnsigned(key, value);
+        if (cells != 0 && (cells < 16 || cells > 4096 || (cells & (cells - 1)) != 0)) {
+            throw std::invalid_argument("Mesh cells must be a power of two between 16 and 4096, or 0 to use the tree.");
+        }
+        config.meshCells = static_cast<size_t>(cells);
+    }
+    else if (key == "fluid") {
+        config.fluidLength = parseDouble(key, value);
+        if (config.fluidLength < 0) throw std::invalid_argument("Fluid smoothing length cannot be negative.");
+    }
+    else if (key == "rest-density") {
+        config.restDensity = parseDouble(key, value);
+        if (config.restDensity <= 0) throw std::invalid_argument("Rest density must be greater than 0.");
+    }
+    else if (key == "stiffness") {
+        config.stiffness = parseDouble(key, value);
+        if (config.stiffness < 0) throw std::invalid_argument("Stiffness cannot be negative.");
+    }
+    else if (key == "viscosity") {
+        config.viscosity = parseDouble(key, value);
+        if (config.viscosity < 0) throw std::invalid_argument("Viscosity cannot be negative.");
+    }
+    else if (key == "flow") {
+        config.flowField = value;
+    }
+    else if (key == "flow-speed") {
+        config.flowSpeed = parseDouble(key, value);
+        if (config.flowSpeed < 0) throw std::invalid_argument("Flow speed cannot be negative.");
+    }
+    else if (key == "flow-coupling") {
+        config.flowCoupling = parseDouble(key, value);
+        if (config.flowCoupling < 0) throw std::invalid_argument("Flow coupling cannot be negative.");
+    }
+    else if (key == "distance-cell") {
+        config.distanceCellSize = parseDouble(key, value);
+        if (config.distanceCellSize < 0) throw std::invalid_argument("Distance field cell size cannot be negative.");
+    }
+    else if (key == "constraint-iterations") {
+        config.constraintIterations = static_cast<size_t>(parseUnsigned(key, value));
+        if (config.constraintIterations == 0) throw std::invalid_argument("Constraint iterations must be at least 1.");
+    }
+    else if (key == "checkpoint") {
+        config.checkpointFile = value;
+    }
+    else if (key == "checkpoint-every") {
+        config.checkpointEvery = parseUnsigned(key, value);
+    }
+    else if (key == "restore") {
+        config.restoreFile = value;
+    }
+    else if (key == "trajectory") {
+        config.trajectoryFile = value;
+    }
+    else if (key == "keyframe-every") {
+        uint64_t interval = parseUnsigned(key, value);
+        if (interval == 0 || interval > UINT32_MAX) throw std::invalid_argument("Trajectory keyframe interval must be between 1 and 4294967295.");
+        config.trajectoryKeyframeInterval = static_cast<uint32_t>(interval);
+    }
+    else if (key == "trajectory-quantum") {
+        config.trajectoryQuantum = parseDouble(key, value);
+        if (config.trajectoryQuantum <= 0) throw std::invalid_argument("Trajectory quantum must be greater than 0.");
+    }
+    else if (key == "play-trajectory") {
+        config.playTrajectoryFile = value;
+    }
+    else if (key == "stream-port") {
+        uint64_t port = parseUnsigned(key, value);
+        if (port > 65535) throw std::invalid_argument("Stream port must be between 1 and 65535, or 0 to disable streaming.");
+        config.streamPort = static_cast<unsigned short>(port);
+    }
+    else if (key == "stream-fps") {
+        uint64_t fps = parseUnsigned(key, value);
+        if (fps == 0 || fps > 1000) throw std::invalid_argument("Stream frame rate must be between 1 and 1000.");
+        config.streamFps = static_cast<unsigned int>(fps);
+    }
+    else if (key == "stream-bandwidth") {
+        config.streamBandwidth = parseUnsigned(key, value) * 1024;
+    }
+    else if (key == "view") {
+        config.viewAddress = value;
+    }
+    else if (key == "control-port") {
+        uint64_t port = parseUnsigned(key, value);
+        if (port > 65535) throw std::invalid_argument("Control port must be between 1 and 65535, or 0 to disable it.");
+        config.controlPort = static_cast<unsigned short>(port);
+    }
+    else if (key == "cluster-nodes") {
+        uint64_t nodes = parseUnsigned(key, value);
+        if (nodes > 1024) throw std::invalid_argument("Cluster node count must be at most 1024.");
+        config.clusterNodes = static_cast<size_t>(nodes);
+    }
+    else if (key == "cluster-port") {
+        uint64_t port = parseUnsigned(key, value);
+        if (port == 0 || port > 65535) throw std::invalid_argument("Cluster port must be between 1 and 65535.");
+        config.clusterPort = static_cast<unsigned short>(port);
+    }
+    else if (key == "join") {
+        config.joinAddress = value;
+    }
+    else if (key == "gather-every") {
+        config.gatherInterval = parseUnsigned(key, value);
+    }
+    else if (key == "journal") {
+        config.journalFile = value;
+    }
+    else if (key == "replay") {
+        config.replayFile = value;
+    }
+    else if (key == "shared-memory") {
+        if (value.empty() || value.find_first_of("/\\") != std::string::npos) {
+            throw std::invalid_argument("Shared memory name must be non-empty and contain no slashes.");
+        }
+        config.sharedMemoryName = value;
+    }
+    else if (key == "stats") {
+        config.statsOutput = value;
+    }
+    else if (key == "profile") {
+        config.profile = parseBool(key, value);
+    }
+    else if (key == "profile-output") {
+        config.profileOutput = value;
+    }
+    else if (key == "metrics") {
+        config.metricsEnabled = parseBool(key, value);
+    }
+    else if (key == "no-metrics") {
+        config.metricsEnabled = !parseBool(key, value);
+    }
+    else if (key == "metrics-port") {
+        uint64_t port = parseUnsigned(key, value);
+        if (port == 0 || port > 65535) throw std::invalid_argument("Metrics port must be between 1 and 65535.");
+        config.metricsPort = static_cast<unsigned short>(port);
+    }
+    else if (key == "help") {
+        config.showHelp = parseBool(key, value);
+    }
+    else {
+        throw std::invalid_argument("Unknown option '" + key + "'.");
+    }
+    config.explicitOptions.insert(key);
+}
+
+void loadConfigFile(const std::string& path, SimulationConfig& config) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::invalid_argument("Could not open config file '" + path + "'.");
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t separator = line.find('=');
+        if (separator == std::string::npos) {
+            throw std::invalid_argument(path + ":" + std::to_string(lineNumber) + ": expected 'key = value'.");
+        }
+        std::string key = trim(line.substr(0, separator));
+        std::string value = trim(line.substr(separator + 1));
+        try {
+            applyOption(config, key, value);
+        }
+        catch (const std::invalid_argument& e) {
+            throw std::invalid_argument(path + ":" + std::to_string(lineNumber) + ": " + e.what());
+        }
+    }
+}
+
+SimulationConfig parseCommandLine(int argc, char* argv[]) {
+    // Split into key/value pairs first so the config file can be applied before any flag
+    std::vector<std::pair<std::string, std::string>> options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0 || arg.size() == 2) {
+            throw std::invalid_argument("Unexpected argument '" + arg + "'.");
+        }
+
+        std::string key = arg.substr(2);
+        std::string value;
+        size_t separator = key.find('=');
+        if (separator != std::string::npos) {
+            value = key.substr(separator + 1);
+            key = key.substr(0, separator);
+        }
+        else if (isFlag(key)) {
+            value = "true";
+        }
+        else if (i + 1 < argc) {
+            value = argv[++i];
+        }
+        else {
+            throw std::invalid_argument("Option '" + key + "' is missing a value.");
+        }
+        options.emplace_back(key, value);
+    }
+
+    SimulationConfig config;
+    for (const auto& option : options) {
+        if (option.first == "config") {
+            loadConfigFile(option.second, config);
+        }
+    }
+    for (const auto& option : options) {
+        if (option.first != "config") {
+            applyOption(config, option.first, option.second);
+        }
+    }
+    return config;
+}
+
+void printUsage(std::ostream& out) {
+    out << "Usage: Particle-Simulator [options]\n"
+        << "  --config FILE          Read 'key = value' options from FILE (flags override it)\n"
+        << "  --threads N            Worker thread count (default: hardware concurrency)\n"
+        << "  --dt X                 Time step per simulation step (default: 1)\n"
+        << "  --width W              Domain width (default: 1280)\n"
+        << "  --height H             Domain height (default: 720)\n"
+        << "  --headless             Run without a window\n"
+        << "  --steps N              Stop after N steps (default: run until closed)\n"
+        << "  --scene FILE           Load walls, particles and batches from a text or binary scene\n"
+        << "  --convert-scene FILE   Save the loaded scene to FILE (binary if it ends in .pscene) and exit\n"
+        << "  --walls-svg FILE       Add walls along the outlines of an SVG drawing\n"
+        << "  --svg-tolerance T      Farthest imported walls may stray from curves and merged runs (default: 0.25)\n"
+        << "  --walls-mask FILE      Stretch a PNG or BMP mask over the domain and add walls around its dark pixels\n"
+        << "  --mask-tolerance T     Farthest traced walls may stray from the mask's outlines (default: 1)\n"
+        << "  --seed N               Seed for the simulation's random number generator\n"
+        << "  --deterministic        Partition work identically for any thread count and checksum every step\n"
+        << "  --checksum-output FILE Write per-step checksums to FILE as CSV (implies --deterministic)\n"
+        << "  --sort-threshold X     Re-sort particles by location once this fraction is out of order (default: 0.25, 0 never)\n"
+        << "  --gravity G            Attract every particle to every other with strength G, negative repels (default: 0)\n"
+        << "  --opening-angle X      Barnes-Hut opening angle; 0 sums every pair exactly (default: 0.5)\n"
+        << "  --softening X          Distance that softens gravity and attractors at close range (default: 5)\n"
+        << "  --mesh-cells N         Solve gravity on an N x N particle mesh instead of a tree (power of two)\n"
+        << "  --fluid H              Simulate the particles as an SPH fluid with smoothing length H\n"
+        << "  --rest-density D       Fluid density at zero pressure, in particles per unit area (default: 0.02)\n"
+        << "  --stiffness K          Fluid pressure per unit of density above the rest density (default: 5)\n"
+        << "  --viscosity MU         Fluid viscosity (default: 0.5)\n"
+        << "  --constraint-iterations N\n"
+        << "                         Solver passes over the chain and cloth constraints per step (default: 8)\n"
+        << "  --flow NAME|FILE       Drag particles along a flow field: vortex, cells, gyre or a field file\n"
+        << "  --flow-speed S         Peak speed of a flow preset (default: 2)\n"
+        << "  --flow-coupling C      Rate particles take up the flow velocity, 1 or more follows it exactly (default: 1)\n"
+        << "  --distance-cell S      Skip wall tests for particles a wall distance field with S-sized cells clears\n"
+        << "  --checkpoint FILE      Write a checkpoint to FILE on exit\n"
+        << "  --checkpoint-every N   Also write the checkpoint every N steps\n"
+        << "  --restore FILE         Resume from a checkpoint instead of loading a scene\n"
+        << "  --trajectory FILE      Record particle positions for every step to FILE\n"
+        << "  --keyframe-every N     Frames between exact keyframes in the trajectory (default: 100)\n"
+        << "  --trajectory-quantum Q Position resolution between keyframes (default: 0.015625)\n"
+        << "  --play-trajectory FILE Scrub through a recorded trajectory instead of simulating\n"
+        << "  --stream-port P        Stream particle positions to remote viewers on port P\n"
+        << "  --stream-fps N         Most frames per second sent to each viewer (default: 30)\n"
+        << "  --stream-bandwidth KB  Kilobytes per second allowed per viewer, 0 for no limit (default: 8192)\n"
+        << "  --view HOST[:PORT]     Watch a simulation streamed from another machine\n"
+        << "  --control-port P       Accept line-delimited JSON commands on loopback port P\n"
+        << "  --cluster-nodes N      Split the domain across N node processes and coordinate them\n"
+        << "  --cluster-port P       Port the coordinator accepts nodes on (default: 9490)\n"
+        << "  --join HOST[:PORT]     Run as a node of the cluster coordinator at HOST\n"
+        << "  --gather-every N       Steps between gathering the nodes' particles, 0 never (default: 1)\n"
+        << "  --journal FILE         Log every GUI or remote command with its step to FILE\n"
+        << "  --replay FILE          Replay a journal headless (add --headless=false to watch it)\n"
+        << "  --shared-memory NAME   Publish particle arrays every step in shared memory segment NAME\n"
+        << "  --stats FILE           Write a run summary to FILE on exit\n"
+        << "  --profile              Print step timing statistics on exit\n"
+        << "  --profile-output FILE  Write per-step timings to FILE as CSV\n"
+        << "  --metrics-port P       Port for the loopback metrics endpoint (default: 9464)\n"
+        << "  --no-metrics           Disable the metrics endpoint\n"
+        << "  --help                 Show this message\n";
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <set>
+#include <string>
+#include <thread>
+
+// Startup settings. Defaults reproduce the interactive simulator; a config file
+// and command-line flags override them in that order.
+struct SimulationConfig {
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency()); // hardware_concurrency() may be 0
+    double deltaTime = 1;          // Time step for updating particle positions
+    double simWidth = 1280;        // Domain size, also the window size when not headless
+    double simHeight = 720;
+    bool headless = false;         // Run without a window or GUI
+    uint64_t runSteps = 0;         // Stop after this many steps, 0 runs until closed or interrupted
+    std::string sceneFile;         // Scene loaded at startup
+    std::string convertSceneOutput; // Save the loaded scene here (binary if it ends in .pscene) and exit
+    std::string svgFile;           // SVG drawing whose outlines are added as walls
+    double svgTolerance = 0.25;    // Farthest an imported wall may stray from the drawing
+    std::string maskFile;          // PNG or BMP obstacle mask, stretched over the domain, traced into walls
+    double maskTolerance = 1;      // Farthest a traced wall may stray from the mask's outlines
+    uint64_t seed = 5489;          // Seed for the simulation's random number generator
+    bool deterministic = false;    // Fixed work partitioning and per-step state checksums
+    std::string checksumOutput;    // Per-step checksums as CSV; implies deterministic
+    double sortThreshold = 0.25;   // Re-sort particles by location past this fraction out of order, 0 never
+    double gravity = 0;            // Strength of the attraction between particles, 0 disables it
+    double openingAngle = 0.5;     // Barnes–Hut accuracy; smaller is more exact and slower
+    double softening = 5;          // Distance added in quadrature to soften close encounters
+    size_t meshCells = 0;          // Cells per side of the gravity particle mesh, 0 uses the tree instead
+    double fluidLength = 0;        // SPH smoothing length, 0 disables the fluid
+    double restDensity = 0.02;     // Fluid density at zero pressure, in particles per unit area
+    double stiffness = 5;          // Pressure per unit of density above the rest density
+    double viscosity = 0.5;
+    size_t constraintIterations = 8; // Solver passes over the constraints every step
+    std::string flowField;         // Flow preset name or file, empty for no flow
+    double flowSpeed = 2;          // Peak speed of a flow preset
+    double flowCoupling = 1;       // How quickly particles take up the flow velocity
+    double distanceCellSize = 0;   // Cell size of the wall distance field, 0 for none
+
+    std::string checkpointFile;    // Checkpoint written periodically and on exit
+    uint64_t checkpointEvery = 0;  // Steps between checkpoints, 0 only writes one on exit
+    std::string restoreFile;       // Checkpoint to resume from instead of loading a scene
+
+    std::string trajectoryFile;    // Record particle positions every step
+    uint32_t trajectoryKeyframeInterval = 100; // Frames between exact keyframes
+    double trajectoryQuantum = 1.0 / 64; // Position resolution of delta frames
+    std::string playTrajectoryFile; // Open a recorded trajectory in the viewer instead of simulating
+
+    unsigned short streamPort = 0; // Stream positions to remote viewers on this port, 0 disables
+    unsigned int streamFps = 30;   // Most frames per second sent to any one viewer
+    uint64_t streamBandwidth = 8 * 1024 * 1024; // Bytes per second per viewer, 0 for no limit
+    std::string viewAddress;       // Watch a remote stream ("host[:port]") instead of simulating
+
+    unsigned short controlPort = 0; // Accept JSON commands on this loopback port, 0 disables
+
+    size_t clusterNodes = 0;       // Coordinate this many node processes instead of simulating locally, 0 disables
+    unsigned short clusterPort = 9490; // Port the coordinator accepts nodes on
+    std::string joinAddress;       // Run as a cluster node of the coordinator at "host[:port]"
+    uint64_t gatherInterval = 1;   // Steps between gathering the nodes' particles, 0 never
+
+    std::string journalFile;       // Log GUI and remote commands with the step they applied at
+    std::string replayFile;        // Rebuild a session from a journal instead of taking input
+
+    std::string sharedMemoryName;  // Publish particles to this shared-memory segment every step
+
+    std::string statsOutput;       // Run summary written on exit
+    std::string profileOutput;     // Per-step timings as CSV
+    bool profile = false;          // Print a step timing summary on exit
+
+    bool metricsEnabled = true;
+    unsigned short metricsPort = 9464;
+
+    bool showHelp = false;
+
+    std::set<std::string> explicitOptions; // Options set by a config file or flag, which scenes must not override
+};
+
+// Parses argv, loading any --config file first so flags always take precedence.
+// Throws std::invalid_argument on unknown options or malformed values.
+SimulationConfig parseCommandLine(int argc, char* argv[]);
+
+// Applies "key = value" lines from a config file. Blank lines and # comments are ignored.
+void loadConfigFile(const std::string& path, SimulationConfig& config);
+
+// Sets a single option by its long name (without the leading dashes).
+void applyOption(SimulationConfig& config, const std::string& key, const std::string& value);
+
+void printUsage(std::ostream& out);
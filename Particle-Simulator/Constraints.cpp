@@ -0,0 +1,266 @@
+#include "Constraints.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+uint64_t hashConstraints(const std::vector<Constraint>& constraints) {
+    uint64_t h = 0xcbf29ce484222325ULL ^ constraints.size();
+    for (const auto& constraint : constraints) {
+        uint32_t bits[4] = { constraint.a, constraint.b, 0, 0 };
+        std::memcpy(&bits[2], &constraint.restLength, sizeof(float));
+        std::memcpy(&bits[3], &constraint.stiffness, sizeof(float));
+        for (uint32_t value : bits) {
+            h = (h ^ value) * 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+// Whether the path from the particle to (toX, toY) crosses the wall. If it does, (toX, toY)
+// minus the unit normal (nx, ny) times shift is back on the particle's side, keeping the
+// motion along the wall.
+bool crossing(const Particle& particle, double toX, double toY, double startX, double startY, double endX, double endY,
+    double& nx, double& ny, double& shift) {
+    double ex = endX - startX, ey = endY - startY;
+    double dx = toX - particle.x, dy = toY - particle.y;
+    double det = dx * ey - dy * ex;
+    if (det == 0) {
+        return false;
+    }
+    double rx = startX - particle.x, ry = startY - particle.y;
+    double t = (rx * ey - ry * ex) / det; // Along the path
+    double u = (rx * dy - ry * dx) / det; // Along the wall
+    if (t < 0 || t > 1 || u < 0 || u > 1) {
+        return false;
+    }
+    double length = std::sqrt(ex * ex + ey * ey);
+    nx = -ey / length;
+    ny = ex / length;
+    double depth = (toX - startX) * nx + (toY - startY) * ny;
+    double side = (particle.x - startX) * nx + (particle.y - startY) * ny;
+    shift = depth - (side < 0 ? -ConstraintSolver::wallClearance : ConstraintSolver::wallClearance);
+    return true;
+}
+
+}
+
+const size_t ConstraintSolver::maxColors;
+const size_t ConstraintSolver::chunkSize;
+constexpr double ConstraintSolver::wallClearance;
+
+void ConstraintSolver::removeDead(Simulation& simulation) {
+    auto dead = [&](uint32_t id) {
+        uint32_t slot = simulation.slotOf(id);
+        return slot == Simulation::noSlot || !simulation.particles[slot].alive();
+    };
+    simulation.constraints.erase(std::remove_if(simulation.constraints.begin(), simulation.constraints.end(),
+        [&](const Constraint& constraint) { return dead(constraint.a) || dead(constraint.b); }), simulation.constraints.end());
+}
+
+void ConstraintSolver::color(const Simulation& simulation) {
+    // Each constraint takes the lowest color neither of its particles has yet
+    const std::vector<Constraint>& constraints = simulation.constraints;
+    std::vector<uint64_t> used(simulation.idCount(), 0);
+    colors.resize(constraints.size());
+    for (size_t i = 0; i < constraints.size(); ++i) {
+        uint64_t taken = used[constraints[i].a] | used[constraints[i].b];
+        size_t color = 0;
+        while (color < maxColors && (taken >> color) & 1) {
+            ++color;
+        }
+        colors[i] = static_cast<uint8_t>(color);
+        if (color < maxColors) {
+            used[constraints[i].a] |= uint64_t(1) << color;
+            used[constraints[i].b] |= uint64_t(1) << color;
+        }
+    }
+    coloredFingerprint = hashConstraints(constraints);
+    coloredCount = constraints.size();
+}
+
+void ConstraintSolver::layout(const Simulation& simulation) {
+    const std::vector<Constraint>& constraints = simulation.constraints;
+
+    // The constrained particles in slot order, which follows the Morton curve after a sort
+    handles.clear();
+    std::vector<uint32_t> entry(simulation.idCount(), UINT32_MAX);
+    for (const auto& constraint : constraints) {
+        for (uint32_t id : { constraint.a, constraint.b }) {
+            if (entry[id] == UINT32_MAX) {
+                entry[id] = 0;
+                handles.push_back(id);
+            }
+        }
+    }
+    std::sort(handles.begin(), handles.end(), [&](uint32_t x, uint32_t y) { return simulation.slotOf(x) < simulation.slotOf(y); });
+    for (size_t i = 0; i < handles.size(); ++i) {
+        entry[handles[i]] = static_cast<uint32_t>(i);
+    }
+
+    // Links grouped by color, each color sorted by its first particle
+    size_t iterations = std::max<size_t>(1, simulation.constraintIterations);
+    std::vector<size_t> counts(maxColors + 1, 0);
+    for (uint8_t color : colors) {
+        ++counts[color];
+    }
+    size_t colorsUsed = maxColors + 1;
+    while (colorsUsed > 0 && counts[colorsUsed - 1] == 0) {
+        --colorsUsed;
+    }
+    colorStart.assign(colorsUsed + 1, 0);
+    for (size_t color = 0; color < colorsUsed; ++color) {
+        colorStart[color + 1] = colorStart[color] + counts[color];
+    }
+    links.resize(constraints.size());
+    std::vector<size_t> next(colorStart.begin(), colorStart.end() - 1);
+    for (size_t i = 0; i < constraints.size(); ++i) {
+        const Constraint& constraint = constraints[i];
+        uint32_t a = entry[constraint.a], b = entry[constraint.b];
+        // Stiffness is per step, so each of the iterations applies its share
+        float stiffness = static_cast<float>(1 - std::pow(1 - std::min(std::max(constraint.stiffness, 0.0f), 1.0f), 1.0 / iterations));
+        links[next[colors[i]]++] = { std::min(a, b), std::max(a, b), constraint.restLength, stiffness };
+    }
+    for (size_t color = 0; color < colorsUsed; ++color) {
+        std::sort(links.begin() + colorStart[color], links.begin() + colorStart[color + 1],
+            [](const Link& x, const Link& y) { return x.a < y.a || (x.a == y.a && x.b < y.b); });
+    }
+
+    laidOutSorts = simulation.sortCount;
+    laidOutIterations = simulation.constraintIterations;
+}
+
+void ConstraintSolver::stopAtWalls(Simulation& simulation) {
+    // The wall lists only need to reach as far as any prediction strays
+    const std::vector<Particle>& particles = simulation.particles;
+    std::vector<double> chunkReach((handles.size() + Simulation::parallelChunkSize - 1) / Simulation::parallelChunkSize, 0);
+    simulation.parallelFor(handles.size(), [&](size_t begin, size_t end) {
+        double farthest = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const Particle& particle = particles[slots[i]];
+            double dx = predictedX[i] - particle.x, dy = predictedY[i] - particle.y;
+            farthest = std::max(farthest, dx * dx + dy * dy);
+        }
+        chunkReach[begin / Simulation::parallelChunkSize] = farthest;
+    });
+    double reach = 0;
+    for (double farthest : chunkReach) {
+        reach = std::max(reach, farthest);
+    }
+    // The simulation's own tiles, so the step reuses the lists and the predictions stop at
+    // the walls the particles are about to collide with
+    const TileGrid& grid = simulation.prepareWalls(std::sqrt(reach));
+    const std::vector<Simulation::WallSweep>& sweeps = simulation.movingWallSweeps();
+
+    simulation.parallelFor(handles.size(), [&](size_t begin, size_t end) {
+        double nx, ny, shift;
+        for (size_t i = begin; i < end; ++i) {
+            const Particle& particle = particles[slots[i]];
+            size_t tile = grid.tileOf(particle.x, particle.y);
+            for (size_t k = grid.tiles[tile].firstWall; k < grid.tiles[tile].lastWall; ++k) {
+                const Wall& wall = grid.walls[k];
+                if (crossing(particle, predictedX[i], predictedY[i], wall.start.x, wall.start.y, wall.end.x, wall.end.y, nx, ny, shift)) {
+                    predictedX[i] -= nx * shift;
+                    predictedY[i] -= ny * shift;
+                }
+            }
+            // Moving walls are tested where they start the step, with the prediction carried
+            // back through their slide and turn, as the particle update does
+            for (uint32_t k : grid.movingWalls[tile]) {
+                const Simulation::WallSweep& sweep = sweeps[k];
+                double rx = predictedX[i] - (sweep.pivotX + sweep.slideX), ry = predictedY[i] - (sweep.pivotY + sweep.slideY);
+                double backX = sweep.pivotX + sweep.cosine * rx + sweep.sine * ry;
+                double backY = sweep.pivotY - sweep.sine * rx + sweep.cosine * ry;
+                if (crossing(particle, backX, backY, sweep.startX, sweep.startY, sweep.endX, sweep.endY, nx, ny, shift)) {
+                    // Turn the normal forward with the wall before pulling the prediction back
+                    predictedX[i] -= (sweep.cosine * nx - sweep.sine * ny) * shift;
+                    predictedY[i] -= (sweep.sine * nx + sweep.cosine * ny) * shift;
+                }
+            }
+        }
+    });
+}
+
+double ConstraintSolver::solve(Simulation& simulation) {
+    if (simulation.constraints.size() != coloredCount || hashConstraints(simulation.constraints) != coloredFingerprint) {
+        removeDead(simulation);
+        color(simulation);
+        laidOutSorts = UINT64_MAX;
+    }
+    if (simulation.sortCount != laidOutSorts || simulation.constraintIterations != laidOutIterations) {
+        layout(simulation);
+    }
+
+    std::vector<Particle>& particles = simulation.particles;
+    double dt = simulation.deltaTime;
+    slots.resize(handles.size());
+    predictedX.resize(handles.size());
+    predictedY.resize(handles.size());
+    radii.resize(handles.size());
+    simulation.parallelFor(handles.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            slots[i] = simulation.slotOf(handles[i]);
+            const Particle& particle = particles[slots[i]];
+            predictedX[i] = particle.x + particle.vx * dt;
+            predictedY[i] = particle.y + particle.vy * dt;
+            radii[i] = particle.radius;
+        }
+    });
+
+    // A prediction left outside the domain would have its velocity flipped by the edge
+    // bounce, which the constraints then pull back, pumping energy in every step
+    double width = simulation.simWidth, height = simulation.simHeight;
+    auto confine = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            predictedX[i] = std::min(std::max(predictedX[i], radii[i]), width - radii[i]);
+            predictedY[i] = std::min(std::max(predictedY[i], radii[i]), height - radii[i]);
+        }
+    };
+
+    // Within a color no two links share a particle, so every chunk works undisturbed
+    size_t iterations = std::max<size_t>(1, simulation.constraintIterations);
+    for (size_t iteration = 0; iteration < iterations; ++iteration) {
+        for (size_t color = 0; color < colorCount(); ++color) {
+            size_t first = colorStart[color], count = colorStart[color + 1] - first;
+            simulation.parallelFor(count, [&](size_t begin, size_t end) {
+                for (size_t k = first + begin; k < first + end; ++k) {
+                    const Link& link = links[k];
+                    double dx = predictedX[link.b] - predictedX[link.a], dy = predictedY[link.b] - predictedY[link.a];
+                    double length = std::sqrt(dx * dx + dy * dy);
+                    if (length == 0) {
+                        continue;
+                    }
+                    double correction = link.stiffness * (length - link.restLength) / (2 * length);
+                    predictedX[link.a] += dx * correction;
+                    predictedY[link.a] += dy * correction;
+                    predictedX[link.b] -= dx * correction;
+                    predictedY[link.b] -= dy * correction;
+                }
+            }, color < maxColors ? chunkSize : std::max<size_t>(1, count));
+        }
+        simulation.parallelFor(handles.size(), confine);
+    }
+    if (!simulation.walls.empty() || !simulation.movingWalls.empty()) {
+        stopAtWalls(simulation);
+    }
+
+    std::vector<double> chunkSpeed((handles.size() + Simulation::parallelChunkSize - 1) / Simulation::parallelChunkSize, 0);
+    simulation.parallelFor(handles.size(), [&](size_t begin, size_t end) {
+        double fastest = 0;
+        for (size_t i = begin; i < end; ++i) {
+            Particle& particle = particles[slots[i]];
+            particle.vx = (predictedX[i] - particle.x) / dt;
+            particle.vy = (predictedY[i] - particle.y) / dt;
+            fastest = std::max(fastest, particle.vx * particle.vx + particle.vy * particle.vy);
+        }
+        chunkSpeed[begin / Simulation::parallelChunkSize] = fastest;
+    });
+    double fastest = 0;
+    for (double speed : chunkSpeed) {
+        fastest = std::max(fastest, speed);
+    }
+    return std::sqrt(fastest);
+}
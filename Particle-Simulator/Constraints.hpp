@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Keeps two particles, given by handle, restLength apart. A stiffness of 1 makes a rigid
+// rod; smaller values give a softer spring.
+class Constraint {
+public:
+    uint32_t a = 0, b = 0;
+    float restLength = 0;
+    float stiffness = 1;
+
+    Constraint() = default;
+    Constraint(uint32_t a, uint32_t b, float restLength, float stiffness) : a(a), b(b), restLength(restLength), stiffness(stiffness) {}
+};
+
+// Position-based solver for the simulation's constraints. Each step it predicts where
+// the constrained particles will be, moves the predictions to satisfy the constraints
+// over a number of iterations, and sets the velocities so the particles head for the
+// corrected positions. The particles then move through the normal update, so they still
+// bounce off walls and the domain edges. Predictions are kept inside the domain and on
+// their own side of every wall, moving walls included, since a bounce the constraints
+// pulled against would feed energy into them every step. The walls are found through
+// the simulation's tiles, so the step reuses the lists brought up to date here.
+//
+// The constraints are greedily colored so no two of the same color share a particle,
+// and each color is solved in parallel without locks. The constrained particles are
+// copied into a compact array in particle order, and the constraints of each color are
+// sorted by their first particle in it, so the solve walks memory mostly forward. That
+// layout is rebuilt whenever the particles are re-sorted by location or the constraints
+// change; the coloring only when the constraints change.
+class ConstraintSolver {
+public:
+    // Solves the simulation's constraints for this step and returns the fastest speed it
+    // gave a particle. Constraints on handles without a live particle are dropped first.
+    double solve(Simulation& simulation);
+
+    // Drops every constraint with an endpoint that has despawned
+    static void removeDead(Simulation& simulation);
+
+    size_t colorCount() const { return colorStart.empty() ? 0 : colorStart.size() - 1; }
+
+    static const size_t maxColors = 64;  // Constraints past this many colors are solved on one thread
+    static const size_t chunkSize = 2048; // Constraints per parallelFor chunk
+    static constexpr double wallClearance = 0.01; // Gap left between a stopped prediction and its wall
+
+private:
+    // A constraint between two entries of the compact particle array
+    struct Link {
+        uint32_t a, b;
+        float restLength, stiffness; // stiffness already spread over the iterations
+    };
+
+    void color(const Simulation& simulation);
+    void layout(const Simulation& simulation);
+    void stopAtWalls(Simulation& simulation);
+
+    uint64_t coloredFingerprint = 0;      // Hash of the constraints the colors were computed for
+    size_t coloredCount = SIZE_MAX;
+    uint64_t laidOutSorts = UINT64_MAX;   // Simulation::sortCount when laid out
+    size_t laidOutIterations = 0;
+    std::vector<uint8_t> colors;          // Color of each constraint, maxColors if none was free
+    std::vector<size_t> colorStart;       // Color c's links are links[colorStart[c], colorStart[c + 1])
+    std::vector<Link> links;
+    std::vector<uint32_t> handles;        // Particle handle of each compact entry
+    std::vector<uint32_t> slots;          // Its slot in the current step
+    std::vector<double> predictedX, predictedY, radii;
+};
@@ -0,0 +1,664 @@
+#include "Control.hpp"
+#include "Journal.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+const size_t maxLineBytes = 64 * 1024 * 1024; // A client sending more than this without a newline is dropped
+const size_t maxOutputBytes = 64 * 1024 * 1024; // A client leaving more replies than this unread is dropped
+const int maxJsonDepth = 32;
+
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object };
+    Type type = Null;
+    bool boolean = false;
+    double number = 0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* find(const char* key) const {
+        for (const auto& member : members) {
+            if (member.first == key) return &member.second;
+        }
+        return nullptr;
+    }
+};
+
+// Minimal RFC 8259 parser; throws std::invalid_argument on malformed input
+class JsonParser {
+public:
+    JsonParser(const char* begin, const char* end) : p(begin), end(end) {}
+
+    JsonValue parseDocument() {
+        JsonValue value = parseValue(0);
+        skipSpace();
+        if (p != end) fail("unexpected text after the value");
+        return value;
+    }
+
+private:
+    const char* p;
+    const char* end;
+
+    [[noreturn]] void fail(const char* message) {
+        throw std::invalid_argument(std::string("Invalid JSON: ") + message + ".");
+    }
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) ++p;
+    }
+
+    bool consume(const char* literal) {
+        size_t length = std::strlen(literal);
+        if (static_cast<size_t>(end - p) < length || std::memcmp(p, literal, length) != 0) {
+            return false;
+        }
+        p += length;
+        return true;
+    }
+
+    JsonValue parseValue(int depth) {
+        if (depth > maxJsonDepth) fail("nested too deeply");
+        skipSpace();
+        if (p == end) fail("unexpected end of line");
+
+        JsonValue value;
+        if (*p == '{') {
+            value.type = JsonValue::Object;
+            ++p;
+            skipSpace();
+            if (p < end && *p == '}') {
+                ++p;
+                return value;
+            }
+            while (true) {
+                skipSpace();
+                if (p == end || *p != '"') fail("expected a member name");
+                std::string key = parseString();
+                skipSpace();
+                if (p == end || *p++ != ':') fail("expected ':'");
+                value.members.emplace_back(std::move(key), parseValue(depth + 1));
+                skipSpace();
+                if (p < end && *p == ',') {
+                    ++p;
+                    continue;
+                }
+                if (p < end && *p == '}') {
+                    ++p;
+                    return value;
+                }
+                fail("expected ',' or '}'");
+            }
+        }
+        if (*p == '[') {
+            value.type = JsonValue::Array;
+            ++p;
+            skipSpace();
+            if (p < end && *p == ']') {
+                ++p;
+                return value;
+            }
+            while (true) {
+                value.items.push_back(parseValue(depth + 1));
+                skipSpace();
+                if (p < end && *p == ',') {
+                    ++p;
+                    continue;
+                }
+                if (p < end && *p == ']') {
+                    ++p;
+                    return value;
+                }
+                fail("expected ',' or ']'");
+            }
+        }
+        if (*p == '"') {
+            value.type = JsonValue::String;
+            value.text = parseString();
+            return value;
+        }
+        if (consume("true")) {
+            value.type = JsonValue::Bool;
+            value.boolean = true;
+            return value;
+        }
+        if (consume("false")) {
+            value.type = JsonValue::Bool;
+            return value;
+        }
+        if (consume("null")) {
+            return value;
+        }
+
+        // strtod accepts a superset of JSON numbers, which is harmless here
+        char* parsedEnd = nullptr;
+        value.number = std::strtod(p, &parsedEnd);
+        if (parsedEnd == p || parsedEnd > end || !std::isfinite(value.number)) fail("expected a value");
+        value.type = JsonValue::Number;
+        p = parsedEnd;
+        return value;
+    }
+
+    std::string parseString() {
+        std::string text;
+        ++p; // Opening quote
+        while (true) {
+            if (p == end) fail("unterminated string");
+            char c = *p++;
+            if (c == '"') return text;
+            if (c != '\\') {
+                text.push_back(c);
+                continue;
+            }
+            if (p == end) fail("unterminated string");
+            char escape = *p++;
+            switch (escape) {
+            case '"': case '\\': case '/': text.push_back(escape); break;
+            case 'b': text.push_back('\b'); break;
+            case 'f': text.push_back('\f'); break;
+            case 'n': text.push_back('\n'); break;
+            case 'r': text.push_back('\r'); break;
+            case 't': text.push_back('\t'); break;
+            case 'u': {
+                if (end - p < 4) fail("bad \\u escape");
+                unsigned int code = static_cast<unsigned int>(std::strtoul(std::string(p, p + 4).c_str(), nullptr, 16));
+                p += 4;
+                // Names and keywords are ASCII, so anything else only needs to survive as UTF-8
+                if (code < 0x80) {
+                    text.push_back(static_cast<char>(code));
+                }
+                else if (code < 0x800) {
+                    text.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                else {
+                    text.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    text.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    text.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default: fail("bad escape");
+            }
+        }
+    }
+};
+
+std::string quote(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out.push_back(c);
+        }
+    }
+    return out + "\"";
+}
+
+std::string formatNumber(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.17g", value);
+    return text;
+}
+
+double requireNumber(const JsonValue& object, const char* key) {
+    const JsonValue* value = object.find(key);
+    if (value == nullptr || value->type != JsonValue::Number) {
+        throw std::invalid_argument(std::string("'") + key + "' must be a number.");
+    }
+    return value->number;
+}
+
+double optionalNumber(const JsonValue& object, const char* key, double fallback) {
+    return object.find(key) != nullptr ? requireNumber(object, key) : fallback;
+}
+
+int particleCount(const JsonValue& object) {
+    double count = requireNumber(object, "count");
+    if (count < 1 || count != std::floor(count) || count > 2147483647.0) {
+        throw std::invalid_argument("Number of particles must be a positive integer.");
+    }
+    return static_cast<int>(count);
+}
+
+// Flat numeric array whose length is a multiple of stride
+const std::vector<JsonValue>& numberArray(const JsonValue& object, size_t stride) {
+    const JsonValue* data = object.find("data");
+    if (data == nullptr || data->type != JsonValue::Array || data->items.size() % stride != 0) {
+        throw std::invalid_argument("'data' must be an array of " + std::to_string(stride) + " numbers per item.");
+    }
+    for (const auto& item : data->items) {
+        if (item.type != JsonValue::Number) {
+            throw std::invalid_argument("'data' must only hold numbers.");
+        }
+    }
+    return data->items;
+}
+
+ControlServer::Command parseAdd(const JsonValue& object) {
+    ControlServer::Command command;
+    command.type = ControlServer::Command::Add;
+
+    const JsonValue* generator = object.find("generator");
+    std::string name = generator != nullptr && generator->type == JsonValue::String ? generator->text : "";
+    if (name == "line") {
+        LineBatch batch;
+        batch.count = particleCount(object);
+        batch.x1 = static_cast<float>(requireNumber(object, "x1"));
+        batch.y1 = static_cast<float>(requireNumber(object, "y1"));
+        batch.x2 = static_cast<float>(requireNumber(object, "x2"));
+        batch.y2 = static_cast<float>(requireNumber(object, "y2"));
+        batch.velocity = static_cast<float>(optionalNumber(object, "velocity", batch.velocity));
+        batch.angle = static_cast<float>(optionalNumber(object, "angle", batch.angle));
+        command.additions.lineBatches.push_back(batch);
+    }
+    else if (name == "fan") {
+        AngleBatch batch;
+        batch.count = particleCount(object);
+        batch.startAngle = static_cast<float>(requireNumber(object, "startAngle"));
+        batch.endAngle = static_cast<float>(requireNumber(object, "endAngle"));
+        if (batch.startAngle > batch.endAngle) throw std::invalid_argument("Start Theta must be less than End Theta.");
+        if (object.find("x") != nullptr || object.find("y") != nullptr) {
+            batch.atCenter = false;
+            batch.x = static_cast<float>(requireNumber(object, "x"));
+            batch.y = static_cast<float>(requireNumber(object, "y"));
+        }
+        batch.velocity = static_cast<float>(optionalNumber(object, "velocity", batch.velocity));
+        command.additions.angleBatches.push_back(batch);
+    }
+    else if (name == "sweep") {
+        VelocityBatch batch;
+        batch.count = particleCount(object);
+        batch.startVelocity = static_cast<float>(requireNumber(object, "startVelocity"));
+        batch.endVelocity = static_cast<float>(requireNumber(object, "endVelocity"));
+        if (batch.startVelocity <= 0 || batch.startVelocity >= batch.endVelocity) {
+            throw std::invalid_argument("Start Velocity must be greater than 0 and less than End Velocity.");
+        }
+        batch.x = static_cast<float>(optionalNumber(object, "x", batch.x));
+        batch.y = static_cast<float>(optionalNumber(object, "y", batch.y));
+        batch.angle = static_cast<float>(optionalNumber(object, "angle", batch.angle));
+        command.additions.velocityBatches.push_back(batch);
+    }
+    else if (name == "particles") {
+        const std::vector<JsonValue>& data = numberArray(object, 4);
+        double radius = optionalNumber(object, "radius", particleRadius);
+        if (radius <= 0) throw std::invalid_argument("Radius must be greater than 0.");
+        command.particles.reserve(data.size() / 4);
+        for (size_t i = 0; i < data.size(); i += 4) {
+            if (data[i + 3].number <= 0) throw std::invalid_argument("Velocity must be greater than 0.");
+            command.particles.push_back({ data[i].number, data[i + 1].number, data[i + 2].number, data[i + 3].number, radius });
+        }
+    }
+    else {
+        throw std::invalid_argument("'generator' must be \"line\", \"fan\", \"sweep\" or \"particles\".");
+    }
+    return command;
+}
+
+ControlServer::Command parseCommand(const JsonValue& object) {
+    if (object.type != JsonValue::Object) {
+        throw std::invalid_argument("Each command must be a JSON object.");
+    }
+    const JsonValue* cmd = object.find("cmd");
+    if (cmd == nullptr || cmd->type != JsonValue::String) {
+        throw std::invalid_argument("Command is missing \"cmd\".");
+    }
+
+    ControlServer::Command command;
+    const std::string& name = cmd->text;
+    if (name == "add") {
+        return parseAdd(object);
+    }
+    else if (name == "walls") {
+        command.type = ControlServer::Command::Add;
+        const std::vector<JsonValue>& data = numberArray(object, 4);
+        command.additions.walls.reserve(data.size() / 4);
+        for (size_t i = 0; i < data.size(); i += 4) {
+            Wall wall(static_cast<float>(data[i].number), static_cast<float>(data[i + 1].number),
+                static_cast<float>(data[i + 2].number), static_cast<float>(data[i + 3].number));
+            if (const char* error = wallError(wall)) throw std::invalid_argument(error);
+            command.additions.walls.push_back(wall);
+        }
+    }
+    else if (name == "clear") {
+        command.type = ControlServer::Command::Clear;
+        const JsonValue* target = object.find("target");
+        std::string what = target != nullptr && target->type == JsonValue::String ? target->text : (target == nullptr ? "all" : "");
+        if (what != "particles" && what != "walls" && what != "all") {
+            throw std::invalid_argument("'target' must be \"particles\", \"walls\" or \"all\".");
+        }
+        command.clearParticles = what != "walls";
+        command.clearWalls = what != "particles";
+    }
+    else if (name == "pause") {
+        command.type = ControlServer::Command::Pause;
+    }
+    else if (name == "resume") {
+        command.type = ControlServer::Command::Resume;
+    }
+    else if (name == "step") {
+        command.type = ControlServer::Command::Step;
+        double count = optionalNumber(object, "count", 1);
+        if (count < 1 || count != std::floor(count) || count > 1e15) throw std::invalid_argument("'count' must be a positive integer.");
+        command.count = static_cast<uint64_t>(count);
+    }
+    else if (name == "dt") {
+        command.type = ControlServer::Command::SetDeltaTime;
+        command.value = requireNumber(object, "value");
+        if (const char* error = deltaTimeError(command.value)) throw std::invalid_argument(error);
+    }
+    else if (name == "stats") {
+        command.type = ControlServer::Command::Stats;
+    }
+    else {
+        throw std::invalid_argument("Unknown command \"" + name + "\".");
+    }
+    return command;
+}
+
+ControlServer::Request parseRequest(const char* begin, const char* end) {
+    ControlServer::Request request;
+    try {
+        JsonValue document = JsonParser(begin, end).parseDocument();
+        if (document.type == JsonValue::Array) {
+            request.commands.reserve(document.items.size());
+            for (const auto& item : document.items) {
+                request.commands.push_back(parseCommand(item));
+            }
+        }
+        else {
+            if (const JsonValue* id = document.find("id")) {
+                if (id->type == JsonValue::Number) request.id = formatNumber(id->number);
+                else if (id->type == JsonValue::String) request.id = quote(id->text);
+            }
+            request.commands.push_back(parseCommand(document));
+        }
+    }
+    catch (const std::invalid_argument& e) {
+        request.commands.clear();
+        request.error = e.what();
+    }
+    return request;
+}
+
+std::string formatReply(const std::string& id, const Simulation& simulation, bool stats, bool paused) {
+    std::string text = "{";
+    if (!id.empty()) text += "\"id\":" + id + ",";
+    text += "\"ok\":true,\"step\":" + std::to_string(simulation.stepCount);
+    if (stats) {
+        text += ",\"particles\":" + std::to_string(simulation.aliveCount())
+            + ",\"walls\":" + std::to_string(simulation.walls.size())
+            + ",\"time\":" + formatNumber(simulation.time)
+            + ",\"dt\":" + formatNumber(simulation.deltaTime)
+            + ",\"paused\":" + (paused ? "true" : "false")
+            + ",\"stepSeconds\":" + formatNumber(simulation.lastStepSeconds);
+    }
+    return text + "}\n";
+}
+
+}
+
+ControlServer::ControlServer(unsigned short port)
+    : port(port) {}
+
+ControlServer::~ControlServer() {
+    stop();
+}
+
+bool ControlServer::start() {
+    if (listener.listen(port, sf::IpAddress::LocalHost) != sf::Socket::Done) {
+        std::cerr << "Control server could not listen on port " << port << '\n';
+        return false;
+    }
+    running = true;
+    thread = std::thread(&ControlServer::run, this);
+    return true;
+}
+
+void ControlServer::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    listener.close();
+}
+
+void ControlServer::run() {
+    sf::SocketSelector selector;
+    std::vector<std::pair<uint64_t, std::string>> sending;
+
+    while (running) {
+        selector.clear();
+        selector.add(listener);
+        for (const auto& client : clients) {
+            selector.add(*client->socket);
+        }
+
+        if (selector.wait(sf::milliseconds(2))) {
+            if (selector.isReady(listener)) {
+                std::unique_ptr<Client> client(new Client());
+                client->socket.reset(new sf::TcpSocket());
+                if (listener.accept(*client->socket) == sf::Socket::Done) {
+                    // One slow reader must not stall the other clients or the command intake
+                    client->socket->setBlocking(false);
+                    client->id = nextClientId++;
+                    clients.push_back(std::move(client));
+                }
+            }
+            for (size_t i = 0; i < clients.size();) {
+                if (selector.isReady(*clients[i]->socket) && !readClient(*clients[i])) {
+                    clients.erase(clients.begin() + i);
+                    continue;
+                }
+                ++i;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sending.swap(outbox);
+        }
+        for (const auto& message : sending) {
+            for (const auto& client : clients) {
+                if (client->id == message.first) {
+                    client->output += message.second;
+                }
+            }
+        }
+        sending.clear();
+        for (size_t i = 0; i < clients.size();) {
+            if (!writeClient(*clients[i])) {
+                clients.erase(clients.begin() + i);
+                continue;
+            }
+            ++i;
+        }
+    }
+
+    clients.clear();
+}
+
+bool ControlServer::readClient(Client& client) {
+    char buffer[65536];
+    std::size_t received = 0;
+    sf::Socket::Status status = client.socket->receive(buffer, sizeof(buffer), received);
+    if (status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+        return false;
+    }
+    client.input.append(buffer, received);
+
+    // Parse every complete line here so the main thread only has to apply them
+    size_t lineStart = 0;
+    std::vector<Request> parsed;
+    while (true) {
+        size_t lineEnd = client.input.find('\n', lineStart);
+        if (lineEnd == std::string::npos) {
+            break;
+        }
+        const char* begin = client.input.data() + lineStart;
+        const char* end = client.input.data() + lineEnd;
+        lineStart = lineEnd + 1;
+        if (std::all_of(begin, end, [](char c) { return c == ' ' || c == '\t' || c == '\r'; })) {
+            continue;
+        }
+        parsed.push_back(parseRequest(begin, end));
+        parsed.back().client = client.id;
+    }
+    client.input.erase(0, lineStart);
+    if (client.input.size() > maxLineBytes) {
+        return false;
+    }
+
+    if (!parsed.empty()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& request : parsed) {
+            requests.push_back(std::move(request));
+        }
+        commandArrived.notify_all();
+    }
+    return true;
+}
+
+bool ControlServer::writeClient(Client& client) {
+    if (client.output.empty()) {
+        return true;
+    }
+    // Sends as much as the socket takes now; the rest waits for the next pass
+    std::size_t sent = 0;
+    sf::Socket::Status status = client.socket->send(client.output.data(), client.output.size(), sent);
+    if (status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+        return false;
+    }
+    client.output.erase(0, sent);
+    return client.output.size() <= maxOutputBytes;
+}
+
+void ControlServer::reply(uint64_t client, const std::string& text) {
+    std::lock_guard<std::mutex> lock(mutex);
+    outbox.emplace_back(client, text);
+}
+
+void ControlServer::apply(Simulation& simulation, JournalWriter* journal) {
+    std::deque<Request> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(requests);
+    }
+
+    for (const Request& request : batch) {
+        if (!request.error.empty()) {
+            reply(request.client, "{" + (request.id.empty() ? std::string() : "\"id\":" + request.id + ",")
+                + "\"ok\":false,\"error\":" + quote(request.error) + "}\n");
+            continue;
+        }
+
+        bool stats = false;
+        uint64_t replyStep = 0;
+        for (const Command& command : request.commands) {
+            uint64_t step = simulation.stepCount;
+            switch (command.type) {
+            case Command::Add: {
+                // Same order as applyScene, so a replayed journal adds particles in the same order
+                const Scene& scene = command.additions;
+                simulation.walls.insert(simulation.walls.end(), scene.walls.begin(), scene.walls.end());
+                simulation.particles.reserve(simulation.particles.size() + command.particles.size());
+                for (const auto& particle : command.particles) {
+                    simulation.particles.emplace_back(particle.x, particle.y, particle.angle, particle.velocity, particle.radius);
+                }
+                for (const auto& line : scene.lineBatches) addLineBatch(simulation, line);
+                for (const auto& fan : scene.angleBatches) addAngleBatch(simulation, fan);
+                for (const auto& sweep : scene.velocityBatches) addVelocityBatch(simulation, sweep);
+                if (journal) {
+                    for (const auto& wall : scene.walls) journal->recordWall(step, wall);
+                    for (const auto& particle : command.particles) {
+                        journal->recordParticle(step, particle.x, particle.y, particle.angle, particle.velocity, particle.radius);
+                    }
+                    for (const auto& line : scene.lineBatches) journal->recordLine(step, line);
+                    for (const auto& fan : scene.angleBatches) journal->recordAngle(step, fan);
+                    for (const auto& sweep : scene.velocityBatches) journal->recordVelocity(step, sweep);
+                }
+                break;
+            }
+            case Command::Clear:
+                if (command.clearParticles) simulation.clearParticles();
+                if (command.clearWalls) simulation.clearWalls();
+                if (journal) journal->recordClear(step, command.clearParticles, command.clearWalls);
+                break;
+            case Command::Pause:
+                paused = true;
+                break;
+            case Command::Resume:
+                paused = false;
+                stepsRemaining = 0;
+                break;
+            case Command::Step:
+                if (paused) {
+                    stepsRemaining += command.count;
+                    replyStep = std::max(replyStep, step + stepsRemaining);
+                }
+                else {
+                    replyStep = std::max(replyStep, step + command.count);
+                }
+                break;
+            case Command::SetDeltaTime:
+                simulation.deltaTime = command.value;
+                if (journal) journal->recordDeltaTime(step, command.value);
+                break;
+            case Command::Stats:
+                stats = true;
+                break;
+            }
+        }
+
+        if (replyStep > simulation.stepCount) {
+            pendingReplies.push_back({ request.client, replyStep, request.id, stats });
+        }
+        else {
+            reply(request.client, formatReply(request.id, simulation, stats, paused));
+        }
+    }
+
+    for (size_t i = 0; i < pendingReplies.size();) {
+        const PendingReply& pending = pendingReplies[i];
+        if (simulation.stepCount >= pending.step) {
+            reply(pending.client, formatReply(pending.id, simulation, pending.stats, paused));
+            pendingReplies.erase(pendingReplies.begin() + i);
+            continue;
+        }
+        ++i;
+    }
+}
+
+bool ControlServer::shouldStep() {
+    if (!paused) {
+        return true;
+    }
+    if (stepsRemaining > 0) {
+        --stepsRemaining;
+        return true;
+    }
+    return false;
+}
+
+void ControlServer::waitForCommands(sf::Time timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    commandArrived.wait_for(lock, std::chrono::microseconds(timeout.asMicroseconds()), [this] { return !requests.empty(); });
+}
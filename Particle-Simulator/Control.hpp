@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Scene.hpp"
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class JournalWriter;
+class Simulation;
+
+// Remote control of a running simulation over a loopback TCP socket.
+//
+// Each line sent to the socket is one JSON command object, or an array of them that
+// is applied as a single batch:
+//   {"cmd": "add", "generator": "line", "count": 500, "x1": 10, "y1": 10, "x2": 600, "y2": 10}
+//   {"cmd": "add", "generator": "fan", "count": 100, "startAngle": 0, "endAngle": 360}
+//   {"cmd": "add", "generator": "sweep", "count": 100, "startVelocity": 5, "endVelocity": 50}
+//   {"cmd": "add", "generator": "particles", "data": [x, y, angle, velocity, ...]}
+//   {"cmd": "walls", "data": [x1, y1, x2, y2, ...]}
+//   {"cmd": "clear", "target": "particles"}           (also "walls"; default "all")
+//   {"cmd": "pause"}  {"cmd": "resume"}  {"cmd": "step", "count": 10}
+//   {"cmd": "dt", "value": 0.5}
+//   {"cmd": "stats"}
+// Generator fields match the scene entries (see Scene.hpp) and take the same defaults.
+//
+// Lines are parsed and validated on the server thread; the main thread applies
+// everything that arrived at the next step boundary. Every line gets one reply line,
+// {"ok": true, "step": N} plus the stats if asked for, or {"ok": false, "error": "..."}
+// with nothing applied. An "id" member of a single command is echoed back. Replies to
+// lines containing "step" are sent once those steps have run. Client sockets never
+// block the server thread: replies queue per client, and a client that leaves too many
+// of them unread is disconnected.
+class ControlServer {
+public:
+    explicit ControlServer(unsigned short port);
+    ~ControlServer();
+
+    bool start();
+    void stop();
+
+    // Applies every command received since the last call and sends the replies that are due.
+    // Call between steps; added items and clears are also recorded to the journal if there is one.
+    void apply(Simulation& simulation, JournalWriter* journal);
+
+    // False while paused, except for steps requested with "step"
+    bool shouldStep();
+
+    // Waits up to timeout for a command to arrive, so a paused headless run does not spin
+    void waitForCommands(sf::Time timeout);
+
+    struct ParticleInput {
+        double x, y, angle, velocity, radius;
+    };
+
+    struct Command {
+        enum Type { Add, Clear, Pause, Resume, Step, SetDeltaTime, Stats };
+        Type type = Stats;
+        Scene additions;                      // Add: walls and batches
+        std::vector<ParticleInput> particles; // Add: explicit particles
+        bool clearParticles = true, clearWalls = true;
+        uint64_t count = 1;                   // Step
+        double value = 0;                     // SetDeltaTime
+    };
+
+    struct Request {
+        uint64_t client = 0;
+        std::string id;                       // Raw JSON of the "id" member, empty if absent
+        std::vector<Command> commands;
+        std::string error;                    // Set if the line was rejected
+    };
+
+private:
+    struct Client {
+        uint64_t id = 0;
+        std::unique_ptr<sf::TcpSocket> socket;
+        std::string input;                    // Bytes received after the last complete line
+        std::string output;                   // Replies the socket has not taken yet
+    };
+
+    struct PendingReply {
+        uint64_t client;
+        uint64_t step;                        // Sent once the simulation reaches this step
+        std::string id;
+        bool stats;
+    };
+
+    void run();
+    bool readClient(Client& client);
+    bool writeClient(Client& client);
+    void reply(uint64_t client, const std::string& text);
+
+    unsigned short port;
+    sf::TcpListener listener;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+
+    std::mutex mutex;
+    std::condition_variable commandArrived;
+    std::deque<Request> requests;             // Parsed lines waiting for the next step boundary
+    std::vector<std::pair<uint64_t, std::string>> outbox; // Replies for the server thread to send
+
+    // Server thread state
+    std::vector<std::unique_ptr<Client>> clients;
+    uint64_t nextClientId = 1;
+
+    // Main thread state
+    bool paused = false;
+    uint64_t stepsRemaining = 0;              // Steps still to run while paused
+    std::vector<PendingReply> pendingReplies;
+};
@@ -0,0 +1,122 @@
+#include "DistanceField.hpp"
+#include "Simulation.hpp"
+
+#include <cmath>
+#include <cstring>
+
+const size_t DistanceField::bandCells;
+const size_t DistanceField::bucketCells;
+
+void DistanceField::update(Simulation& simulation, double newCellSize) {
+    const std::vector<Wall>& walls = simulation.walls;
+    bool current = newCellSize == cellSize && simulation.simWidth == width && simulation.simHeight == height
+        && simulation.wallVersion == builtVersion && walls.size() >= wallCount;
+    if (current && walls.size() == wallCount) {
+        return;
+    }
+
+    size_t firstWall = wallCount;
+    if (!current) {
+        cellSize = newCellSize;
+        cellsPerUnit = 1 / cellSize;
+        band = bandCells * cellSize;
+        width = simulation.simWidth;
+        height = simulation.simHeight;
+        columns = std::max<size_t>(1, static_cast<size_t>(std::ceil(width * cellsPerUnit)));
+        rows = std::max<size_t>(1, static_cast<size_t>(std::ceil(height * cellsPerUnit)));
+        bucketColumns = (columns + bucketCells - 1) / bucketCells;
+        bucketRows = (rows + bucketCells - 1) / bucketCells;
+        cells.assign(columns * rows, static_cast<float>(band));
+        buckets.assign(bucketColumns * bucketRows, std::vector<Wall>());
+        builtVersion = simulation.wallVersion;
+        firstWall = 0;
+        ++rebuilds;
+    }
+    else {
+        ++extensions;
+    }
+    wallCount = walls.size();
+    addWalls(simulation, firstWall);
+}
+
+void DistanceField::removeWall(size_t index, const Wall& removed) {
+    // Walls appended since the last update are not in the field yet
+    if (index >= wallCount) {
+        return;
+    }
+    --wallCount;
+
+    // Distances only grow without the wall, so the cells stay valid lower bounds and
+    // only the bucket lists change. Each bucket drops its first identical copy.
+    double minX = std::min(removed.start.x, removed.end.x) - band, maxX = std::max(removed.start.x, removed.end.x) + band;
+    double minY = std::min(removed.start.y, removed.end.y) - band, maxY = std::max(removed.start.y, removed.end.y) + band;
+    double top = std::floor(minY * cellsPerUnit), bottom = std::floor(maxY * cellsPerUnit);
+    double left = std::floor(minX * cellsPerUnit), right = std::floor(maxX * cellsPerUnit);
+    ++removals;
+    if (bottom < 0 || top >= static_cast<double>(rows) || right < 0 || left >= static_cast<double>(columns)) {
+        return;
+    }
+    size_t firstBucketRow = static_cast<size_t>(std::max(top, 0.0)) / bucketCells;
+    size_t lastBucketRow = std::min(rows - 1, static_cast<size_t>(bottom)) / bucketCells;
+    size_t firstBucketColumn = static_cast<size_t>(std::max(left, 0.0)) / bucketCells;
+    size_t lastBucketColumn = std::min(columns - 1, static_cast<size_t>(right)) / bucketCells;
+    for (size_t bucketRow = firstBucketRow; bucketRow <= lastBucketRow; ++bucketRow) {
+        for (size_t bucketColumn = firstBucketColumn; bucketColumn <= lastBucketColumn; ++bucketColumn) {
+            std::vector<Wall>& bucket = buckets[bucketRow * bucketColumns + bucketColumn];
+            for (auto it = bucket.begin(); it != bucket.end(); ++it) {
+                if (std::memcmp(&*it, &removed, sizeof(Wall)) == 0) {
+                    bucket.erase(it);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void DistanceField::addWalls(Simulation& simulation, size_t firstWall) {
+    // Each job takes a row of buckets and every new wall whose band reaches it, so no
+    // two jobs write the same cell or bucket
+    const std::vector<Wall>& walls = simulation.walls;
+    double halfDiagonal = cellSize * std::sqrt(0.5);
+    simulation.parallelFor(bucketRows, [&](size_t firstBucketRow, size_t lastBucketRow) {
+        size_t firstRow = firstBucketRow * bucketCells, lastRow = std::min(rows, lastBucketRow * bucketCells);
+        for (size_t k = firstWall; k < walls.size(); ++k) {
+            const Wall& wall = walls[k];
+            double minX = std::min(wall.start.x, wall.end.x) - band, maxX = std::max(wall.start.x, wall.end.x) + band;
+            double minY = std::min(wall.start.y, wall.end.y) - band, maxY = std::max(wall.start.y, wall.end.y) + band;
+            double top = std::floor(minY * cellsPerUnit), bottom = std::floor(maxY * cellsPerUnit);
+            double left = std::floor(minX * cellsPerUnit), right = std::floor(maxX * cellsPerUnit);
+            if (bottom < static_cast<double>(firstRow) || top >= static_cast<double>(lastRow) || right < 0 || left >= static_cast<double>(columns)) {
+                continue;
+            }
+            size_t rowBegin = std::max(firstRow, static_cast<size_t>(std::max(top, 0.0)));
+            size_t rowEnd = std::min(lastRow, static_cast<size_t>(bottom) + 1);
+            size_t columnBegin = static_cast<size_t>(std::max(left, 0.0));
+            size_t columnEnd = std::min(columns, static_cast<size_t>(right) + 1);
+
+            for (size_t bucketRow = rowBegin / bucketCells; bucketRow <= (rowEnd - 1) / bucketCells; ++bucketRow) {
+                for (size_t bucketColumn = columnBegin / bucketCells; bucketColumn <= (columnEnd - 1) / bucketCells; ++bucketColumn) {
+                    buckets[bucketRow * bucketColumns + bucketColumn].push_back(wall);
+                }
+            }
+
+            double ax = wall.start.x, ay = wall.start.y;
+            double ex = wall.end.x - ax, ey = wall.end.y - ay;
+            double lengthSquared = ex * ex + ey * ey;
+            for (size_t row = rowBegin; row < rowEnd; ++row) {
+                double y = (row + 0.5) * cellSize;
+                float* cellRow = &cells[row * columns];
+                for (size_t column = columnBegin; column < columnEnd; ++column) {
+                    // Distance from the cell center to the closest point of the wall, less
+                    // the farthest any point of the cell is from its center
+                    double x = (column + 0.5) * cellSize;
+                    double t = lengthSquared > 0 ? ((x - ax) * ex + (y - ay) * ey) / lengthSquared : 0;
+                    t = std::min(std::max(t, 0.0), 1.0);
+                    double dx = x - (ax + t * ex), dy = y - (ay + t * ey);
+                    float lower = static_cast<float>(std::sqrt(dx * dx + dy * dy) - halfDiagonal);
+                    cellRow[column] = std::min(cellRow[column], lower);
+                }
+            }
+        }
+    }, 1);
+}
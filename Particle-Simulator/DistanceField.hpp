@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Wall.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Distance from every cell of a square grid over the domain to the nearest wall, kept
+// as a lower bound for anywhere in the cell and capped at a band of bandCells cells.
+// A particle whose clearance exceeds the distance it can travel in a step cannot hit
+// any wall, so the update skips its exact wall tests. Walls are open segments with no
+// inside, so the distance is unsigned.
+//
+// The field only culls; it stores no gradient and resolves no collisions. Particles in
+// the band near a wall still run the exact segment test, which finds the crossing point
+// and reflects off the wall's own normal, but only against the walls listed for their
+// bucket, a square of band cells holding every wall within a band of it. A gradient of
+// a lower bound sampled per cell would bounce particles off the wrong point of thin
+// walls and change the results the field is meant to leave alone. The lists keep the
+// walls' global order, so the first wall hit is the same one a search of every wall
+// would find.
+//
+// Each wall only touches the cells and buckets within the band around it. Walls
+// appended since the last update are added in place, and Simulation::grabWall() drops
+// the wall it takes out of its buckets, leaving the cells as looser but still valid
+// bounds. Neither looks at the other walls, so keeping up costs nothing per step while
+// the walls are unchanged. Any other edit bumps Simulation::wallVersion and rebuilds
+// the field.
+class DistanceField {
+public:
+    // Brings the field up to date with the simulation's walls on cells of cellSize
+    void update(Simulation& simulation, double cellSize);
+
+    // Forgets walls[index], which the caller is about to erase from the simulation's walls
+    void removeWall(size_t index, const Wall& wall);
+
+    // Narrows [begin, end) to the walls a particle at (x, y) could hit travelling at most
+    // reach. Leaves it alone outside the domain or if reach is beyond the band.
+    void nearbyWalls(double x, double y, double reach, const Wall*& begin, const Wall*& end) const {
+        if (!(x >= 0 && x < width && y >= 0 && y < height) || reach > band) {
+            return;
+        }
+        size_t column = std::min(columns - 1, static_cast<size_t>(x * cellsPerUnit));
+        size_t row = std::min(rows - 1, static_cast<size_t>(y * cellsPerUnit));
+        if (cells[row * columns + column] > reach) {
+            end = begin;
+            return;
+        }
+        const std::vector<Wall>& bucket = buckets[(row / bucketCells) * bucketColumns + column / bucketCells];
+        begin = bucket.data();
+        end = bucket.data() + bucket.size();
+    }
+
+    uint64_t rebuilds = 0;               // Times the whole field was rebuilt
+    uint64_t extensions = 0;             // Times appended walls were added in place
+    uint64_t removals = 0;               // Times a wall was dropped in place
+
+    static const size_t bandCells = 8;   // Distances are capped this many cells out
+    static const size_t bucketCells = bandCells; // Cells per side of a bucket
+
+private:
+    void addWalls(Simulation& simulation, size_t firstWall);
+
+    double cellSize = 0, cellsPerUnit = 0, band = 0;
+    double width = 0, height = 0;
+    size_t columns = 0, rows = 0;
+    size_t bucketColumns = 0, bucketRows = 0;
+    size_t wallCount = 0;                // Leading walls the field holds
+    uint64_t builtVersion = UINT64_MAX;  // Simulation::wallVersion the field was built from
+    std::vector<float> cells;            // Row after row
+    std::vector<std::vector<Wall>> buckets; // Row after row
+};
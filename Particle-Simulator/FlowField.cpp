@@ -0,0 +1,276 @@
+#include "FlowField.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLOW_SSE2 1
+#endif
+
+namespace {
+
+const double presetSpacing = 8;      // Distance between the nodes of a preset
+const size_t gyreFrames = 32;        // Frames over one gyre period
+
+// Appends a frame, calling f(x, y, u, v) for the velocity at every node's position
+template <typename Function>
+void fillFrame(std::vector<float>& velocities, size_t columns, size_t rows, double width, double height, Function f) {
+    for (size_t j = 0; j < rows; ++j) {
+        for (size_t i = 0; i < columns; ++i) {
+            double u = 0, v = 0;
+            f(width * i / (columns - 1), height * j / (rows - 1), u, v);
+            velocities.push_back(static_cast<float>(u));
+            velocities.push_back(static_cast<float>(v));
+        }
+    }
+}
+
+FlowField makePreset(const std::string& name, double width, double height, double speed) {
+    size_t columns = static_cast<size_t>(std::ceil(width / presetSpacing)) + 1;
+    size_t rows = static_cast<size_t>(std::ceil(height / presetSpacing)) + 1;
+    size_t frames = 1;
+    double interval = 1;
+    std::vector<float> velocities;
+
+    if (name == "vortex") {
+        // Speed rises to its peak at the core radius and falls off beyond it
+        double core = std::min(width, height) / 4;
+        fillFrame(velocities, columns, rows, width, height, [&](double x, double y, double& u, double& v) {
+            double dx = x - width / 2, dy = y - height / 2;
+            double scale = 1 / (core * core + dx * dx + dy * dy);
+            u = -dy * scale;
+            v = dx * scale;
+        });
+    }
+    else if (name == "cells") {
+        double cell = std::min(width, height) / 4;
+        fillFrame(velocities, columns, rows, width, height, [&](double x, double y, double& u, double& v) {
+            u = std::sin(M_PI * x / cell) * std::cos(M_PI * y / cell);
+            v = -std::cos(M_PI * x / cell) * std::sin(M_PI * y / cell);
+        });
+    }
+    else {
+        // The double gyre on [0, 2] x [0, 1], stretched over the domain
+        frames = gyreFrames;
+        interval = gyrePeriod / gyreFrames;
+        const double sway = 0.25;
+        for (size_t frame = 0; frame < frames; ++frame) {
+            double phase = std::sin(2 * M_PI * frame / frames);
+            double a = sway * phase, b = 1 - 2 * sway * phase;
+            fillFrame(velocities, columns, rows, width, height, [&](double x, double y, double& u, double& v) {
+                double gx = 2 * x / width, gy = y / height;
+                double f = a * gx * gx + b * gx;
+                u = -M_PI * std::sin(M_PI * f) * std::cos(M_PI * gy) * (width / 2);
+                v = M_PI * std::cos(M_PI * f) * std::sin(M_PI * gy) * (2 * a * gx + b) * height;
+            });
+        }
+    }
+
+    // Presets are shapes; speed sets how fast they run
+    float peak = 0;
+    for (size_t k = 0; k < velocities.size(); k += 2) {
+        peak = std::max(peak, std::sqrt(velocities[k] * velocities[k] + velocities[k + 1] * velocities[k + 1]));
+    }
+    if (peak > 0) {
+        float scale = static_cast<float>(speed / peak);
+        for (float& component : velocities) {
+            component *= scale;
+        }
+    }
+
+    FlowField field;
+    field.assign(columns, rows, frames, interval, width, height, velocities);
+    return field;
+}
+
+FlowField loadFlowFile(const std::string& path, double width, double height) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::invalid_argument("Could not open flow field file '" + path + "'.");
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    // Every value in the file in order, skipping comments
+    std::vector<double> values;
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    while (cursor < end) {
+        if (*cursor == '#') {
+            while (cursor < end && *cursor != '\n') ++cursor;
+            continue;
+        }
+        if (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') {
+            ++cursor;
+            continue;
+        }
+        char* parsedEnd = nullptr;
+        double value = std::strtod(cursor, &parsedEnd);
+        if (parsedEnd == cursor) {
+            throw std::invalid_argument("Flow field file '" + path + "' holds something other than numbers.");
+        }
+        values.push_back(value);
+        cursor = parsedEnd;
+    }
+
+    if (values.size() < 2) {
+        throw std::invalid_argument("Flow field file '" + path + "' has no grid size.");
+    }
+    auto count = [&](double value) {
+        if (value < 1 || value != std::floor(value) || value > 65536) {
+            throw std::invalid_argument("Flow field file '" + path + "' has an invalid grid size.");
+        }
+        return static_cast<size_t>(value);
+    };
+    size_t columns = count(values[0]), rows = count(values[1]);
+    size_t frames = 1;
+    double interval = 1;
+    size_t headerSize = 2;
+    size_t frameValues = columns * rows * 2;
+    if (values.size() != headerSize + frameValues) {
+        // Not a single frame after a two-value header, so the header must give the frames
+        if (values.size() < 4) {
+            throw std::invalid_argument("Flow field file '" + path + "' does not hold a velocity for every node.");
+        }
+        frames = count(values[2]);
+        interval = values[3];
+        headerSize = 4;
+        if (interval <= 0) {
+            throw std::invalid_argument("Flow field file '" + path + "' must have a frame interval greater than 0.");
+        }
+    }
+    if (values.size() - headerSize != frameValues * frames) {
+        throw std::invalid_argument("Flow field file '" + path + "' does not hold a velocity for every node.");
+    }
+
+    std::vector<float> velocities(values.begin() + headerSize, values.end());
+    FlowField field;
+    field.assign(columns, rows, frames, interval, width, height, velocities);
+    return field;
+}
+
+}
+
+const size_t FlowField::tileNodes;
+
+size_t FlowField::nodeIndex(size_t column, size_t row) const {
+    return ((row / tileNodes) * tileColumns + column / tileNodes) * tileNodes * tileNodes
+        + (row % tileNodes) * tileNodes + column % tileNodes;
+}
+
+void FlowField::assign(size_t newColumns, size_t newRows, size_t frames, double frameInterval, double width, double height,
+    const std::vector<float>& velocities) {
+    if (newColumns < 2 || newRows < 2 || frames < 1) {
+        throw std::invalid_argument("A flow field needs at least 2 x 2 nodes and one frame.");
+    }
+    if (velocities.size() != newColumns * newRows * frames * 2) {
+        throw std::invalid_argument("A flow field needs a velocity for every node.");
+    }
+    columns = newColumns;
+    rows = newRows;
+    frameCount = frames;
+    interval = frameInterval;
+    nodesPerX = (columns - 1) / width;
+    nodesPerY = (rows - 1) / height;
+    tileColumns = (columns + tileNodes - 1) / tileNodes;
+    frameSize = tileColumns * ((rows + tileNodes - 1) / tileNodes) * tileNodes * tileNodes;
+
+    nodes.assign(frameSize * frames * 2, 0.0f);
+    fastest = 0;
+    const float* in = velocities.data();
+    for (size_t frame = 0; frame < frames; ++frame) {
+        float* out = nodes.data() + frame * frameSize * 2;
+        for (size_t row = 0; row < rows; ++row) {
+            for (size_t column = 0; column < columns; ++column, in += 2) {
+                size_t index = nodeIndex(column, row);
+                out[2 * index] = in[0];
+                out[2 * index + 1] = in[1];
+                fastest = std::max(fastest, std::sqrt(static_cast<double>(in[0]) * in[0] + static_cast<double>(in[1]) * in[1]));
+            }
+        }
+    }
+}
+
+void FlowField::sample(const Particle* particles, size_t count, double time, double* u, double* v) const {
+    // The two frames around time and how far it is from the first to the second
+    double position = frameCount > 1 ? time / interval : 0;
+    double whole = std::floor(position);
+    double blend = position - whole;
+    size_t first = static_cast<size_t>(std::fmod(std::max(whole, 0.0), static_cast<double>(frameCount)));
+    const float* frames[2] = { nodes.data() + first * frameSize * 2, nodes.data() + (first + 1) % frameCount * frameSize * 2 };
+    size_t frameUsed = frameCount > 1 ? 2 : 1;
+
+#ifdef FLOW_SSE2
+    // Lane 0 works on x or u, lane 1 on y or v
+    const __m128d scale = _mm_set_pd(nodesPerY, nodesPerX);
+    const __m128d lastCell = _mm_set_pd(static_cast<double>(rows - 2), static_cast<double>(columns - 2));
+    const __m128d lastNode = _mm_set_pd(static_cast<double>(rows - 1), static_cast<double>(columns - 1));
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d blendLanes = _mm_set1_pd(blend);
+    for (size_t k = 0; k < count; ++k) {
+        __m128d grid = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(&particles[k].x), scale), zero), lastNode);
+        __m128d cell = _mm_min_pd(_mm_cvtepi32_pd(_mm_cvttpd_epi32(grid)), lastCell);
+        __m128d t = _mm_sub_pd(grid, cell);
+        __m128d tx = _mm_unpacklo_pd(t, t), ty = _mm_unpackhi_pd(t, t);
+        size_t column = static_cast<size_t>(_mm_cvtsd_f64(cell));
+        size_t row = static_cast<size_t>(_mm_cvtsd_f64(_mm_unpackhi_pd(cell, cell)));
+        size_t corners[4] = { nodeIndex(column, row), nodeIndex(column + 1, row), nodeIndex(column, row + 1), nodeIndex(column + 1, row + 1) };
+
+        __m128d flow[2];
+        for (size_t f = 0; f < frameUsed; ++f) {
+            __m128d n[4];
+            for (size_t c = 0; c < 4; ++c) {
+                n[c] = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(frames[f] + 2 * corners[c]))));
+            }
+            __m128d top = _mm_add_pd(n[0], _mm_mul_pd(_mm_sub_pd(n[1], n[0]), tx));
+            __m128d bottom = _mm_add_pd(n[2], _mm_mul_pd(_mm_sub_pd(n[3], n[2]), tx));
+            flow[f] = _mm_add_pd(top, _mm_mul_pd(_mm_sub_pd(bottom, top), ty));
+        }
+        if (frameUsed > 1) {
+            flow[0] = _mm_add_pd(flow[0], _mm_mul_pd(_mm_sub_pd(flow[1], flow[0]), blendLanes));
+        }
+        _mm_storel_pd(&u[k], flow[0]);
+        _mm_storeh_pd(&v[k], flow[0]);
+    }
+#else
+    for (size_t k = 0; k < count; ++k) {
+        double gx = std::min(std::max(particles[k].x * nodesPerX, 0.0), static_cast<double>(columns - 1));
+        double gy = std::min(std::max(particles[k].y * nodesPerY, 0.0), static_cast<double>(rows - 1));
+        double cx = std::min(static_cast<double>(static_cast<int>(gx)), static_cast<double>(columns - 2));
+        double cy = std::min(static_cast<double>(static_cast<int>(gy)), static_cast<double>(rows - 2));
+        double tx = gx - cx, ty = gy - cy;
+        size_t column = static_cast<size_t>(cx), row = static_cast<size_t>(cy);
+        size_t corners[4] = { nodeIndex(column, row), nodeIndex(column + 1, row), nodeIndex(column, row + 1), nodeIndex(column + 1, row + 1) };
+
+        double flow[2][2];
+        for (size_t f = 0; f < frameUsed; ++f) {
+            for (size_t axis = 0; axis < 2; ++axis) {
+                double n[4];
+                for (size_t c = 0; c < 4; ++c) {
+                    n[c] = frames[f][2 * corners[c] + axis];
+                }
+                double top = n[0] + (n[1] - n[0]) * tx;
+                double bottom = n[2] + (n[3] - n[2]) * tx;
+                flow[f][axis] = top + (bottom - top) * ty;
+            }
+        }
+        if (frameUsed > 1) {
+            flow[0][0] += (flow[1][0] - flow[0][0]) * blend;
+            flow[0][1] += (flow[1][1] - flow[0][1]) * blend;
+        }
+        u[k] = flow[0][0];
+        v[k] = flow[0][1];
+    }
+#endif
+}
+
+FlowField makeFlowField(const std::string& spec, double width, double height, double speed) {
+    if (spec == "vortex" || spec == "cells" || spec == "gyre") {
+        return makePreset(spec, width, height, speed);
+    }
+    return loadFlowFile(spec, width, height);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A 2D velocity field over the domain, such as wind or a current, that particles are
+// dragged along by. It is sampled on a grid of nodes spanning the domain from corner to
+// corner and bilinearly interpolated between them. A time-varying field holds a
+// sequence of frames, each shown for frameInterval and blended into the next, looping.
+//
+// The nodes are stored in square tiles of tileNodes² nodes, each frame tile after tile,
+// so the four nodes of a sample nearly always share a tile and particles sorted by
+// location walk the grid tile by tile. Sampling runs the bilinear blend on both
+// components at once with SSE2 where it is available.
+class FlowField {
+public:
+    bool empty() const { return frameCount == 0; }
+
+    // Replaces the field. velocities holds (u, v) for every node, row after row, frame
+    // after frame. Throws std::invalid_argument on an impossible layout.
+    void assign(size_t columns, size_t rows, size_t frames, double frameInterval, double width, double height,
+        const std::vector<float>& velocities);
+
+    // Flow velocity at each of count consecutive particles at the given time
+    void sample(const Particle* particles, size_t count, double time, double* u, double* v) const;
+
+    // Fastest flow anywhere; interpolated samples never exceed it
+    double maxSpeed() const { return fastest; }
+
+    static const size_t tileNodes = 8;   // Nodes per side of a storage tile
+
+private:
+    size_t nodeIndex(size_t column, size_t row) const;
+
+    size_t columns = 0, rows = 0, frameCount = 0;
+    size_t tileColumns = 0;
+    size_t frameSize = 0;                // Nodes per frame, padded out to whole tiles
+    double interval = 0;
+    double nodesPerX = 0, nodesPerY = 0; // Inverse node spacing
+    double fastest = 0;
+    std::vector<float> nodes;            // (u, v) of every node
+};
+
+// Builds a field for a width x height domain. spec names a preset, which peaks at
+// speed, or else a file. Presets:
+//   vortex  one swirl around the domain center
+//   cells   a grid of counter-rotating cells (Taylor–Green)
+//   gyre    two gyres whose shared edge sways back and forth over gyrePeriod
+// Files are text: "columns rows [frames interval]" and then u v for every node, row
+// after row and frame after frame; # starts a comment.
+// Throws std::invalid_argument if the file cannot be read or is malformed.
+FlowField makeFlowField(const std::string& spec, double width, double height, double speed);
+
+const double gyrePeriod = 1000;          // Simulated time of one sway of the gyre preset
@@ -0,0 +1,298 @@
+#include "Fluid.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPH_SSE2 1
+#endif
+
+namespace {
+
+// One particle's neighbors, gathered into contiguous arrays for the kernel loops
+struct Neighborhood {
+    std::vector<double> dx, dy;         // Neighbor position minus the particle's
+    std::vector<double> dvx, dvy;       // Neighbor velocity minus the particle's
+    std::vector<double> pressureTerm;   // (p_i + p_j) / (2 rho_j)
+    std::vector<double> inverseDensity; // 1 / rho_j
+    size_t count = 0;
+
+    void resize(size_t n) {
+        count = n;
+        if (dx.size() < n) {
+            dx.resize(n);
+            dy.resize(n);
+            dvx.resize(n);
+            dvy.resize(n);
+            pressureTerm.resize(n);
+            inverseDensity.resize(n);
+        }
+    }
+};
+
+// Sum of (h² - r²)³ over the neighbors closer than h, the unnormalized poly6 kernel
+double densitySum(const Neighborhood& near, double h2) {
+    size_t k = 0;
+    double sum = 0;
+#ifdef SPH_SSE2
+    __m128d total = _mm_setzero_pd();
+    __m128d limit = _mm_set1_pd(h2);
+    for (; k + 2 <= near.count; k += 2) {
+        __m128d x = _mm_loadu_pd(&near.dx[k]);
+        __m128d y = _mm_loadu_pd(&near.dy[k]);
+        __m128d q = _mm_max_pd(_mm_sub_pd(limit, _mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))), _mm_setzero_pd());
+        total = _mm_add_pd(total, _mm_mul_pd(_mm_mul_pd(q, q), q));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, total);
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; k < near.count; ++k) {
+        double q = std::max(h2 - near.dx[k] * near.dx[k] - near.dy[k] * near.dy[k], 0.0);
+        sum += q * q * q;
+    }
+    return sum;
+}
+
+// Unnormalized pressure and viscosity sums: sum of pressureTerm (h - r)² / r times the
+// offset, and of inverseDensity (h - r) times the velocity difference
+void forceSums(const Neighborhood& near, double h, double& px, double& py, double& vx, double& vy) {
+    size_t k = 0;
+    px = py = vx = vy = 0;
+#ifdef SPH_SSE2
+    __m128d sumPx = _mm_setzero_pd(), sumPy = _mm_setzero_pd(), sumVx = _mm_setzero_pd(), sumVy = _mm_setzero_pd();
+    __m128d length = _mm_set1_pd(h);
+    __m128d tiny = _mm_set1_pd(1e-12);
+    for (; k + 2 <= near.count; k += 2) {
+        __m128d x = _mm_loadu_pd(&near.dx[k]);
+        __m128d y = _mm_loadu_pd(&near.dy[k]);
+        __m128d r = _mm_max_pd(_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y))), tiny);
+        __m128d q = _mm_max_pd(_mm_sub_pd(length, r), _mm_setzero_pd());
+        __m128d pressure = _mm_div_pd(_mm_mul_pd(_mm_loadu_pd(&near.pressureTerm[k]), _mm_mul_pd(q, q)), r);
+        __m128d viscosity = _mm_mul_pd(_mm_loadu_pd(&near.inverseDensity[k]), q);
+        sumPx = _mm_add_pd(sumPx, _mm_mul_pd(pressure, x));
+        sumPy = _mm_add_pd(sumPy, _mm_mul_pd(pressure, y));
+        sumVx = _mm_add_pd(sumVx, _mm_mul_pd(viscosity, _mm_loadu_pd(&near.dvx[k])));
+        sumVy = _mm_add_pd(sumVy, _mm_mul_pd(viscosity, _mm_loadu_pd(&near.dvy[k])));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, sumPx);
+    px = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, sumPy);
+    py = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, sumVx);
+    vx = lanes[0] + lanes[1];
+    _mm_storeu_pd(lanes, sumVy);
+    vy = lanes[0] + lanes[1];
+#endif
+    for (; k < near.count; ++k) {
+        double r = std::max(std::sqrt(near.dx[k] * near.dx[k] + near.dy[k] * near.dy[k]), 1e-12);
+        double q = std::max(h - r, 0.0);
+        double pressure = near.pressureTerm[k] * q * q / r;
+        double viscosity = near.inverseDensity[k] * q;
+        px += pressure * near.dx[k];
+        py += pressure * near.dy[k];
+        vx += viscosity * near.dvx[k];
+        vy += viscosity * near.dvy[k];
+    }
+}
+
+}
+
+constexpr double SphFluid::skinFraction;
+
+bool SphFluid::listsStale(Simulation& simulation) {
+    if (builtLength != simulation.fluidLength || builtPopulation != simulation.populationVersion) {
+        return true;
+    }
+
+    // Neighbors can only come into range once some particle has covered half the skin
+    const std::vector<Particle>& particles = simulation.particles;
+    double halfSkin = skinFraction * builtLength / 2;
+    size_t chunkCount = (particles.size() + Simulation::parallelChunkSize - 1) / Simulation::parallelChunkSize;
+    std::vector<char> moved(chunkCount, 0);
+    simulation.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; ++slot) {
+            uint32_t id = simulation.ids[slot];
+            double dx = particles[slot].x - referenceX[id], dy = particles[slot].y - referenceY[id];
+            if (particles[slot].alive() && dx * dx + dy * dy > halfSkin * halfSkin) {
+                moved[begin / Simulation::parallelChunkSize] = 1;
+                return;
+            }
+        }
+    });
+    return std::find(moved.begin(), moved.end(), 1) != moved.end();
+}
+
+void SphFluid::buildLists(Simulation& simulation) {
+    const std::vector<Particle>& particles = simulation.particles;
+    size_t count = particles.size();
+    size_t chunkSize = Simulation::parallelChunkSize;
+    size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    double cutoff = simulation.fluidLength * (1 + skinFraction);
+    size_t columns = std::max<size_t>(1, static_cast<size_t>(std::ceil(simulation.simWidth / cutoff)));
+    size_t rows = std::max<size_t>(1, static_cast<size_t>(std::ceil(simulation.simHeight / cutoff)));
+    size_t cellCount = columns * rows;
+    auto cellColumn = [&](double x) { return x <= 0 ? 0 : std::min(columns - 1, static_cast<size_t>(x / cutoff)); };
+    auto cellRow = [&](double y) { return y <= 0 ? 0 : std::min(rows - 1, static_cast<size_t>(y / cutoff)); };
+
+    // Counting sort of the live slots by cell
+    cellKeys.resize(count);
+    offsets.assign(chunkCount * cellCount, 0);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* histogram = &offsets[begin / chunkSize * cellCount];
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (!particles[slot].alive()) {
+                cellKeys[slot] = UINT32_MAX;
+                continue;
+            }
+            cellKeys[slot] = static_cast<uint32_t>(cellRow(particles[slot].y) * columns + cellColumn(particles[slot].x));
+            ++histogram[cellKeys[slot]];
+        }
+    });
+    cellStart.assign(cellCount + 1, 0);
+    size_t running = 0;
+    for (size_t cell = 0; cell < cellCount; ++cell) {
+        cellStart[cell] = running;
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t n = offsets[chunk * cellCount + cell];
+            offsets[chunk * cellCount + cell] = running;
+            running += n;
+        }
+    }
+    cellStart[cellCount] = running;
+    cellSlots.resize(running);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* next = &offsets[begin / chunkSize * cellCount];
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (cellKeys[slot] != UINT32_MAX) {
+                cellSlots[next[cellKeys[slot]]++] = static_cast<uint32_t>(slot);
+            }
+        }
+    });
+
+    // Each particle's neighbors are counted in one pass and written in a second, in cell order
+    size_t idCount = simulation.idCount();
+    auto visit = [&](size_t slot, auto&& found) {
+        const Particle& particle = particles[slot];
+        size_t column = cellColumn(particle.x), row = cellRow(particle.y);
+        for (size_t r = row > 0 ? row - 1 : 0; r <= std::min(rows - 1, row + 1); ++r) {
+            for (size_t c = column > 0 ? column - 1 : 0; c <= std::min(columns - 1, column + 1); ++c) {
+                size_t cell = r * columns + c;
+                for (size_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+                    uint32_t other = cellSlots[k];
+                    double dx = particles[other].x - particle.x, dy = particles[other].y - particle.y;
+                    if (other != slot && dx * dx + dy * dy < cutoff * cutoff) {
+                        found(other);
+                    }
+                }
+            }
+        }
+    };
+    listBegin.assign(idCount + 1, 0);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (particles[slot].alive()) {
+                size_t n = 0;
+                visit(slot, [&](uint32_t) { ++n; });
+                listBegin[simulation.ids[slot] + 1] = n;
+            }
+        }
+    });
+    for (size_t id = 0; id < idCount; ++id) {
+        listBegin[id + 1] += listBegin[id];
+    }
+    neighbors.resize(listBegin[idCount]);
+    referenceX.assign(idCount, 0);
+    referenceY.assign(idCount, 0);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (particles[slot].alive()) {
+                uint32_t id = simulation.ids[slot];
+                size_t out = listBegin[id];
+                visit(slot, [&](uint32_t other) { neighbors[out++] = simulation.ids[other]; });
+                referenceX[id] = particles[slot].x;
+                referenceY[id] = particles[slot].y;
+            }
+        }
+    });
+
+    builtLength = simulation.fluidLength;
+    builtPopulation = simulation.populationVersion;
+    ++listBuilds;
+}
+
+void SphFluid::step(Simulation& simulation) {
+    if (listsStale(simulation)) {
+        buildLists(simulation);
+    }
+
+    std::vector<Particle>& particles = simulation.particles;
+    size_t idCount = simulation.idCount();
+    double h = simulation.fluidLength;
+    double h2 = h * h;
+    double density2d = 4 / (M_PI * std::pow(h, 8));   // poly6 in two dimensions
+    double gradient2d = 30 / (M_PI * std::pow(h, 5)); // Spiky gradient
+    double laplacian2d = 40 / (M_PI * std::pow(h, 5)); // Viscosity Laplacian
+    density.assign(idCount, 0);
+    pressure.assign(idCount, 0);
+
+    // Density, counting the particle itself, and pressure from the equation of state.
+    // Pressure is clamped at 0 so sparse regions do not pull together.
+    simulation.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+        Neighborhood near;
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (!particles[slot].alive()) {
+                continue;
+            }
+            uint32_t id = simulation.ids[slot];
+            near.resize(listBegin[id + 1] - listBegin[id]);
+            for (size_t k = 0; k < near.count; ++k) {
+                const Particle& other = particles[simulation.slotOf(neighbors[listBegin[id] + k])];
+                near.dx[k] = other.x - particles[slot].x;
+                near.dy[k] = other.y - particles[slot].y;
+            }
+            density[id] = density2d * (h2 * h2 * h2 + densitySum(near, h2));
+            pressure[id] = std::max(simulation.stiffness * (density[id] - simulation.restDensity), 0.0);
+        }
+    });
+
+    // Pressure pushes apart and viscosity evens out the velocities
+    double dt = simulation.deltaTime;
+    std::vector<double> ax(particles.size(), 0), ay(particles.size(), 0);
+    simulation.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+        Neighborhood near;
+        for (size_t slot = begin; slot < end; ++slot) {
+            if (!particles[slot].alive()) {
+                continue;
+            }
+            const Particle& particle = particles[slot];
+            uint32_t id = simulation.ids[slot];
+            near.resize(listBegin[id + 1] - listBegin[id]);
+            for (size_t k = 0; k < near.count; ++k) {
+                uint32_t otherId = neighbors[listBegin[id] + k];
+                const Particle& other = particles[simulation.slotOf(otherId)];
+                near.dx[k] = other.x - particle.x;
+                near.dy[k] = other.y - particle.y;
+                near.dvx[k] = other.vx - particle.vx;
+                near.dvy[k] = other.vy - particle.vy;
+                near.pressureTerm[k] = (pressure[id] + pressure[otherId]) / (2 * density[otherId]);
+                near.inverseDensity[k] = 1 / density[otherId];
+            }
+            double px, py, vx, vy;
+            forceSums(near, h, px, py, vx, vy);
+            ax[slot] = (-gradient2d * px + simulation.viscosity * laplacian2d * vx) / density[id];
+            ay[slot] = (-gradient2d * py + simulation.viscosity * laplacian2d * vy) / density[id];
+        }
+    });
+
+    // Velocities change only once every acceleration is known, since the viscosity reads them
+    simulation.parallelFor(particles.size(), [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; ++slot) {
+            particles[slot].vx += ax[slot] * dt;
+            particles[slot].vy += ay[slot] * dt;
+        }
+    });
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Smoothed-particle hydrodynamics over the live particles, each of unit mass. Every
+// step each particle's density is summed from its neighbors within the smoothing
+// length, its pressure follows from how far that is above the rest density, and the
+// pressure and viscosity forces are applied to its velocity. The particles then move
+// through the normal update, so walls and the domain edges contain the fluid.
+//
+// Neighbors come from Verlet lists: everything within the smoothing length plus a
+// skin, found through a grid of cells that size. The lists are kept by particle handle
+// so sorting and binning do not invalidate them, and are only rebuilt once some
+// particle has moved more than half the skin or particles were added or removed.
+//
+// The kernel sums run two neighbors at a time with SSE2 where it is available.
+class SphFluid {
+public:
+    // Computes every live particle's density and pressure and kicks its velocity by the
+    // resulting acceleration, in parallel on the simulation's workers
+    void step(Simulation& simulation);
+
+    // State from the last step by particle handle, 0 for handles without a live particle
+    std::vector<double> density, pressure;
+
+    uint64_t listBuilds = 0;              // Times the neighbor lists were rebuilt
+
+    static constexpr double skinFraction = 0.5; // Skin as a fraction of the smoothing length
+
+private:
+    bool listsStale(Simulation& simulation);
+    void buildLists(Simulation& simulation);
+
+    double builtLength = -1;              // Smoothing length the lists were built for
+    uint64_t builtPopulation = UINT64_MAX; // Simulation::populationVersion when built
+    std::vector<double> referenceX, referenceY; // Position of each handle when built
+    std::vector<size_t> listBegin;        // Handle h's neighbors are neighbors[listBegin[h], listBegin[h + 1])
+    std::vector<uint32_t> neighbors;      // Neighbor handles
+
+    // Cell lists, only used while building
+    std::vector<uint32_t> cellKeys, cellSlots;
+    std::vector<size_t> cellStart, offsets;
+};
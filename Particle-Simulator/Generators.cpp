@@ -0,0 +1,196 @@
+#include "Generators.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Grows the particle array by n and returns the first new slot. The slots are left unset
+// (see the Particle default constructor), so the caller's parallel fill is the only pass
+// over them; callers reserve up front to keep this from reallocating.
+Particle* appendParticles(Simulation& simulation, int n) {
+    std::vector<Particle>& particles = simulation.particles;
+    size_t first = particles.size();
+    particles.resize(first + n);
+    return particles.data() + first;
+}
+
+// Same velocity components as the Particle constructor, for a direction computed once
+void setParticle(Particle& particle, double x, double y, double velocity, double cosAngle, double sinAngle) {
+    particle.x = x;
+    particle.y = y;
+    particle.vx = velocity * cosAngle;
+    particle.vy = -velocity * sinAngle;
+    particle.radius = particleRadius;
+}
+
+}
+
+void addLineBatch(Simulation& simulation, const LineBatch& batch) {
+    int n = batch.count;
+    float xStep = (batch.x2 - batch.x1) / std::max(1, n - 1); // Calculate the x step between particles
+    float yStep = (batch.y2 - batch.y1) / std::max(1, n - 1); // Calculate the y step between particles
+
+    // Every particle moves in the same direction, so the trig is done once for the batch
+    double rad = batch.angle * (M_PI / 180.0);
+    double cosAngle = cos(rad), sinAngle = sin(rad);
+
+    Particle* out = appendParticles(simulation, n);
+    simulation.parallelFor(n, [&](size_t begin, size_t end) {
+        for (int i = static_cast<int>(begin); i < static_cast<int>(end); ++i) {
+            float xPos = batch.x1 + i * xStep; // Calculate the x position for each particle
+            float yPos = batch.y1 + i * yStep; // Calculate the y position for each particle
+
+            setParticle(out[i], xPos, yPos, batch.velocity, cosAngle, sinAngle);
+        }
+    });
+}
+
+void addAngleBatch(Simulation& simulation, const AngleBatch& batch) {
+    int n = batch.count;
+    float startX = batch.atCenter ? static_cast<float>(simulation.simWidth / 2) : batch.x;
+    float startY = batch.atCenter ? static_cast<float>(simulation.simHeight / 2) : batch.y;
+
+    float angularStep = (n > 1) ? (batch.endAngle - batch.startAngle) / (n - 1) : 0;
+
+    // A full circle would place the first and last particle on top of each other
+    if (batch.startAngle == 0.0f && batch.endAngle == 360.0f) {
+        angularStep = (n > 1) ? (batch.endAngle - batch.startAngle) / (n) : 0;
+    }
+
+    Particle* out = appendParticles(simulation, n);
+    simulation.parallelFor(n, [&](size_t begin, size_t end) {
+        for (int i = static_cast<int>(begin); i < static_cast<int>(end); ++i) {
+            float angle = batch.startAngle + i * angularStep; // Calculate the angle for each particle
+            double rad = angle * (M_PI / 180.0);
+
+            setParticle(out[i], startX, startY, batch.velocity, cos(rad), sin(rad));
+        }
+    });
+}
+
+void addVelocityBatch(Simulation& simulation, const VelocityBatch& batch) {
+    int n = batch.count;
+    float velocityStep = (batch.endVelocity - batch.startVelocity) / std::max(1, n - 1); // Calculate the velocity step between particles
+
+    double rad = batch.angle * (M_PI / 180.0);
+    double cosAngle = cos(rad), sinAngle = sin(rad);
+
+    Particle* out = appendParticles(simulation, n);
+    simulation.parallelFor(n, [&](size_t begin, size_t end) {
+        for (int i = static_cast<int>(begin); i < static_cast<int>(end); ++i) {
+            float velocity = batch.startVelocity + i * velocityStep; // Calculate the velocity for each particle
+
+            setParticle(out[i], batch.x, batch.y, velocity, cosAngle, sinAngle);
+        }
+    });
+}
+
+void addChain(Simulation& simulation, const ChainBatch& batch) {
+    int n = batch.count;
+    if (n <= 0) {
+        return;
+    }
+    float xStep = (batch.x2 - batch.x1) / std::max(1, n - 1);
+    float yStep = (batch.y2 - batch.y1) / std::max(1, n - 1);
+    float spacing = std::sqrt(xStep * xStep + yStep * yStep);
+
+    size_t first = simulation.particles.size();
+    Particle* out = appendParticles(simulation, n);
+    for (int i = 0; i < n; ++i) {
+        setParticle(out[i], batch.x1 + i * xStep, batch.y1 + i * yStep, 0, 1, 0);
+    }
+    simulation.assignIds();
+    for (int i = 0; i + 1 < n; ++i) {
+        simulation.constraints.emplace_back(simulation.ids[first + i], simulation.ids[first + i + 1], spacing, batch.stiffness);
+    }
+}
+
+void addCloth(Simulation& simulation, const ClothBatch& batch) {
+    int columns = batch.columns, rows = batch.rows;
+    if (columns <= 0 || rows <= 0) {
+        return;
+    }
+    size_t first = simulation.particles.size();
+    Particle* out = appendParticles(simulation, columns * rows);
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            setParticle(out[row * columns + column], batch.x + column * batch.spacing, batch.y + row * batch.spacing, 0, 1, 0);
+        }
+    }
+    simulation.assignIds();
+
+    auto id = [&](int column, int row) { return simulation.ids[first + row * columns + column]; };
+    float diagonal = batch.spacing * static_cast<float>(std::sqrt(2.0));
+    for (int row = 0; row < rows; ++row) {
+        for (int column = 0; column < columns; ++column) {
+            if (column + 1 < columns) {
+                simulation.constraints.emplace_back(id(column, row), id(column + 1, row), batch.spacing, batch.stiffness);
+            }
+            if (row + 1 < rows) {
+                simulation.constraints.emplace_back(id(column, row), id(column, row + 1), batch.spacing, batch.stiffness);
+            }
+            if (column + 1 < columns && row + 1 < rows) {
+                simulation.constraints.emplace_back(id(column, row), id(column + 1, row + 1), diagonal, batch.stiffness);
+                simulation.constraints.emplace_back(id(column + 1, row), id(column, row + 1), diagonal, batch.stiffness);
+            }
+        }
+    }
+}
+
+void emitParticles(Simulation& simulation, Emitter& emitter) {
+    int n = emitter.pending();
+    if (n <= 0) {
+        return;
+    }
+    emitter.emitted += n;
+
+    if (emitter.lifetime > 0) {
+        // Earlier particles without an expiry live forever
+        std::vector<double>& expiry = simulation.expiry;
+        expiry.resize(simulation.particles.size(), std::numeric_limits<double>::infinity());
+        expiry.resize(expiry.size() + n, simulation.time + emitter.lifetime);
+    }
+
+    if (emitter.shape == Emitter::Point) {
+        AngleBatch batch;
+        batch.count = n;
+        batch.startAngle = emitter.startAngle;
+        batch.endAngle = emitter.endAngle;
+        batch.atCenter = false;
+        batch.x = emitter.x1;
+        batch.y = emitter.y1;
+        batch.velocity = emitter.velocity;
+        addAngleBatch(simulation, batch);
+    }
+    else if (emitter.shape == Emitter::Line) {
+        LineBatch batch;
+        batch.count = n;
+        batch.x1 = emitter.x1;
+        batch.y1 = emitter.y1;
+        batch.x2 = emitter.x2;
+        batch.y2 = emitter.y2;
+        batch.velocity = emitter.velocity;
+        batch.angle = emitter.angle;
+        addLineBatch(simulation, batch);
+    }
+    else {
+        float angularStep = (n > 1) ? (emitter.endAngle - emitter.startAngle) / (n - 1) : 0;
+        if (emitter.startAngle == 0.0f && emitter.endAngle == 360.0f) {
+            angularStep = (n > 1) ? 360.0f / n : 0;
+        }
+
+        Particle* out = appendParticles(simulation, n);
+        simulation.parallelFor(n, [&](size_t begin, size_t end) {
+            for (int i = static_cast<int>(begin); i < static_cast<int>(end); ++i) {
+                double rad = (emitter.startAngle + i * angularStep) * (M_PI / 180.0);
+                double cosAngle = cos(rad), sinAngle = sin(rad);
+                // y grows downwards, matching the direction convention of the velocity
+                setParticle(out[i], emitter.x1 + emitter.radius * cosAngle, emitter.y1 - emitter.radius * sinAngle,
+                    emitter.velocity, cosAngle, sinAngle);
+            }
+        });
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Batch definitions matching the three particle input forms. Defaults are the
+// constants the forms have always used.
+
+// Form 1: particles spread evenly along the line from (x1, y1) to (x2, y2)
+struct LineBatch {
+    int count = 0;
+    float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    float velocity = 20.0f;
+    float angle = 45.0f;
+};
+
+// Form 2: particles fanned evenly between two angles from a single point
+struct AngleBatch {
+    int count = 0;
+    float startAngle = 0, endAngle = 0;
+    bool atCenter = true; // Start from the center of the domain instead of (x, y)
+    float x = 0, y = 0;
+    float velocity = 20.0f;
+};
+
+// Form 3: particles from a single point with velocities spread between two speeds
+struct VelocityBatch {
+    int count = 0;
+    float startVelocity = 0, endVelocity = 0;
+    float x = 400, y = 300;
+    float angle = 45.0f;
+};
+
+// Continuous source that adds up to rate particles at the start of every step until
+// total have been emitted. Each step's particles are spread like a batch:
+//   Point: from (x1, y1), directions spread from startAngle to endAngle
+//   Line:  along (x1, y1)-(x2, y2), all moving at angle
+//   Arc:   on the arc of the given radius around (x1, y1) from startAngle to endAngle,
+//          each moving straight outward
+// With a lifetime, every particle despawns that much simulated time after it is emitted.
+struct Emitter {
+    enum Shape : int32_t { Point, Line, Arc };
+    Shape shape = Point;
+    int rate = 1;                      // Particles per step
+    uint64_t total = 0;                // Particles to emit in all, 0 for no limit
+    uint64_t emitted = 0;              // Particles emitted so far
+    float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    float radius = 0;
+    float startAngle = 0, endAngle = 0;
+    float angle = 45.0f;
+    float velocity = 20.0f;
+    float lifetime = 0;                // Simulated time each particle lives, 0 forever
+
+    bool exhausted() const { return total != 0 && emitted >= total; }
+    // Particles the next step will emit
+    int pending() const { return total == 0 ? rate : static_cast<int>(std::min<uint64_t>(rate, total - std::min(total, emitted))); }
+};
+
+// Particles at rest spread evenly from (x1, y1) to (x2, y2), each joined to the next by
+// a constraint of their initial spacing
+struct ChainBatch {
+    int count = 0;
+    float x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+    float stiffness = 1;
+};
+
+// A grid of particles at rest with its top left corner at (x, y), joined to their
+// horizontal and vertical neighbors and across the diagonals of each cell
+struct ClothBatch {
+    int columns = 0, rows = 0;
+    float x = 0, y = 0;
+    float spacing = 20;
+    float stiffness = 1;
+};
+
+const double particleRadius = 5; // Radius given to every generated particle
+
+// Append a batch to the simulation's particles. Storage is grown once and the
+// particles are filled in parallel on the simulation's worker threads, so call these
+// between steps.
+void addLineBatch(Simulation& simulation, const LineBatch& batch);
+void addAngleBatch(Simulation& simulation, const AngleBatch& batch);
+void addVelocityBatch(Simulation& simulation, const VelocityBatch& batch);
+
+// Append the particles and their constraints. The particles get their handles
+// immediately so the constraints can refer to them.
+void addChain(Simulation& simulation, const ChainBatch& batch);
+void addCloth(Simulation& simulation, const ClothBatch& batch);
+
+// Appends the emitter's particles for one step and advances its count
+void emitParticles(Simulation& simulation, Emitter& emitter);
@@ -0,0 +1,294 @@
+#include "Gravity.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const uint32_t gridSide = 1u << BarnesHutTree::topLevels;
+const uint32_t gridCells = gridSide * gridSide;
+
+// Index of level l's first cell in the cells array
+size_t levelStart(int level) {
+    return ((size_t(1) << (2 * level)) - 1) / 3;
+}
+
+// Morton index of a grid cell: x in the even bits, y in the odd ones
+uint32_t interleave(uint32_t x, uint32_t y) {
+    uint32_t key = 0;
+    for (int bit = 0; bit < BarnesHutTree::topLevels; ++bit) {
+        key |= ((x >> bit) & 1u) << (2 * bit);
+        key |= ((y >> bit) & 1u) << (2 * bit + 1);
+    }
+    return key;
+}
+
+uint32_t gridCoordinate(double offset, double cellSize) {
+    double cell = std::floor(offset / cellSize);
+    return cell <= 0 ? 0 : std::min(gridSide - 1, static_cast<uint32_t>(cell));
+}
+
+}
+
+const int BarnesHutTree::topLevels;
+const uint32_t BarnesHutTree::leafSize;
+const int BarnesHutTree::maxDepth;
+
+void BarnesHutTree::build(Simulation& simulation) {
+    const std::vector<Particle>& particles = simulation.particles;
+    size_t count = particles.size();
+    size_t chunkSize = Simulation::parallelChunkSize;
+    size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+
+    // Bounding square of the live particles
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> chunkBounds(chunkCount * 4);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        double minX = infinity, minY = infinity, maxX = -infinity, maxY = -infinity;
+        for (size_t i = begin; i < end; ++i) {
+            if (particles[i].alive()) {
+                minX = std::min(minX, particles[i].x);
+                minY = std::min(minY, particles[i].y);
+                maxX = std::max(maxX, particles[i].x);
+                maxY = std::max(maxY, particles[i].y);
+            }
+        }
+        double* bounds = &chunkBounds[begin / chunkSize * 4];
+        bounds[0] = minX;
+        bounds[1] = minY;
+        bounds[2] = maxX;
+        bounds[3] = maxY;
+    });
+    double minX = infinity, minY = infinity, maxX = -infinity, maxY = -infinity;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        minX = std::min(minX, chunkBounds[chunk * 4]);
+        minY = std::min(minY, chunkBounds[chunk * 4 + 1]);
+        maxX = std::max(maxX, chunkBounds[chunk * 4 + 2]);
+        maxY = std::max(maxY, chunkBounds[chunk * 4 + 3]);
+    }
+    order.clear();
+    cells.assign(levelStart(topLevels + 1), Node());
+    subtrees.resize(gridCells);
+    if (minX > maxX) {
+        return; // No live particles
+    }
+    double rootSize = std::max(std::max(maxX - minX, maxY - minY), 1e-9);
+    double cellSize = rootSize / gridSide;
+
+    // Counting sort of the live particles by grid cell, like one radix pass
+    keys.resize(count);
+    offsets.assign(chunkCount * gridCells, 0);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* histogram = &offsets[begin / chunkSize * gridCells];
+        for (size_t i = begin; i < end; ++i) {
+            if (!particles[i].alive()) {
+                keys[i] = gridCells;
+                continue;
+            }
+            uint32_t key = interleave(gridCoordinate(particles[i].x - minX, cellSize), gridCoordinate(particles[i].y - minY, cellSize));
+            keys[i] = key;
+            ++histogram[key];
+        }
+    });
+    cellStart.assign(gridCells + 1, 0);
+    size_t running = 0;
+    for (uint32_t cell = 0; cell < gridCells; ++cell) {
+        cellStart[cell] = static_cast<uint32_t>(running);
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t n = offsets[chunk * gridCells + cell];
+            offsets[chunk * gridCells + cell] = running;
+            running += n;
+        }
+    }
+    cellStart[gridCells] = static_cast<uint32_t>(running);
+    order.resize(running);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* next = &offsets[begin / chunkSize * gridCells];
+        for (size_t i = begin; i < end; ++i) {
+            if (keys[i] < gridCells) {
+                order[next[keys[i]]++] = static_cast<uint32_t>(i);
+            }
+        }
+    });
+
+    // Each cell's subtree is built by the chunk its first particle falls in
+    for (auto& nodes : subtrees) {
+        nodes.clear();
+    }
+    simulation.parallelFor(order.size(), [&](size_t begin, size_t end) {
+        uint32_t cell = static_cast<uint32_t>(std::lower_bound(cellStart.begin(), cellStart.end() - 1, begin) - cellStart.begin());
+        for (; cell < gridCells && cellStart[cell] < end; ++cell) {
+            uint32_t x = 0, y = 0;
+            for (int bit = 0; bit < topLevels; ++bit) {
+                x |= ((cell >> (2 * bit)) & 1u) << bit;
+                y |= ((cell >> (2 * bit + 1)) & 1u) << bit;
+            }
+            std::vector<Node>& nodes = subtrees[cell];
+            nodes.resize(1);
+            buildNode(particles, nodes, 0, minX + x * cellSize, minY + y * cellSize, cellSize, cellStart[cell], cellStart[cell + 1], topLevels);
+        }
+    });
+
+    // The grid is summed from its finest level up
+    for (uint32_t cell = 0; cell < gridCells; ++cell) {
+        Node& node = cells[levelStart(topLevels) + cell];
+        if (!subtrees[cell].empty()) {
+            node = subtrees[cell][0];
+        }
+    }
+    for (int level = topLevels - 1; level >= 0; --level) {
+        for (size_t cell = 0; cell < (size_t(1) << (2 * level)); ++cell) {
+            Node& node = cells[levelStart(level) + cell];
+            const Node* children = &cells[levelStart(level + 1) + cell * 4];
+            for (int child = 0; child < 4; ++child) {
+                node.mass += children[child].mass;
+                node.x += children[child].x * children[child].mass;
+                node.y += children[child].y * children[child].mass;
+            }
+            if (node.mass > 0) {
+                node.x /= node.mass;
+                node.y /= node.mass;
+            }
+        }
+    }
+    // Boxes of the grid cells, which the opening test needs even when they are empty
+    for (int level = 0; level <= topLevels; ++level) {
+        double size = rootSize / (1u << level);
+        for (uint32_t cell = 0; cell < (1u << (2 * level)); ++cell) {
+            uint32_t x = 0, y = 0;
+            for (int bit = 0; bit < level; ++bit) {
+                x |= ((cell >> (2 * bit)) & 1u) << bit;
+                y |= ((cell >> (2 * bit + 1)) & 1u) << bit;
+            }
+            Node& node = cells[levelStart(level) + cell];
+            node.minX = minX + x * size;
+            node.minY = minY + y * size;
+            node.size = size;
+            node.firstChild = level < topLevels ? static_cast<int32_t>(levelStart(level + 1) + cell * 4) : -1;
+        }
+    }
+}
+
+void BarnesHutTree::buildNode(const std::vector<Particle>& particles, std::vector<Node>& nodes, size_t index,
+    double minX, double minY, double size, uint32_t begin, uint32_t end, int depth) {
+    Node node;
+    node.minX = minX;
+    node.minY = minY;
+    node.size = size;
+    node.begin = begin;
+    node.end = end;
+    if (end - begin <= leafSize || depth >= maxDepth) {
+        for (uint32_t i = begin; i < end; ++i) {
+            node.x += particles[order[i]].x;
+            node.y += particles[order[i]].y;
+        }
+        node.mass = end - begin;
+        if (node.mass > 0) {
+            node.x /= node.mass;
+            node.y /= node.mass;
+        }
+        nodes[index] = node;
+        return;
+    }
+
+    // Quadrants in Morton order: bit 0 set right of the middle, bit 1 set below it
+    double half = size / 2;
+    double midX = minX + half, midY = minY + half;
+    uint32_t* first = order.data() + begin;
+    uint32_t* last = order.data() + end;
+    uint32_t* lower = std::partition(first, last, [&](uint32_t i) { return particles[i].y < midY; });
+    uint32_t* upperRight = std::partition(first, lower, [&](uint32_t i) { return particles[i].x < midX; });
+    uint32_t* lowerRight = std::partition(lower, last, [&](uint32_t i) { return particles[i].x < midX; });
+    uint32_t bounds[5] = { begin, static_cast<uint32_t>(upperRight - order.data()), static_cast<uint32_t>(lower - order.data()),
+        static_cast<uint32_t>(lowerRight - order.data()), end };
+
+    node.firstChild = static_cast<int32_t>(nodes.size());
+    nodes.resize(nodes.size() + 4); // May reallocate, so children are only reached by index
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        buildNode(particles, nodes, node.firstChild + quadrant, minX + (quadrant & 1) * half, minY + (quadrant >> 1) * half, half,
+            bounds[quadrant], bounds[quadrant + 1], depth + 1);
+    }
+    for (int quadrant = 0; quadrant < 4; ++quadrant) {
+        const Node& child = nodes[node.firstChild + quadrant];
+        node.mass += child.mass;
+        node.x += child.x * child.mass;
+        node.y += child.y * child.mass;
+    }
+    node.x /= node.mass;
+    node.y /= node.mass;
+    nodes[index] = node;
+}
+
+bool BarnesHutTree::approximate(const Node& node, Probe& probe) const {
+    // A node holding the particle itself is always opened, so no particle attracts itself
+    bool inside = probe.x >= node.minX && probe.x <= node.minX + node.size && probe.y >= node.minY && probe.y <= node.minY + node.size;
+    double dx = node.x - probe.x, dy = node.y - probe.y;
+    double distanceSquared = dx * dx + dy * dy;
+    if (inside || node.size * node.size >= probe.openingAngleSquared * distanceSquared) {
+        return false;
+    }
+    double r2 = distanceSquared + probe.softeningSquared;
+    double scale = node.mass / (r2 * std::sqrt(r2));
+    probe.ax += dx * scale;
+    probe.ay += dy * scale;
+    return true;
+}
+
+void BarnesHutTree::visitSubtree(const std::vector<Node>& nodes, Probe& probe) const {
+    int32_t stack[4 * maxDepth + 4];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (node.mass == 0 || approximate(node, probe)) {
+            continue;
+        }
+        if (node.firstChild >= 0) {
+            for (int quadrant = 3; quadrant >= 0; --quadrant) {
+                stack[top++] = node.firstChild + quadrant;
+            }
+            continue;
+        }
+        const std::vector<Particle>& particles = *probe.particles;
+        for (uint32_t i = node.begin; i < node.end; ++i) {
+            if (order[i] == probe.self) {
+                continue;
+            }
+            double dx = particles[order[i]].x - probe.x, dy = particles[order[i]].y - probe.y;
+            double r2 = dx * dx + dy * dy + probe.softeningSquared;
+            double scale = 1 / (r2 * std::sqrt(r2));
+            probe.ax += dx * scale;
+            probe.ay += dy * scale;
+        }
+    }
+}
+
+void BarnesHutTree::acceleration(const std::vector<Particle>& particles, size_t self, double openingAngle, double softening,
+    double& ax, double& ay) const {
+    Probe probe = { &particles, self, particles[self].x, particles[self].y, openingAngle * openingAngle, softening * softening, 0, 0 };
+    if (!order.empty()) {
+        // The grid is walked like the top of the tree; its finest cells lead into the subtrees
+        uint32_t stack[4 * topLevels + 4];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            uint32_t index = stack[--top];
+            const Node& node = cells[index];
+            if (node.mass == 0 || approximate(node, probe)) {
+                continue;
+            }
+            if (node.firstChild >= 0) {
+                for (int quadrant = 3; quadrant >= 0; --quadrant) {
+                    stack[top++] = node.firstChild + quadrant;
+                }
+            }
+            else {
+                visitSubtree(subtrees[index - levelStart(topLevels)], probe);
+            }
+        }
+    }
+    ax = probe.ax;
+    ay = probe.ay;
+}
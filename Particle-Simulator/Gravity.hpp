@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Barnes–Hut quadtree over the live particles, each of unit mass. A node counts as a
+// single mass at its center of mass once its side divided by its distance is below
+// the opening angle, so the force on a particle costs O(log N) rather than O(N).
+//
+// The top levels form a fixed grid of cells over the particles' bounding square.
+// Particles are counting-sorted into the cells, then each cell's subtree is built on
+// its own worker. The tree depends only on the particle positions and their order, so
+// forces are identical for any number of workers.
+class BarnesHutTree {
+public:
+    // Rebuilds the tree over the simulation's live particles, in parallel on its workers
+    void build(Simulation& simulation);
+
+    // Acceleration on particles[self] from every other live particle, for a unit
+    // gravitational constant. softening is added to every distance in quadrature.
+    // particles must be the array the tree was built from.
+    void acceleration(const std::vector<Particle>& particles, size_t self, double openingAngle, double softening,
+        double& ax, double& ay) const;
+
+    static const int topLevels = 4;     // Levels in the fixed grid, so it has 16 x 16 cells
+    static const uint32_t leafSize = 8; // Most particles in a leaf
+    static const int maxDepth = 40;     // Coincident particles share a leaf at this depth
+
+private:
+    struct Node {
+        double mass = 0, x = 0, y = 0;     // Particle count and center of mass
+        double minX = 0, minY = 0, size = 0; // The node's square
+        int32_t firstChild = -1;           // Index of the first of four contiguous children, -1 for a leaf
+        uint32_t begin = 0, end = 0;       // A leaf's particles in order
+    };
+
+    // One particle's traversal
+    struct Probe {
+        const std::vector<Particle>* particles;
+        size_t self;
+        double x, y;
+        double openingAngleSquared, softeningSquared;
+        double ax, ay;
+    };
+
+    void buildNode(const std::vector<Particle>& particles, std::vector<Node>& nodes, size_t index,
+        double minX, double minY, double size, uint32_t begin, uint32_t end, int depth);
+    bool approximate(const Node& node, Probe& probe) const;
+    void visitSubtree(const std::vector<Node>& nodes, Probe& probe) const;
+
+    std::vector<uint32_t> order;              // Live particle indices, grouped by node
+    std::vector<Node> cells;                  // The grid's levels, coarsest first; children of cell c are 4c to 4c + 3 of the next level
+    std::vector<std::vector<Node>> subtrees;  // Below each finest grid cell, in Morton order
+    std::vector<uint32_t> cellStart;          // Each finest cell's first particle in order
+    std::vector<uint32_t> keys;               // Finest cell of each particle slot
+    std::vector<size_t> offsets;              // Per-chunk counting sort buckets
+};
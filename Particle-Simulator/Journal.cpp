@@ -0,0 +1,359 @@
+#include "Journal.hpp"
+#include "Config.hpp"
+#include "Simulation.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+std::string lineError(const std::string& path, int lineNumber, const std::string& message) {
+    return path + ":" + std::to_string(lineNumber) + ": " + message;
+}
+
+uint64_t parseStep(const std::string& text, const std::string& path, int lineNumber) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (text.empty() || text[0] == '-' || *end != '\0') {
+        throw std::invalid_argument(lineError(path, lineNumber, "expected a step number."));
+    }
+    return value;
+}
+
+double parseNumber(const std::string& text, const std::string& path, int lineNumber) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (text.empty() || *end != '\0') {
+        throw std::invalid_argument(lineError(path, lineNumber, "expected a number."));
+    }
+    return value;
+}
+
+}
+
+Journal loadJournal(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::invalid_argument("Could not open journal '" + path + "'.");
+    }
+
+    Journal journal;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        size_t keywordEnd = line.find_first_of(" \t", start);
+        std::string keyword = line.substr(start, keywordEnd - start);
+        size_t valueStart = keywordEnd == std::string::npos ? std::string::npos : line.find_first_not_of(" \t", keywordEnd);
+        std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart);
+
+        if (keyword == "at") {
+            size_t stepEnd = value.find_first_of(" \t");
+            size_t textStart = stepEnd == std::string::npos ? std::string::npos : value.find_first_not_of(" \t", stepEnd);
+            if (textStart == std::string::npos) {
+                throw std::invalid_argument(lineError(path, lineNumber, "expected 'at <step> <command>'."));
+            }
+            JournalEntry entry;
+            entry.step = parseStep(value.substr(0, stepEnd), path, lineNumber);
+            std::string text = value.substr(textStart);
+            if (text.rfind("clear", 0) == 0) {
+                size_t targetStart = text.find_first_not_of(" \t", 5);
+                std::string target = targetStart == std::string::npos ? "" : text.substr(targetStart);
+                entry.clearParticles = target == "particles" || target == "all";
+                entry.clearWalls = target == "walls" || target == "all";
+                if (!entry.clearParticles && !entry.clearWalls) {
+                    throw std::invalid_argument(lineError(path, lineNumber, "expected 'clear particles', 'clear walls' or 'clear all'."));
+                }
+            }
+            else if (text.rfind("grab", 0) == 0 || text.rfind("steer", 0) == 0 || text.rfind("release", 0) == 0) {
+                std::istringstream words(text);
+                std::string verb;
+                unsigned long long index = 0;
+                words >> verb >> index;
+                entry.drag = verb == "grab" ? WallDrag::Grab : (verb == "steer" ? WallDrag::Steer : WallDrag::Release);
+                entry.dragIndex = static_cast<size_t>(index);
+                if (entry.drag == WallDrag::Steer) {
+                    words >> entry.steerVelocity.x >> entry.steerVelocity.y;
+                }
+                std::string rest;
+                if (!words || words >> rest) {
+                    throw std::invalid_argument(lineError(path, lineNumber, "expected 'grab <wall>', 'steer <moving wall> <vx> <vy>' or 'release <moving wall>'."));
+                }
+            }
+            else {
+                entry.command = parseSceneText(text, path + ":" + std::to_string(lineNumber));
+
+                const Scene& command = entry.command;
+                size_t items = command.walls.size() + command.particles.size() + command.lineBatches.size()
+                    + command.angleBatches.size() + command.velocityBatches.size() + command.movingWalls.size();
+                bool single = items == 1 && !command.hasDeltaTime;
+                bool timeStep = items == 0 && command.hasDeltaTime;
+                if ((!single && !timeStep) || command.hasWidth || command.hasHeight) {
+                    throw std::invalid_argument(lineError(path, lineNumber, "expected a single wall, particle, batch, clear, drag or time step."));
+                }
+            }
+            if (!journal.entries.empty() && entry.step < journal.entries.back().step) {
+                throw std::invalid_argument(lineError(path, lineNumber, "commands must be in step order."));
+            }
+            journal.entries.push_back(std::move(entry));
+        }
+        else if (keyword == "threads") {
+            journal.threadCount = static_cast<size_t>(parseStep(value, path, lineNumber));
+        }
+        else if (keyword == "dt") {
+            journal.deltaTime = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "width") {
+            journal.simWidth = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "height") {
+            journal.simHeight = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "seed") {
+            journal.seed = parseStep(value, path, lineNumber);
+        }
+        else if (keyword == "sort-threshold") {
+            journal.sortThreshold = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "gravity") {
+            journal.gravity = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "opening-angle") {
+            journal.openingAngle = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "softening") {
+            journal.softening = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "mesh-cells") {
+            journal.meshCells = static_cast<size_t>(parseStep(value, path, lineNumber));
+        }
+        else if (keyword == "fluid") {
+            journal.fluidLength = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "rest-density") {
+            journal.restDensity = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "stiffness") {
+            journal.stiffness = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "viscosity") {
+            journal.viscosity = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "constraint-iterations") {
+            journal.constraintIterations = static_cast<size_t>(parseStep(value, path, lineNumber));
+        }
+        else if (keyword == "flow") {
+            journal.flowField = value;
+        }
+        else if (keyword == "flow-speed") {
+            journal.flowSpeed = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "flow-coupling") {
+            journal.flowCoupling = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "scene") {
+            journal.sceneFile = value;
+        }
+        else if (keyword == "walls-svg") {
+            journal.svgFile = value;
+        }
+        else if (keyword == "svg-tolerance") {
+            journal.svgTolerance = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "walls-mask") {
+            journal.maskFile = value;
+        }
+        else if (keyword == "mask-tolerance") {
+            journal.maskTolerance = parseNumber(value, path, lineNumber);
+        }
+        else if (keyword == "restore") {
+            journal.restoreFile = value;
+        }
+        else if (keyword == "start") {
+            journal.startStep = parseStep(value, path, lineNumber);
+        }
+        else if (keyword == "end") {
+            journal.endStep = parseStep(value, path, lineNumber);
+            journal.hasEnd = true;
+        }
+        else {
+            throw std::invalid_argument(lineError(path, lineNumber, "unknown entry '" + keyword + "'."));
+        }
+    }
+
+    if (journal.deltaTime <= 0 || journal.simWidth <= 0 || journal.simHeight <= 0) {
+        throw std::invalid_argument("Journal '" + path + "' has an invalid time step or domain size.");
+    }
+    return journal;
+}
+
+void applyJournalSettings(const Journal& journal, SimulationConfig& config) {
+    if (journal.threadCount > 0 && !config.explicitOptions.count("threads")) {
+        config.threadCount = journal.threadCount;
+    }
+    config.deltaTime = journal.deltaTime;
+    config.simWidth = journal.simWidth;
+    config.simHeight = journal.simHeight;
+    config.seed = journal.seed;
+    config.sortThreshold = journal.sortThreshold;
+    config.gravity = journal.gravity;
+    config.openingAngle = journal.openingAngle;
+    config.softening = journal.softening;
+    config.meshCells = journal.meshCells;
+    config.fluidLength = journal.fluidLength;
+    config.restDensity = journal.restDensity;
+    config.stiffness = journal.stiffness;
+    config.viscosity = journal.viscosity;
+    config.constraintIterations = journal.constraintIterations;
+    config.flowField = journal.flowField;
+    config.flowSpeed = journal.flowSpeed;
+    config.flowCoupling = journal.flowCoupling;
+    config.sceneFile = journal.sceneFile;
+    config.svgFile = journal.svgFile;
+    config.svgTolerance = journal.svgTolerance;
+    config.maskFile = journal.maskFile;
+    config.maskTolerance = journal.maskTolerance;
+    config.restoreFile = journal.restoreFile;
+    config.explicitOptions.insert("dt"); // Scenes must not override the recorded settings
+    config.explicitOptions.insert("width");
+    config.explicitOptions.insert("height");
+}
+
+JournalWriter::JournalWriter(const std::string& path, const SimulationConfig& config, const Simulation& simulation) {
+    file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::invalid_argument("Could not write journal '" + path + "'.");
+    }
+
+    std::fprintf(file, "# Particle Simulator journal\n");
+    std::fprintf(file, "threads %zu\n", simulation.workerCount());
+    std::fprintf(file, "dt %.17g\n", simulation.deltaTime);
+    std::fprintf(file, "width %.17g\n", simulation.simWidth);
+    std::fprintf(file, "height %.17g\n", simulation.simHeight);
+    std::fprintf(file, "seed %llu\n", static_cast<unsigned long long>(config.seed));
+    std::fprintf(file, "sort-threshold %.17g\n", simulation.sortThreshold);
+    std::fprintf(file, "gravity %.17g\n", simulation.gravity);
+    std::fprintf(file, "opening-angle %.17g\n", simulation.openingAngle);
+    std::fprintf(file, "softening %.17g\n", simulation.softening);
+    std::fprintf(file, "mesh-cells %zu\n", simulation.meshCells);
+    std::fprintf(file, "fluid %.17g\n", simulation.fluidLength);
+    std::fprintf(file, "rest-density %.17g\n", simulation.restDensity);
+    std::fprintf(file, "stiffness %.17g\n", simulation.stiffness);
+    std::fprintf(file, "viscosity %.17g\n", simulation.viscosity);
+    std::fprintf(file, "constraint-iterations %zu\n", simulation.constraintIterations);
+    if (!config.flowField.empty()) std::fprintf(file, "flow %s\n", config.flowField.c_str());
+    std::fprintf(file, "flow-speed %.17g\n", config.flowSpeed);
+    std::fprintf(file, "flow-coupling %.17g\n", simulation.flowCoupling);
+    if (!config.sceneFile.empty()) std::fprintf(file, "scene %s\n", config.sceneFile.c_str());
+    if (!config.svgFile.empty()) std::fprintf(file, "walls-svg %s\nsvg-tolerance %.17g\n", config.svgFile.c_str(), config.svgTolerance);
+    if (!config.maskFile.empty()) std::fprintf(file, "walls-mask %s\nmask-tolerance %.17g\n", config.maskFile.c_str(), config.maskTolerance);
+    if (!config.restoreFile.empty()) std::fprintf(file, "restore %s\n", config.restoreFile.c_str());
+    std::fprintf(file, "start %llu\n", static_cast<unsigned long long>(simulation.stepCount));
+    std::fflush(file);
+}
+
+JournalWriter::~JournalWriter() {
+    std::fclose(file);
+}
+
+void JournalWriter::recordLine(uint64_t step, const LineBatch& batch) {
+    std::fprintf(file, "at %llu line %d %.9g %.9g %.9g %.9g %.9g %.9g\n", static_cast<unsigned long long>(step),
+        batch.count, batch.x1, batch.y1, batch.x2, batch.y2, batch.velocity, batch.angle);
+    std::fflush(file);
+}
+
+void JournalWriter::recordAngle(uint64_t step, const AngleBatch& batch) {
+    if (batch.atCenter) {
+        std::fprintf(file, "at %llu fan %d %.9g %.9g\n", static_cast<unsigned long long>(step),
+            batch.count, batch.startAngle, batch.endAngle);
+    }
+    else {
+        std::fprintf(file, "at %llu fan %d %.9g %.9g %.9g %.9g %.9g\n", static_cast<unsigned long long>(step),
+            batch.count, batch.startAngle, batch.endAngle, batch.x, batch.y, batch.velocity);
+    }
+    std::fflush(file);
+}
+
+void JournalWriter::recordVelocity(uint64_t step, const VelocityBatch& batch) {
+    std::fprintf(file, "at %llu sweep %d %.9g %.9g %.9g %.9g %.9g\n", static_cast<unsigned long long>(step),
+        batch.count, batch.startVelocity, batch.endVelocity, batch.x, batch.y, batch.angle);
+    std::fflush(file);
+}
+
+void JournalWriter::recordParticle(uint64_t step, double x, double y, double angle, double velocity, double radius) {
+    // Scenes read particle values as doubles, so print them at full double precision
+    if (radius == particleRadius) {
+        std::fprintf(file, "at %llu particle %.17g %.17g %.17g %.17g\n", static_cast<unsigned long long>(step), x, y, angle, velocity);
+    }
+    else {
+        std::fprintf(file, "at %llu particle %.17g %.17g %.17g %.17g %.17g\n", static_cast<unsigned long long>(step), x, y, angle, velocity, radius);
+    }
+    std::fflush(file);
+}
+
+void JournalWriter::recordWall(uint64_t step, const Wall& wall) {
+    std::fprintf(file, "at %llu wall %.9g %.9g %.9g %.9g\n", static_cast<unsigned long long>(step),
+        wall.start.x, wall.start.y, wall.end.x, wall.end.y);
+    std::fflush(file);
+}
+
+void JournalWriter::recordClear(uint64_t step, bool particles, bool walls) {
+    std::fprintf(file, "at %llu clear %s\n", static_cast<unsigned long long>(step),
+        particles && walls ? "all" : (particles ? "particles" : "walls"));
+    std::fflush(file);
+}
+
+void JournalWriter::recordDeltaTime(uint64_t step, double deltaTime) {
+    std::fprintf(file, "at %llu dt %.17g\n", static_cast<unsigned long long>(step), deltaTime);
+    std::fflush(file);
+}
+
+void JournalWriter::recordGrab(uint64_t step, size_t wallIndex) {
+    std::fprintf(file, "at %llu grab %llu\n", static_cast<unsigned long long>(step), static_cast<unsigned long long>(wallIndex));
+    std::fflush(file);
+}
+
+void JournalWriter::recordSteer(uint64_t step, size_t movingIndex, sf::Vector2f velocity) {
+    std::fprintf(file, "at %llu steer %llu %.9g %.9g\n", static_cast<unsigned long long>(step),
+        static_cast<unsigned long long>(movingIndex), velocity.x, velocity.y);
+    std::fflush(file);
+}
+
+void JournalWriter::recordRelease(uint64_t step, size_t movingIndex) {
+    std::fprintf(file, "at %llu release %llu\n", static_cast<unsigned long long>(step), static_cast<unsigned long long>(movingIndex));
+    std::fflush(file);
+}
+
+void JournalWriter::close(uint64_t endStep) {
+    std::fprintf(file, "end %llu\n", static_cast<unsigned long long>(endStep));
+    std::fflush(file);
+}
+
+void JournalPlayer::apply(Simulation& simulation) {
+    while (next < journal.entries.size() && journal.entries[next].step <= simulation.stepCount) {
+        const JournalEntry& entry = journal.entries[next];
+        if (entry.clearParticles) simulation.clearParticles();
+        if (entry.clearWalls) simulation.clearWalls();
+        if (entry.command.hasDeltaTime) simulation.deltaTime = entry.command.deltaTime;
+        if (entry.drag == WallDrag::Grab) simulation.grabWall(entry.dragIndex);
+        if (entry.drag == WallDrag::Release) simulation.releaseWall(entry.dragIndex);
+        if (entry.drag == WallDrag::Steer) {
+            if (entry.dragIndex >= simulation.movingWalls.size()) {
+                throw std::invalid_argument("There is no moving wall " + std::to_string(entry.dragIndex) + " to steer.");
+            }
+            simulation.movingWalls[entry.dragIndex].velocity = entry.steerVelocity;
+        }
+        applyScene(entry.command, simulation);
+        ++next;
+    }
+}
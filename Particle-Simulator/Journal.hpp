@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Generators.hpp"
+#include "Scene.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Simulation;
+struct SimulationConfig;
+
+// Input journals log every command entered in the GUI or received over the control
+// socket together with the step it was applied at, so an interactive session can be rebuilt exactly without
+// recording any particle state.
+//
+// Text form:
+//   # Particle Simulator journal
+//   threads 8
+//   dt 1
+//   width 1280
+//   height 720
+//   seed 5489
+//   scene FILE          (optional, rest of the line)
+//   restore FILE        (optional, rest of the line)
+//   start 0             Step the session started at
+//   at 120 line 100 10 10 500 500 20 45
+//   at 340 wall 100 100 300 100
+//   at 400 clear particles  Also "walls" or "all"
+//   at 410 dt 0.5           Time step change
+//   at 500 grab 3           Wall 3 starts being dragged as moving wall 0
+//   at 501 steer 0 12 -4    Moving wall 0 slides at (12, -4)
+//   at 560 release 0        Moving wall 0 settles back into a wall
+//   end 2000            Step the session ended at; missing if it crashed
+//
+// Each "at" line holds one scene entry (see Scene.hpp), a clear, a wall drag or a
+// time step change that is applied once the simulation has completed that many steps, before
+// the next step runs.
+
+enum class WallDrag { None, Grab, Steer, Release };
+
+struct JournalEntry {
+    uint64_t step = 0;
+    Scene command; // Holds exactly one wall, particle or batch, or only a time step
+    bool clearParticles = false, clearWalls = false;
+    WallDrag drag = WallDrag::None;    // Instead of the command, grab, steer or release a wall
+    size_t dragIndex = 0;              // Wall grabbed, or moving wall steered or released
+    sf::Vector2f steerVelocity;
+};
+
+struct Journal {
+    size_t threadCount = 0;
+    double deltaTime = 1;
+    double simWidth = 1280, simHeight = 720;
+    uint64_t seed = 5489;
+    double sortThreshold = 0.25; // Particle order feeds the checksums, so the sorting must match
+    double gravity = 0;
+    double openingAngle = 0.5;
+    double softening = 5;
+    size_t meshCells = 0;
+    double fluidLength = 0;
+    double restDensity = 0.02;
+    double stiffness = 5;
+    double viscosity = 0.5;
+    size_t constraintIterations = 8;
+    std::string flowField;
+    double flowSpeed = 2;
+    double flowCoupling = 1;
+    std::string sceneFile;
+    std::string svgFile;
+    double svgTolerance = 0.25;
+    std::string maskFile;
+    double maskTolerance = 1;
+    std::string restoreFile;
+    uint64_t startStep = 0;
+    bool hasEnd = false;
+    uint64_t endStep = 0;
+    std::vector<JournalEntry> entries; // In step order
+};
+
+// Throws std::invalid_argument if the file cannot be read or is malformed
+Journal loadJournal(const std::string& path);
+
+// Replaces the startup settings that determine the simulation state with the journal's.
+// The thread count is only taken from the journal if it was not given explicitly.
+void applyJournalSettings(const Journal& journal, SimulationConfig& config);
+
+// Appends commands as they happen. Every line is flushed, so a crash loses at most
+// the session end marker.
+class JournalWriter {
+public:
+    JournalWriter(const std::string& path, const SimulationConfig& config, const Simulation& simulation);
+    ~JournalWriter();
+
+    JournalWriter(const JournalWriter&) = delete;
+    JournalWriter& operator=(const JournalWriter&) = delete;
+
+    void recordLine(uint64_t step, const LineBatch& batch);
+    void recordAngle(uint64_t step, const AngleBatch& batch);
+    void recordVelocity(uint64_t step, const VelocityBatch& batch);
+    void recordParticle(uint64_t step, double x, double y, double angle, double velocity, double radius = particleRadius);
+    void recordWall(uint64_t step, const Wall& wall);
+    void recordClear(uint64_t step, bool particles, bool walls);
+    void recordDeltaTime(uint64_t step, double deltaTime);
+    void recordGrab(uint64_t step, size_t wallIndex);
+    void recordSteer(uint64_t step, size_t movingIndex, sf::Vector2f velocity);
+    void recordRelease(uint64_t step, size_t movingIndex);
+
+    void close(uint64_t endStep);
+
+private:
+    std::FILE* file;
+};
+
+// Applies due journal commands to the simulation during a replay
+class JournalPlayer {
+public:
+    explicit JournalPlayer(Journal journal) : journal(std::move(journal)) {}
+
+    // Applies every command logged at the simulation's current step
+    void apply(Simulation& simulation);
+
+    const Journal& source() const { return journal; }
+    bool done() const { return next == journal.entries.size(); }
+
+private:
+    Journal journal;
+    size_t next = 0;
+};
@@ -0,0 +1,85 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& path) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::invalid_argument("Could not open '" + path + "'.");
+    }
+    fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        throw std::invalid_argument("Could not read the size of '" + path + "'.");
+    }
+    length = static_cast<size_t>(fileSize.QuadPart);
+    if (length == 0) {
+        return; // Empty files cannot be mapped; data() stays null
+    }
+
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr) {
+        CloseHandle(file);
+        throw std::invalid_argument("Could not map '" + path + "'.");
+    }
+    bytes = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (bytes == nullptr) {
+        CloseHandle(mappingHandle);
+        CloseHandle(file);
+        throw std::invalid_argument("Could not map '" + path + "'.");
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) UnmapViewOfFile(bytes);
+    if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+    if (fileHandle != nullptr) CloseHandle(fileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    fileDescriptor = open(path.c_str(), O_RDONLY);
+    if (fileDescriptor < 0) {
+        throw std::invalid_argument("Could not open '" + path + "'.");
+    }
+
+    struct stat info;
+    if (fstat(fileDescriptor, &info) != 0) {
+        close(fileDescriptor);
+        throw std::invalid_argument("Could not read the size of '" + path + "'.");
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length == 0) {
+        return; // Empty files cannot be mapped; data() stays null
+    }
+
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+        close(fileDescriptor);
+        throw std::invalid_argument("Could not map '" + path + "'.");
+    }
+    bytes = static_cast<const unsigned char*>(mapping);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) munmap(const_cast<unsigned char*>(bytes), length);
+    if (fileDescriptor >= 0) close(fileDescriptor);
+}
+
+#endif
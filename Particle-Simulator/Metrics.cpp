@@ -0,0 +1,207 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fstream>
+#include <unistd.h>
+#endif
+
+const double SimulationMetrics::frameTimeBuckets[SimulationMetrics::frameTimeBucketCount] = {
+    0.001, 0.002, 0.004, 0.008, 0.0167, 0.0333, 0.05, 0.1, 0.25, 1.0
+};
+
+SimulationMetrics::SimulationMetrics(size_t workerCount)
+    : workers(workerCount), workerBusyNanos(new std::atomic<uint64_t>[workerCount]) {
+    for (size_t i = 0; i < workers; ++i) {
+        workerBusyNanos[i].store(0);
+    }
+}
+
+void SimulationMetrics::recordFrame(double seconds) {
+    int bucket = 0;
+    while (bucket < frameTimeBucketCount && seconds > frameTimeBuckets[bucket]) {
+        ++bucket;
+    }
+    frameTimeCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    frameTimeSumNanos.fetch_add(static_cast<uint64_t>(seconds * 1e9), std::memory_order_relaxed);
+}
+
+uint64_t residentMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#else
+    // Second field of statm is the resident page count
+    std::ifstream statm("/proc/self/statm");
+    uint64_t totalPages = 0, residentPages = 0;
+    if (statm >> totalPages >> residentPages) {
+        return residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    }
+    return 0;
+#endif
+}
+
+MetricsServer::MetricsServer(const SimulationMetrics& metrics, unsigned short port)
+    : metrics(metrics), port(port), lastWorkerBusy(metrics.workerCount(), 0) {}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+bool MetricsServer::start() {
+    if (listener.listen(port, sf::IpAddress::LocalHost) != sf::Socket::Done) {
+        std::cerr << "Metrics endpoint could not listen on port " << port << '\n';
+        return false;
+    }
+    running = true;
+    thread = std::thread(&MetricsServer::run, this);
+    return true;
+}
+
+void MetricsServer::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    listener.close();
+}
+
+void MetricsServer::run() {
+    // Poll with a timeout so stop() is noticed without needing a wake-up connection
+    sf::SocketSelector selector;
+    selector.add(listener);
+
+    while (running) {
+        if (!selector.wait(sf::milliseconds(250)) || !selector.isReady(listener)) {
+            continue;
+        }
+
+        sf::TcpSocket client;
+        if (listener.accept(client) == sf::Socket::Done) {
+            serveClient(client);
+        }
+    }
+}
+
+void MetricsServer::serveClient(sf::TcpSocket& client) {
+    // Wait briefly for the request line; a client that never sends anything is dropped
+    sf::SocketSelector selector;
+    selector.add(client);
+    if (!selector.wait(sf::seconds(1))) {
+        return;
+    }
+
+    char request[2048];
+    std::size_t received = 0;
+    if (client.receive(request, sizeof(request) - 1, received) != sf::Socket::Done) {
+        return;
+    }
+    request[received] = '\0';
+
+    std::string requestLine(request, std::find(request, request + received, '\r'));
+    std::string status = "200 OK";
+    std::string body;
+    if (requestLine.rfind("GET /metrics", 0) == 0 || requestLine.rfind("GET / ", 0) == 0) {
+        body = render();
+    }
+    else {
+        status = "404 Not Found";
+        body = "Not found\n";
+    }
+
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\n"
+        << "Content-Type: text/plain; version=0.0.4\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n\r\n"
+        << body;
+
+    std::string data = response.str();
+    client.send(data.data(), data.size());
+    client.disconnect();
+}
+
+std::string MetricsServer::render() {
+    double elapsed = scrapeClock.restart().asSeconds();
+    std::ostringstream out;
+
+    uint64_t steps = metrics.stepsTotal.load(std::memory_order_relaxed);
+    double stepRate = elapsed > 0 ? (steps - lastSteps) / elapsed : 0.0;
+    lastSteps = steps;
+
+    out << "# HELP particle_sim_steps_total Simulation steps completed.\n"
+        << "# TYPE particle_sim_steps_total counter\n"
+        << "particle_sim_steps_total " << steps << '\n';
+
+    out << "# HELP particle_sim_step_rate Steps per second since the previous scrape.\n"
+        << "# TYPE particle_sim_step_rate gauge\n"
+        << "particle_sim_step_rate " << stepRate << '\n';
+
+    out << "# HELP particle_sim_frame_seconds Wall-clock time per frame.\n"
+        << "# TYPE particle_sim_frame_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for (int i = 0; i < SimulationMetrics::frameTimeBucketCount; ++i) {
+        cumulative += metrics.frameTimeCounts[i].load(std::memory_order_relaxed);
+        out << "particle_sim_frame_seconds_bucket{le=\"" << SimulationMetrics::frameTimeBuckets[i] << "\"} " << cumulative << '\n';
+    }
+    cumulative += metrics.frameTimeCounts[SimulationMetrics::frameTimeBucketCount].load(std::memory_order_relaxed);
+    out << "particle_sim_frame_seconds_bucket{le=\"+Inf\"} " << cumulative << '\n'
+        << "particle_sim_frame_seconds_sum " << metrics.frameTimeSumNanos.load(std::memory_order_relaxed) / 1e9 << '\n'
+        << "particle_sim_frame_seconds_count " << cumulative << '\n';
+
+    out << "# HELP particle_sim_particles Particles in the simulation.\n"
+        << "# TYPE particle_sim_particles gauge\n"
+        << "particle_sim_particles " << metrics.particleCount.load(std::memory_order_relaxed) << '\n';
+
+    out << "# HELP particle_sim_particles_despawned_total Particles removed by lifetimes, absorbers and sinks.\n"
+        << "# TYPE particle_sim_particles_despawned_total counter\n"
+        << "particle_sim_particles_despawned_total " << metrics.particlesDespawned.load(std::memory_order_relaxed) << '\n';
+
+    out << "# HELP particle_sim_locality_sorts_total Times the particles were re-sorted along the Morton curve.\n"
+        << "# TYPE particle_sim_locality_sorts_total counter\n"
+        << "particle_sim_locality_sorts_total " << metrics.localitySorts.load(std::memory_order_relaxed) << '\n';
+
+    out << "# HELP particle_sim_walls Walls in the simulation.\n"
+        << "# TYPE particle_sim_walls gauge\n"
+        << "particle_sim_walls " << metrics.wallCount.load(std::memory_order_relaxed) << '\n';
+
+    out << "# HELP particle_sim_worker_busy_seconds_total Time each worker spent updating particles.\n"
+        << "# TYPE particle_sim_worker_busy_seconds_total counter\n";
+    for (size_t i = 0; i < metrics.workerCount(); ++i) {
+        out << "particle_sim_worker_busy_seconds_total{worker=\"" << i << "\"} " << metrics.workerBusy(i) / 1e9 << '\n';
+    }
+
+    out << "# HELP particle_sim_worker_busy_ratio Fraction of time each worker was busy since the previous scrape.\n"
+        << "# TYPE particle_sim_worker_busy_ratio gauge\n";
+    for (size_t i = 0; i < metrics.workerCount(); ++i) {
+        uint64_t busy = metrics.workerBusy(i);
+        double ratio = elapsed > 0 ? (busy - lastWorkerBusy[i]) / 1e9 / elapsed : 0.0;
+        lastWorkerBusy[i] = busy;
+        out << "particle_sim_worker_busy_ratio{worker=\"" << i << "\"} " << ratio << '\n';
+    }
+
+    out << "# HELP particle_sim_queue_depth Items waiting in each simulation queue.\n"
+        << "# TYPE particle_sim_queue_depth gauge\n"
+        << "particle_sim_queue_depth{queue=\"work\"} " << metrics.workQueueDepth.load(std::memory_order_relaxed) << '\n';
+
+    out << "# HELP particle_sim_resident_memory_bytes Resident memory of the process.\n"
+        << "# TYPE particle_sim_resident_memory_bytes gauge\n"
+        << "particle_sim_resident_memory_bytes " << residentMemoryBytes() << '\n';
+
+    out << "# HELP particle_sim_state_bytes Memory reserved for particle and wall storage.\n"
+        << "# TYPE particle_sim_state_bytes gauge\n"
+        << "particle_sim_state_bytes " << metrics.stateBytes.load(std::memory_order_relaxed) << '\n';
+
+    return out.str();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counters shared between the simulation threads and the metrics endpoint.
+// Every field is a relaxed atomic so recording never blocks a frame.
+class SimulationMetrics {
+public:
+    static constexpr int frameTimeBucketCount = 10;
+    static const double frameTimeBuckets[frameTimeBucketCount]; // Histogram upper bounds in seconds
+
+    std::atomic<uint64_t> stepsTotal{ 0 };
+    std::atomic<uint64_t> particleCount{ 0 };       // Live particles, not counting despawned slots
+    std::atomic<uint64_t> particlesDespawned{ 0 };
+    std::atomic<uint64_t> localitySorts{ 0 };      // Particle arrays re-sorted along the Morton curve
+    std::atomic<uint64_t> wallCount{ 0 };
+    std::atomic<uint64_t> workQueueDepth{ 0 };  // Step work items or parallelFor chunks not yet claimed by a worker
+    std::atomic<uint64_t> stateBytes{ 0 };      // Bytes reserved for particle and wall storage
+    std::atomic<uint64_t> frameTimeCounts[frameTimeBucketCount + 1] = {}; // Last slot is +Inf
+    std::atomic<uint64_t> frameTimeSumNanos{ 0 };
+
+    explicit SimulationMetrics(size_t workerCount);
+
+    void recordFrame(double seconds);
+    void addWorkerBusy(size_t worker, uint64_t nanos) {
+        workerBusyNanos[worker].fetch_add(nanos, std::memory_order_relaxed);
+    }
+
+    size_t workerCount() const { return workers; }
+    uint64_t workerBusy(size_t worker) const { return workerBusyNanos[worker].load(std::memory_order_relaxed); }
+
+private:
+    size_t workers;
+    std::unique_ptr<std::atomic<uint64_t>[]> workerBusyNanos;
+};
+
+// Resident set size of this process in bytes, or 0 if the platform does not report it
+uint64_t residentMemoryBytes();
+
+// Serves SimulationMetrics in the Prometheus text format over HTTP on the loopback
+// interface. Runs on its own thread and only ever reads the atomics.
+class MetricsServer {
+public:
+    MetricsServer(const SimulationMetrics& metrics, unsigned short port);
+    ~MetricsServer();
+
+    bool start();
+    void stop();
+
+private:
+    void run();
+    void serveClient(sf::TcpSocket& client);
+    std::string render();
+
+    const SimulationMetrics& metrics;
+    unsigned short port;
+    sf::TcpListener listener;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+
+    // Previous scrape, used to turn counters into rates. Only touched by the server thread.
+    sf::Clock scrapeClock;
+    uint64_t lastSteps = 0;
+    std::vector<uint64_t> lastWorkerBusy;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Wall.hpp"
+#include <cmath>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+class Particle {
+public:
+    double x, y; // Position
+    double vx, vy; // Velocity
+    double radius;
+
+    // Leaves the fields unset, so growing a particle array does not zero it before the
+    // generators overwrite every slot
+    Particle() {}
+
+    Particle(double x, double y, double angle, double velocity, double radius)
+        : x(x), y(y), radius(radius) {
+        // Convert angle to radians and calculate velocity components
+        double rad = angle * (M_PI / 180.0);
+        vx = velocity * cos(rad);
+        vy = -velocity * sin(rad);
+    }
+
+    // Despawned particles keep their slot with a zero radius until the simulation is compacted
+    bool alive() const { return radius > 0; }
+
+    void updatePosition(double deltaTime, double simWidth, double simHeight, const std::vector<Wall>& walls) {
+        updatePosition(deltaTime, simWidth, simHeight, walls.data(), walls.data() + walls.size());
+    }
+
+    // Same, checking only the walls in [wallsBegin, wallsEnd)
+    void updatePosition(double deltaTime, double simWidth, double simHeight, const Wall* wallsBegin, const Wall* wallsEnd) {
+        double nextX = x + vx * deltaTime;
+        double nextY = y + vy * deltaTime;
+
+        // Boundary collision
+        if (nextX - radius < 0 || nextX + radius > simWidth) vx = -vx;
+        if (nextY - radius < 0 || nextY + radius > simHeight) vy = -vy;
+
+        // Wall collision with direct calculation
+        for (const Wall* wallIt = wallsBegin; wallIt != wallsEnd; ++wallIt) {
+            const Wall& wall = *wallIt;
+            sf::Vector2f collisionPoint;
+            if (directCollisionDetection(*this, wall, collisionPoint)) {
+                // Calculate wall's normal vector
+                sf::Vector2f wallDirection = wall.end - wall.start;
+                sf::Vector2f wallNormal = { -wallDirection.y, wallDirection.x };
+
+                // Normalize the wall normal
+                float length = sqrt(wallNormal.x * wallNormal.x + wallNormal.y * wallNormal.y);
+                wallNormal.x /= length;
+                wallNormal.y /= length;
+
+                // Reflect the velocity based on the wall's normal vector
+                reflectVelocity(wall);
+
+                // Adjust the position to the collision point to prevent the particle from "sinking" into the wall
+                x = collisionPoint.x;
+                y = collisionPoint.y;
+                break;
+            }
+        }
+
+        // Update position
+        x += vx * deltaTime;
+        y += vy * deltaTime;
+    }
+
+    bool directCollisionDetection(const Particle& particle, const Wall& wall, sf::Vector2f& collisionPoint) {
+        // Get start and end points of the wall
+        sf::Vector2f wallStart = wall.start;
+        sf::Vector2f wallEnd = wall.end;
+
+        // Particle's position and velocity vector
+        sf::Vector2f particlePos(particle.x, particle.y);
+        sf::Vector2f particleVelocity(particle.vx, particle.vy);
+
+        // Calculate vectors
+        sf::Vector2f wallVector = wallEnd - wallStart;
+        sf::Vector2f particleVector = particleVelocity;
+
+        // Calculate determinants
+        float det = (-wallVector.x * particleVector.y + particleVector.x * wallVector.y);
+        if (std::abs(det) < 1e-9) {
+            return false; // Parallel movement, no collision
+        }
+
+        // Calculate relative position using Cramer's rule
+        sf::Vector2f relativePos = particlePos - wallStart;
+        float t = (-particleVector.y * relativePos.x + particleVector.x * relativePos.y) / det;
+        float u = (wallVector.x * relativePos.y - wallVector.y * relativePos.x) / det;
+
+        // Check if intersection point is within the segment and particle's path
+        if (t >= 0.0f && t <= 1.0f && u >= 0.0f && u <= 1.0f) {
+            // Calculate the collision point without considering the radius
+            sf::Vector2f rawCollisionPoint = wallStart + t * wallVector;
+
+            // Adjust the collision point for the particle's radius
+            sf::Vector2f wallNormal(-wallVector.y, wallVector.x);
+            float normalLength = std::sqrt(wallNormal.x * wallNormal.x + wallNormal.y * wallNormal.y);
+            wallNormal /= normalLength; // Normalize the wall normal
+
+            // Push the collision point out by the radius in the direction of the wall normal
+            collisionPoint = rawCollisionPoint + sf::Vector2f(wallNormal.x * particle.radius, wallNormal.y * particle.radius);
+            return true;
+        }
+
+        return false;
+    }
+
+    void reflectVelocity(const Wall& wall) {
+        sf::Vector2f D = wall.end - wall.start;
+        sf::Vector2f N(-D.y, D.x); // Normal vector
+
+        // Normalize N
+        float length = std::sqrt(N.x * N.x + N.y * N.y);
+        N.x /= length;
+        N.y /= length;
+
+        // Dot product of velocity and normal
+        float dotProduct = vx * N.x + vy * N.y;
+
+        // Reflect velocity
+        vx -= 2 * dotProduct * N.x;
+        vy -= 2 * dotProduct * N.y;
+
+        // Maintain same speed
+        float speed = std::sqrt(vx * vx + vy * vy);
+        float originalSpeed = std::sqrt(vx * vx + vy * vy);
+        vx = (vx / speed) * originalSpeed;
+        vy = (vy / speed) * originalSpeed;
+    }
+};
@@ -0,0 +1,219 @@
+#include "ParticleMesh.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+const size_t rowsPerChunk = 8; // Grid lines per parallelFor chunk of the transforms
+
+}
+
+void ParticleMesh::locate(double x, double y, size_t& i, size_t& j, double& tx, double& ty) const {
+    double fx = std::min(std::max(x / cellWidth - 0.5, 0.0), static_cast<double>(size - 1));
+    double fy = std::min(std::max(y / cellHeight - 0.5, 0.0), static_cast<double>(size - 1));
+    i = std::min(static_cast<size_t>(fx), size - 2);
+    j = std::min(static_cast<size_t>(fy), size - 2);
+    tx = fx - i;
+    ty = fy - j;
+}
+
+void ParticleMesh::build(Simulation& simulation, size_t cells, double softening) {
+    if (cells < 2 || (cells & (cells - 1)) != 0) {
+        throw std::invalid_argument("Particle-mesh grid size must be a power of two.");
+    }
+    const std::vector<Particle>& particles = simulation.particles;
+    size = cells;
+    cellWidth = simulation.simWidth / size;
+    cellHeight = simulation.simHeight / size;
+    if (green.size() != 4 * size * size || greenWidth != simulation.simWidth || greenHeight != simulation.simHeight || greenSoftening != softening) {
+        prepareTransform(simulation, simulation.simWidth, simulation.simHeight, softening);
+    }
+
+    // Counting sort of the live particles by their lower grid row, so each chunk of the
+    // sorted order deposits onto a narrow strip of rows
+    size_t count = particles.size();
+    size_t chunkSize = Simulation::parallelChunkSize;
+    size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    rows.resize(count);
+    offsets.assign(chunkCount * size, 0);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* histogram = &offsets[begin / chunkSize * size];
+        for (size_t index = begin; index < end; ++index) {
+            if (!particles[index].alive()) {
+                rows[index] = UINT32_MAX;
+                continue;
+            }
+            size_t i, j;
+            double tx, ty;
+            locate(particles[index].x, particles[index].y, i, j, tx, ty);
+            rows[index] = static_cast<uint32_t>(j);
+            ++histogram[j];
+        }
+    });
+    size_t running = 0;
+    for (size_t row = 0; row < size; ++row) {
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t n = offsets[chunk * size + row];
+            offsets[chunk * size + row] = running;
+            running += n;
+        }
+    }
+    order.resize(running);
+    simulation.parallelFor(count, [&](size_t begin, size_t end) {
+        size_t* next = &offsets[begin / chunkSize * size];
+        for (size_t index = begin; index < end; ++index) {
+            if (rows[index] != UINT32_MAX) {
+                order[next[rows[index]]++] = static_cast<uint32_t>(index);
+            }
+        }
+    });
+
+    // Cloud-in-cell deposit, each chunk onto its own strip
+    size_t depositChunks = (order.size() + chunkSize - 1) / chunkSize;
+    strips.resize(depositChunks);
+    chunkFirstRow.resize(depositChunks);
+    simulation.parallelFor(order.size(), [&](size_t begin, size_t end) {
+        size_t chunk = begin / chunkSize;
+        size_t firstRow = rows[order[begin]];
+        std::vector<double>& strip = strips[chunk];
+        strip.assign((rows[order[end - 1]] - firstRow + 2) * size, 0);
+        chunkFirstRow[chunk] = firstRow;
+        for (size_t k = begin; k < end; ++k) {
+            size_t i, j;
+            double tx, ty;
+            locate(particles[order[k]].x, particles[order[k]].y, i, j, tx, ty);
+            double* cell = &strip[(j - firstRow) * size + i];
+            cell[0] += (1 - tx) * (1 - ty);
+            cell[1] += tx * (1 - ty);
+            cell[size] += (1 - tx) * ty;
+            cell[size + 1] += tx * ty;
+        }
+    });
+    size_t side = 2 * size;
+    padded.assign(side * side, Complex(0, 0));
+    for (size_t chunk = 0; chunk < depositChunks; ++chunk) {
+        const std::vector<double>& strip = strips[chunk];
+        Complex* target = &padded[chunkFirstRow[chunk] * side];
+        for (size_t row = 0; row < strip.size() / size; ++row) {
+            for (size_t i = 0; i < size; ++i) {
+                target[row * side + i] += strip[row * size + i];
+            }
+        }
+    }
+
+    // Convolve with the Green's function. Only the first half of the rows hold density on
+    // the way in, and only the first half of the rows are needed on the way out.
+    transformRows(simulation, size, false);
+    transformColumns(simulation, false);
+    simulation.parallelFor(padded.size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            padded[k] *= green[k];
+        }
+    });
+    transformColumns(simulation, true);
+    transformRows(simulation, size, true);
+
+    // Acceleration is minus the gradient of the potential, one-sided at the grid edges
+    forceX.resize(size * size);
+    forceY.resize(size * size);
+    simulation.parallelFor(size * size, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            size_t i = k % size, j = k / size;
+            size_t left = i > 0 ? i - 1 : i, right = i + 1 < size ? i + 1 : i;
+            size_t below = j > 0 ? j - 1 : j, above = j + 1 < size ? j + 1 : j;
+            forceX[k] = -(padded[j * side + right].real() - padded[j * side + left].real()) / ((right - left) * cellWidth);
+            forceY[k] = -(padded[above * side + i].real() - padded[below * side + i].real()) / ((above - below) * cellHeight);
+        }
+    });
+}
+
+void ParticleMesh::acceleration(const Particle& particle, double& ax, double& ay) const {
+    size_t i, j;
+    double tx, ty;
+    locate(particle.x, particle.y, i, j, tx, ty);
+    const double* fx = &forceX[j * size + i];
+    const double* fy = &forceY[j * size + i];
+    ax = (fx[0] * (1 - tx) + fx[1] * tx) * (1 - ty) + (fx[size] * (1 - tx) + fx[size + 1] * tx) * ty;
+    ay = (fy[0] * (1 - tx) + fy[1] * tx) * (1 - ty) + (fy[size] * (1 - tx) + fy[size + 1] * tx) * ty;
+}
+
+void ParticleMesh::prepareTransform(Simulation& simulation, double width, double height, double softening) {
+    size_t side = 2 * size;
+    twiddles.resize(side / 2);
+    for (size_t k = 0; k < side / 2; ++k) {
+        double angle = -2 * M_PI * k / side;
+        twiddles[k] = Complex(std::cos(angle), std::sin(angle));
+    }
+
+    // Offsets past the middle of the padded grid wrap around to negative ones. The
+    // inverse transform's 1 / side² is folded in here.
+    double scale = 1.0 / (static_cast<double>(side) * side);
+    padded.assign(side * side, Complex(0, 0));
+    for (size_t b = 0; b < side; ++b) {
+        double dy = (b < size ? static_cast<double>(b) : static_cast<double>(b) - side) * cellHeight;
+        for (size_t a = 0; a < side; ++a) {
+            double dx = (a < size ? static_cast<double>(a) : static_cast<double>(a) - side) * cellWidth;
+            padded[b * side + a] = -scale / std::sqrt(dx * dx + dy * dy + softening * softening);
+        }
+    }
+    transformRows(simulation, side, false);
+    transformColumns(simulation, false);
+    green.swap(padded);
+    greenWidth = width;
+    greenHeight = height;
+    greenSoftening = softening;
+}
+
+void ParticleMesh::transformRows(Simulation& simulation, size_t rowCount, bool inverse) {
+    size_t side = 2 * size;
+    simulation.parallelFor(rowCount, [&](size_t begin, size_t end) {
+        std::vector<Complex> scratch;
+        for (size_t row = begin; row < end; ++row) {
+            fft(&padded[row * side], 1, inverse, scratch);
+        }
+    }, rowsPerChunk);
+}
+
+void ParticleMesh::transformColumns(Simulation& simulation, bool inverse) {
+    size_t side = 2 * size;
+    simulation.parallelFor(side, [&](size_t begin, size_t end) {
+        std::vector<Complex> scratch;
+        for (size_t column = begin; column < end; ++column) {
+            fft(&padded[column], side, inverse, scratch);
+        }
+    }, rowsPerChunk);
+}
+
+void ParticleMesh::fft(Complex* values, size_t stride, bool inverse, std::vector<Complex>& scratch) const {
+    // Iterative radix-2 transform on a copy in bit-reversed order, written back in place
+    size_t n = 2 * size;
+    scratch.resize(n);
+    size_t bits = 0;
+    while ((size_t(1) << bits) < n) {
+        ++bits;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        size_t reversed = 0;
+        for (size_t bit = 0; bit < bits; ++bit) {
+            reversed |= ((k >> bit) & 1) << (bits - 1 - bit);
+        }
+        scratch[reversed] = values[k * stride];
+    }
+    for (size_t length = 2; length <= n; length *= 2) {
+        size_t half = length / 2, step = n / length;
+        for (size_t start = 0; start < n; start += length) {
+            for (size_t k = 0; k < half; ++k) {
+                Complex twiddle = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+                Complex odd = scratch[start + k + half] * twiddle;
+                scratch[start + k + half] = scratch[start + k] - odd;
+                scratch[start + k] += odd;
+            }
+        }
+    }
+    for (size_t k = 0; k < n; ++k) {
+        values[k * stride] = scratch[k];
+    }
+}
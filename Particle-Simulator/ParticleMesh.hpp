@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Simulation;
+
+// Particle-mesh gravity over the domain, each particle of unit mass. Particles are
+// deposited onto a square grid of nodes with cloud-in-cell weights. The potential is
+// the density convolved with the softened Green's function 1/sqrt(r² + softening²),
+// done with FFTs on a grid padded to twice the size so the domain is not treated as
+// periodic. Accelerations are differenced from the potential on the grid and
+// interpolated back with the same weights.
+//
+// The cost is O(N + G log G) for G grid nodes, independent of how the particles are
+// clustered, but detail finer than a grid cell is lost. It suits dense scenes that
+// fill the domain, while the Barnes–Hut tree suits clustered ones.
+//
+// Every sum is done in an order fixed by the particle order and grid size, so forces
+// are identical for any number of workers.
+class ParticleMesh {
+public:
+    // Deposits the simulation's live particles on a cells x cells grid, which must be a
+    // power of two, and solves for the accelerations, in parallel on its workers
+    void build(Simulation& simulation, size_t cells, double softening);
+
+    // Acceleration at the particle's position for a unit gravitational constant
+    void acceleration(const Particle& particle, double& ax, double& ay) const;
+
+private:
+    typedef std::complex<double> Complex;
+
+    // Grid node to the lower left of a position, and the weight of the node above and right of it
+    void locate(double x, double y, size_t& i, size_t& j, double& tx, double& ty) const;
+    void prepareTransform(Simulation& simulation, double width, double height, double softening);
+    void transformRows(Simulation& simulation, size_t rowCount, bool inverse);
+    void transformColumns(Simulation& simulation, bool inverse);
+    void fft(Complex* values, size_t stride, bool inverse, std::vector<Complex>& scratch) const;
+
+    size_t size = 0;                      // Grid nodes per side
+    double cellWidth = 0, cellHeight = 0; // Spacing of the nodes, the first sitting half a cell in
+    std::vector<double> forceX, forceY;   // Acceleration at every node, row after row
+
+    // The transform of the Green's function only changes with the grid and domain
+    double greenWidth = 0, greenHeight = 0, greenSoftening = 0;
+    std::vector<Complex> green;           // On the padded grid of (2 size)², row after row
+    std::vector<Complex> twiddles;        // exp(-2πik / 2 size) for the first half of a padded line
+    std::vector<Complex> padded;
+
+    std::vector<uint32_t> order;          // Live particle indices by their lower grid row
+    std::vector<uint32_t> rows;           // Lower grid row of each particle slot
+    std::vector<size_t> offsets;          // Per-chunk counting sort buckets
+    std::vector<size_t> chunkFirstRow;    // First grid row of each chunk's strip
+    std::vector<std::vector<double>> strips; // Each chunk's deposit, summed in chunk order
+};
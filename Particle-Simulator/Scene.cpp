@@ -0,0 +1,752 @@
+#include "Scene.hpp"
+#include "Simulation.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace {
+
+const char sceneMagic[4] = { 'P', 'S', 'C', 'N' };
+const uint32_t sceneVersion = 1;
+
+enum SceneFlags : uint32_t {
+    HasDeltaTime = 1 << 0,
+    HasWidth = 1 << 1,
+    HasHeight = 1 << 2,
+};
+
+struct SceneFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t reserved;
+    double deltaTime, simWidth, simHeight;
+    uint64_t wallCount, particleCount, lineCount, fanCount, sweepCount, emitterCount;
+    uint64_t absorberCount, sinkCount, attractorCount, chainCount, clothCount, movingWallCount;
+};
+
+// Fixed-layout batch records so the file does not depend on struct padding
+struct LineRecord { int32_t count; float x1, y1, x2, y2, velocity, angle; };
+struct AngleRecord { int32_t count; float startAngle, endAngle; int32_t atCenter; float x, y, velocity; };
+struct VelocityRecord { int32_t count; float startVelocity, endVelocity, x, y, angle; };
+struct ChainRecord { int32_t count; float x1, y1, x2, y2, stiffness; };
+struct ClothRecord { int32_t columns, rows; float x, y, spacing, stiffness; };
+struct EmitterRecord { int32_t shape, rate; uint64_t total; float x1, y1, x2, y2, radius, startAngle, endAngle, angle, velocity, lifetime; };
+
+// Walls and particles are written exactly as they sit in memory
+static_assert(sizeof(Wall) == 4 * sizeof(float), "Wall must be four packed floats");
+static_assert(sizeof(Sink) == 4 * sizeof(float), "Sink must be four packed floats");
+static_assert(sizeof(Attractor) == 3 * sizeof(float), "Attractor must be three packed floats");
+static_assert(sizeof(MovingWall) == 11 * sizeof(float), "MovingWall must be eleven packed floats");
+static_assert(sizeof(Particle) == 5 * sizeof(double), "Particle must be five packed doubles");
+static_assert(std::is_trivially_copyable<Wall>::value && std::is_trivially_copyable<Sink>::value
+    && std::is_trivially_copyable<Attractor>::value && std::is_trivially_copyable<MovingWall>::value
+    && std::is_trivially_copyable<Particle>::value,
+    "Walls, sinks, attractors, moving walls and particles are copied as raw bytes");
+
+std::string lineError(const std::string& sourceName, int lineNumber, const std::string& message) {
+    return sourceName + ":" + std::to_string(lineNumber) + ": " + message;
+}
+
+bool finite(sf::Vector2f point) {
+    return std::isfinite(point.x) && std::isfinite(point.y);
+}
+
+// Batch checks shared by the text and binary forms. Each returns why the entry cannot
+// be used, or nullptr if it can.
+const char* countError(double count) {
+    return count < 1 || count != std::floor(count) || count > 2147483647.0 ? "Number of particles must be a positive integer." : nullptr;
+}
+
+const char* stiffnessError(float stiffness) {
+    return stiffness <= 0 || stiffness > 1 ? "Stiffness must be greater than 0 and at most 1." : nullptr;
+}
+
+const char* chainError(const ChainBatch& batch) {
+    if (const char* error = countError(batch.count)) return error;
+    if (batch.count < 2) return "A chain needs at least 2 particles.";
+    return stiffnessError(batch.stiffness);
+}
+
+const char* clothError(const ClothBatch& batch) {
+    if (const char* error = countError(batch.columns)) return error;
+    if (const char* error = countError(batch.rows)) return error;
+    if (static_cast<double>(batch.columns) * batch.rows > 2147483647.0) return "Cloth has too many particles.";
+    if (batch.spacing <= 0) return "Spacing must be greater than 0.";
+    return stiffnessError(batch.stiffness);
+}
+
+const char* fanError(const AngleBatch& batch) {
+    if (const char* error = countError(batch.count)) return error;
+    return batch.startAngle > batch.endAngle ? "Start Theta must be less than End Theta." : nullptr;
+}
+
+const char* sweepError(const VelocityBatch& batch) {
+    if (const char* error = countError(batch.count)) return error;
+    return batch.startVelocity <= 0 || batch.startVelocity >= batch.endVelocity
+        ? "Start Velocity must be greater than 0 and less than End Velocity." : nullptr;
+}
+
+// Reads count items, refusing any count the rest of the file cannot hold before
+// allocating for it
+template <typename T>
+void readArray(std::ifstream& file, uint64_t fileSize, std::vector<T>& out, uint64_t count, const std::string& path) {
+    std::streamoff position = file.tellg();
+    if (position < 0 || count > (fileSize - static_cast<uint64_t>(position)) / sizeof(T)) {
+        throw std::invalid_argument("Scene file '" + path + "' is truncated.");
+    }
+    out.resize(static_cast<size_t>(count));
+    if (count > 0 && !file.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(count * sizeof(T)))) {
+        throw std::invalid_argument("Scene file '" + path + "' is truncated.");
+    }
+}
+
+template <typename T>
+void writeArray(std::ofstream& file, const std::vector<T>& data) {
+    if (!data.empty()) {
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size() * sizeof(T)));
+    }
+}
+
+}
+
+const char* deltaTimeError(double deltaTime) {
+    return !(deltaTime > 0) || !std::isfinite(deltaTime) ? "Time step must be greater than 0." : nullptr;
+}
+
+const char* domainSizeError(double size) {
+    return !(size > 0) || !std::isfinite(size) ? "Domain size must be greater than 0." : nullptr;
+}
+
+const char* wallError(const Wall& wall) {
+    if (!finite(wall.start) || !finite(wall.end)) return "Wall coordinates must be finite.";
+    return wall.start == wall.end ? "Wall start and end points cannot be the same." : nullptr;
+}
+
+const char* absorberError(const Wall& wall) {
+    if (!finite(wall.start) || !finite(wall.end)) return "Absorber coordinates must be finite.";
+    return wall.start == wall.end ? "Absorber start and end points cannot be the same." : nullptr;
+}
+
+const char* movingWallError(const MovingWall& moving) {
+    if (const char* error = wallError(moving.wall)) return error;
+    if (!finite(moving.pivot) || !finite(moving.velocity) || !std::isfinite(moving.spin) || !std::isfinite(moving.period)
+        || !std::isfinite(moving.phase)) {
+        return "Moving wall values must be finite.";
+    }
+    return moving.period < 0 ? "Period cannot be negative." : nullptr;
+}
+
+const char* sinkError(const Sink& sink) {
+    if (!finite(sink.min) || !finite(sink.max)) return "Sink coordinates must be finite.";
+    return !(sink.min.x < sink.max.x) || !(sink.min.y < sink.max.y) ? "Sink must have a nonzero width and height." : nullptr;
+}
+
+const char* attractorError(const Attractor& attractor) {
+    return !finite(attractor.position) || !std::isfinite(attractor.strength) ? "Attractor values must be finite." : nullptr;
+}
+
+const char* particleError(const Particle& particle) {
+    if (!std::isfinite(particle.x) || !std::isfinite(particle.y) || !std::isfinite(particle.vx) || !std::isfinite(particle.vy)
+        || !std::isfinite(particle.radius)) {
+        return "Particle values must be finite.";
+    }
+    return particle.radius > 0 ? nullptr : "Radius must be greater than 0.";
+}
+
+const char* emitterError(const Emitter& emitter) {
+    if (emitter.shape != Emitter::Point && emitter.shape != Emitter::Line && emitter.shape != Emitter::Arc) return "Unknown emitter shape.";
+    if (const char* error = countError(emitter.rate)) return error;
+    if (!finite(sf::Vector2f(emitter.x1, emitter.y1)) || !finite(sf::Vector2f(emitter.x2, emitter.y2)) || !std::isfinite(emitter.radius)
+        || !std::isfinite(emitter.startAngle) || !std::isfinite(emitter.endAngle) || !std::isfinite(emitter.angle)
+        || !std::isfinite(emitter.velocity) || !std::isfinite(emitter.lifetime)) {
+        return "Emitter values must be finite.";
+    }
+    if (emitter.shape == Emitter::Arc && emitter.radius <= 0) return "Radius must be greater than 0.";
+    if (emitter.lifetime < 0) return "Lifetime cannot be negative.";
+    if (emitter.shape != Emitter::Line && emitter.startAngle > emitter.endAngle) return "Start Theta must be less than End Theta.";
+    return nullptr;
+}
+
+Scene parseSceneText(const std::string& text, const std::string& sourceName) {
+    Scene scene;
+    const char* cursor = text.c_str();
+    const char* end = cursor + text.size();
+    int lineNumber = 0;
+
+    while (cursor < end) {
+        ++lineNumber;
+        const char* lineEnd = static_cast<const char*>(std::memchr(cursor, '\n', end - cursor));
+        if (lineEnd == nullptr) {
+            lineEnd = end;
+        }
+        const char* commentStart = static_cast<const char*>(std::memchr(cursor, '#', lineEnd - cursor));
+        const char* contentEnd = commentStart ? commentStart : lineEnd;
+
+        // Keyword
+        const char* p = cursor;
+        while (p < contentEnd && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        const char* keywordStart = p;
+        while (p < contentEnd && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+        std::string keyword(keywordStart, p);
+
+        // Numeric arguments, parsed in place with strtod
+        double args[10];
+        int argCount = 0;
+        while (true) {
+            while (p < contentEnd && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+            if (p >= contentEnd) {
+                break;
+            }
+            if (argCount == 10) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "too many values."));
+            }
+            char* parsedEnd = nullptr;
+            args[argCount] = std::strtod(p, &parsedEnd);
+            if (parsedEnd == p || parsedEnd > contentEnd || (parsedEnd < contentEnd && *parsedEnd != ' ' && *parsedEnd != '\t' && *parsedEnd != '\r')) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "expected a number."));
+            }
+            ++argCount;
+            p = parsedEnd;
+        }
+
+        cursor = lineEnd + 1;
+        if (keyword.empty()) {
+            continue;
+        }
+
+        auto expectArgs = [&](int minCount, int maxCount) {
+            if (argCount < minCount || argCount > maxCount) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "wrong number of values for '" + keyword + "'."));
+            }
+        };
+        auto check = [&](const char* error) {
+            if (error != nullptr) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, error));
+            }
+        };
+        auto expectCount = [&](double count) {
+            check(countError(count));
+            return static_cast<int>(count);
+        };
+
+        if (keyword == "dt") {
+            expectArgs(1, 1);
+            check(deltaTimeError(args[0]));
+            scene.deltaTime = args[0];
+            scene.hasDeltaTime = true;
+        }
+        else if (keyword == "width" || keyword == "height") {
+            expectArgs(1, 1);
+            check(domainSizeError(args[0]));
+            if (keyword == "width") {
+                scene.simWidth = args[0];
+                scene.hasWidth = true;
+            }
+            else {
+                scene.simHeight = args[0];
+                scene.hasHeight = true;
+            }
+        }
+        else if (keyword == "wall") {
+            expectArgs(4, 4);
+            Wall wall(static_cast<float>(args[0]), static_cast<float>(args[1]), static_cast<float>(args[2]), static_cast<float>(args[3]));
+            check(wallError(wall));
+            scene.walls.push_back(wall);
+        }
+        else if (keyword == "moving") {
+            if (argCount != 6 && argCount != 7 && argCount != 8 && argCount != 10) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "wrong number of values for 'moving'."));
+            }
+            MovingWall moving(Wall(static_cast<float>(args[0]), static_cast<float>(args[1]), static_cast<float>(args[2]), static_cast<float>(args[3])),
+                static_cast<float>(args[4]), static_cast<float>(args[5]));
+            if (argCount > 6) moving.spin = static_cast<float>(args[6] * (M_PI / 180.0));
+            if (argCount > 7) moving.period = static_cast<float>(args[7]);
+            if (argCount > 8) moving.pivot = sf::Vector2f(static_cast<float>(args[8]), static_cast<float>(args[9]));
+            check(movingWallError(moving));
+            scene.movingWalls.push_back(moving);
+        }
+        else if (keyword == "absorber") {
+            expectArgs(4, 4);
+            Wall absorber(static_cast<float>(args[0]), static_cast<float>(args[1]), static_cast<float>(args[2]), static_cast<float>(args[3]));
+            check(absorberError(absorber));
+            scene.absorbers.push_back(absorber);
+        }
+        else if (keyword == "sink") {
+            expectArgs(4, 4);
+            Sink sink(static_cast<float>(args[0]), static_cast<float>(args[1]), static_cast<float>(args[2]), static_cast<float>(args[3]));
+            check(sinkError(sink));
+            scene.sinks.push_back(sink);
+        }
+        else if (keyword == "attractor") {
+            expectArgs(3, 3);
+            Attractor attractor(static_cast<float>(args[0]), static_cast<float>(args[1]), static_cast<float>(args[2]));
+            check(attractorError(attractor));
+            scene.attractors.push_back(attractor);
+        }
+        else if (keyword == "chain") {
+            expectArgs(5, 6);
+            ChainBatch batch;
+            batch.count = expectCount(args[0]);
+            batch.x1 = static_cast<float>(args[1]);
+            batch.y1 = static_cast<float>(args[2]);
+            batch.x2 = static_cast<float>(args[3]);
+            batch.y2 = static_cast<float>(args[4]);
+            if (argCount > 5) batch.stiffness = static_cast<float>(args[5]);
+            check(chainError(batch));
+            scene.chainBatches.push_back(batch);
+        }
+        else if (keyword == "cloth") {
+            expectArgs(5, 6);
+            ClothBatch batch;
+            batch.columns = expectCount(args[0]);
+            batch.rows = expectCount(args[1]);
+            batch.x = static_cast<float>(args[2]);
+            batch.y = static_cast<float>(args[3]);
+            batch.spacing = static_cast<float>(args[4]);
+            if (argCount > 5) batch.stiffness = static_cast<float>(args[5]);
+            check(clothError(batch));
+            scene.clothBatches.push_back(batch);
+        }
+        else if (keyword == "particle") {
+            expectArgs(4, 5);
+            double radius = argCount > 4 ? args[4] : particleRadius;
+            if (args[3] <= 0) throw std::invalid_argument(lineError(sourceName, lineNumber, "Velocity must be greater than 0."));
+            Particle particle(args[0], args[1], args[2], args[3], radius);
+            check(particleError(particle));
+            scene.particles.push_back(particle);
+        }
+        else if (keyword == "line") {
+            expectArgs(5, 7);
+            LineBatch batch;
+            batch.count = expectCount(args[0]);
+            batch.x1 = static_cast<float>(args[1]);
+            batch.y1 = static_cast<float>(args[2]);
+            batch.x2 = static_cast<float>(args[3]);
+            batch.y2 = static_cast<float>(args[4]);
+            if (argCount > 5) batch.velocity = static_cast<float>(args[5]);
+            if (argCount > 6) batch.angle = static_cast<float>(args[6]);
+            scene.lineBatches.push_back(batch);
+        }
+        else if (keyword == "fan") {
+            if (argCount != 3 && argCount != 5 && argCount != 6) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "wrong number of values for 'fan'."));
+            }
+            AngleBatch batch;
+            batch.count = expectCount(args[0]);
+            batch.startAngle = static_cast<float>(args[1]);
+            batch.endAngle = static_cast<float>(args[2]);
+            if (argCount >= 5) {
+                batch.atCenter = false;
+                batch.x = static_cast<float>(args[3]);
+                batch.y = static_cast<float>(args[4]);
+            }
+            if (argCount == 6) batch.velocity = static_cast<float>(args[5]);
+            check(fanError(batch));
+            scene.angleBatches.push_back(batch);
+        }
+        else if (keyword == "sweep") {
+            if (argCount != 3 && argCount != 5 && argCount != 6) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "wrong number of values for 'sweep'."));
+            }
+            VelocityBatch batch;
+            batch.count = expectCount(args[0]);
+            batch.startVelocity = static_cast<float>(args[1]);
+            batch.endVelocity = static_cast<float>(args[2]);
+            if (argCount >= 5) {
+                batch.x = static_cast<float>(args[3]);
+                batch.y = static_cast<float>(args[4]);
+            }
+            if (argCount == 6) batch.angle = static_cast<float>(args[5]);
+            check(sweepError(batch));
+            scene.velocityBatches.push_back(batch);
+        }
+        else if (keyword == "point-source" || keyword == "line-source" || keyword == "arc-source") {
+            Emitter emitter;
+            int valueCount = 0;
+            if (keyword == "point-source") {
+                expectArgs(6, 8);
+                emitter.shape = Emitter::Point;
+                emitter.x1 = static_cast<float>(args[2]);
+                emitter.y1 = static_cast<float>(args[3]);
+                emitter.startAngle = static_cast<float>(args[4]);
+                emitter.endAngle = static_cast<float>(args[5]);
+                valueCount = 6;
+            }
+            else if (keyword == "line-source") {
+                expectArgs(6, 9);
+                emitter.shape = Emitter::Line;
+                emitter.x1 = static_cast<float>(args[2]);
+                emitter.y1 = static_cast<float>(args[3]);
+                emitter.x2 = static_cast<float>(args[4]);
+                emitter.y2 = static_cast<float>(args[5]);
+                if (argCount > 7) emitter.angle = static_cast<float>(args[7]);
+                valueCount = 6;
+            }
+            else {
+                expectArgs(7, 9);
+                emitter.shape = Emitter::Arc;
+                emitter.x1 = static_cast<float>(args[2]);
+                emitter.y1 = static_cast<float>(args[3]);
+                emitter.radius = static_cast<float>(args[4]);
+                emitter.startAngle = static_cast<float>(args[5]);
+                emitter.endAngle = static_cast<float>(args[6]);
+                valueCount = 7;
+            }
+            emitter.rate = expectCount(args[0]);
+            if (args[1] < 0 || args[1] != std::floor(args[1])) {
+                throw std::invalid_argument(lineError(sourceName, lineNumber, "Total must be a non-negative integer."));
+            }
+            emitter.total = static_cast<uint64_t>(args[1]);
+            if (argCount > valueCount) emitter.velocity = static_cast<float>(args[valueCount]);
+            int lifetimeIndex = emitter.shape == Emitter::Line ? valueCount + 2 : valueCount + 1;
+            if (argCount > lifetimeIndex) emitter.lifetime = static_cast<float>(args[lifetimeIndex]);
+            check(emitterError(emitter));
+            scene.emitters.push_back(emitter);
+        }
+        else {
+            throw std::invalid_argument(lineError(sourceName, lineNumber, "unknown entry '" + keyword + "'."));
+        }
+    }
+
+    return scene;
+}
+
+Scene loadSceneBinary(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::invalid_argument("Could not open scene file '" + path + "'.");
+    }
+
+    SceneFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, sceneMagic, sizeof(sceneMagic)) != 0) {
+        throw std::invalid_argument("'" + path + "' is not a binary scene file.");
+    }
+    if (header.version != sceneVersion) {
+        throw std::invalid_argument("Scene file '" + path + "' has unsupported version " + std::to_string(header.version) + ".");
+    }
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(static_cast<std::streamoff>(sizeof(header)));
+
+    Scene scene;
+    scene.hasDeltaTime = (header.flags & HasDeltaTime) != 0;
+    scene.hasWidth = (header.flags & HasWidth) != 0;
+    scene.hasHeight = (header.flags & HasHeight) != 0;
+    scene.deltaTime = header.deltaTime;
+    scene.simWidth = header.simWidth;
+    scene.simHeight = header.simHeight;
+
+    readArray(file, fileSize, scene.walls, header.wallCount, path);
+    readArray(file, fileSize, scene.particles, header.particleCount, path);
+
+    std::vector<LineRecord> lines;
+    std::vector<AngleRecord> fans;
+    std::vector<VelocityRecord> sweeps;
+    readArray(file, fileSize, lines, header.lineCount, path);
+    readArray(file, fileSize, fans, header.fanCount, path);
+    readArray(file, fileSize, sweeps, header.sweepCount, path);
+    std::vector<EmitterRecord> emitters;
+    readArray(file, fileSize, emitters, header.emitterCount, path);
+    readArray(file, fileSize, scene.absorbers, header.absorberCount, path);
+    readArray(file, fileSize, scene.sinks, header.sinkCount, path);
+    readArray(file, fileSize, scene.attractors, header.attractorCount, path);
+    std::vector<ChainRecord> chains;
+    std::vector<ClothRecord> cloths;
+    readArray(file, fileSize, chains, header.chainCount, path);
+    readArray(file, fileSize, cloths, header.clothCount, path);
+    readArray(file, fileSize, scene.movingWalls, header.movingWallCount, path);
+
+    auto check = [&](const char* error) {
+        if (error != nullptr) {
+            throw std::invalid_argument("Scene file '" + path + "': " + error);
+        }
+    };
+    if (scene.hasDeltaTime) check(deltaTimeError(scene.deltaTime));
+    if (scene.hasWidth) check(domainSizeError(scene.simWidth));
+    if (scene.hasHeight) check(domainSizeError(scene.simHeight));
+    for (const auto& wall : scene.walls) {
+        check(wallError(wall));
+    }
+    for (const auto& moving : scene.movingWalls) {
+        check(movingWallError(moving));
+    }
+    for (const auto& absorber : scene.absorbers) {
+        check(absorberError(absorber));
+    }
+    for (const auto& sink : scene.sinks) {
+        check(sinkError(sink));
+    }
+    for (const auto& attractor : scene.attractors) {
+        check(attractorError(attractor));
+    }
+    for (const auto& particle : scene.particles) {
+        check(particleError(particle));
+    }
+    for (const auto& record : lines) {
+        check(countError(record.count));
+        scene.lineBatches.push_back({ record.count, record.x1, record.y1, record.x2, record.y2, record.velocity, record.angle });
+    }
+    for (const auto& record : fans) {
+        scene.angleBatches.push_back({ record.count, record.startAngle, record.endAngle, record.atCenter != 0, record.x, record.y, record.velocity });
+        check(fanError(scene.angleBatches.back()));
+    }
+    for (const auto& record : sweeps) {
+        scene.velocityBatches.push_back({ record.count, record.startVelocity, record.endVelocity, record.x, record.y, record.angle });
+        check(sweepError(scene.velocityBatches.back()));
+    }
+    for (const auto& record : emitters) {
+        Emitter emitter;
+        emitter.shape = static_cast<Emitter::Shape>(record.shape);
+        emitter.rate = record.rate;
+        emitter.total = record.total;
+        emitter.x1 = record.x1;
+        emitter.y1 = record.y1;
+        emitter.x2 = record.x2;
+        emitter.y2 = record.y2;
+        emitter.radius = record.radius;
+        emitter.startAngle = record.startAngle;
+        emitter.endAngle = record.endAngle;
+        emitter.angle = record.angle;
+        emitter.velocity = record.velocity;
+        emitter.lifetime = record.lifetime;
+        check(emitterError(emitter));
+        scene.emitters.push_back(emitter);
+    }
+    for (const auto& record : chains) {
+        scene.chainBatches.push_back({ record.count, record.x1, record.y1, record.x2, record.y2, record.stiffness });
+        check(chainError(scene.chainBatches.back()));
+    }
+    for (const auto& record : cloths) {
+        scene.clothBatches.push_back({ record.columns, record.rows, record.x, record.y, record.spacing, record.stiffness });
+        check(clothError(scene.clothBatches.back()));
+    }
+    return scene;
+}
+
+Scene loadScene(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::invalid_argument("Could not open scene file '" + path + "'.");
+    }
+
+    char magic[sizeof(sceneMagic)] = {};
+    file.read(magic, sizeof(magic));
+    if (file.gcount() == sizeof(magic) && std::memcmp(magic, sceneMagic, sizeof(sceneMagic)) == 0) {
+        file.close();
+        return loadSceneBinary(path);
+    }
+
+    // Read the whole text file at once and parse it in place
+    file.clear();
+    file.seekg(0, std::ios::end);
+    std::string text(static_cast<size_t>(file.tellg()), '\0');
+    file.seekg(0);
+    file.read(&text[0], static_cast<std::streamsize>(text.size()));
+    return parseSceneText(text, path);
+}
+
+void saveSceneText(const std::string& path, const Scene& scene) {
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        throw std::invalid_argument("Could not write scene file '" + path + "'.");
+    }
+
+    std::fprintf(file, "# Particle Simulator scene\n");
+    if (scene.hasDeltaTime) std::fprintf(file, "dt %.17g\n", scene.deltaTime);
+    if (scene.hasWidth) std::fprintf(file, "width %.17g\n", scene.simWidth);
+    if (scene.hasHeight) std::fprintf(file, "height %.17g\n", scene.simHeight);
+
+    for (const auto& wall : scene.walls) {
+        std::fprintf(file, "wall %.9g %.9g %.9g %.9g\n", wall.start.x, wall.start.y, wall.end.x, wall.end.y);
+    }
+    for (const auto& moving : scene.movingWalls) {
+        // The text form has no phase, so a stroke always starts on its outward half
+        std::fprintf(file, "moving %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n", moving.wall.start.x, moving.wall.start.y,
+            moving.wall.end.x, moving.wall.end.y, moving.velocity.x, moving.velocity.y, moving.spin * (180.0 / M_PI), moving.period,
+            moving.pivot.x, moving.pivot.y);
+    }
+    for (const auto& wall : scene.absorbers) {
+        std::fprintf(file, "absorber %.9g %.9g %.9g %.9g\n", wall.start.x, wall.start.y, wall.end.x, wall.end.y);
+    }
+    for (const auto& sink : scene.sinks) {
+        std::fprintf(file, "sink %.9g %.9g %.9g %.9g\n", sink.min.x, sink.min.y, sink.max.x, sink.max.y);
+    }
+    for (const auto& attractor : scene.attractors) {
+        std::fprintf(file, "attractor %.9g %.9g %.9g\n", attractor.position.x, attractor.position.y, attractor.strength);
+    }
+    for (const auto& particle : scene.particles) {
+        // Stored as velocity components; the text form uses the same angle/speed as the input forms
+        double angle = std::atan2(-particle.vy, particle.vx) * (180.0 / M_PI);
+        if (angle < 0) angle += 360.0;
+        double velocity = std::sqrt(particle.vx * particle.vx + particle.vy * particle.vy);
+        std::fprintf(file, "particle %.17g %.17g %.17g %.17g %.17g\n", particle.x, particle.y, angle, velocity, particle.radius);
+    }
+    for (const auto& batch : scene.lineBatches) {
+        std::fprintf(file, "line %d %.9g %.9g %.9g %.9g %.9g %.9g\n", batch.count, batch.x1, batch.y1, batch.x2, batch.y2, batch.velocity, batch.angle);
+    }
+    for (const auto& batch : scene.angleBatches) {
+        if (batch.atCenter) {
+            std::fprintf(file, "fan %d %.9g %.9g\n", batch.count, batch.startAngle, batch.endAngle);
+        }
+        else {
+            std::fprintf(file, "fan %d %.9g %.9g %.9g %.9g %.9g\n", batch.count, batch.startAngle, batch.endAngle, batch.x, batch.y, batch.velocity);
+        }
+    }
+    for (const auto& batch : scene.velocityBatches) {
+        std::fprintf(file, "sweep %d %.9g %.9g %.9g %.9g %.9g\n", batch.count, batch.startVelocity, batch.endVelocity, batch.x, batch.y, batch.angle);
+    }
+    for (const auto& emitter : scene.emitters) {
+        unsigned long long total = static_cast<unsigned long long>(emitter.total);
+        if (emitter.shape == Emitter::Point) {
+            std::fprintf(file, "point-source %d %llu %.9g %.9g %.9g %.9g %.9g", emitter.rate, total,
+                emitter.x1, emitter.y1, emitter.startAngle, emitter.endAngle, emitter.velocity);
+        }
+        else if (emitter.shape == Emitter::Line) {
+            std::fprintf(file, "line-source %d %llu %.9g %.9g %.9g %.9g %.9g %.9g", emitter.rate, total,
+                emitter.x1, emitter.y1, emitter.x2, emitter.y2, emitter.velocity, emitter.angle);
+        }
+        else {
+            std::fprintf(file, "arc-source %d %llu %.9g %.9g %.9g %.9g %.9g %.9g", emitter.rate, total,
+                emitter.x1, emitter.y1, emitter.radius, emitter.startAngle, emitter.endAngle, emitter.velocity);
+        }
+        if (emitter.lifetime > 0) std::fprintf(file, " %.9g", emitter.lifetime);
+        std::fprintf(file, "\n");
+    }
+    for (const auto& batch : scene.chainBatches) {
+        std::fprintf(file, "chain %d %.9g %.9g %.9g %.9g %.9g\n", batch.count, batch.x1, batch.y1, batch.x2, batch.y2, batch.stiffness);
+    }
+    for (const auto& batch : scene.clothBatches) {
+        std::fprintf(file, "cloth %d %d %.9g %.9g %.9g %.9g\n", batch.columns, batch.rows, batch.x, batch.y, batch.spacing, batch.stiffness);
+    }
+
+    bool failed = std::ferror(file) != 0;
+    if (std::fclose(file) != 0 || failed) {
+        throw std::invalid_argument("Could not write scene file '" + path + "'.");
+    }
+}
+
+void saveSceneBinary(const std::string& path, const Scene& scene) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::invalid_argument("Could not write scene file '" + path + "'.");
+    }
+
+    SceneFileHeader header = {};
+    std::memcpy(header.magic, sceneMagic, sizeof(sceneMagic));
+    header.version = sceneVersion;
+    header.flags = (scene.hasDeltaTime ? static_cast<uint32_t>(HasDeltaTime) : 0u) | (scene.hasWidth ? static_cast<uint32_t>(HasWidth) : 0u)
+        | (scene.hasHeight ? static_cast<uint32_t>(HasHeight) : 0u);
+    header.deltaTime = scene.deltaTime;
+    header.simWidth = scene.simWidth;
+    header.simHeight = scene.simHeight;
+    header.wallCount = scene.walls.size();
+    header.particleCount = scene.particles.size();
+    header.lineCount = scene.lineBatches.size();
+    header.fanCount = scene.angleBatches.size();
+    header.sweepCount = scene.velocityBatches.size();
+    header.emitterCount = scene.emitters.size();
+    header.absorberCount = scene.absorbers.size();
+    header.sinkCount = scene.sinks.size();
+    header.attractorCount = scene.attractors.size();
+    header.chainCount = scene.chainBatches.size();
+    header.clothCount = scene.clothBatches.size();
+    header.movingWallCount = scene.movingWalls.size();
+
+    std::vector<LineRecord> lines;
+    std::vector<AngleRecord> fans;
+    std::vector<VelocityRecord> sweeps;
+    for (const auto& batch : scene.lineBatches) {
+        lines.push_back({ batch.count, batch.x1, batch.y1, batch.x2, batch.y2, batch.velocity, batch.angle });
+    }
+    for (const auto& batch : scene.angleBatches) {
+        fans.push_back({ batch.count, batch.startAngle, batch.endAngle, batch.atCenter ? 1 : 0, batch.x, batch.y, batch.velocity });
+    }
+    for (const auto& batch : scene.velocityBatches) {
+        sweeps.push_back({ batch.count, batch.startVelocity, batch.endVelocity, batch.x, batch.y, batch.angle });
+    }
+    std::vector<EmitterRecord> emitters;
+    for (const auto& emitter : scene.emitters) {
+        emitters.push_back({ emitter.shape, emitter.rate, emitter.total, emitter.x1, emitter.y1, emitter.x2, emitter.y2,
+            emitter.radius, emitter.startAngle, emitter.endAngle, emitter.angle, emitter.velocity, emitter.lifetime });
+    }
+    std::vector<ChainRecord> chains;
+    std::vector<ClothRecord> cloths;
+    for (const auto& batch : scene.chainBatches) {
+        chains.push_back({ batch.count, batch.x1, batch.y1, batch.x2, batch.y2, batch.stiffness });
+    }
+    for (const auto& batch : scene.clothBatches) {
+        cloths.push_back({ batch.columns, batch.rows, batch.x, batch.y, batch.spacing, batch.stiffness });
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(file, scene.walls);
+    writeArray(file, scene.particles);
+    writeArray(file, lines);
+    writeArray(file, fans);
+    writeArray(file, sweeps);
+    writeArray(file, emitters);
+    writeArray(file, scene.absorbers);
+    writeArray(file, scene.sinks);
+    writeArray(file, scene.attractors);
+    writeArray(file, chains);
+    writeArray(file, cloths);
+    writeArray(file, scene.movingWalls);
+
+    if (!file) {
+        throw std::invalid_argument("Could not write scene file '" + path + "'.");
+    }
+}
+
+void saveScene(const std::string& path, const Scene& scene) {
+    const std::string binaryExtension = ".pscene";
+    bool binary = path.size() >= binaryExtension.size()
+        && path.compare(path.size() - binaryExtension.size(), binaryExtension.size(), binaryExtension) == 0;
+    if (binary) {
+        saveSceneBinary(path, scene);
+    }
+    else {
+        saveSceneText(path, scene);
+    }
+}
+
+void applyScene(const Scene& scene, Simulation& simulation) {
+    simulation.walls.insert(simulation.walls.end(), scene.walls.begin(), scene.walls.end());
+    simulation.movingWalls.insert(simulation.movingWalls.end(), scene.movingWalls.begin(), scene.movingWalls.end());
+    simulation.emitters.insert(simulation.emitters.end(), scene.emitters.begin(), scene.emitters.end());
+    simulation.absorbers.insert(simulation.absorbers.end(), scene.absorbers.begin(), scene.absorbers.end());
+    simulation.sinks.insert(simulation.sinks.end(), scene.sinks.begin(), scene.sinks.end());
+    simulation.attractors.insert(simulation.attractors.end(), scene.attractors.begin(), scene.attractors.end());
+
+    size_t generated = 0;
+    for (const auto& batch : scene.lineBatches) generated += batch.count;
+    for (const auto& batch : scene.angleBatches) generated += batch.count;
+    for (const auto& batch : scene.velocityBatches) generated += batch.count;
+    for (const auto& batch : scene.chainBatches) generated += batch.count;
+    for (const auto& batch : scene.clothBatches) generated += static_cast<size_t>(batch.columns) * batch.rows;
+    simulation.particles.reserve(simulation.particles.size() + scene.particles.size() + generated);
+
+    simulation.particles.insert(simulation.particles.end(), scene.particles.begin(), scene.particles.end());
+    for (const auto& batch : scene.lineBatches) {
+        addLineBatch(simulation, batch);
+    }
+    for (const auto& batch : scene.angleBatches) {
+        addAngleBatch(simulation, batch);
+    }
+    for (const auto& batch : scene.velocityBatches) {
+        addVelocityBatch(simulation, batch);
+    }
+    for (const auto& batch : scene.chainBatches) {
+        addChain(simulation, batch);
+    }
+    for (const auto& batch : scene.clothBatches) {
+        addCloth(simulation, batch);
+    }
+}
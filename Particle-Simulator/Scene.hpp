@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Generators.hpp"
+#include "Particle.hpp"
+#include "Wall.hpp"
+#include <string>
+#include <vector>
+
+class Simulation;
+
+// Everything needed to set up a run: simulation parameters, walls, explicit
+// particles and batch generator definitions.
+//
+// Text form (one entry per line, # starts a comment):
+//   dt 1
+//   width 1280
+//   height 720
+//   wall x1 y1 x2 y2
+//   moving x1 y1 x2 y2 vx vy [spin [period [pivotX pivotY]]]
+//                                 (spin in degrees per unit time, clockwise; pivot defaults to the middle)
+//   absorber x1 y1 x2 y2          (a wall that despawns the particles hitting it)
+//   sink x1 y1 x2 y2              (a box that despawns the particles entering it)
+//   attractor x y strength        (pulls every particle toward it; negative strengths push)
+//   particle x y angle velocity [radius]
+//   line count x1 y1 x2 y2 [velocity angle]
+//   fan count startAngle endAngle [x y [velocity]]    (defaults to the domain center)
+//   sweep count startVelocity endVelocity [x y [angle]]
+//   point-source rate total x y startAngle endAngle [velocity [lifetime]]    (total 0 never runs out)
+//   line-source rate total x1 y1 x2 y2 [velocity angle [lifetime]]
+//   arc-source rate total x y radius startAngle endAngle [velocity [lifetime]]
+//   chain count x1 y1 x2 y2 [stiffness]           (particles at rest joined in a line)
+//   cloth columns rows x y spacing [stiffness]    (a grid of particles at rest joined to their neighbors)
+//
+// Binary form: a fixed header followed by raw little-endian arrays, so the walls,
+// particles and batches each load with a single read.
+struct Scene {
+    bool hasDeltaTime = false, hasWidth = false, hasHeight = false;
+    double deltaTime = 1;
+    double simWidth = 1280;
+    double simHeight = 720;
+
+    std::vector<Wall> walls;
+    std::vector<MovingWall> movingWalls;
+    std::vector<Particle> particles; // Explicit particles, stored with their velocity components
+    std::vector<LineBatch> lineBatches;
+    std::vector<AngleBatch> angleBatches;
+    std::vector<VelocityBatch> velocityBatches;
+    std::vector<Emitter> emitters;
+    std::vector<Wall> absorbers;
+    std::vector<Sink> sinks;
+    std::vector<Attractor> attractors;
+    std::vector<ChainBatch> chainBatches;
+    std::vector<ClothBatch> clothBatches;
+};
+
+// Checks shared by scene files, checkpoints and the control socket. Each returns why
+// the value cannot be used, or nullptr if it can.
+const char* deltaTimeError(double deltaTime);
+const char* domainSizeError(double size);
+const char* wallError(const Wall& wall);
+const char* absorberError(const Wall& wall);
+const char* movingWallError(const MovingWall& moving);
+const char* sinkError(const Sink& sink);
+const char* attractorError(const Attractor& attractor);
+const char* particleError(const Particle& particle);
+const char* emitterError(const Emitter& emitter);
+
+// Loads either form; binary files are recognised by their header.
+// Throws std::invalid_argument if the file cannot be read or is malformed.
+Scene loadScene(const std::string& path);
+Scene parseSceneText(const std::string& text, const std::string& sourceName);
+Scene loadSceneBinary(const std::string& path);
+
+void saveSceneText(const std::string& path, const Scene& scene);
+void saveSceneBinary(const std::string& path, const Scene& scene);
+
+// Saves in binary form when the path ends in .pscene, otherwise as text
+void saveScene(const std::string& path, const Scene& scene);
+
+// Adds the scene's walls, moving walls, absorbers, sinks, attractors, particles and emitters to the simulation and runs its batch,
+// chain and cloth generators
+void applyScene(const Scene& scene, Simulation& simulation);
@@ -0,0 +1,270 @@
+#include "SharedState.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char sharedStateMagic[4] = { 'P', 'S', 'H', 'M' };
+const uint32_t sharedStateVersion = 1;
+const uint64_t sharedStateAlignment = 64;
+const size_t minimumCapacity = 4096;
+
+uint64_t alignUp(uint64_t offset) {
+    return (offset + sharedStateAlignment - 1) / sharedStateAlignment * sharedStateAlignment;
+}
+
+uint64_t bufferBytes(size_t capacity) {
+    return alignUp(capacity * sizeof(Particle));
+}
+
+std::string generationName(const std::string& baseName, uint32_t generation) {
+    return generation == 0 ? baseName : baseName + "." + std::to_string(generation);
+}
+
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<SharedSegment> SharedSegment::create(const std::string& name, size_t size) {
+    std::unique_ptr<SharedSegment> segment(new SharedSegment());
+    segment->name = "Local\\" + name;
+    segment->owner = true;
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), segment->name.c_str());
+    if (mapping == nullptr) {
+        throw std::invalid_argument("Could not create shared memory '" + name + "'.");
+    }
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        throw std::invalid_argument("Shared memory '" + name + "' is already in use.");
+    }
+    segment->mappingHandle = mapping;
+    segment->bytes = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+    if (segment->bytes == nullptr) {
+        throw std::invalid_argument("Could not map shared memory '" + name + "'.");
+    }
+    segment->length = size;
+    return segment;
+}
+
+std::unique_ptr<SharedSegment> SharedSegment::open(const std::string& name) {
+    std::unique_ptr<SharedSegment> segment(new SharedSegment());
+    segment->name = "Local\\" + name;
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, segment->name.c_str());
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    segment->mappingHandle = mapping;
+    segment->bytes = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+    if (segment->bytes == nullptr) {
+        return nullptr;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(segment->bytes, &info, sizeof(info));
+    segment->length = info.RegionSize;
+    return segment;
+}
+
+SharedSegment::~SharedSegment() {
+    // Windows removes the name once the last handle is closed
+    if (bytes != nullptr) UnmapViewOfFile(bytes);
+    if (mappingHandle != nullptr) CloseHandle(mappingHandle);
+}
+
+#else
+
+std::unique_ptr<SharedSegment> SharedSegment::create(const std::string& name, size_t size) {
+    std::unique_ptr<SharedSegment> segment(new SharedSegment());
+    segment->name = "/" + name;
+    shm_unlink(segment->name.c_str()); // Left behind by a simulator that crashed
+    int descriptor = shm_open(segment->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (descriptor < 0) {
+        throw std::invalid_argument("Could not create shared memory '" + name + "'.");
+    }
+    segment->owner = true;
+    if (ftruncate(descriptor, static_cast<off_t>(size)) != 0) {
+        close(descriptor);
+        throw std::invalid_argument("Could not size shared memory '" + name + "'.");
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        throw std::invalid_argument("Could not map shared memory '" + name + "'.");
+    }
+    segment->bytes = static_cast<unsigned char*>(mapping);
+    segment->length = size;
+    return segment;
+}
+
+std::unique_ptr<SharedSegment> SharedSegment::open(const std::string& name) {
+    std::unique_ptr<SharedSegment> segment(new SharedSegment());
+    segment->name = "/" + name;
+    int descriptor = shm_open(segment->name.c_str(), O_RDWR, 0);
+    if (descriptor < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(SharedStateHeader))) {
+        close(descriptor);
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    segment->bytes = static_cast<unsigned char*>(mapping);
+    segment->length = static_cast<size_t>(info.st_size);
+    return segment;
+}
+
+SharedSegment::~SharedSegment() {
+    if (bytes != nullptr) munmap(bytes, length);
+    if (owner) shm_unlink(name.c_str());
+}
+
+#endif
+
+SharedStateExporter::SharedStateExporter(const std::string& name)
+    : baseName(name) {
+    createSegment(minimumCapacity);
+}
+
+void SharedStateExporter::createSegment(size_t capacity) {
+    uint64_t firstBuffer = alignUp(sizeof(SharedStateHeader));
+    uint64_t size = firstBuffer + sharedStateBufferCount * bufferBytes(capacity);
+    std::unique_ptr<SharedSegment> segment = SharedSegment::create(generationName(baseName, generation), static_cast<size_t>(size));
+
+    SharedStateHeader* created = new (segment->data()) SharedStateHeader();
+    std::memcpy(created->magic, sharedStateMagic, sizeof(sharedStateMagic));
+    created->version = sharedStateVersion;
+    created->headerSize = sizeof(SharedStateHeader);
+    created->bufferCount = sharedStateBufferCount;
+    created->capacity = capacity;
+    created->segmentSize = size;
+    created->particleStride = sizeof(Particle);
+    created->xOffset = offsetof(Particle, x);
+    created->yOffset = offsetof(Particle, y);
+    created->vxOffset = offsetof(Particle, vx);
+    created->vyOffset = offsetof(Particle, vy);
+    created->radiusOffset = offsetof(Particle, radius);
+    created->nextGeneration.store(0);
+    created->latest.store(0);
+    for (uint32_t i = 0; i < sharedStateBufferCount; ++i) {
+        created->buffers[i].sequence.store(0);
+        created->buffers[i].offset = firstBuffer + i * bufferBytes(capacity);
+    }
+
+    // Readers of the old segment move over once they see the new generation
+    if (header != nullptr) {
+        header->nextGeneration.store(generation, std::memory_order_release);
+    }
+    header = created;
+    segments.push_back(std::move(segment));
+}
+
+void SharedStateExporter::publish(const Simulation& simulation) {
+    size_t count = simulation.particles.size();
+    if (count > header->capacity) {
+        ++generation;
+        createSegment(std::max<size_t>(count * 2, static_cast<size_t>(header->capacity) * 2));
+    }
+
+    uint32_t index = static_cast<uint32_t>((header->latest.load(std::memory_order_relaxed) + 1) % sharedStateBufferCount);
+    SharedBufferInfo& buffer = header->buffers[index];
+
+    uint64_t sequence = buffer.sequence.load(std::memory_order_relaxed);
+    buffer.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    buffer.step = simulation.stepCount;
+    buffer.time = simulation.time;
+    buffer.simWidth = simulation.simWidth;
+    buffer.simHeight = simulation.simHeight;
+    buffer.particleCount = count;
+    if (count > 0) {
+        std::memcpy(segments.back()->data() + buffer.offset, simulation.particles.data(), count * sizeof(Particle));
+    }
+
+    buffer.sequence.store(sequence + 2, std::memory_order_release);
+    header->latest.store(index, std::memory_order_release);
+}
+
+SharedStateReader::SharedStateReader(const std::string& name)
+    : baseName(name) {
+    connect();
+}
+
+bool SharedStateReader::connect() {
+    header = nullptr;
+    uint32_t generation = 0;
+    while (true) {
+        segment = SharedSegment::open(generationName(baseName, generation));
+        if (!segment || segment->size() < sizeof(SharedStateHeader)) {
+            segment.reset();
+            return false;
+        }
+        SharedStateHeader* candidate = reinterpret_cast<SharedStateHeader*>(segment->data());
+        if (std::memcmp(candidate->magic, sharedStateMagic, sizeof(sharedStateMagic)) != 0 || candidate->version != sharedStateVersion
+            || candidate->particleStride != sizeof(Particle) || candidate->segmentSize > segment->size()) {
+            segment.reset();
+            return false;
+        }
+        uint32_t next = candidate->nextGeneration.load(std::memory_order_acquire);
+        if (next == 0) {
+            header = candidate;
+            return true;
+        }
+        generation = next;
+    }
+}
+
+bool SharedStateReader::acquire(View& view) {
+    if (header == nullptr || header->nextGeneration.load(std::memory_order_acquire) != 0) {
+        if (!connect()) {
+            return false;
+        }
+    }
+
+    while (true) {
+        uint32_t index = static_cast<uint32_t>(header->latest.load(std::memory_order_acquire));
+        const SharedBufferInfo& buffer = header->buffers[index];
+        uint64_t sequence = buffer.sequence.load(std::memory_order_acquire);
+        if (sequence == 0) {
+            return false; // Nothing published yet
+        }
+        if (sequence & 1) {
+            continue; // Only possible if the writer lapped us; the next latest is complete
+        }
+
+        view.step = buffer.step;
+        view.time = buffer.time;
+        view.particleCount = std::min<uint64_t>(buffer.particleCount, header->capacity);
+        view.particles = reinterpret_cast<const Particle*>(segment->data() + buffer.offset);
+        view.buffer = index;
+        view.sequence = sequence;
+        if (stillValid(view)) {
+            return true;
+        }
+    }
+}
+
+bool SharedStateReader::stillValid(const View& view) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return header->buffers[view.buffer].sequence.load(std::memory_order_relaxed) == view.sequence;
+}
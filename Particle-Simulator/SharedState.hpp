@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Particle.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Simulation;
+
+// Publishes the particle array in a named shared-memory segment so other processes
+// can read the latest step in place.
+//
+// The segment starts with a SharedStateHeader followed by three particle buffers,
+// each 64-byte aligned. The simulator fills the buffer after the latest one and then
+// points latest at it, so it never waits for readers. Each buffer carries a sequence
+// number that is odd while the buffer is being written (a seqlock): a reader notes
+// the sequence, uses the data in place, then checks the sequence is unchanged.
+// A reader has at least two publishes' worth of time before its buffer is reused.
+//
+// If the particle count outgrows the buffers the simulator creates a larger segment
+// named "<name>.<generation>" and stores the generation in nextGeneration of the old
+// one; readers follow the chain from the base name.
+//
+// Particles are copied as the simulation holds them, so despawned slots awaiting
+// compaction appear with a radius of 0.
+
+const uint32_t sharedStateBufferCount = 3;
+
+struct SharedBufferInfo {
+    std::atomic<uint64_t> sequence; // Odd while the buffer is being written
+    uint64_t step;
+    double time;
+    double simWidth, simHeight;
+    uint64_t particleCount;
+    uint64_t offset;                // Start of the particle array
+    uint64_t reserved;
+};
+
+struct SharedStateHeader {
+    char magic[4];                  // "PSHM"
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t bufferCount;
+    uint64_t capacity;              // Particles each buffer can hold
+    uint64_t segmentSize;
+    uint32_t particleStride;        // Bytes per particle
+    uint32_t xOffset, yOffset;      // Byte offsets of the double fields within a particle
+    uint32_t vxOffset, vyOffset;
+    uint32_t radiusOffset;
+    std::atomic<uint32_t> nextGeneration; // Non-zero once a larger segment replaced this one
+    uint32_t reserved;
+    std::atomic<uint64_t> latest;   // Index of the most recently published buffer
+    SharedBufferInfo buffers[sharedStateBufferCount];
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+    "Shared-memory atomics must have the layout of plain integers");
+
+// Platform shared-memory object: POSIX shm_open on Linux, a named file mapping on Windows
+class SharedSegment {
+public:
+    // Creates (or replaces) a writable segment; throws std::invalid_argument on failure
+    static std::unique_ptr<SharedSegment> create(const std::string& name, size_t size);
+    // Maps an existing segment read-write; returns null if it does not exist
+    static std::unique_ptr<SharedSegment> open(const std::string& name);
+    ~SharedSegment();
+
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    SharedSegment() = default;
+
+    std::string name;
+    bool owner = false; // Unlinks the name on destruction
+    unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* mappingHandle = nullptr;
+#endif
+};
+
+class SharedStateExporter {
+public:
+    explicit SharedStateExporter(const std::string& name);
+
+    // Copies the particles into the next buffer and makes it the latest
+    void publish(const Simulation& simulation);
+
+private:
+    void createSegment(size_t capacity);
+
+    std::string baseName;
+    uint32_t generation = 0;
+    std::vector<std::unique_ptr<SharedSegment>> segments; // Old generations stay open so readers can follow the chain
+    SharedStateHeader* header = nullptr;
+};
+
+// Reader side, for tools that link against the simulator sources
+class SharedStateReader {
+public:
+    struct View {
+        uint64_t step = 0;
+        double time = 0;
+        const Particle* particles = nullptr; // Points into the segment; valid until the next acquire
+        uint64_t particleCount = 0;
+        uint32_t buffer = 0;
+        uint64_t sequence = 0;
+    };
+
+    explicit SharedStateReader(const std::string& name);
+
+    bool connected() const { return header != nullptr; }
+
+    // Points view at the latest complete step; returns false if nothing has been published yet
+    bool acquire(View& view);
+    // True if the simulator has not started rewriting the view's buffer since acquire()
+    bool stillValid(const View& view) const;
+
+private:
+    bool connect();
+
+    std::string baseName;
+    std::unique_ptr<SharedSegment> segment;
+    SharedStateHeader* header = nullptr;
+};
@@ -0,0 +1,900 @@
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// 64-bit finalizer from MurmurHash3; used to fold particle bits into the checksum
+uint64_t mixHash(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashValue(uint64_t h, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return mixHash(h ^ bits) + 0x9e3779b97f4a7c15ULL;
+}
+
+uint64_t hashBlock(const Particle* begin, const Particle* end) {
+    uint64_t h = 0;
+    for (const Particle* particle = begin; particle != end; ++particle) {
+        h = hashValue(h, particle->x);
+        h = hashValue(h, particle->y);
+        h = hashValue(h, particle->vx);
+        h = hashValue(h, particle->vy);
+        h = hashValue(h, particle->radius);
+    }
+    return h;
+}
+
+// Spreads the low 16 bits of v to the even bit positions
+uint32_t spreadBits(uint32_t v) {
+    v &= 0xffff;
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+}
+
+const size_t Simulation::checksumBlockSize;
+const size_t Simulation::tileItemSize;
+const size_t Simulation::parallelChunkSize;
+const uint64_t Simulation::emitterReserveSteps;
+const uint64_t Simulation::emitterReserveLimit;
+const size_t Simulation::compactRatio;
+const uint64_t Simulation::compactInterval;
+const uint64_t Simulation::sortCheckInterval;
+constexpr double Simulation::sortCellSize;
+const uint32_t Simulation::noSlot;
+
+Simulation::Simulation(size_t threadCount, double deltaTime, double simWidth, double simHeight, SimulationMetrics& metrics)
+    : deltaTime(deltaTime), simWidth(simWidth), simHeight(simHeight), metrics(metrics) {
+    threadCount = std::max<size_t>(1, threadCount);
+    workerCursors.reset(new std::atomic<size_t>[threadCount]);
+    workerFirstItem.assign(threadCount + 1, 0);
+    workerBattedSpeed.assign(threadCount, 0);
+    for (size_t i = 0; i < threadCount; ++i) {
+        workerCursors[i].store(0);
+        threads.emplace_back(&Simulation::updateParticleWorker, this, i);
+    }
+}
+
+Simulation::~Simulation() {
+    // Signal threads to exit and join them
+    {
+        std::lock_guard<std::mutex> lk(cv_m);
+        done = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Simulation::step() {
+    auto stepStart = std::chrono::steady_clock::now();
+    // Compacting before the step rather than after it keeps stepChecksum a hash of the state callers see
+    if (deadCount > 0 && (deadCount * compactRatio >= particles.size() || stepCount % compactInterval == 0)) {
+        compact();
+    }
+    if (sortThreshold > 0 && stepCount % sortCheckInterval == 0 && particles.size() > 1 && measureDisorder() > sortThreshold) {
+        sortByLocation();
+    }
+    emit();
+    assignIds();
+    applyForces();
+    prepareTiles();
+
+    std::unique_lock<std::mutex> lk(cv_m);
+    stepDeaths.store(0);
+    stepEndTime = time + deltaTime;
+    workersFinished = 0;
+    stepDeterministic = deterministic;
+    if (stepDeterministic) {
+        blockChecksums.assign((particles.size() + checksumBlockSize - 1) / checksumBlockSize, 0);
+    }
+    ++frame;
+    metrics.workQueueDepth.store(stepDeterministic ? blockChecksums.size() : workItems.size(), std::memory_order_relaxed);
+    cv.notify_all();
+    finishedCv.wait(lk, [this] { return workersFinished == threads.size(); });
+    lk.unlock();
+    metrics.workQueueDepth.store(0, std::memory_order_relaxed);
+
+    // A moving wall can bat a particle past the speed the ghost zones were sized for
+    for (double speed : workerBattedSpeed) {
+        maxSpeed = std::max(maxSpeed, std::sqrt(speed));
+    }
+    for (auto& wall : movingWalls) {
+        wall.advance(deltaTime);
+    }
+    ++stepCount;
+    time += deltaTime;
+    size_t deaths = stepDeaths.load();
+    deadCount += deaths;
+    if (deaths > 0) {
+        ++populationVersion;
+        if (!constraints.empty()) {
+            ConstraintSolver::removeDead(*this);
+        }
+    }
+    if (stepDeterministic) {
+        stepChecksum = combineChecksum(blockChecksums);
+    }
+    lastStepSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - stepStart).count();
+
+    metrics.stepsTotal.fetch_add(1, std::memory_order_relaxed);
+    metrics.particlesDespawned.fetch_add(deaths, std::memory_order_relaxed);
+    metrics.particleCount.store(aliveCount(), std::memory_order_relaxed);
+    metrics.wallCount.store(walls.size(), std::memory_order_relaxed);
+    metrics.stateBytes.store((particles.capacity() + compactParticles.capacity()) * sizeof(Particle) + walls.capacity() * sizeof(Wall)
+        + (expiry.capacity() + compactExpiry.capacity()) * sizeof(double)
+        + (ids.capacity() + compactIds.capacity() + idSlots.capacity() + freeIds.capacity()) * sizeof(uint32_t), std::memory_order_relaxed);
+}
+
+void Simulation::clearParticles() {
+    particles.clear();
+    expiry.clear();
+    ids.clear();
+    idSlots.clear();
+    freeIds.clear();
+    constraints.clear();
+    deadCount = 0;
+    ++layoutVersion;
+    ++populationVersion;
+}
+
+void Simulation::clearWalls() {
+    walls.clear();
+    ++wallVersion;
+    movingWalls.clear();
+    absorbers.clear();
+    sinks.clear();
+    attractors.clear();
+}
+
+void Simulation::grabWall(size_t index) {
+    if (index >= walls.size()) {
+        throw std::invalid_argument("There is no wall " + std::to_string(index) + " to grab.");
+    }
+    movingWalls.push_back(MovingWall(walls[index], 0, 0));
+    distanceField.removeWall(index, walls[index]);
+    walls.erase(walls.begin() + static_cast<std::ptrdiff_t>(index));
+}
+
+void Simulation::releaseWall(size_t index) {
+    if (index >= movingWalls.size()) {
+        throw std::invalid_argument("There is no moving wall " + std::to_string(index) + " to release.");
+    }
+    walls.push_back(movingWalls[index].wall);
+    movingWalls.erase(movingWalls.begin() + static_cast<std::ptrdiff_t>(index));
+}
+
+void Simulation::compact() {
+    if (deadCount == 0) {
+        return;
+    }
+    assignIds();
+
+    // Count the survivors of each chunk, turn the counts into output offsets, then copy
+    // every chunk's survivors into place. Chunks write disjoint ranges, so both passes run
+    // in parallel, and survivors keep their order.
+    size_t count = particles.size();
+    bool hasExpiry = !expiry.empty();
+    if (hasExpiry) {
+        expiry.resize(count, std::numeric_limits<double>::infinity());
+    }
+    std::vector<size_t> offsets((count + parallelChunkSize - 1) / parallelChunkSize + 1, 0);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        size_t alive = 0;
+        for (size_t i = begin; i < end; ++i) {
+            alive += particles[i].alive() ? 1 : 0;
+        }
+        offsets[begin / parallelChunkSize + 1] = alive;
+    });
+    for (size_t chunk = 1; chunk < offsets.size(); ++chunk) {
+        offsets[chunk] += offsets[chunk - 1];
+    }
+
+    compactParticles.resize(offsets.back());
+    compactIds.resize(offsets.back());
+    if (hasExpiry) {
+        compactExpiry.resize(offsets.back());
+    }
+    // The handles of despawned particles are released in slot order
+    size_t firstFree = freeIds.size();
+    freeIds.resize(firstFree + count - offsets.back());
+    parallelFor(count, [&](size_t begin, size_t end) {
+        size_t out = offsets[begin / parallelChunkSize];
+        size_t released = firstFree + begin - out;
+        for (size_t i = begin; i < end; ++i) {
+            if (particles[i].alive()) {
+                compactParticles[out] = particles[i];
+                compactIds[out] = ids[i];
+                idSlots[ids[i]] = static_cast<uint32_t>(out);
+                if (hasExpiry) {
+                    compactExpiry[out] = expiry[i];
+                }
+                ++out;
+            }
+            else {
+                freeIds[released++] = ids[i];
+                idSlots[ids[i]] = noSlot;
+            }
+        }
+    });
+
+    particles.swap(compactParticles);
+    ids.swap(compactIds);
+    expiry.swap(compactExpiry);
+    compactExpiry.clear();
+    deadCount = 0;
+    ++layoutVersion;
+}
+
+uint32_t Simulation::mortonCode(const Particle& particle) const {
+    if (!particle.alive()) {
+        return UINT32_MAX; // Despawned slots sort to the end
+    }
+    auto cell = [](double position) {
+        double index = position / sortCellSize;
+        return index <= 0 ? 0u : index >= 65535 ? 65535u : static_cast<uint32_t>(index);
+    };
+    return spreadBits(cell(particle.x)) | (spreadBits(cell(particle.y)) << 1);
+}
+
+double Simulation::measureDisorder() {
+    // Counted per chunk and summed in chunk order, so the result never depends on thread count
+    size_t pairs = particles.size() > 0 ? particles.size() - 1 : 0;
+    std::vector<size_t> counts((pairs + parallelChunkSize - 1) / parallelChunkSize, 0);
+    parallelFor(pairs, [&](size_t begin, size_t end) {
+        size_t descents = 0;
+        uint32_t previous = mortonCode(particles[begin]);
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t next = mortonCode(particles[i + 1]);
+            descents += next < previous ? 1 : 0;
+            previous = next;
+        }
+        counts[begin / parallelChunkSize] = descents;
+    });
+
+    size_t descents = 0;
+    for (size_t chunkDescents : counts) {
+        descents += chunkDescents;
+    }
+    disorder = pairs > 0 ? static_cast<double>(descents) / pairs : 0;
+    return disorder;
+}
+
+void Simulation::sortByLocation() {
+    assignIds();
+    size_t count = particles.size();
+    sortKeys.resize(count);
+    sortOrder.resize(count);
+    sortKeysScratch.resize(count);
+    sortOrderScratch.resize(count);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sortKeys[i] = mortonCode(particles[i]);
+            sortOrder[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    // LSD radix sort, one byte per pass. Each chunk counts its digits, the counts are
+    // turned into per-chunk output offsets in (digit, chunk) order, and each chunk then
+    // scatters its items in order, which keeps every pass stable.
+    size_t chunkCount = (count + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<size_t> offsets(chunkCount * 256);
+    for (int shift = 0; shift < 32; shift += 8) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallelFor(count, [&](size_t begin, size_t end) {
+            size_t* histogram = &offsets[begin / parallelChunkSize * 256];
+            for (size_t i = begin; i < end; ++i) {
+                ++histogram[(sortKeys[i] >> shift) & 0xff];
+            }
+        });
+
+        size_t running = 0;
+        bool sharedDigit = false; // Every key has the same digit, so the pass would not move anything
+        for (size_t digit = 0; digit < 256; ++digit) {
+            size_t digitStart = running;
+            for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+                size_t n = offsets[chunk * 256 + digit];
+                offsets[chunk * 256 + digit] = running;
+                running += n;
+            }
+            sharedDigit = sharedDigit || running - digitStart == count;
+        }
+        if (sharedDigit) {
+            continue;
+        }
+
+        parallelFor(count, [&](size_t begin, size_t end) {
+            size_t* next = &offsets[begin / parallelChunkSize * 256];
+            for (size_t i = begin; i < end; ++i) {
+                size_t out = next[(sortKeys[i] >> shift) & 0xff]++;
+                sortKeysScratch[out] = sortKeys[i];
+                sortOrderScratch[out] = sortOrder[i];
+            }
+        });
+        sortKeys.swap(sortKeysScratch);
+        sortOrder.swap(sortOrderScratch);
+    }
+
+    applyOrder();
+    disorder = 0;
+    ++layoutVersion;
+    ++sortCount;
+    metrics.localitySorts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Simulation::applyOrder() {
+    // Slot i receives the particle from slot sortOrder[i], with its handle and expiry
+    size_t count = particles.size();
+    bool hasExpiry = !expiry.empty();
+    if (hasExpiry) {
+        expiry.resize(count, std::numeric_limits<double>::infinity());
+        compactExpiry.resize(count);
+    }
+    compactParticles.resize(count);
+    compactIds.resize(count);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t from = sortOrder[i];
+            compactParticles[i] = particles[from];
+            compactIds[i] = ids[from];
+            idSlots[ids[from]] = static_cast<uint32_t>(i);
+            if (hasExpiry) {
+                compactExpiry[i] = expiry[from];
+            }
+        }
+    });
+
+    particles.swap(compactParticles);
+    ids.swap(compactIds);
+    expiry.swap(compactExpiry);
+    compactExpiry.clear();
+}
+
+void Simulation::applyForces() {
+    bool pulled = gravity != 0 || !attractors.empty();
+    if (!pulled && fluidLength <= 0 && constraints.empty()) {
+        return;
+    }
+    if (fluidLength > 0) {
+        fluid.step(*this);
+    }
+    if (gravity != 0 && meshCells > 0) {
+        mesh.build(*this, meshCells, softening);
+    }
+    else if (gravity != 0) {
+        tree.build(*this);
+    }
+
+    if (pulled || fluidLength > 0) {
+        kick();
+    }
+    // The solver also sets velocities, and reports the fastest it set
+    if (!constraints.empty()) {
+        maxSpeed = std::max(maxSpeed, constraintSolver.solve(*this));
+    }
+}
+
+void Simulation::kick() {
+    // Kicks every velocity by one step of acceleration. The kicks can raise the fastest
+    // speed past the one the ghost zones were last sized for, so it is tracked as well.
+    size_t count = particles.size();
+    std::vector<double> chunkSpeed((count + parallelChunkSize - 1) / parallelChunkSize, 0);
+    double softeningSquared = softening * softening;
+    parallelFor(count, [&](size_t begin, size_t end) {
+        double fastest = 0;
+        for (size_t i = begin; i < end; ++i) {
+            Particle& particle = particles[i];
+            if (!particle.alive()) {
+                continue;
+            }
+            double ax = 0, ay = 0;
+            if (gravity != 0 && meshCells > 0) {
+                mesh.acceleration(particle, ax, ay);
+                ax *= gravity;
+                ay *= gravity;
+            }
+            else if (gravity != 0) {
+                tree.acceleration(particles, i, openingAngle, softening, ax, ay);
+                ax *= gravity;
+                ay *= gravity;
+            }
+            for (const Attractor& attractor : attractors) {
+                double dx = attractor.position.x - particle.x, dy = attractor.position.y - particle.y;
+                double r2 = dx * dx + dy * dy + softeningSquared;
+                double scale = attractor.strength / (r2 * std::sqrt(r2));
+                ax += dx * scale;
+                ay += dy * scale;
+            }
+            particle.vx += ax * deltaTime;
+            particle.vy += ay * deltaTime;
+            fastest = std::max(fastest, particle.vx * particle.vx + particle.vy * particle.vy);
+        }
+        chunkSpeed[begin / parallelChunkSize] = fastest;
+    });
+    for (double speed : chunkSpeed) {
+        maxSpeed = std::max(maxSpeed, std::sqrt(speed));
+    }
+}
+
+void Simulation::prepareTiles() {
+    if (grid.resize(simWidth, simHeight)) {
+        binnedCount = SIZE_MAX;
+    }
+    if (stepMigrations.load() > 0 || particles.size() != binnedCount || layoutVersion != binnedLayout) {
+        binParticles();
+    }
+    // The flow only blends velocities toward its own, so no particle outruns the faster of the two
+    double reachSpeed = flow.empty() ? maxSpeed : std::max(maxSpeed, flow.maxSpeed());
+    prepareWalls(reachSpeed * std::max(1.0, deltaTime) + maxRadius);
+    if (distanceCellSize > 0) {
+        distanceField.update(*this, distanceCellSize);
+    }
+
+    stepMigrations.store(0);
+    for (size_t worker = 0; worker < threads.size(); ++worker) {
+        workerCursors[worker].store(workerFirstItem[worker]);
+    }
+}
+
+const TileGrid& Simulation::prepareWalls(double reach) {
+    // New tiles need the particles binned into them before the next step
+    if (grid.resize(simWidth, simHeight)) {
+        binnedCount = SIZE_MAX;
+    }
+    grid.updateWalls(walls, reach);
+    prepareMovingWalls(reach);
+    return grid;
+}
+
+void Simulation::prepareMovingWalls(double reach) {
+    wallSweeps.resize(movingWalls.size());
+    sweepBounds.resize(movingWalls.size());
+    for (size_t k = 0; k < movingWalls.size(); ++k) {
+        const MovingWall& moving = movingWalls[k];
+        sf::Vector2f slide = moving.slide(deltaTime);
+        double angle = moving.spin * deltaTime;
+        WallSweep& sweep = wallSweeps[k];
+        sweep.startX = moving.wall.start.x;
+        sweep.startY = moving.wall.start.y;
+        sweep.endX = moving.wall.end.x;
+        sweep.endY = moving.wall.end.y;
+        sweep.pivotX = moving.pivot.x;
+        sweep.pivotY = moving.pivot.y;
+        sweep.slideX = slide.x;
+        sweep.slideY = slide.y;
+        sweep.cosine = std::cos(angle);
+        sweep.sine = std::sin(angle);
+        sweep.velocityX = slide.x / deltaTime;
+        sweep.velocityY = slide.y / deltaTime;
+        sweep.spin = moving.spin;
+
+        // Both poses, widened by the farthest any point of the wall travels around the
+        // pivot, and by the ghost zone
+        MovingWall next = moving;
+        next.advance(deltaTime);
+        double arm = std::max(std::hypot(sweep.startX - sweep.pivotX, sweep.startY - sweep.pivotY),
+            std::hypot(sweep.endX - sweep.pivotX, sweep.endY - sweep.pivotY));
+        double margin = reach + arm * std::fabs(angle);
+        sweepBounds[k].minX = static_cast<float>(std::min(std::min(sweep.startX, sweep.endX), static_cast<double>(std::min(next.wall.start.x, next.wall.end.x))) - margin);
+        sweepBounds[k].maxX = static_cast<float>(std::max(std::max(sweep.startX, sweep.endX), static_cast<double>(std::max(next.wall.start.x, next.wall.end.x))) + margin);
+        sweepBounds[k].minY = static_cast<float>(std::min(std::min(sweep.startY, sweep.endY), static_cast<double>(std::min(next.wall.start.y, next.wall.end.y))) - margin);
+        sweepBounds[k].maxY = static_cast<float>(std::max(std::max(sweep.startY, sweep.endY), static_cast<double>(std::max(next.wall.start.y, next.wall.end.y))) + margin);
+    }
+    grid.refitMovingWalls(sweepBounds);
+}
+
+bool Simulation::collideMovingWalls(Particle& particle, const std::vector<uint32_t>& list) const {
+    // Each wall is tested in its own frame at the start of the step: the end of the
+    // particle's path is carried back through the wall's slide and turn, and the path
+    // checked against the wall where it started. The earliest crossing wins.
+    double nextX = particle.x + particle.vx * deltaTime, nextY = particle.y + particle.vy * deltaTime;
+    const WallSweep* hit = nullptr;
+    double hitPath = 2, hitWall = 0;
+    for (uint32_t k : list) {
+        const WallSweep& sweep = wallSweeps[k];
+        double rx = nextX - (sweep.pivotX + sweep.slideX), ry = nextY - (sweep.pivotY + sweep.slideY);
+        double pathX = sweep.pivotX + sweep.cosine * rx + sweep.sine * ry - particle.x;
+        double pathY = sweep.pivotY - sweep.sine * rx + sweep.cosine * ry - particle.y;
+        double wallX = sweep.endX - sweep.startX, wallY = sweep.endY - sweep.startY;
+        double determinant = pathX * wallY - pathY * wallX;
+        if (std::abs(determinant) < 1e-12) {
+            continue; // Parallel movement, no collision
+        }
+        double offsetX = sweep.startX - particle.x, offsetY = sweep.startY - particle.y;
+        double alongPath = (offsetX * wallY - offsetY * wallX) / determinant;
+        double alongWall = (offsetX * pathY - offsetY * pathX) / determinant;
+        if (alongPath >= 0 && alongPath <= 1 && alongWall >= 0 && alongWall <= 1 && alongPath < hitPath) {
+            hit = &sweep;
+            hitPath = alongPath;
+            hitWall = alongWall;
+        }
+    }
+    if (hit == nullptr) {
+        return false;
+    }
+
+    // Reflect the velocity relative to the wall's own velocity where it was hit
+    double wallX = hit->endX - hit->startX, wallY = hit->endY - hit->startY;
+    double length = std::sqrt(wallX * wallX + wallY * wallY);
+    double normalX = -wallY / length, normalY = wallX / length;
+    double contactX = hit->startX + hitWall * wallX, contactY = hit->startY + hitWall * wallY;
+    double surfaceX = hit->velocityX - hit->spin * (contactY - hit->pivotY);
+    double surfaceY = hit->velocityY + hit->spin * (contactX - hit->pivotX);
+    double relative = (particle.vx - surfaceX) * normalX + (particle.vy - surfaceY) * normalY;
+    double side = (particle.x - hit->startX) * normalX + (particle.y - hit->startY) * normalY;
+    if (side == 0) {
+        side = -relative;
+    }
+    if (relative * side >= 0) {
+        return false; // Already leaving the wall
+    }
+    particle.vx -= 2 * relative * normalX;
+    particle.vy -= 2 * relative * normalY;
+
+    // Out of the wall where it had got to when hit, on the side the particle came from
+    double push = side > 0 ? particle.radius : -particle.radius;
+    double elapsed = hitPath * deltaTime;
+    particle.x = contactX + surfaceX * elapsed + normalX * push;
+    particle.y = contactY + surfaceY * elapsed + normalY * push;
+    return true;
+}
+
+void Simulation::binParticles() {
+    // A counting sort by tile, stable so each tile keeps its particles in their previous
+    // (usually Morton) order. It runs like one radix pass with a bucket per tile, plus a
+    // last bucket that collects despawned slots so no tile holds any.
+    size_t count = particles.size();
+    size_t tileCount = grid.tileCount();
+    size_t buckets = tileCount + 1;
+    size_t chunkCount = (count + parallelChunkSize - 1) / parallelChunkSize;
+    std::vector<size_t> offsets(chunkCount * buckets, 0);
+    std::vector<double> chunkSpeed(chunkCount, 0), chunkRadius(chunkCount, 0);
+    std::vector<char> chunkOrdered(chunkCount, 1);
+    sortKeys.resize(count);
+    parallelFor(count, [&](size_t begin, size_t end) {
+        size_t chunk = begin / parallelChunkSize;
+        size_t* histogram = &offsets[chunk * buckets];
+        double speedSquared = 0, radius = 0;
+        uint32_t previous = 0;
+        bool ordered = true;
+        for (size_t i = begin; i < end; ++i) {
+            const Particle& particle = particles[i];
+            uint32_t key = static_cast<uint32_t>(tileCount);
+            if (particle.alive()) {
+                key = static_cast<uint32_t>(grid.tileOf(particle.x, particle.y));
+                speedSquared = std::max(speedSquared, particle.vx * particle.vx + particle.vy * particle.vy);
+                radius = std::max(radius, particle.radius);
+            }
+            ordered = ordered && key >= previous;
+            previous = key;
+            sortKeys[i] = key;
+            ++histogram[key];
+        }
+        chunkSpeed[chunk] = speedSquared;
+        chunkRadius[chunk] = radius;
+        chunkOrdered[chunk] = ordered ? 1 : 0;
+    });
+
+    bool ordered = true;
+    maxSpeed = 0;
+    maxRadius = 0;
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        ordered = ordered && chunkOrdered[chunk] && (chunk == 0 || sortKeys[chunk * parallelChunkSize - 1] <= sortKeys[chunk * parallelChunkSize]);
+        maxSpeed = std::max(maxSpeed, chunkSpeed[chunk]);
+        maxRadius = std::max(maxRadius, chunkRadius[chunk]);
+    }
+    maxSpeed = std::sqrt(maxSpeed);
+
+    size_t running = 0;
+    for (size_t bucket = 0; bucket < buckets; ++bucket) {
+        size_t bucketStart = running;
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            size_t n = offsets[chunk * buckets + bucket];
+            offsets[chunk * buckets + bucket] = running;
+            running += n;
+        }
+        if (bucket < tileCount) {
+            grid.tiles[bucket].begin = bucketStart;
+            grid.tiles[bucket].end = running;
+        }
+    }
+
+    // Particles that stayed in their tiles need not move at all
+    if (!ordered) {
+        sortOrder.resize(count);
+        parallelFor(count, [&](size_t begin, size_t end) {
+            size_t* next = &offsets[begin / parallelChunkSize * buckets];
+            for (size_t i = begin; i < end; ++i) {
+                sortOrder[next[sortKeys[i]]++] = static_cast<uint32_t>(i);
+            }
+        });
+        applyOrder();
+        ++layoutVersion;
+    }
+    binnedCount = count;
+    binnedLayout = layoutVersion;
+
+    // Split large tiles so idle workers have something to take, then give each worker
+    // a contiguous run holding an equal share of the particles
+    workItems.clear();
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        const TileGrid::Tile& bounds = grid.tiles[tile];
+        for (size_t begin = bounds.begin; begin < bounds.end; begin += tileItemSize) {
+            workItems.push_back({ tile, begin, std::min(begin + tileItemSize, bounds.end) });
+        }
+    }
+    size_t live = tileCount > 0 ? grid.tiles.back().end : 0;
+    size_t item = 0;
+    for (size_t worker = 0; worker < threads.size(); ++worker) {
+        size_t share = live * worker / threads.size();
+        while (item < workItems.size() && workItems[item].begin < share) {
+            ++item;
+        }
+        workerFirstItem[worker] = item;
+    }
+    workerFirstItem[threads.size()] = workItems.size();
+}
+
+void Simulation::assignIds() {
+    if (ids.size() > particles.size()) {
+        // Particles were replaced wholesale; start the handles over
+        ids.clear();
+        idSlots.clear();
+        freeIds.clear();
+    }
+    size_t first = ids.size();
+    if (first < particles.size()) {
+        ++populationVersion;
+    }
+    ids.resize(particles.size());
+    for (size_t slot = first; slot < particles.size(); ++slot) {
+        uint32_t id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        else {
+            id = static_cast<uint32_t>(idSlots.size());
+            idSlots.push_back(noSlot);
+        }
+        ids[slot] = id;
+        idSlots[id] = static_cast<uint32_t>(slot);
+    }
+}
+
+void Simulation::emit() {
+    size_t incoming = 0;
+    uint64_t ahead = 0;
+    bool expiring = false;
+    for (const auto& emitter : emitters) {
+        incoming += emitter.pending();
+        expiring = expiring || emitter.lifetime > 0;
+        uint64_t burst = emitter.rate * emitterReserveSteps;
+        ahead += emitter.total == 0 ? burst : std::min(burst, emitter.total - std::min(emitter.total, emitter.emitted));
+    }
+    if (incoming == 0) {
+        return;
+    }
+
+    // Reserve many steps of output at once so emitters write into existing storage, but
+    // not so many that a fast unlimited emitter asks for gigabytes up front
+    ahead = std::max<uint64_t>(incoming, std::min(ahead, emitterReserveLimit));
+    if (particles.size() + incoming > particles.capacity()) {
+        particles.reserve(std::max<size_t>(particles.size() + static_cast<size_t>(ahead), particles.capacity() + particles.capacity() / 2));
+    }
+    if (expiring && expiry.capacity() < particles.capacity()) {
+        expiry.reserve(particles.capacity());
+    }
+    for (auto& emitter : emitters) {
+        emitParticles(*this, emitter);
+    }
+}
+
+void Simulation::parallelFor(size_t count, const std::function<void(size_t, size_t)>& body, size_t chunkSize) {
+    // Waking the workers costs more than a single chunk of work
+    if (count <= chunkSize || threads.size() < 2) {
+        for (size_t begin = 0; begin < count; begin += chunkSize) {
+            body(begin, std::min(begin + chunkSize, count));
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> lk(cv_m);
+    task = &body;
+    taskCount = count;
+    taskChunkSize = chunkSize;
+    nextTaskIndex.store(0);
+    workersFinished = 0;
+    ++frame;
+    metrics.workQueueDepth.store((count + chunkSize - 1) / chunkSize, std::memory_order_relaxed);
+    cv.notify_all();
+    finishedCv.wait(lk, [this] { return workersFinished == threads.size(); });
+    task = nullptr;
+    metrics.workQueueDepth.store(0, std::memory_order_relaxed);
+}
+
+void Simulation::updateParticleWorker(size_t workerId) {
+    uint64_t lastFrame = 0;
+    while (true) {
+        std::unique_lock<std::mutex> lk(cv_m);
+        cv.wait(lk, [&] { return frame != lastFrame || done; });
+        if (done) {
+            return;
+        }
+        lastFrame = frame;
+        lk.unlock();
+
+        auto busyStart = std::chrono::steady_clock::now();
+        StepTally tally;
+        if (task != nullptr) {
+            while (true) {
+                size_t begin = nextTaskIndex.fetch_add(taskChunkSize);
+                if (begin >= taskCount) {
+                    break;
+                }
+                metrics.workQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+                (*task)(begin, std::min(begin + taskChunkSize, taskCount));
+            }
+        }
+        else if (stepDeterministic) {
+            // Each worker owns a contiguous run of blocks, updated and hashed in order
+            size_t blockCount = blockChecksums.size();
+            size_t firstBlock = blockCount * workerId / threads.size();
+            size_t lastBlock = blockCount * (workerId + 1) / threads.size();
+            for (size_t block = firstBlock; block < lastBlock; ++block) {
+                metrics.workQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+                size_t begin = block * checksumBlockSize;
+                size_t end = std::min(begin + checksumBlockSize, particles.size());
+                updateSpan(begin, end, tally);
+                blockChecksums[block] = hashBlock(particles.data() + begin, particles.data() + end);
+            }
+        }
+        else {
+            // Own run first, so the same tiles stay in this core's cache from step to
+            // step, then help whichever workers still have items left
+            size_t workers = threads.size();
+            for (size_t offset = 0; offset < workers; ++offset) {
+                size_t owner = (workerId + offset) % workers;
+                while (true) {
+                    size_t item = workerCursors[owner].fetch_add(1);
+                    if (item >= workerFirstItem[owner + 1]) {
+                        break;
+                    }
+                    metrics.workQueueDepth.fetch_sub(1, std::memory_order_relaxed);
+                    updateRange(workItems[item].begin, workItems[item].end, workItems[item].tile, tally);
+                }
+            }
+        }
+        if (tally.deaths > 0) {
+            stepDeaths.fetch_add(tally.deaths);
+        }
+        if (tally.migrants > 0) {
+            stepMigrations.fetch_add(tally.migrants);
+        }
+        workerBattedSpeed[workerId] = tally.battedSpeed;
+        auto busyTime = std::chrono::steady_clock::now() - busyStart;
+        metrics.addWorkerBusy(workerId, std::chrono::duration_cast<std::chrono::nanoseconds>(busyTime).count());
+
+        lk.lock();
+        if (++workersFinished == threads.size()) {
+            finishedCv.notify_one();
+        }
+    }
+}
+
+void Simulation::updateSpan(size_t begin, size_t end, StepTally& tally) {
+    // Slots past the last tile are despawned, so only the tiles' ranges need updating
+    const std::vector<TileGrid::Tile>& tiles = grid.tiles;
+    auto tile = std::partition_point(tiles.begin(), tiles.end(), [begin](const TileGrid::Tile& t) { return t.end <= begin; });
+    for (; tile != tiles.end() && tile->begin < end; ++tile) {
+        updateRange(std::max(begin, tile->begin), std::min(end, tile->end), static_cast<size_t>(tile - tiles.begin()), tally);
+    }
+}
+
+void Simulation::updateRange(size_t begin, size_t end, size_t tile, StepTally& tally) {
+    const TileGrid::Tile& bounds = grid.tiles[tile];
+    const Wall* tileWalls = grid.walls.data();
+    const std::vector<uint32_t>& movingList = grid.movingWalls[tile];
+    bool flowing = !flow.empty();
+    bool culling = distanceCellSize > 0 && bounds.firstWall != bounds.lastWall;
+    double reachScale = std::max(1.0, deltaTime);
+    double flowBlend = std::min(1.0, flowCoupling * deltaTime);
+    double flowU[flowBlockSize], flowV[flowBlockSize];
+    for (size_t index = begin; index < end; ++index) {
+        // The flow is sampled a block ahead, while the block's particles are in cache anyway
+        size_t flowOffset = (index - begin) % flowBlockSize;
+        if (flowing && flowOffset == 0) {
+            flow.sample(particles.data() + index, std::min(flowBlockSize, end - index), time, flowU, flowV);
+        }
+        Particle& particle = particles[index];
+        if (!particle.alive()) {
+            continue;
+        }
+        if (flowing) {
+            particle.vx += (flowU[flowOffset] - particle.vx) * flowBlend;
+            particle.vy += (flowV[flowOffset] - particle.vy) * flowBlend;
+        }
+
+        bool despawn = index < expiry.size() && stepEndTime >= expiry[index];
+        for (size_t i = 0; i < absorbers.size() && !despawn; ++i) {
+            sf::Vector2f collisionPoint;
+            despawn = particle.directCollisionDetection(particle, absorbers[i], collisionPoint);
+        }
+        if (!despawn) {
+            // Moving walls go first, since a hit changes the velocity the culling reach follows
+            if (!movingList.empty()) {
+                if (collideMovingWalls(particle, movingList)) {
+                    tally.battedSpeed = std::max(tally.battedSpeed, particle.vx * particle.vx + particle.vy * particle.vy);
+                }
+            }
+            const Wall* firstWall = tileWalls + bounds.firstWall;
+            const Wall* lastWall = tileWalls + bounds.lastWall;
+            if (culling) {
+                // Collision tests follow the velocity, so nothing farther than it can be hit
+                double reach = std::sqrt(particle.vx * particle.vx + particle.vy * particle.vy) * reachScale + particle.radius;
+                distanceField.nearbyWalls(particle.x, particle.y, reach, firstWall, lastWall);
+            }
+            particle.updatePosition(deltaTime, simWidth, simHeight, firstWall, lastWall);
+            for (size_t i = 0; i < sinks.size() && !despawn; ++i) {
+                despawn = sinks[i].contains(particle.x, particle.y);
+            }
+        }
+        if (despawn) {
+            particle.radius = 0;
+            ++tally.deaths;
+        }
+        else if (particle.x < bounds.minX || particle.x >= bounds.maxX || particle.y < bounds.minY || particle.y >= bounds.maxY) {
+            ++tally.migrants; // Moves to its new tile when the next step bins
+        }
+    }
+}
+
+uint64_t Simulation::computeChecksum() const {
+    std::vector<uint64_t> blockHashes;
+    for (size_t begin = 0; begin < particles.size(); begin += checksumBlockSize) {
+        size_t end = std::min(begin + checksumBlockSize, particles.size());
+        blockHashes.push_back(hashBlock(particles.data() + begin, particles.data() + end));
+    }
+    return combineChecksum(blockHashes);
+}
+
+uint64_t Simulation::combineChecksum(const std::vector<uint64_t>& blockHashes) const {
+    // Blocks are folded in index order, then the walls and step state
+    uint64_t h = mixHash(particles.size());
+    for (uint64_t blockHash : blockHashes) {
+        h = mixHash(h ^ blockHash) + 0x9e3779b97f4a7c15ULL;
+    }
+    for (const auto& wall : walls) {
+        h = hashValue(h, wall.start.x);
+        h = hashValue(h, wall.start.y);
+        h = hashValue(h, wall.end.x);
+        h = hashValue(h, wall.end.y);
+    }
+    for (const auto& moving : movingWalls) {
+        h = hashValue(h, moving.wall.start.x);
+        h = hashValue(h, moving.wall.start.y);
+        h = hashValue(h, moving.wall.end.x);
+        h = hashValue(h, moving.wall.end.y);
+    }
+    h = mixHash(h ^ stepCount);
+    return hashValue(h, time);
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include "Constraints.hpp"
+#include "DistanceField.hpp"
+#include "FlowField.hpp"
+#include "Fluid.hpp"
+#include "Generators.hpp"
+#include "Gravity.hpp"
+#include "ParticleMesh.hpp"
+#include "Metrics.hpp"
+#include "Particle.hpp"
+#include "TileGrid.hpp"
+#include "Wall.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Owns the particle and wall state plus the worker threads that advance it.
+// step() bins the particles into the tiles of a TileGrid and hands each worker a
+// contiguous run of tiles, which it may lose to idle workers once they run out, and
+// returns once every worker has finished, so callers may freely modify particles and
+// walls between steps.
+class Simulation {
+public:
+    std::vector<Particle> particles;
+    std::vector<Wall> walls;     // Append freely; any other edit must bump wallVersion
+    uint64_t wallVersion = 0;    // Incremented whenever walls change other than by appending or grabWall()
+    std::vector<Emitter> emitters; // Run at the start of every step
+    std::vector<Wall> absorbers; // Walls that despawn the particles hitting them instead of reflecting them
+    std::vector<Sink> sinks;     // Regions that despawn the particles entering them
+    std::vector<Attractor> attractors;
+
+    // Kinematic walls. Each step the particles collide with them along their sweep over
+    // the step, and then they move on. They are indexed per tile apart from the other
+    // walls and refit every step, so moving them never rebuilds the static walls' lists.
+    std::vector<MovingWall> movingWalls;
+
+    // Accelerations are applied to the velocities at the start of every step, before the
+    // particles move and collide. Particles attract each other with strength gravity through
+    // a Barnes–Hut tree; the opening angle trades accuracy for speed, 0 summing every pair
+    // exactly. Each attractor pulls with its own strength. Every distance is softened by
+    // softening so close encounters stay finite. With meshCells set, gravity is solved on a
+    // particle mesh of that many cells per side instead of the tree.
+    double gravity = 0;          // 0 turns particle gravity off
+    double openingAngle = 0.5;
+    double softening = 5;
+    size_t meshCells = 0;        // Power of two, or 0 to use the tree
+
+    // With fluidLength set the particles also behave as an SPH fluid with that smoothing
+    // length. Pressure is stiffness times the density above restDensity, in particles per
+    // unit area. Forces are applied at the start of every step along with gravity.
+    double fluidLength = 0;      // 0 turns the fluid off
+    double restDensity = 0.02;
+    double stiffness = 5;
+    double viscosity = 0.5;
+    SphFluid fluid;              // Per-particle density and pressure from the last step
+
+    // Distance constraints between particles, solved after the other forces every step
+    // over constraintIterations passes. Constraints are dropped once either particle
+    // despawns.
+    std::vector<Constraint> constraints;
+    size_t constraintIterations = 8;
+
+    // With a flow field, every step each particle's velocity moves toward the flow at its
+    // position by flowCoupling times the time step, capped at the whole way, so a coupling
+    // of 1 makes passive tracers. It is sampled as the particles are updated.
+    FlowField flow;              // Empty turns the flow off
+    double flowCoupling = 1;
+
+    // With distanceCellSize set, a field of the distance to the nearest wall is kept on
+    // cells that size, and particles it shows to be out of reach of every wall skip their
+    // wall tests. Collisions are unchanged; only the cost of finding them drops.
+    double distanceCellSize = 0; // 0 turns the field off
+
+    // Simulated time at which each particle despawns. May be shorter than particles;
+    // particles past its end live forever.
+    std::vector<double> expiry;
+    size_t deadCount = 0;        // Despawned slots awaiting compaction
+
+    // Stable handle of the particle in each slot. Compaction and sorting move particles
+    // between slots; slotOf() maps a handle back to where its particle is now. New
+    // particles get handles at the start of the next step, and a despawned particle's
+    // handle is reused once its slot is compacted away.
+    std::vector<uint32_t> ids;
+    uint64_t layoutVersion = 0;  // Incremented whenever particles move between slots
+    uint64_t populationVersion = 0; // Incremented whenever particles are added, despawned or cleared
+
+    // Particles are periodically reordered along a Z-order (Morton) curve of sortCellSize
+    // cells, so particles near each other in space sit near each other in memory. Every
+    // sortCheckInterval steps the fraction of neighboring slots that are out of curve
+    // order is measured, and the particles are re-sorted once it exceeds sortThreshold.
+    double sortThreshold = 0.25; // 0 never sorts
+    double disorder = 0;         // Result of the last measurement
+    uint64_t sortCount = 0;      // Times the particles have been re-sorted
+
+    double deltaTime;            // Time step for updating particle positions
+    double simWidth, simHeight;  // Domain size
+    uint64_t stepCount = 0;      // Steps completed so far
+    double time = 0;             // Simulated time elapsed
+    double lastStepSeconds = 0;  // Wall-clock duration of the most recent step
+    std::mt19937_64 rng;         // Random source for anything that needs randomness; saved in checkpoints
+
+    // Deterministic mode gives every worker a fixed range of particle blocks instead of
+    // letting idle workers take over other workers' tiles, and hashes each block as it
+    // is updated. The block hashes are combined in block order, so stepChecksum is
+    // identical for any thread count.
+    bool deterministic = false;
+    uint64_t stepChecksum = 0;   // Checksum of the state after the last step; only set in deterministic mode
+
+    Simulation(size_t threadCount, double deltaTime, double simWidth, double simHeight, SimulationMetrics& metrics);
+    ~Simulation();
+
+    Simulation(const Simulation&) = delete;
+    Simulation& operator=(const Simulation&) = delete;
+
+    void step();
+
+    // Removes every particle, or every wall, moving wall, absorber, sink and attractor
+    void clearParticles();
+    void clearWalls();
+
+    // Turns walls[index] into a stationary moving wall at the end of movingWalls, for
+    // dragging it around, and movingWalls[index] back into a wall at the end of walls.
+    // Throw std::invalid_argument for an index out of range.
+    void grabWall(size_t index);
+    void releaseWall(size_t index);
+
+    // Drops despawned slots, keeping the survivors in order. step() calls this itself once
+    // enough slots are dead; call it directly only between steps.
+    void compact();
+    size_t aliveCount() const { return particles.size() - deadCount; }
+
+    // Stably sorts the particles by the Morton code of their cell with a parallel radix
+    // sort. step() calls this itself when the order has degraded.
+    void sortByLocation();
+    double measureDisorder();
+
+    // Gives handles to the particles added since the last step. step() calls this itself.
+    void assignIds();
+
+    static const uint32_t noSlot = UINT32_MAX;
+    uint32_t slotOf(uint32_t id) const { return id < idSlots.size() ? idSlots[id] : noSlot; }
+    size_t idCount() const { return idSlots.size(); } // Handles are below this
+    size_t tileCount() const { return grid.tileCount(); }
+    size_t workerCount() const { return threads.size(); }
+
+    // Runs body over [0, count) in chunks on the worker threads and returns once every
+    // chunk is done. Jobs of one chunk run on the calling thread. Must not be called from a
+    // worker. Coarse items such as grid lines can use a smaller chunkSize.
+    void parallelFor(size_t count, const std::function<void(size_t begin, size_t end)>& body, size_t chunkSize = parallelChunkSize);
+
+    // Same value as stepChecksum, computed on the calling thread from the current state
+    uint64_t computeChecksum() const;
+
+    static const size_t checksumBlockSize = 4096; // Particles per block; fixed so checksums never depend on thread count
+    static const size_t parallelChunkSize = 16384; // Items per parallelFor chunk
+    static const uint64_t emitterReserveSteps = 1024; // Steps of emitter output reserved at a time
+    static const uint64_t emitterReserveLimit = 1 << 20; // Most particles reserved ahead of emitters at a time
+    static const size_t compactRatio = 8;          // Compact once this fraction (1/8) of the slots are dead
+    static const uint64_t compactInterval = 64;    // Otherwise compact any dead slots every this many steps
+    static const uint64_t sortCheckInterval = 16;  // Steps between locality measurements
+    static constexpr double sortCellSize = 16;     // Side of the cells the Morton curve visits
+    static const size_t tileItemSize = 4096;       // Most particles in one unit of work; larger tiles are split
+    static const size_t flowBlockSize = 64;        // Particles sampled from the flow field at a time
+
+    // A moving wall's motion over the current step
+    struct WallSweep {
+        double startX, startY, endX, endY; // Pose at the start of the step
+        double pivotX, pivotY;
+        double slideX, slideY;             // Slide over the step
+        double cosine, sine;               // Turn over the step
+        double velocityX, velocityY, spin; // Average slide velocity and spin
+    };
+
+    // Lays out the tiles and brings their wall lists, the moving walls' included, and the
+    // moving walls' sweeps over the coming step up to date for walls within reach. step()
+    // does this itself after the forces; the constraint solver calls it earlier to stop its
+    // predictions at the walls the particles are about to hit.
+    const TileGrid& prepareWalls(double reach);
+    const std::vector<WallSweep>& movingWallSweeps() const { return wallSweeps; } // Indexed like movingWalls
+
+private:
+    struct StepTally {
+        size_t deaths = 0;
+        size_t migrants = 0;   // Particles that ended the step outside their tile
+        double battedSpeed = 0; // Squared speed of the fastest particle a moving wall hit
+    };
+
+    // A run of one tile's particles, and the workers' claims on them
+    struct WorkItem {
+        size_t tile, begin, end;
+    };
+
+    void emit();
+    void applyForces();
+    void kick();
+    void updateParticleWorker(size_t workerId);
+    void updateRange(size_t begin, size_t end, size_t tile, StepTally& tally);
+    void updateSpan(size_t begin, size_t end, StepTally& tally);
+    void prepareTiles();
+    void prepareMovingWalls(double reach);
+    bool collideMovingWalls(Particle& particle, const std::vector<uint32_t>& list) const;
+    void binParticles();
+    void applyOrder();
+    uint32_t mortonCode(const Particle& particle) const;
+    uint64_t combineChecksum(const std::vector<uint64_t>& blockHashes) const;
+
+    SimulationMetrics& metrics;
+    std::vector<std::thread> threads;
+
+    TileGrid grid;
+    BarnesHutTree tree;
+    ParticleMesh mesh;
+    ConstraintSolver constraintSolver;
+    DistanceField distanceField;
+    std::vector<WallSweep> wallSweeps;       // One per moving wall, for the current step
+    std::vector<TileGrid::Bounds> sweepBounds; // Where each moving wall can be hit this step
+    std::vector<WorkItem> workItems;         // Every tile's runs, in tile order
+    std::vector<size_t> workerFirstItem;     // Worker w owns items [workerFirstItem[w], workerFirstItem[w + 1])
+    std::unique_ptr<std::atomic<size_t>[]> workerCursors; // Next unclaimed item of each worker's run
+    size_t binnedCount = 0;                  // particles.size() when last binned, SIZE_MAX once the tiles change
+    uint64_t binnedLayout = UINT64_MAX;      // layoutVersion when last binned
+    double maxSpeed = 0, maxRadius = 0;      // Over the live particles when last binned
+    std::atomic<size_t> stepMigrations{ 0 }; // Particles that left their tile during the last step
+    std::vector<double> workerBattedSpeed;   // Each worker's battedSpeed over the last step
+    std::condition_variable cv;              // Wakes workers when a step starts
+    std::condition_variable finishedCv;      // Wakes step() when the last worker finishes
+    std::mutex cv_m;
+    std::vector<uint64_t> blockChecksums;    // One hash per particle block in deterministic mode
+    std::atomic<size_t> stepDeaths{ 0 };     // Particles despawned during the current step
+    double stepEndTime = 0;                  // time once the current step completes; particles expire against it
+    std::vector<Particle> compactParticles;  // Compaction targets, kept to reuse their storage
+    std::vector<double> compactExpiry;
+    std::vector<uint32_t> compactIds;
+    std::vector<uint32_t> idSlots;           // Slot of each handle, noSlot if unused
+    std::vector<uint32_t> freeIds;           // Handles released by compaction, reused first
+    std::vector<uint32_t> sortKeys, sortOrder, sortKeysScratch, sortOrderScratch;
+    const std::function<void(size_t, size_t)>* task = nullptr; // parallelFor job, run instead of a step when set
+    size_t taskCount = 0;
+    size_t taskChunkSize = parallelChunkSize;
+    std::atomic<size_t> nextTaskIndex{ 0 };
+    bool stepDeterministic = false;          // deterministic as it was when the current step started
+    uint64_t frame = 0;          // Incremented for every step so each worker runs it exactly once
+    size_t workersFinished = 0;  // Workers done with the current frame
+    bool done = false;           // Flag to tell workers to exit
+};
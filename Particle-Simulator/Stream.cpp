@@ -0,0 +1,451 @@
+#include "Stream.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+const char streamMagic[4] = { 'P', 'S', 'T', 'R' };
+const sf::Uint32 streamVersion = 1;
+const size_t maxChunkPayload = 1200;   // Keeps datagrams under a typical MTU
+const uint32_t maxChunkCount = 65536;  // Caps a frame at about 78 MB, a keyframe of some 19 million particles
+const size_t historyLength = 64;       // Frames kept as delta baselines on both ends
+const double resendDelay = 0.25;       // Seconds before an unacknowledged frame is sent again
+const uint32_t chunksPerPass = 16;     // Datagrams sent to a client per loop pass, so bursts don't overrun its receive buffer
+
+// Prefixed to every datagram so each chunk can be placed without the others
+struct ChunkHeader {
+    char magic[4];
+    uint32_t frameId;
+    uint32_t baseline;      // Frame the payload is a delta against, 0 for a keyframe
+    uint32_t chunkIndex;
+    uint32_t chunkCount;
+    uint32_t particleCount;
+    uint64_t step;
+    float simWidth, simHeight;
+    uint32_t payloadBytes;  // Size of the whole frame payload
+    uint32_t reserved;
+};
+
+void putVarint(std::vector<unsigned char>& out, int32_t value) {
+    uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    while (zigzag >= 0x80) {
+        out.push_back(static_cast<unsigned char>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(zigzag));
+}
+
+bool getVarint(const unsigned char*& cursor, const unsigned char* end, int32_t& value) {
+    uint32_t zigzag = 0;
+    for (int shift = 0; cursor < end && shift < 32; shift += 7) {
+        unsigned char byte = *cursor++;
+        zigzag |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            value = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t quantize(double value, double extent) {
+    double scaled = std::round(value / extent * 65535.0);
+    return static_cast<uint16_t>(std::min(65535.0, std::max(0.0, scaled)));
+}
+
+}
+
+StreamServer::StreamServer(unsigned short port, unsigned int maxFps, uint64_t bytesPerSecond)
+    : port(port), maxFps(std::max(1u, maxFps)), bytesPerSecond(bytesPerSecond) {}
+
+StreamServer::~StreamServer() {
+    stop();
+}
+
+bool StreamServer::start() {
+    if (listener.listen(port) != sf::Socket::Done) {
+        std::cerr << "Stream server could not listen on port " << port << '\n';
+        return false;
+    }
+    if (udp.bind(sf::Socket::AnyPort) != sf::Socket::Done) {
+        std::cerr << "Stream server could not open a UDP socket\n";
+        listener.close();
+        return false;
+    }
+    running = true;
+    thread = std::thread(&StreamServer::run, this);
+    return true;
+}
+
+void StreamServer::stop() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+    listener.close();
+    udp.unbind();
+}
+
+void StreamServer::publish(const Simulation& simulation) {
+    if (clientCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+    frame->step = simulation.stepCount;
+    frame->simWidth = static_cast<float>(simulation.simWidth);
+    frame->simHeight = static_cast<float>(simulation.simHeight);
+    frame->positions.resize(simulation.aliveCount() * 2);
+    size_t out = 0;
+    for (const auto& particle : simulation.particles) {
+        if (particle.alive()) { // Despawned slots are not sent
+            frame->positions[out++] = quantize(particle.x, simulation.simWidth);
+            frame->positions[out++] = quantize(particle.y, simulation.simHeight);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    frame->id = nextFrameId++;
+    pending = frame; // An unsent older frame is simply replaced
+}
+
+void StreamServer::run() {
+    sf::Clock clock;
+    double lastTime = 0;
+    sf::SocketSelector selector;
+
+    while (running) {
+        selector.clear();
+        selector.add(listener);
+        for (const auto& client : clients) {
+            selector.add(*client->control);
+        }
+
+        bool sending = false;
+        for (const auto& client : clients) {
+            sending = sending || client->nextChunk < client->chunkCount;
+        }
+        if (selector.wait(sf::milliseconds(sending ? 1 : 2))) {
+            if (selector.isReady(listener)) {
+                std::unique_ptr<Client> client(new Client());
+                client->control.reset(new sf::TcpSocket());
+                if (listener.accept(*client->control) == sf::Socket::Done) {
+                    client->address = client->control->getRemoteAddress();
+                    clients.push_back(std::move(client));
+                    clientCount = clients.size();
+                }
+            }
+            for (size_t i = 0; i < clients.size();) {
+                if (selector.isReady(*clients[i]->control) && !readControl(*clients[i])) {
+                    clients.erase(clients.begin() + i);
+                    clientCount = clients.size();
+                    continue;
+                }
+                ++i;
+            }
+        }
+
+        std::shared_ptr<const Frame> frame;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            frame = pending;
+        }
+        if (frame && (history.empty() || history.back()->id != frame->id)) {
+            history.push_back(frame);
+            if (history.size() > historyLength) {
+                history.pop_front();
+            }
+        }
+        if (history.empty()) {
+            continue;
+        }
+
+        double now = clock.getElapsedTime().asSeconds();
+        double elapsed = now - lastTime;
+        lastTime = now;
+        const Frame& latest = *history.back();
+        for (const auto& client : clients) {
+            if (bytesPerSecond > 0) {
+                client->tokens = std::min(static_cast<double>(bytesPerSecond), client->tokens + elapsed * bytesPerSecond);
+            }
+            if (!client->greeted) {
+                continue;
+            }
+            // A lost frame is only replaced by the next one, so resend it while the simulation is paused
+            bool due = client->lastSent != latest.id ? now >= client->nextSend : client->acked != latest.id && now >= client->nextSend + resendDelay;
+            if (client->nextChunk == client->chunkCount && due) {
+                encodeFrame(*client, latest);
+                client->nextSend = now + client->interval;
+            }
+            sendChunks(*client);
+        }
+    }
+
+    clients.clear();
+    clientCount = 0;
+}
+
+bool StreamServer::readControl(Client& client) {
+    sf::Packet packet;
+    sf::Socket::Status status = client.control->receive(packet);
+    if (status == sf::Socket::Disconnected || status == sf::Socket::Error) {
+        return false;
+    }
+    if (status != sf::Socket::Done) {
+        return true;
+    }
+
+    if (!client.greeted) {
+        sf::Uint32 version = 0, fps = 0;
+        sf::Uint16 udpPort = 0;
+        if (!(packet >> version >> udpPort >> fps) || version != streamVersion || udpPort == 0) {
+            return false;
+        }
+        client.udpPort = udpPort;
+        client.interval = 1.0 / std::max(1u, std::min<unsigned int>(fps, maxFps));
+        client.tokens = static_cast<double>(bytesPerSecond);
+        client.greeted = true;
+
+        // Tell the viewer which port frames come from, so it can ignore datagrams from anywhere else
+        sf::Packet welcome;
+        welcome << static_cast<sf::Uint16>(udp.getLocalPort());
+        return client.control->send(welcome) == sf::Socket::Done;
+    }
+
+    sf::Uint32 ack = 0;
+    if (packet >> ack) {
+        client.acked = std::max(client.acked, static_cast<uint32_t>(ack));
+    }
+    return true;
+}
+
+void StreamServer::encodeFrame(Client& client, const Frame& frame) {
+    // Delta against the newest frame the client confirmed, if it is still in the history
+    const Frame* baseline = nullptr;
+    for (const auto& candidate : history) {
+        if (candidate->id == client.acked && candidate->positions.size() == frame.positions.size()) {
+            baseline = candidate.get();
+        }
+    }
+
+    std::vector<unsigned char>& payload = client.encoded;
+    payload.clear();
+    if (baseline != nullptr) {
+        for (size_t i = 0; i < frame.positions.size(); ++i) {
+            putVarint(payload, static_cast<int16_t>(frame.positions[i] - baseline->positions[i]));
+        }
+    }
+    else {
+        payload.resize(frame.positions.size() * sizeof(uint16_t));
+        if (!payload.empty()) {
+            std::memcpy(payload.data(), frame.positions.data(), payload.size());
+        }
+    }
+
+    ChunkHeader header = {};
+    std::memcpy(header.magic, streamMagic, sizeof(streamMagic));
+    header.frameId = frame.id;
+    header.baseline = baseline != nullptr ? baseline->id : 0;
+    header.chunkCount = static_cast<uint32_t>(std::max<size_t>(1, (payload.size() + maxChunkPayload - 1) / maxChunkPayload));
+    header.particleCount = static_cast<uint32_t>(frame.positions.size() / 2);
+    header.step = frame.step;
+    header.simWidth = frame.simWidth;
+    header.simHeight = frame.simHeight;
+    header.payloadBytes = static_cast<uint32_t>(payload.size());
+
+    client.chunkHeader.resize(sizeof(header));
+    std::memcpy(client.chunkHeader.data(), &header, sizeof(header));
+    client.chunkCount = header.chunkCount;
+    client.nextChunk = 0;
+    client.lastSent = frame.id;
+}
+
+void StreamServer::sendChunks(Client& client) {
+    for (uint32_t sent = 0; sent < chunksPerPass && client.nextChunk < client.chunkCount; ++sent) {
+        if (bytesPerSecond > 0 && client.tokens <= 0) {
+            return;
+        }
+        uint32_t chunk = client.nextChunk++;
+        size_t begin = chunk * maxChunkPayload;
+        size_t length = std::min(maxChunkPayload, client.encoded.size() - std::min(begin, client.encoded.size()));
+        datagram.assign(client.chunkHeader.begin(), client.chunkHeader.end());
+        std::memcpy(datagram.data() + offsetof(ChunkHeader, chunkIndex), &chunk, sizeof(chunk));
+        datagram.insert(datagram.end(), client.encoded.begin() + begin, client.encoded.begin() + begin + length);
+        udp.send(datagram.data(), datagram.size(), client.address, client.udpPort);
+        client.tokens -= static_cast<double>(datagram.size());
+    }
+}
+
+StreamClient::StreamClient(const sf::IpAddress& host, unsigned short port, unsigned int maxFps)
+    : buffer(sf::UdpSocket::MaxDatagramSize) {
+    if (control.connect(host, port, sf::seconds(5)) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not connect to stream server " + host.toString() + ":" + std::to_string(port) + ".");
+    }
+    if (udp.bind(sf::Socket::AnyPort) != sf::Socket::Done) {
+        throw std::invalid_argument("Could not open a UDP socket for the stream.");
+    }
+    udp.setBlocking(false);
+
+    sf::Packet hello;
+    hello << streamVersion << static_cast<sf::Uint16>(udp.getLocalPort()) << static_cast<sf::Uint32>(maxFps);
+    sf::Packet welcome;
+    sf::Uint16 udpPort = 0;
+    if (control.send(hello) != sf::Socket::Done || control.receive(welcome) != sf::Socket::Done || !(welcome >> udpPort) || udpPort == 0) {
+        throw std::invalid_argument("Could not register with stream server " + host.toString() + ".");
+    }
+    serverAddress = control.getRemoteAddress();
+    serverPort = udpPort;
+    thread = std::thread(&StreamClient::run, this);
+}
+
+StreamClient::~StreamClient() {
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool StreamClient::poll(StreamFrame& frame, sf::Time timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!cv.wait_for(lock, std::chrono::microseconds(timeout.asMicroseconds()), [this] { return latestId != returnedId || !isConnected; })
+        || latestId == returnedId) {
+        return false;
+    }
+    frame = latest;
+    returnedId = latestId;
+    return true;
+}
+
+void StreamClient::run() {
+    sf::SocketSelector selector;
+    selector.add(udp);
+    selector.add(control);
+    while (running && isConnected) {
+        if (!selector.wait(sf::milliseconds(50))) {
+            continue;
+        }
+        if (selector.isReady(control)) {
+            // The server only sends the welcome on the control connection, so readable means closed
+            char ignored[64];
+            std::size_t received = 0;
+            if (control.receive(ignored, sizeof(ignored), received) != sf::Socket::Done) {
+                std::lock_guard<std::mutex> lock(mutex);
+                isConnected = false;
+                cv.notify_all();
+            }
+        }
+
+        sf::IpAddress sender;
+        unsigned short senderPort = 0;
+        std::size_t received = 0;
+        while (udp.receive(buffer.data(), buffer.size(), received, sender, senderPort) == sf::Socket::Done) {
+            if (sender == serverAddress && senderPort == serverPort) {
+                receiveChunk(received);
+            }
+        }
+    }
+}
+
+void StreamClient::receiveChunk(size_t received) {
+    ChunkHeader header;
+    if (received < sizeof(header)) {
+        return;
+    }
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    size_t length = received - sizeof(header);
+    size_t begin = static_cast<size_t>(header.chunkIndex) * maxChunkPayload;
+    // The header sizes the assembly buffers, so anything a real frame could not have is dropped
+    if (std::memcmp(header.magic, streamMagic, sizeof(streamMagic)) != 0 || header.frameId <= newest
+        || header.chunkCount == 0 || header.chunkCount > maxChunkCount
+        || header.payloadBytes > static_cast<uint64_t>(header.chunkCount) * maxChunkPayload
+        || header.chunkIndex >= header.chunkCount || begin + length > header.payloadBytes) {
+        return;
+    }
+
+    // A resent frame may be encoded against a newer baseline; start it over in that case
+    Assembly& assembly = assemblies[header.frameId];
+    if (assembly.received.empty() || assembly.baseline != header.baseline || assembly.bytes.size() != header.payloadBytes) {
+        assembly.baseline = header.baseline;
+        assembly.step = header.step;
+        assembly.particleCount = header.particleCount;
+        assembly.simWidth = header.simWidth;
+        assembly.simHeight = header.simHeight;
+        assembly.bytes.resize(header.payloadBytes);
+        assembly.received.assign(header.chunkCount, false);
+        assembly.missing = header.chunkCount;
+    }
+    if (assembly.received[header.chunkIndex]) {
+        return;
+    }
+    if (length > 0) {
+        std::memcpy(assembly.bytes.data() + begin, buffer.data() + sizeof(header), length);
+    }
+    assembly.received[header.chunkIndex] = true;
+    if (--assembly.missing > 0) {
+        return;
+    }
+
+    uint32_t id = header.frameId;
+    if (decode(id, assembly)) {
+        newest = id;
+        sf::Packet ack;
+        ack << static_cast<sf::Uint32>(id);
+        control.send(ack);
+    }
+    // Anything older than the newest decoded frame will never be shown
+    assemblies.erase(assemblies.begin(), assemblies.upper_bound(std::max(id, newest)));
+}
+
+bool StreamClient::decode(uint32_t id, const Assembly& assembly) {
+    std::vector<uint16_t> positions(static_cast<size_t>(assembly.particleCount) * 2);
+    if (assembly.baseline == 0) {
+        if (assembly.bytes.size() != positions.size() * sizeof(uint16_t)) {
+            return false;
+        }
+        if (!positions.empty()) {
+            std::memcpy(positions.data(), assembly.bytes.data(), assembly.bytes.size());
+        }
+    }
+    else {
+        auto baseline = decoded.find(assembly.baseline);
+        if (baseline == decoded.end() || baseline->second.size() != positions.size()) {
+            return false;
+        }
+        const unsigned char* cursor = assembly.bytes.data();
+        const unsigned char* end = cursor + assembly.bytes.size();
+        for (size_t i = 0; i < positions.size(); ++i) {
+            int32_t delta = 0;
+            if (!getVarint(cursor, end, delta)) {
+                return false;
+            }
+            positions[i] = static_cast<uint16_t>(baseline->second[i] + delta);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        latest.step = assembly.step;
+        latest.simWidth = assembly.simWidth;
+        latest.simHeight = assembly.simHeight;
+        latest.positions.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); i += 2) {
+            latest.positions[i] = positions[i] / 65535.0f * assembly.simWidth;
+            latest.positions[i + 1] = positions[i + 1] / 65535.0f * assembly.simHeight;
+        }
+        latestId = id;
+    }
+    cv.notify_all();
+
+    decoded[id] = std::move(positions);
+    while (decoded.size() > historyLength) {
+        decoded.erase(decoded.begin());
+    }
+    return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <SFML/Network.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Simulation;
+
+// Streams particle positions to remote viewers.
+//
+// A viewer connects over TCP and sends a hello with the UDP port it listens on and
+// the frame rate it wants. The server answers with the UDP port it sends from, and
+// the viewer drops datagrams from any other sender. Frames then go out as UDP
+// datagrams: positions are quantized to 16 bits across the domain and, when the
+// viewer has acknowledged a recent frame, sent as zigzag-varint deltas against that
+// frame. The viewer acknowledges every frame it decodes over the TCP connection.
+// Lost datagrams only cost a keyframe or a delta against an older baseline, never a
+// stall.
+//
+// Every client is rate limited by its requested frame rate (capped by the server)
+// and by a token bucket on bytes per second.
+
+const unsigned short defaultStreamPort = 9470;
+
+class StreamServer {
+public:
+    StreamServer(unsigned short port, unsigned int maxFps, uint64_t bytesPerSecond);
+    ~StreamServer();
+
+    bool start();
+    void stop();
+
+    // Quantizes the positions and hands them to the server thread. Does nothing
+    // while no viewer is connected, and never waits for the network.
+    void publish(const Simulation& simulation);
+
+private:
+    struct Frame {
+        uint32_t id = 0;
+        uint64_t step = 0;
+        float simWidth = 0, simHeight = 0;
+        std::vector<uint16_t> positions; // Interleaved x, y
+    };
+
+    struct Client {
+        std::unique_ptr<sf::TcpSocket> control;
+        sf::IpAddress address;
+        unsigned short udpPort = 0;
+        double interval = 0;     // Minimum seconds between frames
+        double nextSend = 0;
+        double tokens = 0;       // Byte budget; refilled at bytesPerSecond
+        uint32_t acked = 0;      // Newest frame the client decoded, 0 if none
+        uint32_t lastSent = 0;
+        bool greeted = false;
+        std::vector<unsigned char> encoded; // Payload of the frame being sent
+        uint32_t nextChunk = 0;
+        uint32_t chunkCount = 0;
+        std::vector<unsigned char> chunkHeader;
+    };
+
+    void run();
+    bool readControl(Client& client);
+    void encodeFrame(Client& client, const Frame& frame);
+    void sendChunks(Client& client);
+
+    unsigned short port;
+    unsigned int maxFps;
+    uint64_t bytesPerSecond;
+    sf::TcpListener listener;
+    sf::UdpSocket udp;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<size_t> clientCount{ 0 };
+
+    std::mutex mutex;
+    std::shared_ptr<const Frame> pending; // Newest published frame, picked up by the server thread
+    uint32_t nextFrameId = 1;
+
+    // Server thread state
+    std::vector<std::unique_ptr<Client>> clients;
+    std::deque<std::shared_ptr<const Frame>> history; // Recent frames kept as delta baselines
+    std::vector<unsigned char> datagram;
+};
+
+struct StreamFrame {
+    uint64_t step = 0;
+    float simWidth = 0, simHeight = 0;
+    std::vector<float> positions; // Interleaved x, y in domain coordinates
+};
+
+// Viewer side of the stream. Datagrams are received and decoded on a background
+// thread so none are dropped while the caller renders. Throws std::invalid_argument
+// if the server cannot be reached.
+class StreamClient {
+public:
+    StreamClient(const sf::IpAddress& host, unsigned short port, unsigned int maxFps);
+    ~StreamClient();
+
+    // Waits up to timeout for a frame newer than the last one returned
+    bool poll(StreamFrame& frame, sf::Time timeout);
+    bool connected() const { return isConnected; }
+
+private:
+    struct Assembly {
+        uint32_t baseline = 0;
+        uint64_t step = 0;
+        uint32_t particleCount = 0;
+        float simWidth = 0, simHeight = 0;
+        std::vector<unsigned char> bytes;
+        std::vector<bool> received;
+        uint32_t missing = 0;
+    };
+
+    void run();
+    void receiveChunk(size_t received);
+    bool decode(uint32_t id, const Assembly& assembly);
+
+    sf::TcpSocket control;
+    sf::UdpSocket udp;
+    sf::IpAddress serverAddress; // Only datagrams from here are decoded
+    unsigned short serverPort = 0;
+    std::thread thread;
+    std::atomic<bool> running{ true };
+    std::atomic<bool> isConnected{ true };
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    StreamFrame latest;   // Newest decoded frame
+    uint32_t latestId = 0;
+    uint32_t returnedId = 0;
+
+    // Receiver thread state
+    uint32_t newest = 0;                                  // Newest frame decoded
+    std::map<uint32_t, Assembly> assemblies;              // Frames still missing chunks
+    std::map<uint32_t, std::vector<uint16_t>> decoded;    // Recent frames, baselines for deltas
+    std::vector<unsigned char> buffer;
+};
@@ -0,0 +1,186 @@
+#include "TileGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+bool sameWalls(const Wall* a, const Wall* b, size_t count) {
+    return count == 0 || std::memcmp(a, b, count * sizeof(Wall)) == 0;
+}
+
+}
+
+constexpr double TileGrid::tileSize;
+
+bool TileGrid::resize(double simWidth, double simHeight) {
+    if (simWidth == width && simHeight == height && !tiles.empty()) {
+        return false;
+    }
+    width = simWidth;
+    height = simHeight;
+    columns = std::max<size_t>(1, static_cast<size_t>(std::ceil(simWidth / tileSize)));
+    rows = std::max<size_t>(1, static_cast<size_t>(std::ceil(simHeight / tileSize)));
+
+    const float infinity = std::numeric_limits<float>::infinity();
+    tiles.assign(columns * rows, Tile());
+    for (size_t row = 0; row < rows; ++row) {
+        for (size_t column = 0; column < columns; ++column) {
+            Tile& tile = tiles[row * columns + column];
+            tile.minX = column == 0 ? -infinity : static_cast<float>(column * tileSize);
+            tile.maxX = column + 1 == columns ? infinity : static_cast<float>((column + 1) * tileSize);
+            tile.minY = row == 0 ? -infinity : static_cast<float>(row * tileSize);
+            tile.maxY = row + 1 == rows ? infinity : static_cast<float>((row + 1) * tileSize);
+        }
+    }
+    wallReach = -1; // New tiles need new wall lists
+    movingWalls.assign(tiles.size(), std::vector<uint32_t>());
+    movingSpans.clear();
+    return true;
+}
+
+size_t TileGrid::tileOf(double x, double y) const {
+    double column = std::floor(x / tileSize);
+    double row = std::floor(y / tileSize);
+    size_t c = column <= 0 ? 0 : std::min(columns - 1, static_cast<size_t>(column));
+    size_t r = row <= 0 ? 0 : std::min(rows - 1, static_cast<size_t>(row));
+    return r * columns + c;
+}
+
+void TileGrid::updateWalls(const std::vector<Wall>& allWalls, double reach) {
+    if (reach <= wallReach) {
+        size_t common = 0;
+        size_t shorter = std::min(allWalls.size(), builtWalls.size());
+        while (common < shorter && sameWalls(&allWalls[common], &builtWalls[common], 1)) {
+            ++common;
+        }
+        if (common == builtWalls.size()) {
+            if (common < allWalls.size()) {
+                appendWalls(allWalls, common);
+                builtWalls.assign(allWalls.begin(), allWalls.end());
+            }
+            return;
+        }
+        if (allWalls.size() + 1 == builtWalls.size()
+            && sameWalls(allWalls.data() + common, builtWalls.data() + common + 1, allWalls.size() - common)) {
+            removeWall(builtWalls[common]);
+            builtWalls.erase(builtWalls.begin() + static_cast<std::ptrdiff_t>(common));
+            return;
+        }
+    }
+    // Leave headroom so a slowly growing reach does not rebuild every step
+    wallReach = reach * 1.25 + 1;
+    rebuildWalls(allWalls);
+    builtWalls.assign(allWalls.begin(), allWalls.end());
+}
+
+bool TileGrid::reaches(const Wall& wall, const Tile& tile) const {
+    float margin = static_cast<float>(wallReach);
+    float minX = std::min(wall.start.x, wall.end.x), maxX = std::max(wall.start.x, wall.end.x);
+    float minY = std::min(wall.start.y, wall.end.y), maxY = std::max(wall.start.y, wall.end.y);
+    return maxX >= tile.minX - margin && minX <= tile.maxX + margin && maxY >= tile.minY - margin && minY <= tile.maxY + margin;
+}
+
+void TileGrid::rebuildWalls(const std::vector<Wall>& allWalls) {
+    // Walls keep their global order within each tile, so the first wall a particle
+    // collides with is the same one it would find searching every wall
+    walls.clear();
+    for (auto& tile : tiles) {
+        tile.firstWall = walls.size();
+        for (const auto& wall : allWalls) {
+            if (reaches(wall, tile)) {
+                walls.push_back(wall);
+            }
+        }
+        tile.lastWall = walls.size();
+    }
+    ++wallRebuilds;
+}
+
+void TileGrid::appendWalls(const std::vector<Wall>& allWalls, size_t first) {
+    // New walls go after each tile's existing ones, which keeps the global order
+    scratchWalls.clear();
+    for (auto& tile : tiles) {
+        size_t begin = scratchWalls.size();
+        scratchWalls.insert(scratchWalls.end(), walls.begin() + static_cast<std::ptrdiff_t>(tile.firstWall),
+            walls.begin() + static_cast<std::ptrdiff_t>(tile.lastWall));
+        for (size_t k = first; k < allWalls.size(); ++k) {
+            if (reaches(allWalls[k], tile)) {
+                scratchWalls.push_back(allWalls[k]);
+            }
+        }
+        tile.firstWall = begin;
+        tile.lastWall = scratchWalls.size();
+    }
+    walls.swap(scratchWalls);
+}
+
+void TileGrid::removeWall(const Wall& removed) {
+    // A copy identical to the removed wall is interchangeable with it, so each tile drops its first match
+    scratchWalls.clear();
+    for (auto& tile : tiles) {
+        size_t begin = scratchWalls.size();
+        bool dropped = !reaches(removed, tile);
+        for (size_t k = tile.firstWall; k < tile.lastWall; ++k) {
+            if (!dropped && sameWalls(&walls[k], &removed, 1)) {
+                dropped = true;
+                continue;
+            }
+            scratchWalls.push_back(walls[k]);
+        }
+        tile.firstWall = begin;
+        tile.lastWall = scratchWalls.size();
+    }
+    walls.swap(scratchWalls);
+}
+
+size_t TileGrid::clampedColumn(double x) const {
+    double column = std::floor(x / tileSize);
+    return column <= 0 ? 0 : std::min(columns - 1, static_cast<size_t>(column));
+}
+
+size_t TileGrid::clampedRow(double y) const {
+    double row = std::floor(y / tileSize);
+    return row <= 0 ? 0 : std::min(rows - 1, static_cast<size_t>(row));
+}
+
+void TileGrid::refitMovingWalls(const std::vector<Bounds>& bounds) {
+    size_t count = std::max(bounds.size(), movingSpans.size());
+    movingSpans.resize(count);
+    for (size_t k = 0; k < count; ++k) {
+        Span span;
+        if (k < bounds.size()) {
+            span.firstColumn = clampedColumn(bounds[k].minX);
+            span.lastColumn = clampedColumn(bounds[k].maxX);
+            span.firstRow = clampedRow(bounds[k].minY);
+            span.lastRow = clampedRow(bounds[k].maxY);
+        }
+        const Span old = movingSpans[k];
+        if (span == old) {
+            continue;
+        }
+
+        uint32_t index = static_cast<uint32_t>(k);
+        for (size_t row = old.firstRow; row <= old.lastRow; ++row) {
+            for (size_t column = old.firstColumn; column <= old.lastColumn; ++column) {
+                if (!span.contains(column, row)) {
+                    std::vector<uint32_t>& list = movingWalls[row * columns + column];
+                    list.erase(std::lower_bound(list.begin(), list.end(), index));
+                }
+            }
+        }
+        for (size_t row = span.firstRow; row <= span.lastRow; ++row) {
+            for (size_t column = span.firstColumn; column <= span.lastColumn; ++column) {
+                if (!old.contains(column, row)) {
+                    std::vector<uint32_t>& list = movingWalls[row * columns + column];
+                    list.insert(std::lower_bound(list.begin(), list.end(), index), index);
+                }
+            }
+        }
+        movingSpans[k] = span;
+        ++movingRefits;
+    }
+    movingSpans.resize(bounds.size());
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Wall.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Splits the domain into square tiles for the workers to own. Between steps the
+// simulation bins its particles by tile, so each tile is a contiguous run of the
+// particle array. Each tile also keeps its own copy of the walls that reach into it
+// or into its ghost zone, a margin as wide as the farthest any particle can travel
+// in one step, so a particle near a tile border still sees every wall it could hit
+// in the neighbouring tile.
+//
+// The tile size is fixed rather than derived from the thread count, so the particle
+// order, and with it every checksum, is the same for any number of workers.
+//
+// Walls appended to the list, or a single wall taken out of it, are added to or
+// dropped from the tiles' copies in place; any other change rebuilds them. Moving walls
+// are listed separately, by index, and refit every step: a wall only joins or leaves
+// the lists of the tiles its swept bounds start or stop reaching.
+class TileGrid {
+public:
+    struct Tile {
+        size_t begin = 0, end = 0;          // Particle range after binning
+        size_t firstWall = 0, lastWall = 0; // Range in walls
+        float minX = 0, minY = 0, maxX = 0, maxY = 0; // Edge tiles extend to infinity outwards
+    };
+
+    struct Bounds {
+        float minX, minY, maxX, maxY;
+    };
+
+    std::vector<Tile> tiles;
+    std::vector<Wall> walls;                // Every tile's nearby walls, stored tile after tile
+    std::vector<std::vector<uint32_t>> movingWalls; // Each tile's moving walls, in ascending order
+
+    uint64_t wallRebuilds = 0;              // Times every tile's walls were rebuilt
+    uint64_t movingRefits = 0;              // Times a moving wall joined or left any tiles
+
+    static constexpr double tileSize = 128; // Multiple of the locality sort cell, so no sort cell straddles two tiles
+
+    // Lays the tiles out over the domain. Returns false, keeping the existing layout, if
+    // the domain is unchanged.
+    bool resize(double simWidth, double simHeight);
+
+    size_t tileCount() const { return tiles.size(); }
+    size_t tileOf(double x, double y) const;
+
+    // Brings the wall lists up to date unless they were built from the same walls with at
+    // least this reach
+    void updateWalls(const std::vector<Wall>& allWalls, double reach);
+
+    // Lists moving wall k in every tile its bounds reach, which should cover everywhere it
+    // sweeps this step plus the ghost zone
+    void refitMovingWalls(const std::vector<Bounds>& bounds);
+
+private:
+    struct Span {
+        size_t firstColumn = 1, lastColumn = 0, firstRow = 1, lastRow = 0; // Empty when first > last
+        bool operator==(const Span& other) const {
+            return firstColumn == other.firstColumn && lastColumn == other.lastColumn
+                && firstRow == other.firstRow && lastRow == other.lastRow;
+        }
+        bool contains(size_t column, size_t row) const {
+            return column >= firstColumn && column <= lastColumn && row >= firstRow && row <= lastRow;
+        }
+    };
+
+    void rebuildWalls(const std::vector<Wall>& allWalls);
+    void appendWalls(const std::vector<Wall>& allWalls, size_t first);
+    void removeWall(const Wall& removed);
+    bool reaches(const Wall& wall, const Tile& tile) const;
+    size_t clampedColumn(double x) const;
+    size_t clampedRow(double y) const;
+
+    size_t columns = 0, rows = 0;
+    double width = 0, height = 0;
+    std::vector<Wall> builtWalls;           // Walls the lists were built from, to spot edits
+    std::vector<Wall> scratchWalls;         // Next lists while editing them in place
+    double wallReach = -1;                  // Ghost zone width the lists were built for
+    std::vector<Span> movingSpans;          // Tiles each moving wall is listed in
+};
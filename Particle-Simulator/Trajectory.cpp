@@ -0,0 +1,358 @@
+#include "Trajectory.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+const char trajectoryMagic[4] = { 'P', 'T', 'R', 'J' };
+const uint32_t trajectoryVersion = 1;
+
+struct TrajectoryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t keyframeInterval;
+    uint32_t reserved;
+    double quantum, simWidth, simHeight;
+    uint64_t frameCount;
+    uint64_t lastStep;
+    uint64_t indexOffset; // 0 until the recording is closed
+    uint64_t indexCount;
+};
+
+struct FrameRecord {
+    uint8_t keyframe;
+    uint8_t reserved[3];
+    uint32_t particleCount;
+    uint64_t step;
+    double time;
+    uint64_t payloadBytes;
+};
+
+// 64-bit file positions, since long is 32 bits on Windows and recordings outgrow 2 GiB
+uint64_t filePosition(std::FILE* file) {
+#ifdef _WIN32
+    return static_cast<uint64_t>(_ftelli64(file));
+#else
+    return static_cast<uint64_t>(ftello(file));
+#endif
+}
+
+void seekFile(std::FILE* file, uint64_t position) {
+#ifdef _WIN32
+    _fseeki64(file, static_cast<__int64>(position), SEEK_SET);
+#else
+    fseeko(file, static_cast<off_t>(position), SEEK_SET);
+#endif
+}
+
+struct IndexEntry {
+    uint64_t step;
+    uint64_t offset;
+};
+
+void putVarint(std::vector<unsigned char>& out, int64_t value) {
+    uint64_t zigzag = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (zigzag >= 0x80) {
+        out.push_back(static_cast<unsigned char>(zigzag | 0x80));
+        zigzag >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(zigzag));
+}
+
+int64_t getVarint(const unsigned char*& cursor, const unsigned char* end) {
+    uint64_t zigzag = 0;
+    int shift = 0;
+    while (cursor < end && shift < 64) {
+        unsigned char byte = *cursor++;
+        zigzag |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+        }
+        shift += 7;
+    }
+    throw std::invalid_argument("Trajectory frame is truncated.");
+}
+
+int64_t quantize(double value, double quantum) {
+    return static_cast<int64_t>(std::llround(value / quantum));
+}
+
+}
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string& path, double simWidth, double simHeight,
+    uint32_t keyframeInterval, double quantum, size_t ringSlots)
+    : path(path), keyframeInterval(std::max<uint32_t>(1, keyframeInterval)), quantum(quantum), ring(std::max<size_t>(2, ringSlots)) {
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::invalid_argument("Could not open trajectory file '" + path + "'.");
+    }
+
+    TrajectoryHeader header = {};
+    std::memcpy(header.magic, trajectoryMagic, sizeof(trajectoryMagic));
+    header.version = trajectoryVersion;
+    header.keyframeInterval = this->keyframeInterval;
+    header.quantum = quantum;
+    header.simWidth = simWidth;
+    header.simHeight = simHeight;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        throw std::invalid_argument("Could not write trajectory file '" + path + "'.");
+    }
+
+    thread = std::thread(&TrajectoryRecorder::run, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+    try {
+        close();
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << '\n';
+    }
+}
+
+void TrajectoryRecorder::close() {
+    if (file == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+    thread.join();
+
+    // Append the keyframe index and patch the header so readers can skip the scan
+    uint64_t indexOffset = filePosition(file);
+    for (const auto& entry : keyframeIndex) {
+        IndexEntry record = { entry.first, entry.second };
+        if (std::fwrite(&record, sizeof(record), 1, file) != 1) failed = true;
+    }
+
+    // frameCount, lastStep, indexOffset and indexCount are the last four header fields
+    uint64_t trailer[4] = { frameCount, lastStep, indexOffset, keyframeIndex.size() };
+    seekFile(file, offsetof(TrajectoryHeader, frameCount));
+    if (std::fwrite(trailer, sizeof(trailer), 1, file) != 1 || std::fflush(file) != 0) failed = true;
+    if (std::fclose(file) != 0) failed = true;
+    file = nullptr;
+    if (failed) {
+        throw std::invalid_argument("Could not write trajectory file '" + path + "'; the recording is incomplete.");
+    }
+}
+
+void TrajectoryRecorder::record(const Simulation& simulation) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return queued < ring.size(); });
+    Slot& slot = ring[head];
+    lock.unlock();
+
+    // The writer never touches a slot until it is queued, so the copy needs no lock
+    slot.step = simulation.stepCount;
+    slot.time = simulation.time;
+    // Particles are copied in handle order rather than slot order: binning and sorting
+    // move particles between slots every few steps, but a particle keeps its handle, so
+    // each one is delta-encoded against its own previous position. Despawned slots are
+    // left out, so playback only ever shows live particles.
+    slot.particles.clear();
+    for (uint32_t id = 0; id < simulation.idCount(); ++id) {
+        uint32_t index = simulation.slotOf(id);
+        if (index != Simulation::noSlot && simulation.particles[index].alive()) {
+            slot.particles.push_back(simulation.particles[index]);
+        }
+    }
+
+    lock.lock();
+    head = (head + 1) % ring.size();
+    ++queued;
+    cv.notify_all();
+}
+
+void TrajectoryRecorder::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return queued > 0 || stopping; });
+        if (queued == 0) {
+            return;
+        }
+        Slot& slot = ring[tail];
+        lock.unlock();
+
+        writeFrame(slot);
+
+        lock.lock();
+        tail = (tail + 1) % ring.size();
+        --queued;
+        cv.notify_all();
+    }
+}
+
+void TrajectoryRecorder::writeFrame(const Slot& slot) {
+    const std::vector<Particle>& particles = slot.particles;
+    bool keyframe = framesSinceKeyframe == 0 || framesSinceKeyframe >= keyframeInterval || previous.size() != particles.size() * 2;
+
+    buffer.clear();
+    if (keyframe) {
+        buffer.resize(particles.size() * 2 * sizeof(double));
+        double* out = reinterpret_cast<double*>(buffer.data());
+        previous.resize(particles.size() * 2);
+        for (size_t i = 0; i < particles.size(); ++i) {
+            out[2 * i] = particles[i].x;
+            out[2 * i + 1] = particles[i].y;
+            previous[2 * i] = quantize(particles[i].x, quantum);
+            previous[2 * i + 1] = quantize(particles[i].y, quantum);
+        }
+        framesSinceKeyframe = 0;
+    }
+    else {
+        for (size_t i = 0; i < particles.size(); ++i) {
+            int64_t qx = quantize(particles[i].x, quantum);
+            int64_t qy = quantize(particles[i].y, quantum);
+            putVarint(buffer, qx - previous[2 * i]);
+            putVarint(buffer, qy - previous[2 * i + 1]);
+            previous[2 * i] = qx;
+            previous[2 * i + 1] = qy;
+        }
+    }
+    ++framesSinceKeyframe;
+
+    FrameRecord record = {};
+    record.keyframe = keyframe ? 1 : 0;
+    record.particleCount = static_cast<uint32_t>(particles.size());
+    record.step = slot.step;
+    record.time = slot.time;
+    record.payloadBytes = buffer.size();
+
+    if (keyframe) {
+        keyframeIndex.emplace_back(slot.step, filePosition(file));
+    }
+    if (std::fwrite(&record, sizeof(record), 1, file) != 1
+        || (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())) {
+        failed = true;
+    }
+    ++frameCount;
+    lastStep = slot.step;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string& path)
+    : mapping(new MappedFile(path)) {
+    TrajectoryHeader header;
+    if (mapping->size() < sizeof(header)) {
+        throw std::invalid_argument("'" + path + "' is not a trajectory file.");
+    }
+    std::memcpy(&header, mapping->data(), sizeof(header));
+    if (std::memcmp(header.magic, trajectoryMagic, sizeof(trajectoryMagic)) != 0) {
+        throw std::invalid_argument("'" + path + "' is not a trajectory file.");
+    }
+    if (header.version != trajectoryVersion) {
+        throw std::invalid_argument("Trajectory '" + path + "' has unsupported version " + std::to_string(header.version) + ".");
+    }
+
+    width = header.simWidth;
+    height = header.simHeight;
+    quantum = header.quantum;
+
+    bool indexed = header.indexOffset >= sizeof(TrajectoryHeader) && header.indexOffset <= mapping->size()
+        && header.indexCount <= (mapping->size() - header.indexOffset) / sizeof(IndexEntry);
+    if (indexed) {
+        // Every keyframe has to start a whole frame record before the index
+        const unsigned char* entries = mapping->data() + header.indexOffset;
+        for (uint64_t i = 0; i < header.indexCount && indexed; ++i) {
+            IndexEntry entry;
+            std::memcpy(&entry, entries + i * sizeof(IndexEntry), sizeof(entry));
+            indexed = entry.offset >= sizeof(TrajectoryHeader) && entry.offset <= header.indexOffset
+                && header.indexOffset - entry.offset >= sizeof(FrameRecord);
+            keyframes.emplace_back(entry.step, entry.offset);
+        }
+    }
+    if (indexed) {
+        frames = header.frameCount;
+        last = header.lastStep;
+        dataEnd = header.indexOffset;
+    }
+    else {
+        std::cerr << "Trajectory '" << path << (header.indexOffset == 0 ? "' was not closed cleanly" : "' has a damaged index")
+            << ", rebuilding its index\n";
+        keyframes.clear();
+        scan(sizeof(TrajectoryHeader));
+    }
+}
+
+void TrajectoryReader::scan(uint64_t offset) {
+    // Walk the frame records until the data runs out; a torn final frame is ignored
+    while (offset + sizeof(FrameRecord) <= mapping->size()) {
+        FrameRecord record;
+        std::memcpy(&record, mapping->data() + offset, sizeof(record));
+        if (record.payloadBytes > mapping->size() - offset - sizeof(record)) {
+            break;
+        }
+        if (record.keyframe) {
+            keyframes.emplace_back(record.step, offset);
+        }
+        else if (keyframes.empty()) {
+            break;
+        }
+        ++frames;
+        last = record.step;
+        offset += sizeof(record) + record.payloadBytes;
+    }
+    dataEnd = offset;
+}
+
+bool TrajectoryReader::seek(uint64_t step, TrajectoryFrame& frame) const {
+    auto keyframe = std::upper_bound(keyframes.begin(), keyframes.end(), std::make_pair(step, UINT64_MAX));
+    if (keyframe == keyframes.begin()) {
+        return false;
+    }
+    --keyframe;
+
+    const unsigned char* data = mapping->data();
+    uint64_t offset = keyframe->second;
+    uint64_t end = (keyframe + 1 != keyframes.end()) ? (keyframe + 1)->second : dataEnd;
+    std::vector<int64_t> quantized;
+    bool decoded = false;
+
+    while (offset + sizeof(FrameRecord) <= end) {
+        FrameRecord record;
+        std::memcpy(&record, data + offset, sizeof(record));
+        if (record.step > step || (decoded && record.keyframe) || record.payloadBytes > end - offset - sizeof(record)) {
+            break;
+        }
+        // Keyframes hold two doubles per particle, and delta frames continue the keyframe's particles
+        bool fits = record.keyframe ? record.particleCount <= record.payloadBytes / (2 * sizeof(double))
+            : decoded && static_cast<size_t>(record.particleCount) * 2 == quantized.size();
+        if (!fits) {
+            throw std::invalid_argument("Trajectory frame at step " + std::to_string(record.step) + " is corrupt.");
+        }
+
+        const unsigned char* payload = data + offset + sizeof(record);
+        frame.step = record.step;
+        frame.time = record.time;
+        frame.positions.resize(static_cast<size_t>(record.particleCount) * 2);
+
+        if (record.keyframe) {
+            std::memcpy(frame.positions.data(), payload, frame.positions.size() * sizeof(double));
+            quantized.resize(frame.positions.size());
+            for (size_t i = 0; i < quantized.size(); ++i) {
+                quantized[i] = quantize(frame.positions[i], quantum);
+            }
+        }
+        else {
+            const unsigned char* cursor = payload;
+            const unsigned char* payloadEnd = payload + record.payloadBytes;
+            for (size_t i = 0; i < quantized.size(); ++i) {
+                quantized[i] += getVarint(cursor, payloadEnd);
+                frame.positions[i] = quantized[i] * quantum;
+            }
+        }
+
+        decoded = true;
+        offset += sizeof(record) + record.payloadBytes;
+    }
+    return decoded;
+}
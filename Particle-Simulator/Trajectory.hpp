@@ -0,0 +1,105 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "Particle.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Simulation;
+
+// Trajectory files record particle positions for every recorded step.
+//
+// Layout: a header, then one record per frame, then a keyframe index. Keyframes
+// hold exact positions; the frames between them hold positions quantized to a
+// fixed grid and delta-encoded against the previous frame as zigzag varints.
+// A keyframe is forced every keyframeInterval frames and whenever the particle
+// count changes, so seeking never decodes more than one interval.
+
+struct TrajectoryFrame {
+    uint64_t step = 0;
+    double time = 0;
+    std::vector<double> positions; // Interleaved x, y
+};
+
+// Records frames on a background thread. record() copies the particle array into
+// a free ring slot and returns; the writer thread encodes and writes it.
+class TrajectoryRecorder {
+public:
+    TrajectoryRecorder(const std::string& path, double simWidth, double simHeight,
+        uint32_t keyframeInterval, double quantum, size_t ringSlots = 8);
+    ~TrajectoryRecorder(); // Closes the file if close() was not called, reporting failures to stderr
+
+    // Blocks only if every ring slot is still waiting to be written
+    void record(const Simulation& simulation);
+
+    // Flushes queued frames, writes the index and closes the file. Throws
+    // std::invalid_argument if any write failed, for example on a full disk.
+    void close();
+
+private:
+    struct Slot {
+        uint64_t step = 0;
+        double time = 0;
+        std::vector<Particle> particles;
+    };
+
+    void run();
+    void writeFrame(const Slot& slot);
+
+    std::string path;
+    std::FILE* file;
+    uint32_t keyframeInterval;
+    double quantum;
+
+    std::vector<Slot> ring;
+    size_t head = 0;  // Next slot the simulation fills
+    size_t tail = 0;  // Next slot the writer drains
+    size_t queued = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    // Writer thread state
+    std::vector<int64_t> previous;          // Quantized positions of the last frame written
+    uint32_t framesSinceKeyframe = 0;
+    uint64_t frameCount = 0;
+    uint64_t lastStep = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> keyframeIndex; // (step, file offset)
+    std::vector<unsigned char> buffer;
+    bool failed = false; // A frame did not reach the file
+
+    std::thread thread;
+};
+
+// Random access to a trajectory file through a memory mapping
+class TrajectoryReader {
+public:
+    explicit TrajectoryReader(const std::string& path);
+
+    double simWidth() const { return width; }
+    double simHeight() const { return height; }
+    uint64_t frameCount() const { return frames; }
+    uint64_t firstStep() const { return keyframes.empty() ? 0 : keyframes.front().first; }
+    uint64_t lastStep() const { return last; }
+
+    // Decodes the last recorded frame at or before step, starting from the nearest
+    // keyframe. Returns false if the recording starts after step. Throws
+    // std::invalid_argument if a frame's payload does not hold its particles.
+    bool seek(uint64_t step, TrajectoryFrame& frame) const;
+
+private:
+    void scan(uint64_t offset); // Rebuilds the index of a recording that was not closed cleanly
+
+    std::unique_ptr<MappedFile> mapping;
+    double width = 0, height = 0, quantum = 0;
+    uint64_t frames = 0;
+    uint64_t last = 0;
+    uint64_t dataEnd = 0; // End of the frame records
+    std::vector<std::pair<uint64_t, uint64_t>> keyframes; // (step, file offset)
+};
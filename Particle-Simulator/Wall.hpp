@@ -0,0 +1,88 @@
+#pragma once
+
+#include <SFML/System/Vector2.hpp>
+#include <algorithm>
+#include <cmath>
+
+class Wall {
+public:
+    sf::Vector2f start, end;
+
+    Wall() = default;
+    Wall(float x1, float y1, float x2, float y2) : start(x1, y1), end(x2, y2) {}
+};
+
+// Kinematic wall, such as a piston, paddle or rotating arm, that moves on its own every
+// step and is never pushed back. It slides along velocity and turns spin radians per
+// unit time about pivot, which slides with it. With period set, the slide reverses
+// every half period, so the wall strokes back and forth. Particles bounce off it with
+// their velocity relative to the wall's at the point they hit.
+class MovingWall {
+public:
+    Wall wall;                   // Current pose
+    sf::Vector2f pivot;          // Current center of rotation
+    sf::Vector2f velocity;       // Slide on the outward half of a stroke
+    float spin = 0;              // Radians per unit time, clockwise on screen
+    float period = 0;            // Time of one stroke out and back, 0 slides on forever
+    float phase = 0;             // Time into the current stroke
+
+    MovingWall() = default;
+    MovingWall(const Wall& wall, float vx, float vy, float spin = 0, float period = 0)
+        : wall(wall), pivot((wall.start + wall.end) / 2.0f), velocity(vx, vy), spin(spin), period(period) {}
+
+    // Distance slid over the next deltaTime from the current phase
+    sf::Vector2f slide(double deltaTime) const {
+        if (period <= 0) {
+            return velocity * static_cast<float>(deltaTime);
+        }
+        return velocity * static_cast<float>(strokeOffset(phase + deltaTime) - strokeOffset(phase));
+    }
+
+    // Moves the wall on by deltaTime
+    void advance(double deltaTime) {
+        sf::Vector2f offset = slide(deltaTime);
+        float angle = static_cast<float>(spin * deltaTime);
+        float c = std::cos(angle), s = std::sin(angle);
+        auto turn = [&](sf::Vector2f point) {
+            sf::Vector2f r = point - pivot;
+            return pivot + offset + sf::Vector2f(c * r.x - s * r.y, s * r.x + c * r.y);
+        };
+        wall.start = turn(wall.start);
+        wall.end = turn(wall.end);
+        pivot += offset;
+        if (period > 0) {
+            phase = static_cast<float>(std::fmod(phase + deltaTime, static_cast<double>(period)));
+        }
+    }
+
+private:
+    // Time spent sliding forward minus time spent sliding back after t into a stroke
+    double strokeOffset(double t) const {
+        double half = period / 2.0;
+        double strokes = std::floor(t / period);
+        double into = t - strokes * period;
+        return into < half ? into : period - into;
+    }
+};
+
+// Axis-aligned region that despawns every particle whose center enters it
+class Sink {
+public:
+    sf::Vector2f min, max;
+
+    Sink() = default;
+    Sink(float x1, float y1, float x2, float y2)
+        : min(std::min(x1, x2), std::min(y1, y2)), max(std::max(x1, x2), std::max(y1, y2)) {}
+
+    bool contains(double x, double y) const { return x >= min.x && x <= max.x && y >= min.y && y <= max.y; }
+};
+
+// Fixed point that pulls every particle toward it, or pushes them away for a negative strength
+class Attractor {
+public:
+    sf::Vector2f position;
+    float strength = 0;
+
+    Attractor() = default;
+    Attractor(float x, float y, float strength) : position(x, y), strength(strength) {}
+};
@@ -0,0 +1,347 @@
+#include "WallImport.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+// Static so it cannot clash with the copies built into SFML and TGUI
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_PNG
+#define STBI_ONLY_BMP
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+#include <TGUI/extlibs/stb/stb_image.h>
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+// The stdlib headers nanosvg uses go first so it can be wrapped in a namespace. TGUI
+// builds its own copy into tgui::priv, so this one gets C++ linkage in an anonymous
+// namespace to keep the two apart.
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+namespace {
+#define NANOSVG_CPLUSPLUS
+#define NANOSVG_IMPLEMENTATION
+#include <TGUI/extlibs/nanosvg/nanosvg.h>
+#undef NANOSVG_IMPLEMENTATION
+#undef NANOSVG_CPLUSPLUS
+
+const int maxSubdivisions = 16; // Deepest a cubic is split, so at most 2^16 segments each
+
+struct Point {
+    double x, y;
+};
+
+// Appends the end of each segment of a flattened cubic from p0 to p3
+void flattenCubic(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3,
+    double toleranceSquared, int depth, std::vector<Point>& points) {
+    // The curve stays within the hull of its control points, so it is flat enough once
+    // both inner control points are within the tolerance of the chord
+    double cx = x3 - x0, cy = y3 - y0;
+    double chordSquared = cx * cx + cy * cy;
+    double d1, d2;
+    if (chordSquared > 0) {
+        double c1 = cx * (y1 - y0) - cy * (x1 - x0);
+        double c2 = cx * (y2 - y0) - cy * (x2 - x0);
+        d1 = c1 * c1 / chordSquared;
+        d2 = c2 * c2 / chordSquared;
+    }
+    else {
+        d1 = (x1 - x0) * (x1 - x0) + (y1 - y0) * (y1 - y0);
+        d2 = (x2 - x0) * (x2 - x0) + (y2 - y0) * (y2 - y0);
+    }
+    if ((d1 <= toleranceSquared && d2 <= toleranceSquared) || depth >= maxSubdivisions) {
+        points.push_back({ x3, y3 });
+        return;
+    }
+
+    double x01 = (x0 + x1) / 2, y01 = (y0 + y1) / 2;
+    double x12 = (x1 + x2) / 2, y12 = (y1 + y2) / 2;
+    double x23 = (x2 + x3) / 2, y23 = (y2 + y3) / 2;
+    double x012 = (x01 + x12) / 2, y012 = (y01 + y12) / 2;
+    double x123 = (x12 + x23) / 2, y123 = (y12 + y23) / 2;
+    double xm = (x012 + x123) / 2, ym = (y012 + y123) / 2;
+    flattenCubic(x0, y0, x01, y01, x012, y012, xm, ym, toleranceSquared, depth + 1, points);
+    flattenCubic(xm, ym, x123, y123, x23, y23, x3, y3, toleranceSquared, depth + 1, points);
+}
+
+// Appends walls along the polyline through points, each covering the longest run that
+// stays within tolerance of it. A run grows while its next point keeps within the wedge
+// of directions from the run's start that pass within tolerance of every point so far,
+// so the whole polyline takes one pass.
+void addRuns(const std::vector<Point>& points, double tolerance, std::vector<Wall>& walls) {
+    const double pi = 3.14159265358979323846;
+    size_t anchor = 0;
+    while (anchor + 1 < points.size()) {
+        double ax = points[anchor].x, ay = points[anchor].y;
+        double referenceX = 0, referenceY = 0;
+        bool hasReference = false;
+        double low = -pi, high = pi, reach = 0;
+        size_t end = anchor + 1;
+        for (size_t j = anchor + 1; j < points.size(); ++j) {
+            double dx = points[j].x - ax, dy = points[j].y - ay;
+            double distance = std::sqrt(dx * dx + dy * dy);
+            if (distance < reach) {
+                break; // Doubling back would leave points beyond the wall's end
+            }
+            if (distance >= tolerance) {
+                double angle = 0;
+                if (!hasReference) {
+                    referenceX = dx / distance;
+                    referenceY = dy / distance;
+                    hasReference = true;
+                }
+                else {
+                    angle = std::atan2(referenceX * dy - referenceY * dx, referenceX * dx + referenceY * dy);
+                }
+                if (angle < low || angle > high) {
+                    break;
+                }
+                double halfWidth = std::asin(tolerance / distance);
+                low = std::max(low, angle - halfWidth);
+                high = std::min(high, angle + halfWidth);
+            }
+            end = j;
+            reach = distance;
+        }
+
+        if (points[end].x != ax || points[end].y != ay) {
+            walls.push_back(Wall(static_cast<float>(ax), static_cast<float>(ay),
+                static_cast<float>(points[end].x), static_cast<float>(points[end].y)));
+        }
+        anchor = end;
+    }
+}
+
+// Runs function(firstRow, lastRow) on up to threadCount even bands of rows at once
+template <typename Function>
+void forRowBands(size_t rows, size_t threadCount, Function function) {
+    size_t bands = std::max<size_t>(1, std::min(threadCount, rows));
+    std::vector<std::thread> threads;
+    for (size_t band = 1; band < bands; ++band) {
+        threads.emplace_back(function, rows * band / bands, rows * (band + 1) / bands);
+    }
+    function(0, rows / bands);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+// Appends walls along the closed outline through points, keeping only the points that
+// Douglas–Peucker needs to stay within tolerance. The outline is first split at the
+// point farthest from its start.
+void addSimplifiedLoop(const std::vector<Point>& points, double tolerance, std::vector<bool>& keep,
+    std::vector<std::pair<size_t, size_t>>& ranges, std::vector<Wall>& walls) {
+    size_t count = points.size();
+    auto at = [&](size_t i) -> const Point& { return points[i == count ? 0 : i]; };
+
+    size_t farthest = 0;
+    double farthestSquared = -1;
+    for (size_t i = 1; i < count; ++i) {
+        double dx = points[i].x - points[0].x, dy = points[i].y - points[0].y;
+        if (dx * dx + dy * dy > farthestSquared) {
+            farthestSquared = dx * dx + dy * dy;
+            farthest = i;
+        }
+    }
+
+    keep.assign(count, false);
+    keep[0] = keep[farthest] = true;
+    ranges.clear();
+    ranges.push_back({ 0, farthest });
+    ranges.push_back({ farthest, count });
+    double toleranceSquared = tolerance * tolerance;
+    while (!ranges.empty()) {
+        size_t first = ranges.back().first, last = ranges.back().second;
+        ranges.pop_back();
+        const Point& a = at(first);
+        const Point& b = at(last);
+        double ex = b.x - a.x, ey = b.y - a.y;
+        double lengthSquared = ex * ex + ey * ey;
+        size_t worst = first;
+        double worstSquared = toleranceSquared;
+        for (size_t i = first + 1; i < last; ++i) {
+            double dx = points[i].x - a.x, dy = points[i].y - a.y;
+            double distanceSquared;
+            if (lengthSquared > 0) {
+                double cross = ex * dy - ey * dx;
+                distanceSquared = cross * cross / lengthSquared;
+            }
+            else {
+                distanceSquared = dx * dx + dy * dy;
+            }
+            if (distanceSquared > worstSquared) {
+                worstSquared = distanceSquared;
+                worst = i;
+            }
+        }
+        if (worst != first) {
+            keep[worst] = true;
+            ranges.push_back({ first, worst });
+            ranges.push_back({ worst, last });
+        }
+    }
+
+    std::vector<size_t> kept;
+    for (size_t i = 0; i < count; ++i) {
+        if (keep[i]) kept.push_back(i);
+    }
+    // Two points left means a sliver that needs one wall rather than two on top of each other
+    size_t wallCount = kept.size() == 2 ? 1 : kept.size();
+    for (size_t k = 0; k < wallCount; ++k) {
+        const Point& a = points[kept[k]];
+        const Point& b = points[kept[(k + 1) % kept.size()]];
+        walls.push_back(Wall(static_cast<float>(a.x), static_cast<float>(a.y), static_cast<float>(b.x), static_cast<float>(b.y)));
+    }
+}
+}
+
+std::vector<Wall> importSvgWalls(const std::string& path, double tolerance) {
+    if (!(tolerance > 0)) {
+        throw std::invalid_argument("SVG tolerance must be greater than 0.");
+    }
+
+    NSVGimage* image = nsvgParseFromFile(path.c_str(), "px", 96);
+    if (image == nullptr) {
+        throw std::invalid_argument("Could not read SVG file '" + path + "'.");
+    }
+
+    std::vector<Wall> walls;
+    std::vector<Point> points;
+    double toleranceSquared = tolerance * tolerance;
+    for (NSVGshape* shape = image->shapes; shape != nullptr; shape = shape->next) {
+        if (!(shape->flags & NSVG_FLAGS_VISIBLE)) {
+            continue;
+        }
+        for (NSVGpath* svgPath = shape->paths; svgPath != nullptr; svgPath = svgPath->next) {
+            // Points are the start followed by three per cubic; closed paths already
+            // end with a segment back to the start
+            const float* p = svgPath->pts;
+            points.clear();
+            points.push_back({ p[0], p[1] });
+            for (int i = 0; i + 3 < svgPath->npts; i += 3, p += 6) {
+                flattenCubic(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], toleranceSquared, 0, points);
+            }
+            addRuns(points, tolerance, walls);
+        }
+    }
+    nsvgDelete(image);
+
+    if (walls.empty()) {
+        throw std::invalid_argument("SVG file '" + path + "' holds no outlines to turn into walls.");
+    }
+    return walls;
+}
+
+std::vector<Wall> importMaskWalls(const std::string& path, double width, double height, double tolerance,
+    size_t threadCount) {
+    if (!(tolerance > 0)) {
+        throw std::invalid_argument("Mask tolerance must be greater than 0.");
+    }
+
+    int imageWidth = 0, imageHeight = 0, channels = 0;
+    unsigned char* pixels = stbi_load(path.c_str(), &imageWidth, &imageHeight, &channels, 2);
+    if (pixels == nullptr) {
+        throw std::invalid_argument("Could not read mask '" + path + "': " + stbi_failure_reason() + ".");
+    }
+
+    // Samples are the pixels with a border of empty ones, so every outline closes
+    size_t columns = static_cast<size_t>(imageWidth), rows = static_cast<size_t>(imageHeight);
+    size_t sampleColumns = columns + 2, sampleRows = rows + 2;
+    if (2 * sampleColumns * sampleRows >= std::numeric_limits<uint32_t>::max()) {
+        stbi_image_free(pixels);
+        throw std::invalid_argument("Mask '" + path + "' is too large.");
+    }
+    std::vector<uint8_t> solid(sampleColumns * sampleRows, 0);
+    forRowBands(rows, threadCount, [&](size_t firstRow, size_t lastRow) {
+        for (size_t y = firstRow; y < lastRow; ++y) {
+            const unsigned char* pixel = pixels + y * columns * 2;
+            uint8_t* sample = &solid[(y + 1) * sampleColumns + 1];
+            for (size_t x = 0; x < columns; ++x, pixel += 2) {
+                sample[x] = pixel[0] < 128 && pixel[1] >= 128;
+            }
+        }
+    });
+    stbi_image_free(pixels);
+
+    // Outline vertices sit halfway along the edges between unlike samples. Horizontal
+    // edges come first, then vertical ones. Each cell links every vertex where the
+    // outline enters an obstacle corner, going clockwise, to the vertex where it leaves;
+    // the cell on the other side of a vertex sees it the other way round, so every vertex
+    // is linked by exactly one cell and the bands never write the same entry.
+    const uint32_t noVertex = std::numeric_limits<uint32_t>::max();
+    size_t horizontalCount = (sampleColumns - 1) * sampleRows;
+    std::vector<uint32_t> next(horizontalCount + sampleColumns * (sampleRows - 1), noVertex);
+    auto horizontal = [&](size_t i, size_t j) { return static_cast<uint32_t>(j * (sampleColumns - 1) + i); };
+    auto vertical = [&](size_t i, size_t j) { return static_cast<uint32_t>(horizontalCount + j * sampleColumns + i); };
+    forRowBands(sampleRows - 1, threadCount, [&](size_t firstRow, size_t lastRow) {
+        for (size_t j = firstRow; j < lastRow; ++j) {
+            const uint8_t* top = &solid[j * sampleColumns];
+            const uint8_t* bottom = top + sampleColumns;
+            for (size_t i = 0; i + 1 < sampleColumns; ++i) {
+                // Corners and edges clockwise from the top left
+                bool corners[4] = { top[i] != 0, top[i + 1] != 0, bottom[i + 1] != 0, bottom[i] != 0 };
+                int solidCorners = corners[0] + corners[1] + corners[2] + corners[3];
+                if (solidCorners == 0 || solidCorners == 4) {
+                    continue;
+                }
+                uint32_t edges[4] = { horizontal(i, j), vertical(i + 1, j), horizontal(i, j + 1), vertical(i, j) };
+                for (int k = 0; k < 4; ++k) {
+                    if (corners[k] || !corners[(k + 1) % 4]) {
+                        continue;
+                    }
+                    int m = (k + 1) % 4;
+                    while (!corners[m] || corners[(m + 1) % 4]) {
+                        m = (m + 1) % 4;
+                    }
+                    next[edges[k]] = edges[m];
+                }
+            }
+        }
+    });
+
+    // Samples sit at pixel centers, so sample (i, j) is at (i - 0.5, j - 0.5) pixels
+    double scaleX = width / imageWidth, scaleY = height / imageHeight;
+    auto position = [&](uint32_t vertex) {
+        if (vertex < horizontalCount) {
+            size_t j = vertex / (sampleColumns - 1), i = vertex % (sampleColumns - 1);
+            return Point{ i * scaleX, (j - 0.5) * scaleY };
+        }
+        size_t j = (vertex - horizontalCount) / sampleColumns, i = (vertex - horizontalCount) % sampleColumns;
+        return Point{ (i - 0.5) * scaleX, j * scaleY };
+    };
+
+    std::vector<Wall> walls;
+    std::vector<Point> points;
+    std::vector<bool> keep;
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (uint32_t start = 0; start < next.size(); ++start) {
+        if (next[start] == noVertex) {
+            continue;
+        }
+        points.clear();
+        uint32_t vertex = start;
+        do {
+            points.push_back(position(vertex));
+            uint32_t following = next[vertex];
+            next[vertex] = noVertex;
+            vertex = following;
+        } while (vertex != start);
+        addSimplifiedLoop(points, tolerance, keep, ranges, walls);
+    }
+
+    if (walls.empty()) {
+        throw std::invalid_argument("Mask '" + path + "' has no dark pixels to turn into walls.");
+    }
+    return walls;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Wall.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Walls traced from an SVG drawing. Every path, polygon, polyline, line, rect, circle
+// and ellipse of a visible shape becomes a chain of walls along its outline, whatever
+// its fill or stroke, with one SVG pixel to one domain unit. Curves are flattened into
+// segments that stray at most tolerance from them, and runs of nearly collinear
+// segments are merged into one wall when no point of the run strays further than
+// tolerance from it.
+// Throws std::invalid_argument if the file cannot be read or holds no outlines.
+std::vector<Wall> importSvgWalls(const std::string& path, double tolerance);
+
+// Walls around the obstacles of a PNG or BMP mask stretched over a width x height
+// domain. A pixel is an obstacle if it is dark (luminance below half) and opaque (alpha
+// at least half). Outlines are traced through the pixel centers with marching squares,
+// split into bands of rows across threadCount threads, and each closed outline is
+// simplified with Douglas–Peucker so no wall strays more than tolerance from it.
+// Throws std::invalid_argument if the file cannot be decoded or has no obstacles.
+std::vector<Wall> importMaskWalls(const std::string& path, double width, double height, double tolerance,
+    size_t threadCount);
@@ -3,180 +3,271 @@
 #include <TGUI/Backend/SFML-Graphics.hpp>
 #include <TGUI/Widget.hpp>
 #include <TGUI/String.hpp>
+#include "Checkpoint.hpp"
+#include "Cluster.hpp"
+#include "Config.hpp"
+#include "Control.hpp"
+#include "Generators.hpp"
+#include "Journal.hpp"
+#include "Metrics.hpp"
+#include "Scene.hpp"
+#include "SharedState.hpp"
+#include "Simulation.hpp"
+#include "Stream.hpp"
+#include "Trajectory.hpp"
+#include "WallImport.hpp"
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <sstream>
 #include <thread>
 #include <queue>
 #include <mutex>
 
-#ifndef M_PI
-#define M_PI 3.14159265358979323846
-#endif
+std::atomic<bool> interrupted(false); // Set by SIGINT/SIGTERM to end a headless run
 
-std::atomic<int> nextParticleIndex(0); // Global counter for the next particle to update
-std::condition_variable cv;
-std::mutex cv_m;
-bool ready = false; // Flag to signal threads to start processing
-bool done = false;  // Flag to indicate processing is done for the current frame
-
-
-class Wall {
-public:
-    sf::Vector2f start, end;
-
-    Wall(float x1, float y1, float x2, float y2) : start(x1, y1), end(x2, y2) {}
-};
+void handleInterrupt(int) {
+    interrupted = true;
+}
 
-class Particle {
+// Step timing collected for --profile and --profile-output
+class StepProfiler {
 public:
-    double x, y; // Position
-    double vx, vy; // Velocity
-    double radius;
-
-    Particle(double x, double y, double angle, double velocity, double radius)
-        : x(x), y(y), radius(radius) {
-        // Convert angle to radians and calculate velocity components
-        double rad = angle * (M_PI / 180.0);
-        vx = velocity * cos(rad);
-        vy = -velocity * sin(rad);
-    }
-
-    void updatePosition(double deltaTime, double simWidth, double simHeight, const std::vector<Wall>& walls) {
-        double nextX = x + vx * deltaTime;
-        double nextY = y + vy * deltaTime;
-
-        // Boundary collision
-        if (nextX - radius < 0 || nextX + radius > simWidth) vx = -vx;
-        if (nextY - radius < 0 || nextY + radius > simHeight) vy = -vy;
-
-        // Wall collision with direct calculation
-        for (const auto& wall : walls) {
-            sf::Vector2f collisionPoint;
-            if (directCollisionDetection(*this, wall, collisionPoint)) {
-                // Calculate wall's normal vector
-                sf::Vector2f wallDirection = wall.end - wall.start;
-                sf::Vector2f wallNormal = { -wallDirection.y, wallDirection.x };
-
-                // Normalize the wall normal
-                float length = sqrt(wallNormal.x * wallNormal.x + wallNormal.y * wallNormal.y);
-                wallNormal.x /= length;
-                wallNormal.y /= length;
-
-                // Reflect the velocity based on the wall's normal vector
-                reflectVelocity(wall);
-
-                // Adjust the position to the collision point to prevent the particle from "sinking" into the wall
-                x = collisionPoint.x;
-                y = collisionPoint.y;
-                break;
+    uint64_t steps = 0;
+    double totalSeconds = 0;
+    double minSeconds = 0;
+    double maxSeconds = 0;
+
+    explicit StepProfiler(const std::string& csvPath) {
+        if (!csvPath.empty()) {
+            csv.open(csvPath);
+            if (!csv) {
+                throw std::invalid_argument("Could not open profile output '" + csvPath + "'.");
             }
+            csv << "step,seconds,particles,walls\n";
         }
+    }
 
-        // Update position
-        x += vx * deltaTime;
-        y += vy * deltaTime;
+    void record(const Simulation& simulation) {
+        double seconds = simulation.lastStepSeconds;
+        minSeconds = steps == 0 ? seconds : std::min(minSeconds, seconds);
+        maxSeconds = std::max(maxSeconds, seconds);
+        totalSeconds += seconds;
+        ++steps;
+        if (csv) {
+            csv << simulation.stepCount << ',' << seconds << ',' << simulation.aliveCount() << ',' << simulation.walls.size() << '\n';
+        }
     }
 
-    bool directCollisionDetection(const Particle& particle, const Wall& wall, sf::Vector2f& collisionPoint) {
-        // Get start and end points of the wall
-        sf::Vector2f wallStart = wall.start;
-        sf::Vector2f wallEnd = wall.end;
+    void report(std::ostream& out) const {
+        double mean = steps > 0 ? totalSeconds / steps : 0.0;
+        out << "Steps: " << steps << "\n"
+            << "Step time (ms): mean " << mean * 1000 << ", min " << minSeconds * 1000 << ", max " << maxSeconds * 1000 << "\n";
+    }
 
-        // Particle's position and velocity vector
-        sf::Vector2f particlePos(particle.x, particle.y);
-        sf::Vector2f particleVelocity(particle.vx, particle.vy);
+private:
+    std::ofstream csv;
+};
 
-        // Calculate vectors
-        sf::Vector2f wallVector = wallEnd - wallStart;
-        sf::Vector2f particleVector = particleVelocity;
+std::string formatCoordinate(double value) {
+    std::ostringstream ss;
+    ss << value;
+    return ss.str();
+}
 
-        // Calculate determinants
-        float det = (-wallVector.x * particleVector.y + particleVector.x * wallVector.y);
-        if (std::abs(det) < 1e-9) {
-            return false; // Parallel movement, no collision
+// Index of the wall closest to point if it is within reach, otherwise walls.size()
+size_t nearestWall(const std::vector<Wall>& walls, sf::Vector2f point, float reach) {
+    size_t nearest = walls.size();
+    float best = reach * reach;
+    for (size_t i = 0; i < walls.size(); ++i) {
+        sf::Vector2f edge = walls[i].end - walls[i].start;
+        sf::Vector2f offset = point - walls[i].start;
+        float lengthSquared = edge.x * edge.x + edge.y * edge.y;
+        float t = lengthSquared > 0 ? (offset.x * edge.x + offset.y * edge.y) / lengthSquared : 0;
+        t = std::min(std::max(t, 0.0f), 1.0f);
+        sf::Vector2f gap = offset - edge * t;
+        float distanceSquared = gap.x * gap.x + gap.y * gap.y;
+        if (distanceSquared <= best) {
+            best = distanceSquared;
+            nearest = i;
         }
+    }
+    return nearest;
+}
 
-        // Calculate relative position using Cramer's rule
-        sf::Vector2f relativePos = particlePos - wallStart;
-        float t = (-particleVector.y * relativePos.x + particleVector.x * relativePos.y) / det;
-        float u = (wallVector.x * relativePos.y - wallVector.y * relativePos.x) / det;
-
-        // Check if intersection point is within the segment and particle's path
-        if (t >= 0.0f && t <= 1.0f && u >= 0.0f && u <= 1.0f) {
-            // Calculate the collision point without considering the radius
-            sf::Vector2f rawCollisionPoint = wallStart + t * wallVector;
+// Everything a run does around the simulation itself: profiling, checkpoints and
+// other work that has to happen on the main thread between steps.
+class RunContext {
+public:
+    const SimulationConfig& config;
+    SimulationMetrics& metrics;
+    StepProfiler profiler;
+    std::unique_ptr<CheckpointWriter> checkpoints;
+    std::ofstream checksums;
+    std::unique_ptr<TrajectoryRecorder> trajectory;
+    std::unique_ptr<SharedStateExporter> sharedState;
+    std::unique_ptr<StreamServer> stream;
+    std::unique_ptr<ControlServer> control;
+    std::unique_ptr<JournalWriter> journal;
+    std::unique_ptr<JournalPlayer> replay;
+    ClusterCoordinator* cluster = nullptr; // When set, steps run on the cluster nodes instead
+    uint64_t replayEnd = 0; // Step the replayed session ended at
+    uint64_t startStep; // Step the run started from, so --steps counts from a restored checkpoint
+
+    RunContext(const SimulationConfig& config, SimulationMetrics& metrics, const Simulation& simulation)
+        : config(config), metrics(metrics), profiler(config.profileOutput), startStep(simulation.stepCount) {
+        if (!config.checkpointFile.empty()) {
+            checkpoints.reset(new CheckpointWriter(config.checkpointFile));
+        }
+        if (!config.trajectoryFile.empty()) {
+            trajectory.reset(new TrajectoryRecorder(config.trajectoryFile, simulation.simWidth, simulation.simHeight,
+                config.trajectoryKeyframeInterval, config.trajectoryQuantum));
+            trajectory->record(simulation); // Starting state, so playback can show step 0 of the run
+        }
+        if (!config.checksumOutput.empty()) {
+            checksums.open(config.checksumOutput);
+            if (!checksums) {
+                throw std::invalid_argument("Could not open checksum output '" + config.checksumOutput + "'.");
+            }
+            checksums << "step,checksum\n" << std::hex << std::setfill('0');
+        }
+        if (!config.sharedMemoryName.empty()) {
+            sharedState.reset(new SharedStateExporter(config.sharedMemoryName));
+            sharedState->publish(simulation);
+        }
+        if (config.streamPort != 0) {
+            stream.reset(new StreamServer(config.streamPort, config.streamFps, config.streamBandwidth));
+            if (!stream->start()) {
+                stream.reset(); // Viewers are optional, so the run goes on without them
+            }
+        }
+        if (config.controlPort != 0) {
+            control.reset(new ControlServer(config.controlPort));
+            if (!control->start()) {
+                throw std::invalid_argument("Could not open the control socket on port " + std::to_string(config.controlPort) + ".");
+            }
+        }
+        if (!config.journalFile.empty()) {
+            journal.reset(new JournalWriter(config.journalFile, config, simulation));
+        }
+    }
 
-            // Adjust the collision point for the particle's radius
-            sf::Vector2f wallNormal(-wallVector.y, wallVector.x);
-            float normalLength = std::sqrt(wallNormal.x * wallNormal.x + wallNormal.y * wallNormal.y);
-            wallNormal /= normalLength; // Normalize the wall normal
+    void startReplay(const Journal& source, const Simulation& simulation) {
+        if (simulation.stepCount != source.startStep) {
+            std::cerr << "Warning: journal starts at step " << source.startStep << " but the simulation is at step " << simulation.stepCount << '\n';
+        }
+        replayEnd = source.hasEnd ? source.endStep : (source.entries.empty() ? source.startStep : source.entries.back().step);
+        if (!source.hasEnd) {
+            std::cerr << "Journal has no end marker, replaying up to its last command at step " << replayEnd << '\n';
+        }
+        replay.reset(new JournalPlayer(source));
+    }
 
-            // Push the collision point out by the radius in the direction of the wall normal
-            collisionPoint = rawCollisionPoint + sf::Vector2f(wallNormal.x * particle.radius, wallNormal.y * particle.radius);
+    bool finished(const Simulation& simulation) const {
+        if (replay && simulation.stepCount >= replayEnd) {
             return true;
         }
+        return config.runSteps > 0 && simulation.stepCount - startStep >= config.runSteps;
+    }
 
-        return false;
+    // Called before every step, while the workers are idle. Returns false if the step
+    // should be skipped because the run was paused over the control socket.
+    bool beforeStep(Simulation& simulation) {
+        if (replay) {
+            replay->apply(simulation);
+        }
+        if (control) {
+            control->apply(simulation, journal.get());
+            return control->shouldStep();
+        }
+        return true;
     }
 
-    void reflectVelocity(const Wall& wall) {
-        sf::Vector2f D = wall.end - wall.start;
-        sf::Vector2f N(-D.y, D.x); // Normal vector
+    void step(Simulation& simulation) {
+        if (cluster) {
+            cluster->step(simulation);
+        }
+        else {
+            simulation.step();
+        }
+    }
 
-        // Normalize N
-        float length = std::sqrt(N.x * N.x + N.y * N.y);
-        N.x /= length;
-        N.y /= length;
+    // Called instead of stepping while paused
+    void idle() {
+        if (control) {
+            control->waitForCommands(sf::milliseconds(10));
+        }
+    }
 
-        // Dot product of velocity and normal
-        float dotProduct = vx * N.x + vy * N.y;
+    // Called after every step, while the workers are idle
+    void afterStep(Simulation& simulation) {
+        profiler.record(simulation);
+        if (checksums.is_open()) {
+            checksums << std::dec << simulation.stepCount << ',' << std::hex << std::setw(16) << simulation.stepChecksum << '\n';
+        }
+        if (trajectory) {
+            trajectory->record(simulation);
+        }
+        if (sharedState) {
+            sharedState->publish(simulation);
+        }
+        if (stream) {
+            stream->publish(simulation);
+        }
 
-        // Reflect velocity
-        vx -= 2 * dotProduct * N.x;
-        vy -= 2 * dotProduct * N.y;
+        if (checkpoints && config.checkpointEvery > 0 && simulation.stepCount % config.checkpointEvery == 0) {
+            if (!checkpoints->request(simulation)) {
+                std::cerr << "Skipping checkpoint at step " << simulation.stepCount << ": previous checkpoint is still being written\n";
+            }
+        }
+    }
 
-        // Maintain same speed
-        float speed = std::sqrt(vx * vx + vy * vy);
-        float originalSpeed = std::sqrt(vx * vx + vy * vy);
-        vx = (vx / speed) * originalSpeed;
-        vy = (vy / speed) * originalSpeed;
+    // Called once when the run ends
+    void finish(Simulation& simulation) {
+        if (checkpoints) {
+            checkpoints->wait();
+            checkpoints->request(simulation);
+            checkpoints->wait();
+        }
+        if (journal) {
+            journal->close(simulation.stepCount);
+        }
+        if (trajectory) {
+            trajectory->close(); // Drains the ring and writes the index; throws if the recording is incomplete
+        }
     }
 };
 
-void updateParticleWorker(std::vector<Particle>& particles, const std::vector<Wall>& walls, double deltaTime, double simWidth, double simHeight) {
-    while (!done) {
-        std::unique_lock<std::mutex> lk(cv_m);
-        cv.wait(lk, [] { return ready || done; });
-        lk.unlock();
+int runHeadless(Simulation& simulation, RunContext& run) {
+    std::signal(SIGINT, handleInterrupt);
+    std::signal(SIGTERM, handleInterrupt);
 
-        while (true) {
-            int index = nextParticleIndex.fetch_add(1);
-            if (index >= particles.size()) {
-                break;
-            }
-            particles[index].updatePosition(deltaTime, simWidth, simHeight, walls);
+    while (!interrupted && !run.finished(simulation)) {
+        if (!run.beforeStep(simulation)) {
+            run.idle();
+            continue;
         }
+        run.step(simulation);
+        run.metrics.recordFrame(simulation.lastStepSeconds);
+        run.afterStep(simulation);
     }
+    return 0;
 }
 
-void startFrame() {
-    nextParticleIndex.store(0); // Reset the counter for the next frame
-    ready = true;
-    cv.notify_all();
-}
-
-int main() {
-    sf::RenderWindow window(sf::VideoMode(1280, 720), "Particle Simulator");
+int runWindowed(Simulation& simulation, RunContext& run) {
+    double simWidth = simulation.simWidth;
+    double simHeight = simulation.simHeight;
+    std::string widthText = formatCoordinate(simWidth);
+    std::string heightText = formatCoordinate(simHeight);
 
-    size_t threadCount = std::thread::hardware_concurrency(); // Use the number of concurrent threads supported by the hardware
+    sf::RenderWindow window(sf::VideoMode(static_cast<unsigned int>(simWidth), static_cast<unsigned int>(simHeight)), "Particle Simulator");
 
-    std::vector<std::thread> threads;
-
-    std::vector<Particle> particles;
-    std::vector<Wall> walls;
-
-    double deltaTime = 1; // Time step for updating particle positions
+    std::vector<Particle>& particles = simulation.particles;
+    std::vector<Wall>& walls = simulation.walls;
 
     // Set the frame rate limit
     window.setFramerateLimit(60);
@@ -217,25 +308,25 @@ int main() {
     auto X1PosEditBox = tgui::EditBox::create();
     X1PosEditBox->setPosition("10%", "10%");
     X1PosEditBox->setSize("18%", "4%");
-    X1PosEditBox->setDefaultText("X1 Coordinate (0-1280)");
+    X1PosEditBox->setDefaultText("X1 Coordinate (0-" + widthText + ")");
     gui.add(X1PosEditBox);
 
     auto Y1PosEditBox = tgui::EditBox::create();
     Y1PosEditBox->setPosition("10%", "15%");
     Y1PosEditBox->setSize("18%", "4%");
-    Y1PosEditBox->setDefaultText("Y1 Coordinate (0-720)");
+    Y1PosEditBox->setDefaultText("Y1 Coordinate (0-" + heightText + ")");
     gui.add(Y1PosEditBox);
 
     auto X2PosEditBox = tgui::EditBox::create();
     X2PosEditBox->setPosition("10%", "20%");
     X2PosEditBox->setSize("18%", "4%");
-    X2PosEditBox->setDefaultText("X2 Coordinate (0-1280)");
+    X2PosEditBox->setDefaultText("X2 Coordinate (0-" + widthText + ")");
     gui.add(X2PosEditBox);
 
     auto Y2PosEditBox = tgui::EditBox::create();
     Y2PosEditBox->setPosition("10%", "25%");
     Y2PosEditBox->setSize("18%", "4%");
-    Y2PosEditBox->setDefaultText("Y2 Coordinate (0-720)");
+    Y2PosEditBox->setDefaultText("Y2 Coordinate (0-" + heightText + ")");
     gui.add(Y2PosEditBox);
 
     auto addButton1 = tgui::Button::create("Add Batch Particle 1");
@@ -295,13 +386,13 @@ int main() {
     auto basicX1PosEditBox = tgui::EditBox::create();
     basicX1PosEditBox->setPosition("75%", "5%");
     basicX1PosEditBox->setSize("18%", "4%");
-    basicX1PosEditBox->setDefaultText("X1 Coordinate (0-1280)");
+    basicX1PosEditBox->setDefaultText("X1 Coordinate (0-" + widthText + ")");
     gui.add(basicX1PosEditBox);
 
     auto basicY1PosEditBox = tgui::EditBox::create();
     basicY1PosEditBox->setPosition("75%", "10%");
     basicY1PosEditBox->setSize("18%", "4%");
-    basicY1PosEditBox->setDefaultText("Y1 Coordinate (0-720)");
+    basicY1PosEditBox->setDefaultText("Y1 Coordinate (0-" + heightText + ")");
     gui.add(basicY1PosEditBox);
 
     auto basicAngleEditBox = tgui::EditBox::create();
@@ -325,25 +416,25 @@ int main() {
     auto wallX1EditBox = tgui::EditBox::create();
     wallX1EditBox->setPosition("75%", "45%");
     wallX1EditBox->setSize("18%", "4%");
-    wallX1EditBox->setDefaultText("X1 Coordinate (0-1280)");
+    wallX1EditBox->setDefaultText("X1 Coordinate (0-" + widthText + ")");
     gui.add(wallX1EditBox);
 
     auto wallY1EditBox = tgui::EditBox::create();
     wallY1EditBox->setPosition("75%", "50%");
     wallY1EditBox->setSize("18%", "4%");
-    wallY1EditBox->setDefaultText("Y1 Coordinate (0-720)");
+    wallY1EditBox->setDefaultText("Y1 Coordinate (0-" + heightText + ")");
     gui.add(wallY1EditBox);
 
     auto wallX2EditBox = tgui::EditBox::create();
     wallX2EditBox->setPosition("75%", "55%");
     wallX2EditBox->setSize("18%", "4%");
-    wallX2EditBox->setDefaultText("X2 Coordinate (0-1280)");
+    wallX2EditBox->setDefaultText("X2 Coordinate (0-" + widthText + ")");
     gui.add(wallX2EditBox);
 
     auto wallY2EditBox = tgui::EditBox::create();
     wallY2EditBox->setPosition("75%", "60%");
     wallY2EditBox->setSize("18%", "4%");
-    wallY2EditBox->setDefaultText("Y2 Coordinate (0-720)");
+    wallY2EditBox->setDefaultText("Y2 Coordinate (0-" + heightText + ")");
     gui.add(wallY2EditBox);
 
     auto addWallButton = tgui::Button::create("Add Wall");
@@ -426,25 +517,21 @@ int main() {
             float x2 = std::stof(X2PosEditBox->getText().toStdString()); // End X coordinate
             float y2 = std::stof(Y2PosEditBox->getText().toStdString()); // End Y coordinate
 
-            float velocity = 20.0f; // constant velocity value
-            float angle = 45.0f; // constant angle in degrees
-
             if (n <= 0) throw std::invalid_argument("Number of particles must be positive.");
-            if (x1 < 0 || x1 > 1280) throw std::invalid_argument("X1 coordinate must be between 0 and 1280.");
-            if (y1 < 0 || y1 > 720) throw std::invalid_argument("Y1 coordinate must be between 0 and 720.");
-            if (x2 < 0 || x2 > 1280) throw std::invalid_argument("X2 coordinate must be between 0 and 1280.");
-            if (y2 < 0 || y2 > 720) throw std::invalid_argument("Y2 coordinate must be between 0 and 720.");
-
-            float xStep = (x2 - x1) / std::max(1, n - 1); // Calculate the x step between particles
-            float yStep = (y2 - y1) / std::max(1, n - 1); // Calculate the y step between particles
-
-            for (int i = 0; i < n; ++i) {
-                float xPos = x1 + i * xStep; // Calculate the x position for each particle
-                float yPos = y1 + i * yStep; // Calculate the y position for each particle
-
-                // Add each particle to the simulation
-                particles.push_back(Particle(xPos, yPos, angle, velocity, 5));// radius is 5
-            }
+            if (x1 < 0 || x1 > simWidth) throw std::invalid_argument("X1 coordinate must be between 0 and " + widthText + ".");
+            if (y1 < 0 || y1 > simHeight) throw std::invalid_argument("Y1 coordinate must be between 0 and " + heightText + ".");
+            if (x2 < 0 || x2 > simWidth) throw std::invalid_argument("X2 coordinate must be between 0 and " + widthText + ".");
+            if (y2 < 0 || y2 > simHeight) throw std::invalid_argument("Y2 coordinate must be between 0 and " + heightText + ".");
+
+            // Particles move at the batch's constant velocity and angle
+            LineBatch batch;
+            batch.count = n;
+            batch.x1 = x1;
+            batch.y1 = y1;
+            batch.x2 = x2;
+            batch.y2 = y2;
+            addLineBatch(simulation, batch);
+            if (run.journal) run.journal->recordLine(simulation.stepCount, batch);
 
             // Clear the edit boxes after adding particles
             noParticles1->setText("");
@@ -468,29 +555,18 @@ int main() {
             float startTheta = std::stof(startAngleEditBox->getText().toStdString()); // Start angle in degrees
             float endTheta = std::stof(endAngleEditBox->getText().toStdString()); // End angle in degrees
 
-            // constant velocity and a starting point for all particles
-            float velocity = 20.0f; // velocity
-            sf::Vector2f startPoint(640, 360); // start point
-
             if (n <= 0) throw std::invalid_argument("Number of particles must be positive.");
             if (startTheta < 0 || startTheta > 360) throw std::invalid_argument("Start Theta must be positive and must be less than 360.");
             if (endTheta < 0 || endTheta> 360) throw std::invalid_argument("End Theta must be positive and must be less than or equal 360.");
             if (startTheta > endTheta) throw std::invalid_argument("Start Theta must be less than End Theta.");
 
-
-            float angularStep = (n > 1) ? (endTheta - startTheta) / (n - 1) : 0;
-
-            if (startTheta == 0.0f && endTheta == 360.0f) {
-                angularStep = (n > 1) ? (endTheta - startTheta) / (n) : 0;
-            }
-
-            for (int i = 0; i < n; ++i) {
-                float angle = startTheta + i * angularStep; // Calculate the angle for each particle
-                double angleRad = angle * (M_PI / 180.0); // Convert angle from degrees to radians              
-
-                // Add each particle to the simulation
-                particles.push_back(Particle(startPoint.x, startPoint.y, angle, velocity, 5)); // radius is 5
-            }
+            // Constant velocity, starting from the center of the domain
+            AngleBatch batch;
+            batch.count = n;
+            batch.startAngle = startTheta;
+            batch.endAngle = endTheta;
+            addAngleBatch(simulation, batch);
+            if (run.journal) run.journal->recordAngle(simulation.stepCount, batch);
 
             // Clear the edit boxes after adding particles
             noParticles2->setText("");
@@ -512,8 +588,6 @@ int main() {
             int n = std::stoi(noParticles3->getText().toStdString()); // Number of particles
             float startVelocity = std::stof(startVelocityEditBox->getText().toStdString()); // Start velocity
             float endVelocity = std::stof(endVelocityEditBox->getText().toStdString()); // End velocity
-            float angle = 45.0f; // constant angle in degrees
-            sf::Vector2f startPoint(400, 300); // constant start point
 
             if (n <= 0) throw std::invalid_argument("Number of particles must be positive.");
             if (startVelocity <= 0) throw std::invalid_argument("Start Velocity must be greater than 0.");
@@ -521,15 +595,14 @@ int main() {
             if (startVelocity >= endVelocity) throw std::invalid_argument("Start Velocity must be less than End Velocity.");;
             if (startVelocity >= 176) throw std::invalid_argument("Start Velocity must be less than or equal 175.");
             if (endVelocity >= 176) throw std::invalid_argument("End Velocity must be less than or equal 175.");
-            float velocityStep = (endVelocity - startVelocity) / std::max(1, n - 1); // Calculate the velocity step between particles
 
-            for (int i = 0; i < n; ++i) {
-                float velocity = startVelocity + i * velocityStep; // Calculate the velocity for each particle
-                double angleRad = angle * (M_PI / 180.0); // Convert angle from degrees to radians
-
-                // Add each particle to the simulation
-                particles.push_back(Particle(startPoint.x, startPoint.y, angle, velocity, 5)); // radius is 5
-            }
+            // Constant angle and start point
+            VelocityBatch batch;
+            batch.count = n;
+            batch.startVelocity = startVelocity;
+            batch.endVelocity = endVelocity;
+            addVelocityBatch(simulation, batch);
+            if (run.journal) run.journal->recordVelocity(simulation.stepCount, batch);
 
             // Clear the edit boxes after adding particles
             noParticles3->setText("");
@@ -552,14 +625,15 @@ int main() {
             float angle = std::stof(basicAngleEditBox->getText().toStdString()); // Angle
             float velocity = std::stof(basicVelocityEditBox->getText().toStdString()); // Velocity
 
-            if (xPos < 0 || xPos > 1280) throw std::invalid_argument("X coordinate must be between 0 and 1280.");
-            if (yPos < 0 || yPos > 720) throw std::invalid_argument("Y coordinate must be between 0 and 720.");
+            if (xPos < 0 || xPos > simWidth) throw std::invalid_argument("X coordinate must be between 0 and " + widthText + ".");
+            if (yPos < 0 || yPos > simHeight) throw std::invalid_argument("Y coordinate must be between 0 and " + heightText + ".");
             if (angle < 0 || angle > 360) throw std::invalid_argument("Angle must be between 0 and 360.");
             if (velocity <= 0) throw std::invalid_argument("Velocity must be greater than 0.");
             if (velocity >= 176) throw std::invalid_argument("Start Velocity must be less than or equal 175.");
 
             // Add particle to the simulation
-            particles.push_back(Particle(xPos, yPos, angle, velocity, 5)); // radius is 5
+            particles.push_back(Particle(xPos, yPos, angle, velocity, particleRadius));
+            if (run.journal) run.journal->recordParticle(simulation.stepCount, xPos, yPos, angle, velocity);
 
             // Clear the edit boxes after adding particles
             basicX1PosEditBox->setText("");
@@ -586,8 +660,8 @@ int main() {
             float y2 = std::stof(wallY2EditBox->getText().toStdString());
 
             // Check if the coordinates are within the simulation boundaries
-            if (x1 < 0 || x1 > 1280 || y1 < 0 || y1 > 720 ||
-                x2 < 0 || x2 > 1280 || y2 < 0 || y2 > 720) {
+            if (x1 < 0 || x1 > simWidth || y1 < 0 || y1 > simHeight ||
+                x2 < 0 || x2 > simWidth || y2 < 0 || y2 > simHeight) {
                 throw std::invalid_argument("Wall coordinates are out of bounds.");
             }
 
@@ -597,6 +671,7 @@ int main() {
             }
 
             walls.push_back(Wall(x1, y1, x2, y2));
+            if (run.journal) run.journal->recordWall(simulation.stepCount, walls.back());
 
             // Reset the wall input fields
             wallX1EditBox->setText("");
@@ -616,18 +691,25 @@ int main() {
         }
         });
 
-    // Create worker threads
-    for (size_t i = 0; i < threadCount; ++i) {
-        threads.emplace_back(updateParticleWorker, std::ref(particles), std::ref(walls), deltaTime, 1280.0, 720.0);
-    }
+    // Left dragging on empty space draws a wall and on a wall moves it. Both are off
+    // while a journal is replayed or the cluster holds the walls.
+    const bool editable = !run.replay && !run.cluster;
+    const float grabReach = 6; // Farthest a press can be from a wall to grab it
+    auto clampToDomain = [&](sf::Vector2f point) {
+        return sf::Vector2f(std::min(std::max(point.x, 0.0f), static_cast<float>(simWidth)),
+            std::min(std::max(point.y, 0.0f), static_cast<float>(simHeight)));
+    };
+    sf::Vector2f mouse, drawStart, dragOffset;
+    bool drawing = false, dragging = false;
+    size_t dragged = 0; // Index in movingWalls of the wall being dragged
+    sf::VertexArray wallLines(sf::Lines);
 
     while (window.isOpen()) {
 
-        nextParticleIndex.store(0); // Reset the counter for the next frame
-
         //compute framerate
         float currentTime = clock.restart().asSeconds();
         float fps = 1.0f / (currentTime);
+        run.metrics.recordFrame(currentTime);
 
         if (fpsUpdateClock.getElapsedTime().asSeconds() >= 0.5f) {
             std::stringstream ss;
@@ -639,46 +721,511 @@ int main() {
 
         sf::Event event;
         while (window.pollEvent(event)) {
-            gui.handleEvent(event); // Pass events to the GUI
+            bool handled = gui.handleEvent(event); // Pass events to the GUI
 
             if (event.type == sf::Event::Closed)
                 window.close();
+            else if (event.type == sf::Event::MouseMoved) {
+                mouse = clampToDomain(window.mapPixelToCoords(sf::Vector2i(event.mouseMove.x, event.mouseMove.y)));
+            }
+            else if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left
+                && !handled && editable && !dragging && !drawing) {
+                mouse = clampToDomain(window.mapPixelToCoords(sf::Vector2i(event.mouseButton.x, event.mouseButton.y)));
+                size_t nearest = nearestWall(walls, mouse, grabReach);
+                if (nearest < walls.size()) {
+                    // Drag the wall as a moving wall so the static walls around it stay put
+                    simulation.grabWall(nearest);
+                    if (run.journal) run.journal->recordGrab(simulation.stepCount, nearest);
+                    dragged = simulation.movingWalls.size() - 1;
+                    dragOffset = simulation.movingWalls[dragged].pivot - mouse;
+                    dragging = true;
+                }
+                else {
+                    drawStart = mouse;
+                    drawing = true;
+                }
+            }
+            else if (event.type == sf::Event::MouseButtonReleased && event.mouseButton.button == sf::Mouse::Left) {
+                if (dragging && dragged < simulation.movingWalls.size()) {
+                    simulation.releaseWall(dragged);
+                    if (run.journal) run.journal->recordRelease(simulation.stepCount, dragged);
+                }
+                if (drawing && mouse != drawStart) {
+                    walls.push_back(Wall(drawStart.x, drawStart.y, mouse.x, mouse.y));
+                    if (run.journal) run.journal->recordWall(simulation.stepCount, walls.back());
+                }
+                dragging = false;
+                drawing = false;
+            }
+        }
+
+        // Steer the dragged wall so it reaches the mouse over the next step
+        if (dragging && dragged < simulation.movingWalls.size() && simulation.deltaTime > 0) {
+            MovingWall& wall = simulation.movingWalls[dragged];
+            sf::Vector2f velocity = (mouse + dragOffset - wall.pivot) / static_cast<float>(simulation.deltaTime);
+            if (velocity != wall.velocity) {
+                wall.velocity = velocity;
+                if (run.journal) run.journal->recordSteer(simulation.stepCount, dragged, velocity);
+            }
         }
 
-        startFrame(); // Signal threads to start processing
-        ready = false; // Threads are now processing
+        if (run.beforeStep(simulation)) {
+            run.step(simulation); // Advance every particle; returns once all workers are done
+            run.afterStep(simulation);
+        }
+        if (run.finished(simulation)) {
+            window.close();
+        }
 
         window.clear();
         //Draw particles
         for (const auto& particle : particles) {
+            if (!particle.alive()) {
+                continue;
+            }
             sf::CircleShape shape(particle.radius);
             shape.setFillColor(sf::Color::Green);
             shape.setPosition(static_cast<float>(particle.x - particle.radius), static_cast<float>(particle.y - particle.radius));
             window.draw(shape);
         }
-        // Draw walls
+        // Draw walls in one batch, moving walls in orange and the wall being drawn in grey
+        wallLines.clear();
         for (const auto& wall : walls) {
+            wallLines.append(sf::Vertex(wall.start, sf::Color::White));
+            wallLines.append(sf::Vertex(wall.end, sf::Color::White));
+        }
+        for (const auto& moving : simulation.movingWalls) {
+            wallLines.append(sf::Vertex(moving.wall.start, sf::Color(255, 165, 0)));
+            wallLines.append(sf::Vertex(moving.wall.end, sf::Color(255, 165, 0)));
+        }
+        if (drawing) {
+            wallLines.append(sf::Vertex(drawStart, sf::Color(128, 128, 128)));
+            wallLines.append(sf::Vertex(mouse, sf::Color(128, 128, 128)));
+        }
+        window.draw(wallLines);
+        // Draw absorbers and sinks
+        for (const auto& wall : simulation.absorbers) {
             sf::VertexArray line(sf::Lines, 2);
-            line[0].position = sf::Vector2f(wall.start.x, wall.start.y);
-            line[0].color = sf::Color::White;
-            line[1].position = sf::Vector2f(wall.end.x, wall.end.y);
-            line[1].color = sf::Color::White;
+            line[0].position = wall.start;
+            line[0].color = sf::Color::Red;
+            line[1].position = wall.end;
+            line[1].color = sf::Color::Red;
             window.draw(line);
         }
+        for (const auto& sink : simulation.sinks) {
+            sf::RectangleShape shape(sink.max - sink.min);
+            shape.setPosition(sink.min);
+            shape.setFillColor(sf::Color(255, 0, 0, 48));
+            window.draw(shape);
+        }
+        // Draw attractors, green when they pull and red when they push
+        for (const auto& attractor : simulation.attractors) {
+            sf::CircleShape marker(6);
+            marker.setOrigin(6, 6);
+            marker.setPosition(attractor.position);
+            marker.setFillColor(sf::Color::Transparent);
+            marker.setOutlineThickness(2);
+            marker.setOutlineColor(attractor.strength >= 0 ? sf::Color::Green : sf::Color::Red);
+            window.draw(marker);
+        }
 
         window.draw(fpsText); // Draw the FPS counter on the window
         gui.draw(); // Draw the GUI
         window.display();
+    }
+
+    return 0;
+}
 
+// Plays back a recorded trajectory. The slider scrubs to any step, Space pauses
+// and the arrow keys step one frame at a time while paused.
+int runTrajectoryViewer(const std::string& path) {
+    TrajectoryReader reader(path);
+    if (reader.frameCount() == 0) {
+        std::cerr << "Trajectory " << path << " has no frames\n";
+        return 1;
     }
+    std::cout << "Loaded " << reader.frameCount() << " frames (steps " << reader.firstStep() << "-" << reader.lastStep() << ") from " << path << '\n';
 
-    // Cleanup: Signal threads to exit and join them
-    done = true;
-    ready = true; // Ensure threads are not stuck waiting
-    cv.notify_all();
-    for (auto& thread : threads) {
-        thread.join();
+    sf::RenderWindow window(sf::VideoMode(static_cast<unsigned int>(reader.simWidth()), static_cast<unsigned int>(reader.simHeight())), "Particle Simulator - " + path);
+    window.setFramerateLimit(60);
+
+    sf::Font font;
+    if (!font.loadFromFile("OpenSans-Regular.ttf")) {
+        std::cerr << "Could not load font\n";
+        return -1;
     }
+    sf::Text stepText("", font, 20);
+    stepText.setFillColor(sf::Color::White);
+    stepText.setPosition(5.f, 5.f);
+
+    tgui::Gui gui(window);
+    auto slider = tgui::Slider::create(static_cast<float>(reader.firstStep()), static_cast<float>(reader.lastStep()));
+    slider->setPosition("5%", "95%");
+    slider->setSize("90%", "2%");
+    slider->setStep(1);
+    gui.add(slider);
+
+    uint64_t step = reader.firstStep();
+    bool playing = true;
+    bool sliderMoved = false;
+    slider->onValueChange([&](float value) {
+        step = static_cast<uint64_t>(value);
+        sliderMoved = true;
+    });
+
+    TrajectoryFrame frame;
+    uint64_t shownStep = UINT64_MAX;
+    while (window.isOpen()) {
+        sf::Event event;
+        while (window.pollEvent(event)) {
+            gui.handleEvent(event);
+
+            if (event.type == sf::Event::Closed)
+                window.close();
+            else if (event.type == sf::Event::KeyPressed) {
+                if (event.key.code == sf::Keyboard::Space) playing = !playing;
+                else if (event.key.code == sf::Keyboard::Right && !playing && step < reader.lastStep()) ++step;
+                else if (event.key.code == sf::Keyboard::Left && !playing && step > reader.firstStep()) --step;
+            }
+        }
 
+        if (playing && !sliderMoved && step < reader.lastStep()) {
+            ++step;
+        }
+        sliderMoved = false;
+
+        if (step != shownStep) {
+            reader.seek(step, frame);
+            shownStep = step;
+            slider->setValue(static_cast<float>(step));
+            sliderMoved = false; // Ignore the change event from our own update
+        }
+        stepText.setString("Step " + std::to_string(frame.step) + (playing ? "" : " (paused)"));
+
+        window.clear();
+        sf::CircleShape shape(static_cast<float>(particleRadius));
+        shape.setFillColor(sf::Color::Green);
+        for (size_t i = 0; i + 1 < frame.positions.size(); i += 2) {
+            shape.setPosition(static_cast<float>(frame.positions[i] - particleRadius), static_cast<float>(frame.positions[i + 1] - particleRadius));
+            window.draw(shape);
+        }
+        window.draw(stepText);
+        gui.draw();
+        window.display();
+    }
+    return 0;
+}
+
+// Splits "host[:port]", keeping defaultPort if no port is given
+void splitAddress(const std::string& address, unsigned short defaultPort, std::string& host, unsigned short& port) {
+    host = address;
+    port = defaultPort;
+    size_t separator = address.rfind(':');
+    if (separator != std::string::npos) {
+        host = address.substr(0, separator);
+        port = static_cast<unsigned short>(std::stoi(address.substr(separator + 1)));
+    }
+}
+
+// Renders a stream from a remote simulation. The window opens once the first frame
+// arrives, sized to the remote domain.
+int runStreamViewer(const std::string& address) {
+    std::string host;
+    unsigned short port;
+    splitAddress(address, defaultStreamPort, host, port);
+
+    StreamClient client(sf::IpAddress(host), port, 60);
+    std::cout << "Connected to " << host << ":" << port << ", waiting for frames\n";
+
+    StreamFrame frame;
+    while (!client.poll(frame, sf::milliseconds(100))) {
+        if (!client.connected()) {
+            std::cerr << "Stream server closed the connection\n";
+            return 1;
+        }
+    }
+
+    sf::RenderWindow window(sf::VideoMode(static_cast<unsigned int>(frame.simWidth), static_cast<unsigned int>(frame.simHeight)), "Particle Simulator - " + address);
+    window.setFramerateLimit(60);
+
+    sf::Font font;
+    if (!font.loadFromFile("OpenSans-Regular.ttf")) {
+        std::cerr << "Could not load font\n";
+        return -1;
+    }
+    sf::Text stepText("", font, 20);
+    stepText.setFillColor(sf::Color::White);
+    stepText.setPosition(5.f, 5.f);
+
+    sf::CircleShape shape(static_cast<float>(particleRadius));
+    shape.setFillColor(sf::Color::Green);
+    while (window.isOpen() && client.connected()) {
+        sf::Event event;
+        while (window.pollEvent(event)) {
+            if (event.type == sf::Event::Closed)
+                window.close();
+        }
+
+        client.poll(frame, sf::Time::Zero); // Keeps showing the previous frame if nothing newer arrived
+        stepText.setString("Step " + std::to_string(frame.step));
+
+        window.clear();
+        for (size_t i = 0; i + 1 < frame.positions.size(); i += 2) {
+            shape.setPosition(frame.positions[i] - static_cast<float>(particleRadius), frame.positions[i + 1] - static_cast<float>(particleRadius));
+            window.draw(shape);
+        }
+        window.draw(stepText);
+        window.display();
+    }
+    if (!client.connected()) {
+        std::cerr << "Stream server closed the connection\n";
+    }
     return 0;
+}
+
+void writeRunSummary(const std::string& path, const Simulation& simulation, const StepProfiler& profiler) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Could not write run summary to " << path << '\n';
+        return;
+    }
+    out << "steps=" << simulation.stepCount << '\n'
+        << "time=" << simulation.time << '\n'
+        << "particles=" << simulation.aliveCount() << '\n'
+        << "walls=" << simulation.walls.size() << '\n'
+        << "threads=" << simulation.workerCount() << '\n'
+        << "step_seconds_total=" << profiler.totalSeconds << '\n'
+        << "step_seconds_mean=" << (profiler.steps > 0 ? profiler.totalSeconds / profiler.steps : 0.0) << '\n';
+    if (simulation.deterministic) {
+        out << "checksum=" << std::hex << std::setw(16) << std::setfill('0') << simulation.computeChecksum() << '\n';
+    }
+}
+
+int main(int argc, char* argv[]) {
+    SimulationConfig config;
+    try {
+        config = parseCommandLine(argc, argv);
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << "Invalid configuration: " << e.what() << '\n';
+        printUsage(std::cerr);
+        return 1;
+    }
+
+    if (config.showHelp) {
+        printUsage(std::cout);
+        return 0;
+    }
+
+    if (!config.viewAddress.empty()) {
+        try {
+            return runStreamViewer(config.viewAddress);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (!config.joinAddress.empty()) {
+        try {
+            std::string host;
+            unsigned short port;
+            splitAddress(config.joinAddress, defaultClusterPort, host, port);
+            ClusterNode node(sf::IpAddress(host), port, config.threadCount);
+            std::cout << "Joined cluster coordinator " << host << ":" << port << '\n';
+            return node.run();
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (!config.playTrajectoryFile.empty()) {
+        try {
+            return runTrajectoryViewer(config.playTrajectoryFile);
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error loading trajectory: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    Journal journal;
+    if (!config.replayFile.empty()) {
+        if (!config.sceneFile.empty() || !config.svgFile.empty() || !config.maskFile.empty() || !config.restoreFile.empty()) {
+            std::cerr << "Invalid configuration: --replay takes its scene and checkpoint from the journal\n";
+            return 1;
+        }
+        try {
+            journal = loadJournal(config.replayFile);
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error loading journal: " << e.what() << '\n';
+            return 1;
+        }
+        applyJournalSettings(journal, config);
+        if (!config.explicitOptions.count("headless")) {
+            config.headless = true; // Replays run at full speed unless asked to show a window
+        }
+    }
+
+    if (!config.restoreFile.empty() && !config.sceneFile.empty()) {
+        std::cerr << "Invalid configuration: --restore and --scene cannot be combined\n";
+        return 1;
+    }
+    if (!config.restoreFile.empty() && (!config.svgFile.empty() || !config.maskFile.empty())) {
+        // The checkpoint already holds every wall
+        std::cerr << "Invalid configuration: --restore cannot be combined with --walls-svg or --walls-mask\n";
+        return 1;
+    }
+    if (config.clusterNodes > 0 && config.gravity != 0) {
+        // Every particle attracts every other, so no node could work from its own strip
+        std::cerr << "Invalid configuration: --gravity cannot be used with --cluster-nodes\n";
+        return 1;
+    }
+    if (config.clusterNodes > 0 && config.fluidLength > 0) {
+        std::cerr << "Invalid configuration: --fluid cannot be used with --cluster-nodes\n";
+        return 1;
+    }
+    if (config.clusterNodes > 0 && !config.flowField.empty()) {
+        std::cerr << "Invalid configuration: --flow cannot be used with --cluster-nodes\n";
+        return 1;
+    }
+
+    std::vector<Wall> svgWalls;
+    if (!config.svgFile.empty()) {
+        try {
+            sf::Clock importClock;
+            svgWalls = importSvgWalls(config.svgFile, config.svgTolerance);
+            std::cout << "Imported " << svgWalls.size() << " walls from " << config.svgFile
+                << " in " << importClock.getElapsedTime().asMilliseconds() << " ms\n";
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error importing SVG: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    Scene scene;
+    if (!config.sceneFile.empty()) {
+        try {
+            sf::Clock loadClock;
+            scene = loadScene(config.sceneFile);
+            std::cout << "Loaded scene " << config.sceneFile << " in " << loadClock.getElapsedTime().asMilliseconds() << " ms\n";
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error loading scene: " << e.what() << '\n';
+            return 1;
+        }
+
+        // Scene parameters fill in anything the config file and flags left unset
+        if (scene.hasDeltaTime && !config.explicitOptions.count("dt")) config.deltaTime = scene.deltaTime;
+        if (scene.hasWidth && !config.explicitOptions.count("width")) config.simWidth = scene.simWidth;
+        if (scene.hasHeight && !config.explicitOptions.count("height")) config.simHeight = scene.simHeight;
+    }
+    else if (!config.convertSceneOutput.empty()) {
+        std::cerr << "Invalid configuration: --convert-scene needs a --scene to convert\n";
+        return 1;
+    }
+
+    // Drawn and traced walls follow the scene's, so --convert-scene bakes them in
+    scene.walls.insert(scene.walls.end(), svgWalls.begin(), svgWalls.end());
+    if (!config.maskFile.empty()) {
+        try {
+            // The mask is stretched over the domain as the scene left it
+            sf::Clock traceClock;
+            std::vector<Wall> maskWalls = importMaskWalls(config.maskFile, config.simWidth, config.simHeight,
+                config.maskTolerance, config.threadCount);
+            std::cout << "Traced " << maskWalls.size() << " walls from " << config.maskFile
+                << " in " << traceClock.getElapsedTime().asMilliseconds() << " ms\n";
+            scene.walls.insert(scene.walls.end(), maskWalls.begin(), maskWalls.end());
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error tracing mask: " << e.what() << '\n';
+            return 1;
+        }
+    }
+    if (!config.convertSceneOutput.empty()) {
+        try {
+            saveScene(config.convertSceneOutput, scene);
+            return 0;
+        }
+        catch (const std::invalid_argument& e) {
+            std::cerr << "Error saving scene: " << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    SimulationMetrics metrics(config.threadCount);
+    MetricsServer metricsServer(metrics, config.metricsPort);
+    if (config.metricsEnabled) {
+        metricsServer.start(); // Scraping is optional, so the simulation runs even if the port is taken
+    }
+
+    Simulation simulation(config.threadCount, config.deltaTime, config.simWidth, config.simHeight, metrics);
+    simulation.rng.seed(config.seed);
+    simulation.deterministic = config.deterministic;
+    simulation.sortThreshold = config.sortThreshold;
+    simulation.gravity = config.gravity;
+    simulation.openingAngle = config.openingAngle;
+    simulation.softening = config.softening;
+    simulation.meshCells = config.meshCells;
+    simulation.fluidLength = config.fluidLength;
+    simulation.restDensity = config.restDensity;
+    simulation.stiffness = config.stiffness;
+    simulation.viscosity = config.viscosity;
+    simulation.constraintIterations = config.constraintIterations;
+    simulation.flowCoupling = config.flowCoupling;
+    simulation.distanceCellSize = config.distanceCellSize;
+    applyScene(scene, simulation);
+    scene = Scene(); // The simulation holds its own copy now
+
+    int result = 0;
+    try {
+        if (!config.restoreFile.empty()) {
+            sf::Clock restoreClock;
+            restoreCheckpoint(config.restoreFile, simulation);
+            std::cout << "Restored step " << simulation.stepCount << " from " << config.restoreFile
+                << " in " << restoreClock.getElapsedTime().asMilliseconds() << " ms\n";
+        }
+        if (!config.flowField.empty()) {
+            // Laid over the domain as restored
+            simulation.flow = makeFlowField(config.flowField, simulation.simWidth, simulation.simHeight, config.flowSpeed);
+        }
+
+        // A coordinator hands its particles to the nodes and only keeps what it gathers back
+        std::unique_ptr<ClusterCoordinator> cluster;
+        if (config.clusterNodes > 0) {
+            cluster.reset(new ClusterCoordinator(config.clusterPort, config.clusterNodes, config.gatherInterval, metrics));
+            cluster->start(simulation, config.seed);
+        }
+
+        RunContext run(config, metrics, simulation);
+        run.cluster = cluster.get();
+        if (!config.replayFile.empty()) {
+            run.startReplay(journal, simulation);
+            journal = Journal();
+        }
+
+        result = config.headless
+            ? runHeadless(simulation, run)
+            : runWindowed(simulation, run);
+        run.finish(simulation);
+
+        if (config.profile) {
+            run.profiler.report(std::cout);
+        }
+        if (!config.statsOutput.empty()) {
+            writeRunSummary(config.statsOutput, simulation, run.profiler);
+        }
+    }
+    catch (const std::invalid_argument& e) {
+        std::cerr << "Error: " << e.what() << '\n';
+        result = 1;
+    }
+
+    return result;
 }
\ No newline at end of file